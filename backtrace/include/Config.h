@@ -8,6 +8,15 @@ constexpr uint64_t TRACK_ALLOCS = 0x2;              // 记录内存申请动作
 constexpr uint64_t BACKTRACE_SPECIFIC_SIZES = 0x4;  // 记录特定大小的内存申请
 constexpr uint64_t RECORD_MEMORY_PEAK = 0x8;        // 记录内存峰值
 constexpr uint64_t DUMP_ON_SIGNAL = 0x80;           // 信号触发dump
+constexpr uint64_t DUMP_RESIDENT = 0x100;           // dump 时统计 mmap/dma 区域的常驻内存
+constexpr uint64_t COMPACT_UNWIND = 0x200;          // 加载 ELF 时预先展开 CFI 表
+constexpr uint64_t STACK_MEMO = 0x400;              // 复用同一线程上次回栈的外层栈帧
+constexpr uint64_t UNWIND_DAEMON = 0x800;           // 回栈交给独立的 unwindd 进程
+constexpr uint64_t NATIVE_ONLY_UNWIND = 0x1000;     // 回栈时不加载 JIT/dex 信息
+constexpr uint64_t SAMPLE_STACKS = 0x2000;          // 定时采样所有线程的调用栈
+constexpr uint64_t DUMP_PPROF = 0x4000;             // dump 时同时输出 pprof 格式
+constexpr uint64_t TIMELINE = 0x8000;               // 输出内存变化的 trace 时间线
+constexpr uint64_t FLAMEGRAPH = 0x10000;            // dump 时同时输出 folded 格式火焰图
 
 class Config {
 public:
@@ -26,6 +35,22 @@ public:
 
     size_t backtrace_dump_peak_val() const { return backtrace_dump_peak_val_; }
 
+    const char* unwind_cache_dir() const { return unwind_cache_dir_; }
+
+    const char* unwind_daemon_name() const { return unwind_daemon_name_; }
+    size_t unwind_daemon_stack_bytes() const { return unwind_daemon_stack_bytes_; }
+
+    size_t sample_interval_ms() const { return sample_interval_ms_; }
+    int sample_signal() const { return sample_signal_; }
+
+    const char* timeline_file() const { return timeline_file_; }
+    size_t timeline_interval_ms() const { return timeline_interval_ms_; }
+    size_t timeline_spike_bytes() const { return timeline_spike_bytes_; }
+
+    bool flamegraph_alloc() const { return flamegraph_alloc_; }
+    bool flamegraph_count() const { return flamegraph_count_; }
+    bool flamegraph_diff() const { return flamegraph_diff_; }
+
 private:
     int backtrace_dump_signal_ = 0;
 
@@ -38,5 +63,21 @@ private:
 
     size_t backtrace_dump_peak_val_ = 0;
 
+    const char* unwind_cache_dir_ = nullptr;
+
+    const char* unwind_daemon_name_ = nullptr;
+    size_t unwind_daemon_stack_bytes_ = 0;
+
+    size_t sample_interval_ms_ = 0;
+    int sample_signal_ = 0;
+
+    const char* timeline_file_ = nullptr;
+    size_t timeline_interval_ms_ = 0;
+    size_t timeline_spike_bytes_ = 0;
+
+    bool flamegraph_alloc_ = false;
+    bool flamegraph_count_ = false;
+    bool flamegraph_diff_ = false;
+
     uint64_t options_ = 0;
 };
\ No newline at end of file
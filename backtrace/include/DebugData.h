@@ -3,6 +3,9 @@
 #include <bionic/macros.h>
 
 #include "Config.h"
+#include "DmaBufData.h"
+#include "GpuMemData.h"
+#include "MmapData.h"
 #include "PointerData.h"
 
 class DebugData {
@@ -10,13 +13,18 @@ public:
     DebugData() = default;
     ~DebugData() = default;
 
-    bool Initialize(void* storage);
+    bool Initialize(
+            void* pointer_storage, void* dmabuf_storage, void* gpu_storage,
+            void* mmap_storage);
 
     const Config& config() { return config_; }
 
     bool TrackPointers() { return config_.options() & TRACK_ALLOCS; }
 
     std::unique_ptr<PointerData> pointer;
+    std::unique_ptr<DmaBufData> dmabuf;
+    std::unique_ptr<GpuMemData> gpu;
+    std::unique_ptr<MmapData> mmap;
 
 private:
     Config config_;
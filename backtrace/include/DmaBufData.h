@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <bionic/macros.h>
+
+#include "Config.h"
+#include "RangeMap.h"
+
+// dma-buf 对象的引用计数信息, 以 inode 作为 key
+struct DmaBufInfoType {
+    size_t size;
+    size_t fd_refs;
+    size_t map_refs;
+};
+
+// 跟踪 dma-buf 的生命周期: fd (ioctl/dup/close) 和 mapping (mmap/munmap) 都持有引用,
+// 最后一个引用释放时, 才将该 buffer 从 PointerData 的 live set 中移除.
+class DmaBufData {
+public:
+    DmaBufData() = default;
+    virtual ~DmaBufData() = default;
+
+    bool Initialize(const Config& config);
+
+    // ioctl 分配或导入 dma-buf 后登记 fd 引用, 同一个 fd 重复登记不会增加引用
+    void AddFd(int fd);
+    void DupFd(int old_fd, int new_fd);
+    void CloseFd(int fd);
+
+    // fd 不是 dma-buf 时返回 false
+    bool AddMap(const void* addr, size_t size, int fd);
+    // munmap 部分区域时拆分 mapping, mapping 完全移除后释放引用
+    void RemoveMap(const void* addr, size_t size);
+    void RemapMap(
+            const void* old_addr, size_t old_size, const void* new_addr,
+            size_t new_size);
+
+    // 统计每个 dma-buf 被 mmap 且常驻的内存, key 为 PointerData 中的 key (inode).
+    // mincore 在锁外执行
+    void GetResident(std::unordered_map<uintptr_t, size_t>* resident);
+
+    static bool ParseFdInfo(int fd, uint64_t* inode, size_t* size);
+
+private:
+    // 以下函数需要持有 dmabuf_mutex_
+    uint64_t AcquireFd(int fd);
+    void ReleaseFd(int fd);
+    void AddRef(uint64_t inode, size_t size, bool is_map);
+    void RemoveRef(uint64_t inode, bool is_map);
+    void RemoveMapLocked(uintptr_t start, uintptr_t end);
+
+    std::mutex dmabuf_mutex_;
+    std::unordered_map<uint64_t, DmaBufInfoType> bufs_;
+    std::unordered_map<int, uint64_t> fds_;
+    // mapping 区间 -> inode, 每个区间持有一个 map 引用
+    RangeMap<uint64_t> maps_;
+
+    BIONIC_DISALLOW_COPY_AND_ASSIGN(DmaBufData);
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <string>
+
+#include <unwindstack/Unwinder.h>
+
+// hook 进程内的 dump 与 unwindd 的 dump 共用的输出格式
+
+// 逐行 dprintf 太慢, 攒够这么多再写
+static constexpr size_t kDumpBufferSize = 64 * 1024;
+
+// 写入全部内容, 出错时放弃剩余部分
+void WriteAll(int fd, const std::string& data);
+
+// 追加一行 "#index rel_pc map (function+offset)", 函数名通过全局缓存只 demangle 一次
+void AppendFrame(std::string* out, size_t index, const unwindstack::FrameData& frame);
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+#include <bionic/macros.h>
+
+#include "Config.h"
+
+// GPU 驱动 (mali kbase / kgsl) 分配的内存以 (驱动 fd, handle) 区分,
+// handle 为 mali 的 gpu_va 或 kgsl 的 id
+struct GpuMemKeyType {
+    int fd;
+    uint64_t handle;
+
+    bool operator==(const GpuMemKeyType& comp) const {
+        return fd == comp.fd && handle == comp.handle;
+    }
+};
+
+namespace std {
+template <>
+struct hash<GpuMemKeyType> {
+    std::size_t operator()(const GpuMemKeyType& key) const {
+        return std::hash<uint64_t>()(key.handle) ^ static_cast<std::size_t>(key.fd);
+    }
+};
+};  // namespace std
+
+struct GpuMemInfoType {
+    size_t size;
+    // mali SAME_VA 分配返回的 gpu_va 只是 mmap 用的 cookie, mmap 之后 gpu va 等于 cpu va
+    bool same_va;
+};
+
+class GpuMemData {
+public:
+    // mmap 之后的 SAME_VA 分配不再属于某个驱动 fd
+    static constexpr int kSameVaFd = -1;
+
+    GpuMemData() = default;
+    virtual ~GpuMemData() = default;
+
+    bool Initialize(const Config& config);
+
+    void Add(int fd, uint64_t handle, size_t size, bool same_va = false);
+    void Remove(int fd, uint64_t handle);
+
+    // mmap 驱动 fd 时, 将 SAME_VA 分配的 cookie 替换为 cpu va
+    void Map(int fd, uint64_t offset, const void* addr);
+    // addr 不是 SAME_VA 分配时返回 false
+    bool Unmap(const void* addr);
+
+    // 驱动 fd 关闭后, 其下所有未 mmap 的分配都被释放
+    void CloseFd(int fd);
+
+private:
+    // 以下函数需要持有 gpu_mutex_
+    void RemoveLocked(const GpuMemKeyType& key);
+
+    std::mutex gpu_mutex_;
+    std::unordered_map<GpuMemKeyType, GpuMemInfoType> allocs_;
+    // 每个驱动 fd 下的分配数量, 非 GPU fd 的 close 只需一次查找
+    std::unordered_map<int, size_t> fd_allocs_;
+
+    BIONIC_DISALLOW_COPY_AND_ASSIGN(GpuMemData);
+};
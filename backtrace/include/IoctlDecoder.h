@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+
+// 解析内存相关的 ioctl, 每个驱动的 request 对应一个 decoder
+class IoctlDecoder {
+public:
+    virtual ~IoctlDecoder() = default;
+
+    // ioctl 之前调用, 保存会被 ioctl 输出覆盖的输入参数
+    virtual uint64_t Prepare(void* arg) const { return 0; }
+    // ioctl 成功之后调用, saved 为 Prepare 的返回值
+    virtual void Decode(int fd, void* arg, uint64_t saved) const = 0;
+};
+
+struct IoctlDecoderEntry {
+    unsigned int request;
+    const IoctlDecoder* decoder;
+};
+
+struct IoctlDecoderTable {
+    const IoctlDecoderEntry* entries;
+    size_t count;
+};
+
+#define IOCTL_DECODER_TABLE(name, entries) \
+    const IoctlDecoderTable name = {entries, sizeof(entries) / sizeof(entries[0])}
+
+// 各驱动的 decoder 表, 新增驱动时在 IoctlDecoder.cpp 的 kDecoderTables 中注册
+extern const IoctlDecoderTable kDmaHeapIoctlDecoders;
+extern const IoctlDecoderTable kMidgardIoctlDecoders;
+extern const IoctlDecoderTable kKgslIoctlDecoders;
+extern const IoctlDecoderTable kMtkCameraIoctlDecoders;
+
+// 将所有 decoder 按 request 排序, 需要在第一次 FindIoctlDecoder 之前调用
+bool IoctlDecoderInitialize();
+
+// 不需要解析的 request 返回 nullptr, 不加锁, 可以在 hook 的最前面调用
+const IoctlDecoder* FindIoctlDecoder(unsigned int request);
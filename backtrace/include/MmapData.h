@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <bionic/macros.h>
+
+#include "Config.h"
+#include "RangeMap.h"
+
+// 跟踪匿名 mmap 区域, 每个区间在 PointerData 中以区间起始地址作为 key.
+// munmap 部分区域时拆分区间, 拆分出的区间共享原来的堆栈.
+class MmapData {
+public:
+    MmapData() = default;
+    virtual ~MmapData() = default;
+
+    bool Initialize(const Config& config);
+
+    // MAP_FIXED 覆盖的已有区间会先被移除
+    void Add(const void* addr, size_t size);
+    void Remove(const void* addr, size_t size);
+    // 统计每个区间的常驻内存, key 为区间起始地址. mincore 在锁外执行
+    void GetResident(std::unordered_map<uintptr_t, size_t>* resident);
+
+    void Remap(
+            const void* old_addr, size_t old_size, const void* new_addr,
+            size_t new_size);
+
+private:
+    // 需要持有 mmap_mutex_
+    void RemoveLocked(uintptr_t start, uintptr_t end);
+
+    struct Empty {};
+
+    std::mutex mmap_mutex_;
+    RangeMap<Empty> ranges_;
+
+    BIONIC_DISALLOW_COPY_AND_ASSIGN(MmapData);
+};
+
+// mmap/munmap/mremap 以页为单位
+size_t PageAlign(size_t size);
+
+// 通过 mincore 统计 [start, end) 中常驻的字节数, vec 为调用者复用的缓冲区
+size_t ResidentBytes(uintptr_t start, uintptr_t end, std::vector<unsigned char>* vec);
@@ -8,7 +8,9 @@
 #include <cstdlib>
 #include <memory>
 #include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <bionic/macros.h>
@@ -63,6 +65,12 @@ inline bool operator<(const timeval& lhs, const timeval& rhs) {
     return l_time < r_time;
 }
 
+// 一个堆栈累计的申请次数和大小, 按 MemType 分开统计, 释放后不减少
+struct AllocStatsType {
+    size_t num[3] = {};
+    size_t size[3] = {};
+};
+
 struct PointerInfoType {
     size_t size;
     size_t hash_index;
@@ -77,7 +85,6 @@ struct ListInfoType {
     size_t num_allocations;
     size_t size;
     MemType mem_type;
-    FrameInfoType* frame_info;
     std::shared_ptr<std::vector<unwindstack::FrameData>> backtrace_info;
     timeval alloc_time;
 };
@@ -91,12 +98,36 @@ public:
     bool Initialize(const Config& config);
 
     void Add(const void* ptr, size_t size, MemType type = HOST);
-    size_t AddBacktrace(size_t num_frames, size_t size_bytes);
+    size_t AddBacktrace(size_t num_frames, size_t size_bytes, MemType type = HOST);
     void Remove(const void* ptr);
     void RemoveBacktrace(size_t hash_index);
 
-    void DumpLiveToFile(int fd);
+    // 修改已记录内存的大小, 不重新抓取堆栈, 用于 munmap/mremap 部分区域
+    void Resize(const void* ptr, size_t new_size);
+    // 以 ptr 的堆栈为 new_ptr 新增一条记录, 用于 munmap 拆分区域和 mremap 移动区域
+    void Split(const void* ptr, const void* new_ptr, size_t new_size);
+
+    // 记录一次采样到的调用栈, 与申请的堆栈存入同一个表, dump 时按采样次数输出
+    void AddSample(std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frames_info);
+
+    // resident 不为空时, 同时输出 mmap/dma 记录的常驻内存, key 为记录的指针
+    void DumpLiveToFile(
+            int fd, const std::unordered_map<uintptr_t, size_t>* resident = nullptr);
     void DumpPeakInfo();
+    // 以 pprof 格式输出存活(或峰值)内存和每个堆栈累计的申请
+    bool DumpPprofToFile(int fd);
+    // 以 folded 格式输出火焰图, diff_fd 不为 -1 时同时输出与上一次 dump 的差异.
+    // 开启 FLAMEGRAPH_DIFF 时每次都保存本次结果作为下一次的对比基准
+    bool DumpFoldedToFile(int fd, int diff_fd);
+    // 是否已经有可对比的上一次 folded 结果
+    bool HasFoldedBaseline();
+
+    // host 包含 mmap
+    void GetCurrentUsed(size_t* host, size_t* mmap, size_t* dma);
+    // 返回 hash_index 对应的堆栈, 堆栈的记录都释放后返回的结果仍然有效
+    std::shared_ptr<std::vector<unwindstack::FrameData>> GetBacktrace(size_t hash_index);
+    // 补全 GetBacktrace 返回的堆栈并按 dump 的格式输出, 不需要持有锁
+    void FormatBacktrace(const std::vector<unwindstack::FrameData>& frames_info, std::string* out);
 
 private:
     inline uintptr_t ManglePointer(uintptr_t pointer) { return pointer ^ UINTPTR_MAX; }
@@ -104,20 +135,50 @@ private:
         return pointer ^ UINTPTR_MAX;
     }
 
+    // 以下两个函数需要持有 pointer_mutex_
+    void AddUsed(MemType type, size_t size);
+    void SubUsed(MemType type, size_t size);
+
+    // 需要持有 frame_mutex_, 返回堆栈的 hash_index 并增加一次引用
+    size_t InternBacktrace(
+            std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frames_info);
+
+    // 补全预热完成前只记录了 pc 的堆栈, 调用时不能持有锁
+    void ResolveBacktraces();
+    // 需要持有 frame_mutex_, 用补全后的 pc 重新登记 hash_index 的堆栈.
+    // 已经有相同的堆栈时 info 改为共用它的 FrameData
+    void RekeyBacktrace(
+            size_t hash_index, std::shared_ptr<std::vector<unwindstack::FrameData>>* info);
+
     void GetList(std::vector<ListInfoType>* list, bool only_with_backtrace, Pred pred);
     void GetUniqueList(std::vector<ListInfoType>* list, bool only_with_backtrace);
 
     std::mutex pointer_mutex_;
     std::unordered_map<uintptr_t, PointerInfoType> pointers_;
 
+    // 以下到 peak_list_ 都由 frame_mutex_ 保护, 与 pointer_mutex_ 同时持有时先拿 pointer_mutex_.
+    // backtraces_info_ 中的 vector 发布后只读, 补全时在副本上修改后整体替换,
+    // 因此拿到 shared_ptr 后可以在锁外读取. UnwindResolveFrames 只修改调用方自己的副本
     std::mutex frame_mutex_;
+    // key 指向 frames_ 中的 frames
     std::unordered_map<FrameKeyType, size_t> key_to_index_;
     std::unordered_map<size_t, FrameInfoType> frames_;
     std::unordered_map<size_t, std::shared_ptr<std::vector<unwindstack::FrameData>>>
             backtraces_info_;
     size_t cur_hash_index_;
-
-    size_t current_used_, current_host_, current_dma_;
+    // 预热完成前只记录了 pc 的堆栈
+    std::unordered_set<size_t> unresolved_;
+    // 采样到的堆栈 hash_index 和采样次数, 每个堆栈持有一次引用
+    std::unordered_map<size_t, size_t> samples_;
+    size_t num_samples_;
+    // 开启 DUMP_PPROF 或按累计申请输出火焰图时每个堆栈累计的申请, 每个堆栈持有一次引用
+    std::unordered_map<size_t, AllocStatsType> alloc_stats_;
+    // 上一次 dump 的 folded 结果, 用于输出差异
+    std::mutex folded_mutex_;
+    std::unordered_map<std::string, int64_t> folded_last_;
+    bool folded_has_last_ = false;
+
+    size_t current_used_, current_host_, current_dma_, current_mmap_;
     size_t peak_tot_, peak_host_, peak_dma_;
     std::vector<ListInfoType> peak_list_;
 
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <zlib.h>
+
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Unwinder.h>
+
+// 以 gzip 压缩的 pprof Profile proto 格式流式写入 fd. Profile 的字段都是
+// repeated, 可以交错出现, 所以每条 sample 引用的 string/mapping/function/location
+// 在第一次出现时立即写出, 不需要在内存中构造完整的 proto
+class PprofWriter {
+public:
+    struct SampleType {
+        const char* type;
+        const char* unit;
+    };
+
+    explicit PprofWriter(int fd) : fd_(fd) {}
+    ~PprofWriter();
+
+    // sample_types 决定每条 sample 的 values 个数, default_type 为 pprof 默认显示的类型下标
+    bool Begin(
+            const std::vector<SampleType>& sample_types, size_t default_type,
+            const std::string& comment);
+    // frames 从栈顶开始, 可以附带一个字符串标签
+    void AddSample(
+            const std::vector<unwindstack::FrameData>& frames, const std::vector<int64_t>& values,
+            const char* label_key, const char* label_value);
+    bool Finish();
+
+private:
+    uint64_t InternString(const std::string& str);
+    uint64_t InternMapping(unwindstack::MapInfo* map_info);
+    uint64_t InternFunction(const std::string& name, uint64_t filename);
+    uint64_t InternLocation(const unwindstack::FrameData& frame);
+
+    // 写出一个 Profile 的顶层字段
+    void WriteField(uint32_t field, const std::string& payload);
+    void WriteVarintField(uint32_t field, uint64_t value);
+    void Deflate(const void* data, size_t size, int flush);
+
+    int fd_;
+    bool started_ = false;
+    bool ok_ = true;
+    z_stream stream_ = {};
+    std::vector<uint8_t> out_;
+
+    std::unordered_map<std::string, uint64_t> strings_;
+    std::unordered_map<const unwindstack::MapInfo*, uint64_t> mappings_;
+    std::map<std::pair<uint64_t, uint64_t>, uint64_t> functions_;
+    std::unordered_map<uint64_t, uint64_t> locations_;
+};
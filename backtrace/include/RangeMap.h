@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <iterator>
+#include <map>
+#include <vector>
+
+// 按地址区间 [start, end) 索引的 map, 区间之间互不重叠.
+// 用于跟踪 mmap 区域, 支持 munmap/mremap/MAP_FIXED 对区间的部分覆盖.
+template <typename ValueType>
+class RangeMap {
+public:
+    struct Range {
+        uintptr_t start;
+        uintptr_t end;
+        ValueType value;
+    };
+
+    // 调用者需保证 [start, end) 与已有区间不重叠, 通常先调用 Erase
+    void Insert(uintptr_t start, uintptr_t end, const ValueType& value) {
+        if (start < end) {
+            ranges_[start] = Range{start, end, value};
+        }
+    }
+
+    // 返回包含 addr 的区间, 不存在时返回 nullptr
+    const Range* Find(uintptr_t addr) const {
+        auto entry = ranges_.upper_bound(addr);
+        if (entry == ranges_.begin()) {
+            return nullptr;
+        }
+        --entry;
+        return addr < entry->second.end ? &entry->second : nullptr;
+    }
+
+    // 删除 [start, end) 覆盖的部分, 被部分覆盖的区间拆分成剩余的左右两段.
+    // 对每个受影响的区间, 在修改之前调用 on_cut(range, cut_start, cut_end),
+    // cut_start > range.start 表示保留左段, cut_end < range.end 表示保留右段.
+    template <typename Callback>
+    void Erase(uintptr_t start, uintptr_t end, Callback on_cut) {
+        if (start >= end) {
+            return;
+        }
+
+        std::vector<Range> cut;
+        auto entry = ranges_.upper_bound(start);
+        if (entry != ranges_.begin() && std::prev(entry)->second.end > start) {
+            --entry;
+        }
+        while (entry != ranges_.end() && entry->second.start < end) {
+            cut.push_back(entry->second);
+            entry = ranges_.erase(entry);
+        }
+
+        for (const Range& range : cut) {
+            uintptr_t cut_start = range.start > start ? range.start : start;
+            uintptr_t cut_end = range.end < end ? range.end : end;
+            on_cut(range, cut_start, cut_end);
+            if (cut_start > range.start) {
+                Insert(range.start, cut_start, range.value);
+            }
+            if (cut_end < range.end) {
+                Insert(cut_end, range.end, range.value);
+            }
+        }
+    }
+
+    // 扩展以 start 开始的区间, 调用者需保证 [end, new_end) 没有其他区间
+    bool Extend(uintptr_t start, uintptr_t new_end) {
+        auto entry = ranges_.find(start);
+        if (entry == ranges_.end() || new_end < entry->second.end) {
+            return false;
+        }
+        entry->second.end = new_end;
+        return true;
+    }
+
+    template <typename Callback>
+    void ForEach(Callback callback) const {
+        for (const auto& entry : ranges_) {
+            callback(entry.second);
+        }
+    }
+
+    void Clear() { ranges_.clear(); }
+
+private:
+    std::map<uintptr_t, Range> ranges_;
+};
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stddef.h>
+
+// 启动后台线程, 每隔 interval_ms 通过 signal 依次复制本进程其他线程的寄存器和栈,
+// 线程继续运行后再回栈, 结果记入 PointerData 的堆栈表, dump 时与申请记录一起输出
+bool StackSamplerStart(size_t interval_ms, int signal);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "PointerData.h"
+
+// 按 Chrome trace event JSON 格式把内存计数器、各线程的申请速率和大块申请流式写入
+// path, 可以直接用 Perfetto UI 或 chrome://tracing 打开. 时间戳使用 CLOCK_BOOTTIME,
+// 与系统 trace 的时间轴一致
+bool TimelineStart(const char* path, size_t interval_ms, size_t spike_bytes);
+bool TimelineEnabled();
+
+// 每次记录申请时调用, 大于 spike_bytes 的申请输出为带堆栈 id 的 instant 事件
+void TimelineRecordAlloc(size_t size, MemType type, size_t stack_id);
+
+// 写出最后一轮计数器并结束 JSON 数组
+void TimelineFinish();
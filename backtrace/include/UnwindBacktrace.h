@@ -29,6 +29,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/types.h>
 #include <vector>
 
 #include <unwindstack/Unwinder.h>
@@ -36,3 +37,31 @@
 unwindstack::ErrorCode Unwind(
         std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* info,
         size_t max_frames);
+
+// 安装 signal 的处理函数. 处理函数把寄存器和栈复制到预先分配的缓冲区后线程立即继续运行
+bool UnwindThreadInit(int signal);
+
+// 通过 signal 复制本进程另一个线程 tid 的寄存器和栈, 线程继续运行后在调用线程中回栈.
+// 需要先调用 UnwindThreadInit, 预热完成前返回 ERROR_UNSUPPORTED
+unwindstack::ErrorCode UnwindThread(
+        pid_t tid, int signal, std::vector<uintptr_t>* frames,
+        std::vector<unwindstack::FrameData>* info, size_t max_frames);
+
+// 开启后每个线程保存上次回栈的结果, 调用链没变的外层栈帧不再重新回栈
+void UnwindSetStackMemoEnabled(bool enabled);
+
+// 关闭后回栈不加载 JIT/dex 信息, 需要在第一次回栈之前调用
+void UnwindSetJitEnabled(bool enabled);
+
+// 启动后台线程预热 maps/elf/符号表, 预热完成前 Unwind 只记录 pc
+bool UnwindWarmupStart();
+
+// 是否包含预热完成前只记录了 pc 的栈帧
+bool UnwindHasPcOnlyFrames(const std::vector<unwindstack::FrameData>& info);
+
+// 补全预热完成前只记录了 pc 的栈帧, 一次传入所有记录以便批量查找符号.
+// 会修改传入的 vector, 调用方不能持有 dlopen 时也会申请的锁. 预热未完成时返回 false
+bool UnwindResolveFrames(const std::vector<std::vector<unwindstack::FrameData>*>& infos);
+
+// dlopen/dlclose 之后调用, 直接增删对应模块的 maps, 避免回栈时重新解析 /proc/self/maps
+void UnwindModulesChanged();
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "PointerData.h"
+
+// 连接 unwindd 成功后, PointerData 的申请/释放记录改为写入共享内存环形缓冲区,
+// 申请时只拷贝寄存器和栈顶 stack_bytes 字节, 回栈和统计都由 unwindd 完成
+bool UnwindClientConnect(const char* name, size_t max_frames, size_t stack_bytes);
+bool UnwindClientConnected();
+
+void UnwindClientAlloc(const void* ptr, size_t size, MemType type);
+void UnwindClientFree(const void* ptr);
+void UnwindClientResize(const void* ptr, size_t new_size);
+void UnwindClientSplit(const void* ptr, const void* new_ptr, size_t new_size);
+void UnwindClientModulesChanged();
+
+// 等待 unwindd 处理完此前写入的所有记录, 并把 dump 写入 fd
+bool UnwindClientDump(int fd);
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstddef>
+
+// hook 与 unwindd 之间的协议.
+// hook 连接 unwindd 的 unix socket, 通过 SCM_RIGHTS 传入环形缓冲区的 memfd,
+// 以及自身的 /proc/self/maps 和 /proc/self/mem, unwindd 不需要 ptrace 权限.
+// 之后申请/释放都写入环形缓冲区, 申请记录带上寄存器和栈顶的拷贝, 由 unwindd 回栈
+
+static constexpr const char kUnwindDaemonDefaultName[] = "alloc_hook_unwindd";
+static constexpr uint32_t kUnwindDaemonMagic = 0x75776431;  // "uwd1"
+static constexpr size_t kStackRingCapacity = 8 * 1024 * 1024;
+
+enum UnwindDaemonRequest : uint32_t {
+    kRequestHello = 1,
+    // 附带一个 fd, unwindd 处理完此前写入的所有记录后把 dump 写入该 fd
+    kRequestDump,
+};
+
+// 请求和应答使用同一结构, unwindd 处理完请求后原样返回, status 为 0 表示成功
+struct UnwindDaemonMessage {
+    uint32_t magic;
+    uint32_t request;
+    int32_t status;
+    // 以下仅 kRequestHello 使用
+    uint32_t arch;  // unwindstack::ArchEnum, 与 unwindd 不一致时拒绝连接
+    uint32_t max_frames;
+    int32_t pid;
+};
+
+enum RingRecordType : uint32_t {
+    kRecordEmpty = 0,  // 已预留, 还没写完
+    kRecordPadding,    // 末尾放不下时填充, 读端直接跳过
+    kRecordAlloc,
+    kRecordFree,
+    kRecordResize,
+    kRecordSplit,
+    kRecordModulesChanged,
+};
+
+struct RingRecordHeader {
+    std::atomic<uint32_t> type;
+    std::atomic<uint32_t> size;  // 包含头部, 8 字节对齐
+};
+
+// 后面紧跟 regs_size 字节的寄存器和 stack_size 字节的栈内容
+struct RingAlloc {
+    uint64_t pointer;
+    uint64_t size;
+    uint32_t mem_type;
+    uint32_t regs_size;
+    // CLOCK_MONOTONIC_COARSE
+    int64_t tv_sec;
+    int64_t tv_nsec;
+    uint64_t stack_start;
+    uint64_t stack_size;
+    // 线程栈的末尾, 拷贝范围之外的栈内容已经变化, unwindd 不能再去读
+    uint64_t stack_limit;
+};
+
+struct RingFree {
+    uint64_t pointer;
+};
+
+struct RingResize {
+    uint64_t pointer;
+    uint64_t size;
+};
+
+struct RingSplit {
+    uint64_t pointer;
+    uint64_t new_pointer;
+    uint64_t new_size;
+};
+
+// 多个线程写, 一个线程读. 写端只在预留空间时持有自旋锁, 拷贝在锁外进行,
+// 预留的顺序即读端处理的顺序, 同一地址的申请和释放不会乱序
+class StackRing {
+public:
+    StackRing() = default;
+    ~StackRing();
+
+    // hook 侧创建 memfd
+    bool Create(size_t capacity);
+    // unwindd 侧映射 hook 传入的 memfd, 成功后持有该 fd
+    bool Attach(int fd);
+
+    int fd() const { return fd_; }
+
+    // 预留 payload_size 字节, 空间不足返回 nullptr. 写完后必须调用 Commit
+    void* Reserve(size_t payload_size);
+    void Commit(void* payload, RingRecordType type);
+
+    // 返回位置在 limit 之前的下一条记录, 没有记录或者还没写完时返回 nullptr.
+    // 另一端写入的内容不可信, size 为校验过的记录大小 (包含头部), 之后只能使用它.
+    // 大小不合法时标记为损坏, 之后一直返回 nullptr
+    const RingRecordHeader* Peek(uint64_t limit, size_t* size);
+    // size 为 Peek 返回的大小
+    void Pop(size_t size);
+
+    bool corrupted() const { return corrupted_; }
+
+    uint64_t write_pos() const;
+    uint64_t read_pos() const;
+
+    // 空间不足丢弃的记录数, 两端共享
+    void AddDropped();
+    uint64_t dropped() const;
+
+private:
+    struct Header;
+
+    bool Map(int fd, size_t total_size, int flags);
+
+    int fd_ = -1;
+    Header* header_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t map_size_ = 0;
+    bool corrupted_ = false;
+};
+
+// 抽象命名空间的 unix socket
+int UnwindDaemonListen(const char* name);
+int UnwindDaemonConnect(const char* name);
+
+bool UnwindDaemonSend(int sock, const UnwindDaemonMessage& message, const int* fds, size_t num_fds);
+// 返回收到的 fd 个数, 连接断开或出错返回 -1
+int UnwindDaemonRecv(int sock, UnwindDaemonMessage* message, int* fds, size_t max_fds);
@@ -14,6 +14,10 @@ void* debug_memalign(size_t alignment, size_t bytes);
 int debug_posix_memalign(void** memptr, size_t alignment, size_t size);
 void* debug_mmap(void* addr, size_t size, int prot, int flags, int fd, off_t offset);
 int debug_munmap(void* addr, size_t size);
+void* debug_mremap(void* old_addr, size_t old_size, size_t new_size, int flags, void* new_addr);
 int debug_ioctl(int fd, unsigned int request, void* arg);
 int debug_close(int fd);
-void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset);
\ No newline at end of file
+int debug_dup(int old_fd);
+int debug_dup3(int old_fd, int new_fd, int flags);
+void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset);
+void debug_modules_changed();
\ No newline at end of file
@@ -1,15 +1,20 @@
 #include <bionic/reserved_signals.h>
 #include <cassert>
 #include <cerrno>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
 #include "Config.h"
+#include "UnwindDaemon.h"
 
 static constexpr size_t DEFAULT_BACKTRACE_FRAMES = 128;
 static constexpr const char DEFAULT_BACKTRACE_DUMP_PREFIX[] =
         "/data/local/tmp/trace/backtrace_heap";
+static constexpr size_t DEFAULT_UNWIND_DAEMON_STACK_KB = 16;
+static constexpr size_t DEFAULT_TIMELINE_INTERVAL_MS = 100;
+static constexpr size_t DEFAULT_TIMELINE_SPIKE_KB = 1024;
 
 static bool ParseValue(const char* value, size_t* parsed_value) {
     *parsed_value = 0;
@@ -69,6 +74,101 @@ bool Config::Init() {
     // 单位是 MB
     backtrace_dump_peak_val_ *= 1024 * 1024;
 
+    // dump 时通过 mincore 统计 mmap/dma 区域实际常驻的内存
+    size_t dump_resident = 0;
+    if (ParseValue(getenv("DUMP_RESIDENT"), &dump_resident) && dump_resident != 0) {
+        options_ |= DUMP_RESIDENT;
+    }
+
+    // 加载 ELF 时把 .eh_frame/.debug_frame 预先展开成有序表, 回栈时只需二分查找
+    size_t compact_unwind = 0;
+    if (ParseValue(getenv("COMPACT_UNWIND"), &compact_unwind) && compact_unwind != 0) {
+        options_ |= COMPACT_UNWIND;
+    }
+    // 按 build id 把紧凑回栈表和排序后的符号表缓存到该目录, 之后的进程直接 mmap 使用
+    unwind_cache_dir_ = getenv("UNWIND_CACHE_DIR");
+    if (unwind_cache_dir_ != nullptr && unwind_cache_dir_[0] != '\0') {
+        options_ |= COMPACT_UNWIND;
+    }
+
+    // 同一线程外层调用链没变时, 外层栈帧直接复用上次回栈的结果
+    size_t stack_memo = 0;
+    if (ParseValue(getenv("STACK_MEMO"), &stack_memo) && stack_memo != 0) {
+        options_ |= STACK_MEMO;
+    }
+
+    // 不查找 libart.so 中的 JIT/dex 描述符, 纯 native 进程省去每次 pc 未命中时遍历 JIT 链表
+    size_t native_only_unwind = 0;
+    if (ParseValue(getenv("NATIVE_ONLY_UNWIND"), &native_only_unwind) && native_only_unwind != 0) {
+        options_ |= NATIVE_ONLY_UNWIND;
+    }
+
+    // 回栈交给 unwindd 进程, 申请时只拷贝寄存器和栈顶. 峰值记录需要在申请时
+    // 拿到完整的堆栈列表, 与之不兼容
+    unwind_daemon_name_ = getenv("UNWIND_DAEMON");
+    if (unwind_daemon_name_ != nullptr && !(options_ & RECORD_MEMORY_PEAK)) {
+        options_ |= UNWIND_DAEMON;
+        if (unwind_daemon_name_[0] == '\0') {
+            unwind_daemon_name_ = kUnwindDaemonDefaultName;
+        }
+        size_t stack_kb = 0;
+        if (!ParseValue(getenv("UNWIND_DAEMON_STACK_KB"), &stack_kb) || stack_kb == 0) {
+            stack_kb = DEFAULT_UNWIND_DAEMON_STACK_KB;
+        }
+        unwind_daemon_stack_bytes_ = stack_kb * 1024;
+    }
+
+    // dump 时额外输出 gzip 压缩的 pprof Profile, 并统计每个堆栈累计的申请次数和大小
+    size_t dump_pprof = 0;
+    if (ParseValue(getenv("DUMP_PPROF"), &dump_pprof) && dump_pprof != 0) {
+        options_ |= DUMP_PPROF;
+    }
+
+    // 定时暂停其他线程并回栈, 调用栈与申请记录存入同一个堆栈表. 信号 33 已用于
+    // 触发 dump, 采样默认使用另一个实时信号
+    if (ParseValue(getenv("SAMPLE_INTERVAL_MS"), &sample_interval_ms_) &&
+        sample_interval_ms_ != 0) {
+        options_ |= SAMPLE_STACKS;
+        size_t sample_signal = 0;
+        if (!ParseValue(getenv("SAMPLE_SIGNAL"), &sample_signal) || sample_signal == 0 ||
+            sample_signal == BIONIC_SIGNAL_BACKTRACE) {
+            sample_signal = SIGRTMAX - 1;
+        }
+        sample_signal_ = static_cast<int>(sample_signal);
+    }
+
+    // 按固定间隔把内存计数器和大块申请写成 trace 文件, 与系统 trace 对齐查看
+    timeline_file_ = getenv("TIMELINE_FILE");
+    if (timeline_file_ != nullptr && timeline_file_[0] != '\0') {
+        options_ |= TIMELINE;
+        if (!ParseValue(getenv("TIMELINE_INTERVAL_MS"), &timeline_interval_ms_) ||
+            timeline_interval_ms_ == 0) {
+            timeline_interval_ms_ = DEFAULT_TIMELINE_INTERVAL_MS;
+        }
+        size_t spike_kb = 0;
+        if (!ParseValue(getenv("TIMELINE_SPIKE_KB"), &spike_kb) || spike_kb == 0) {
+            spike_kb = DEFAULT_TIMELINE_SPIKE_KB;
+        }
+        timeline_spike_bytes_ = spike_kb * 1024;
+    }
+
+    // dump 时额外输出 folded 格式, 统计存活(live)或累计(alloc)的申请, 按大小(bytes)
+    // 或次数(count)加权
+    const char* flamegraph = getenv("FLAMEGRAPH");
+    if (flamegraph != nullptr) {
+        if (strcmp(flamegraph, "live_bytes") == 0 || strcmp(flamegraph, "live_count") == 0 ||
+            strcmp(flamegraph, "alloc_bytes") == 0 || strcmp(flamegraph, "alloc_count") == 0) {
+            options_ |= FLAMEGRAPH;
+            flamegraph_alloc_ = strncmp(flamegraph, "alloc_", 6) == 0;
+            flamegraph_count_ = strstr(flamegraph, "_count") != nullptr;
+            size_t flamegraph_diff = 0;
+            flamegraph_diff_ =
+                    ParseValue(getenv("FLAMEGRAPH_DIFF"), &flamegraph_diff) && flamegraph_diff != 0;
+        } else {
+            printf("Unknown FLAMEGRAPH %s\n", flamegraph);
+        }
+    }
+
     // 通过信号插入 check point
     options_ |= DUMP_ON_SIGNAL;
     backtrace_dump_signal_ = BIONIC_SIGNAL_BACKTRACE;  // BIONIC_SIGNAL_BACKTRACE: 33
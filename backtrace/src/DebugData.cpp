@@ -1,14 +1,31 @@
 #include "DebugData.h"
 
-bool DebugData::Initialize(void* storage) {
+bool DebugData::Initialize(
+        void* pointer_storage, void* dmabuf_storage, void* gpu_storage,
+        void* mmap_storage) {
     if (!config_.Init()) {
         return false;
     }
 
-    pointer.reset(new (storage) PointerData());
+    pointer.reset(new (pointer_storage) PointerData());
     if (!pointer->Initialize(config_)) {
         return false;
     }
 
+    dmabuf.reset(new (dmabuf_storage) DmaBufData());
+    if (!dmabuf->Initialize(config_)) {
+        return false;
+    }
+
+    gpu.reset(new (gpu_storage) GpuMemData());
+    if (!gpu->Initialize(config_)) {
+        return false;
+    }
+
+    mmap.reset(new (mmap_storage) MmapData());
+    if (!mmap->Initialize(config_)) {
+        return false;
+    }
+
     return true;
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include <sys/stat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <android-base/stringprintf.h>
+
+#include "DebugData.h"
+#include "DmaBufData.h"
+#include "MmapData.h"
+#include "PointerData.h"
+#include "memory_hook.h"
+
+constexpr uint64_t kInvalidInode = 0;
+
+// dma-buf 在 PointerData 中以 inode 作为 key
+static inline const void* InodeToPointer(uint64_t inode) {
+    return reinterpret_cast<const void*>(static_cast<uintptr_t>(inode));
+}
+
+bool DmaBufData::Initialize(const Config& config) {
+    bufs_.clear();
+    fds_.clear();
+    maps_.Clear();
+
+    return true;
+}
+
+bool DmaBufData::ParseFdInfo(int fd, uint64_t* inode, size_t* size) {
+    std::string fdinfo = android::base::StringPrintf("/proc/self/fdinfo/%d", fd);
+    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{
+            fopen(fdinfo.c_str(), "re"), fclose};
+    if (fp == nullptr) {
+        return false;
+    }
+
+    bool is_dmabuf_file = false;
+    *inode = kInvalidInode;
+    char* line = nullptr;
+    size_t len = 0;
+    while (getline(&line, &len, fp.get()) > 0) {
+        switch (line[0]) {
+            case 'i':
+                if (strncmp(line, "ino:", 4) == 0) {
+                    char* c = line + 4;
+                    *inode = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 's':
+                if (strncmp(line, "size:", 5) == 0) {
+                    char* c = line + 5;
+                    *size = strtoull(c, nullptr, 10);
+                }
+                break;
+            case 'e':
+                if (strncmp(line, "exp_name:", 9) == 0) {
+                    is_dmabuf_file = true;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    m_sys_free(line);
+
+    if (!is_dmabuf_file) {
+        return false;
+    }
+
+    if (*inode == kInvalidInode) {
+        // Fallback to stat() on the fd path to get inode number
+        std::string fd_path = android::base::StringPrintf("/proc/self/fd/%d", fd);
+
+        struct stat sb;
+        if (stat(fd_path.c_str(), &sb) < 0) {
+            return false;
+        }
+        *inode = sb.st_ino;
+    }
+
+    return true;
+}
+
+void DmaBufData::AddFd(int fd) {
+    uint64_t inode;
+    size_t size = 0;
+    if (fd < 0 || !ParseFdInfo(fd, &inode, &size)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+    auto entry = fds_.find(fd);
+    if (entry != fds_.end()) {
+        if (entry->second == inode) {
+            return;
+        }
+        // fd 被未 hook 的路径关闭后复用, 先释放旧的引用
+        ReleaseFd(fd);
+    }
+    fds_[fd] = inode;
+    AddRef(inode, size, false);
+}
+
+void DmaBufData::DupFd(int old_fd, int new_fd) {
+    if (old_fd == new_fd) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+    // dup2/dup3 会隐式关闭 new_fd
+    ReleaseFd(new_fd);
+
+    auto entry = fds_.find(old_fd);
+    if (entry == fds_.end()) {
+        return;
+    }
+    uint64_t inode = entry->second;
+    fds_[new_fd] = inode;
+    AddRef(inode, 0, false);
+}
+
+void DmaBufData::CloseFd(int fd) {
+    std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+    ReleaseFd(fd);
+}
+
+bool DmaBufData::AddMap(const void* addr, size_t size, int fd) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t end = start + PageAlign(size);
+
+    std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+    // MAP_FIXED 覆盖的旧 mapping 已经不存在
+    RemoveMapLocked(start, end);
+
+    uint64_t inode = AcquireFd(fd);
+    if (inode == kInvalidInode) {
+        return false;
+    }
+    maps_.Insert(start, end, inode);
+    AddRef(inode, 0, true);
+    return true;
+}
+
+void DmaBufData::RemoveMap(const void* addr, size_t size) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+
+    std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+    RemoveMapLocked(start, start + PageAlign(size));
+}
+
+void DmaBufData::RemapMap(
+        const void* old_addr, size_t old_size, const void* new_addr, size_t new_size) {
+    uintptr_t old_start = reinterpret_cast<uintptr_t>(old_addr);
+    uintptr_t old_end = old_start + PageAlign(old_size);
+    uintptr_t new_start = reinterpret_cast<uintptr_t>(new_addr);
+    uintptr_t new_end = new_start + PageAlign(new_size);
+
+    std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+    auto range = maps_.Find(old_start);
+    if (range == nullptr) {
+        return;
+    }
+    uint64_t inode = range->value;
+
+    // 先登记新的 mapping, 避免移除旧 mapping 时释放 buffer
+    AddRef(inode, 0, true);
+    RemoveMapLocked(old_start, old_end);
+    RemoveMapLocked(new_start, new_end);
+    maps_.Insert(new_start, new_end, inode);
+}
+
+void DmaBufData::GetResident(std::unordered_map<uintptr_t, size_t>* resident) {
+    std::vector<std::tuple<uintptr_t, uintptr_t, uint64_t>> ranges;
+    {
+        std::lock_guard<std::mutex> dmabuf_guard(dmabuf_mutex_);
+        maps_.ForEach([&ranges](const RangeMap<uint64_t>::Range& range) {
+            ranges.emplace_back(range.start, range.end, range.value);
+        });
+    }
+
+    std::vector<unsigned char> vec;
+    for (const auto& [start, end, inode] : ranges) {
+        uintptr_t key = reinterpret_cast<uintptr_t>(InodeToPointer(inode));
+        (*resident)[key] += ResidentBytes(start, end, &vec);
+    }
+}
+
+uint64_t DmaBufData::AcquireFd(int fd) {
+    if (fd < 0) {
+        return kInvalidInode;
+    }
+
+    auto entry = fds_.find(fd);
+    if (entry != fds_.end()) {
+        return entry->second;
+    }
+
+    // 从其他进程导入 (binder 等) 的 fd, 第一次 mmap 时登记
+    uint64_t inode;
+    size_t size = 0;
+    if (!ParseFdInfo(fd, &inode, &size)) {
+        return kInvalidInode;
+    }
+    fds_[fd] = inode;
+    AddRef(inode, size, false);
+    return inode;
+}
+
+void DmaBufData::ReleaseFd(int fd) {
+    auto entry = fds_.find(fd);
+    if (entry == fds_.end()) {
+        return;
+    }
+    uint64_t inode = entry->second;
+    fds_.erase(entry);
+    RemoveRef(inode, false);
+}
+
+void DmaBufData::RemoveMapLocked(uintptr_t start, uintptr_t end) {
+    maps_.Erase(
+            start, end,
+            [this](const RangeMap<uint64_t>::Range& range, uintptr_t cut_start,
+                   uintptr_t cut_end) {
+                bool keep_left = cut_start > range.start;
+                bool keep_right = cut_end < range.end;
+                if (keep_left && keep_right) {
+                    // mapping 被拆成两段, 两段都 munmap 后才释放
+                    auto entry = bufs_.find(range.value);
+                    if (entry != bufs_.end()) {
+                        entry->second.map_refs++;
+                    }
+                } else if (!keep_left && !keep_right) {
+                    RemoveRef(range.value, true);
+                }
+            });
+}
+
+void DmaBufData::AddRef(uint64_t inode, size_t size, bool is_map) {
+    auto entry = bufs_.find(inode);
+    if (entry == bufs_.end()) {
+        entry = bufs_.emplace(inode, DmaBufInfoType{size, 0, 0}).first;
+        // 新的 dma-buf 对象, 记录其大小和堆栈
+        g_debug->pointer->Add(InodeToPointer(inode), size, DMA);
+    }
+    is_map ? entry->second.map_refs++ : entry->second.fd_refs++;
+}
+
+void DmaBufData::RemoveRef(uint64_t inode, bool is_map) {
+    auto entry = bufs_.find(inode);
+    if (entry == bufs_.end()) {
+        return;
+    }
+    DmaBufInfoType* info = &entry->second;
+    is_map ? info->map_refs-- : info->fd_refs--;
+    if (info->fd_refs == 0 && info->map_refs == 0) {
+        bufs_.erase(entry);
+        g_debug->pointer->Remove(InodeToPointer(inode));
+    }
+}
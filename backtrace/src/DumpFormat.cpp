@@ -0,0 +1,50 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <unwindstack/Demangle.h>
+#include <unwindstack/MapInfo.h>
+
+#include "DumpFormat.h"
+
+void WriteAll(int fd, const std::string& data) {
+    const char* ptr = data.data();
+    size_t remaining = data.size();
+    while (remaining > 0) {
+        ssize_t written = TEMP_FAILURE_RETRY(write(fd, ptr, remaining));
+        if (written <= 0) {
+            return;
+        }
+        ptr += written;
+        remaining -= written;
+    }
+}
+
+void AppendFrame(std::string* out, size_t index, const unwindstack::FrameData& frame) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "#%0zd %" PRIx64 " ", index, frame.rel_pc);
+    *out += buffer;
+
+    // so path
+    const auto& map_info = frame.map_info;
+    if (map_info == nullptr) {
+        *out += "<unknown>";
+    } else if (map_info->name().empty()) {
+        snprintf(buffer, sizeof(buffer), "<anonymous:%" PRIx64 ">", map_info->start());
+        *out += buffer;
+    } else {
+        *out += static_cast<const std::string&>(map_info->name());
+    }
+
+    if (!frame.function_name.empty()) {
+        *out += " (";
+        *out += static_cast<const std::string&>(
+                unwindstack::DemangleNameCached(frame.function_name));
+        if (frame.function_offset != 0) {
+            *out += '+';
+            *out += std::to_string(frame.function_offset);
+        }
+        *out += ')';
+    }
+    *out += '\n';
+}
@@ -0,0 +1,100 @@
+#include <vector>
+
+#include "DebugData.h"
+#include "GpuMemData.h"
+#include "PointerData.h"
+
+// allocs_ 的节点地址在其生命周期内不变 (rehash 和 extract 都不会移动节点), 并且节点
+// 由未被跟踪的 malloc 分配, 不会与 PointerData 中的其他 key 冲突, 因此直接作为 key 使用
+static inline const void* InfoToPointer(const GpuMemInfoType& info) {
+    return &info;
+}
+
+bool GpuMemData::Initialize(const Config& config) {
+    allocs_.clear();
+    fd_allocs_.clear();
+
+    return true;
+}
+
+void GpuMemData::Add(int fd, uint64_t handle, size_t size, bool same_va) {
+    std::lock_guard<std::mutex> gpu_guard(gpu_mutex_);
+    GpuMemKeyType key{fd, handle};
+    // handle 被驱动复用, 说明旧的分配已经通过未 hook 的路径释放
+    RemoveLocked(key);
+
+    auto entry = allocs_.emplace(key, GpuMemInfoType{size, same_va}).first;
+    fd_allocs_[fd]++;
+    g_debug->pointer->Add(InfoToPointer(entry->second), size, DMA);
+}
+
+void GpuMemData::Remove(int fd, uint64_t handle) {
+    std::lock_guard<std::mutex> gpu_guard(gpu_mutex_);
+    GpuMemKeyType key{fd, handle};
+    if (allocs_.count(key) == 0) {
+        // 已经 mmap 的 SAME_VA 分配, gpu va 等于 cpu va
+        key.fd = kSameVaFd;
+    }
+    RemoveLocked(key);
+}
+
+void GpuMemData::Map(int fd, uint64_t offset, const void* addr) {
+    std::lock_guard<std::mutex> gpu_guard(gpu_mutex_);
+    if (fd_allocs_.count(fd) == 0) {
+        return;
+    }
+
+    auto entry = allocs_.find(GpuMemKeyType{fd, offset});
+    if (entry == allocs_.end() || !entry->second.same_va) {
+        return;
+    }
+
+    // 通过 extract 修改 key, 保持节点地址 (即 PointerData 中的 key) 不变
+    auto node = allocs_.extract(entry);
+    node.key() = GpuMemKeyType{kSameVaFd, reinterpret_cast<uintptr_t>(addr)};
+    allocs_.insert(std::move(node));
+    if (--fd_allocs_[fd] == 0) {
+        fd_allocs_.erase(fd);
+    }
+}
+
+bool GpuMemData::Unmap(const void* addr) {
+    std::lock_guard<std::mutex> gpu_guard(gpu_mutex_);
+    GpuMemKeyType key{kSameVaFd, reinterpret_cast<uintptr_t>(addr)};
+    if (allocs_.count(key) == 0) {
+        return false;
+    }
+    // 最后一个 cpu mapping 释放时, 驱动会释放 SAME_VA 分配
+    RemoveLocked(key);
+    return true;
+}
+
+void GpuMemData::CloseFd(int fd) {
+    std::lock_guard<std::mutex> gpu_guard(gpu_mutex_);
+    if (fd_allocs_.count(fd) == 0) {
+        return;
+    }
+
+    std::vector<GpuMemKeyType> keys;
+    for (const auto& entry : allocs_) {
+        if (entry.first.fd == fd) {
+            keys.push_back(entry.first);
+        }
+    }
+    for (const auto& key : keys) {
+        RemoveLocked(key);
+    }
+}
+
+void GpuMemData::RemoveLocked(const GpuMemKeyType& key) {
+    auto entry = allocs_.find(key);
+    if (entry == allocs_.end()) {
+        return;
+    }
+
+    g_debug->pointer->Remove(InfoToPointer(entry->second));
+    allocs_.erase(entry);
+    if (key.fd != kSameVaFd && --fd_allocs_[key.fd] == 0) {
+        fd_allocs_.erase(key.fd);
+    }
+}
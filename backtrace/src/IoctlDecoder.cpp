@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "IoctlDecoder.h"
+
+static const IoctlDecoderTable* const kDecoderTables[] = {
+        &kDmaHeapIoctlDecoders,
+        &kMidgardIoctlDecoders,
+        &kKgslIoctlDecoders,
+        &kMtkCameraIoctlDecoders,
+};
+
+static constexpr size_t kMaxDecoders = 64;
+static IoctlDecoderEntry g_decoders[kMaxDecoders];
+static size_t g_num_decoders = 0;
+
+bool IoctlDecoderInitialize() {
+    g_num_decoders = 0;
+    for (const IoctlDecoderTable* table : kDecoderTables) {
+        for (size_t i = 0; i < table->count; ++i) {
+            if (g_num_decoders == kMaxDecoders) {
+                return false;
+            }
+            g_decoders[g_num_decoders++] = table->entries[i];
+        }
+    }
+
+    std::sort(
+            g_decoders, g_decoders + g_num_decoders,
+            [](const IoctlDecoderEntry& a, const IoctlDecoderEntry& b) {
+                return a.request < b.request;
+            });
+    return true;
+}
+
+const IoctlDecoder* FindIoctlDecoder(unsigned int request) {
+    auto entry = std::lower_bound(
+            g_decoders, g_decoders + g_num_decoders, request,
+            [](const IoctlDecoderEntry& a, unsigned int request) {
+                return a.request < request;
+            });
+    if (entry == g_decoders + g_num_decoders || entry->request != request) {
+        return nullptr;
+    }
+    return entry->decoder;
+}
@@ -0,0 +1,24 @@
+#include <linux/dma-heap.h>
+
+#include "DebugData.h"
+#include "IoctlDecoder.h"
+
+namespace {
+
+class DmaHeapAllocDecoder : public IoctlDecoder {
+public:
+    void Decode(int, void* arg, uint64_t) const override {
+        struct dma_heap_allocation_data* heap = (struct dma_heap_allocation_data*)arg;
+        g_debug->dmabuf->AddFd(static_cast<int>(heap->fd));
+    }
+};
+
+const DmaHeapAllocDecoder kAllocDecoder;
+
+const IoctlDecoderEntry kEntries[] = {
+        {DMA_HEAP_IOCTL_ALLOC, &kAllocDecoder},
+};
+
+}  // namespace
+
+IOCTL_DECODER_TABLE(kDmaHeapIoctlDecoders, kEntries);
@@ -0,0 +1,54 @@
+#include "DebugData.h"
+#include "IoctlDecoder.h"
+
+#include "msm_ksgl/msm_ksgl.h"
+
+namespace {
+
+class KgslGpuobjAllocDecoder : public IoctlDecoder {
+public:
+    void Decode(int fd, void* arg, uint64_t) const override {
+        struct kgsl_gpuobj_alloc* alloc = (struct kgsl_gpuobj_alloc*)arg;
+        size_t size = alloc->mmapsize != 0 ? alloc->mmapsize : alloc->size;
+        g_debug->gpu->Add(fd, alloc->id, size);
+    }
+};
+
+class KgslGpumemAllocIdDecoder : public IoctlDecoder {
+public:
+    void Decode(int fd, void* arg, uint64_t) const override {
+        struct kgsl_gpumem_alloc_id* alloc = (struct kgsl_gpumem_alloc_id*)arg;
+        g_debug->gpu->Add(fd, alloc->id, alloc->size);
+    }
+};
+
+// KGSL_GPUOBJ_FREE_ON_EVENT 延迟释放的对象, 也在这里视为释放
+class KgslGpuobjFreeDecoder : public IoctlDecoder {
+public:
+    void Decode(int fd, void* arg, uint64_t) const override {
+        g_debug->gpu->Remove(fd, ((struct kgsl_gpuobj_free*)arg)->id);
+    }
+};
+
+class KgslGpumemFreeIdDecoder : public IoctlDecoder {
+public:
+    void Decode(int fd, void* arg, uint64_t) const override {
+        g_debug->gpu->Remove(fd, ((struct kgsl_gpumem_free_id*)arg)->id);
+    }
+};
+
+const KgslGpuobjAllocDecoder kGpuobjAllocDecoder;
+const KgslGpumemAllocIdDecoder kGpumemAllocIdDecoder;
+const KgslGpuobjFreeDecoder kGpuobjFreeDecoder;
+const KgslGpumemFreeIdDecoder kGpumemFreeIdDecoder;
+
+const IoctlDecoderEntry kEntries[] = {
+        {IOCTL_KGSL_GPUOBJ_ALLOC, &kGpuobjAllocDecoder},
+        {IOCTL_KGSL_GPUMEM_ALLOC_ID, &kGpumemAllocIdDecoder},
+        {IOCTL_KGSL_GPUOBJ_FREE, &kGpuobjFreeDecoder},
+        {IOCTL_KGSL_GPUMEM_FREE_ID, &kGpumemFreeIdDecoder},
+};
+
+}  // namespace
+
+IOCTL_DECODER_TABLE(kKgslIoctlDecoders, kEntries);
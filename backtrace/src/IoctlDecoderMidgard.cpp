@@ -0,0 +1,49 @@
+#include <unistd.h>
+
+#include "DebugData.h"
+#include "IoctlDecoder.h"
+
+#include "midgard/mali_kbase_ioctl.h"
+
+namespace {
+
+// mali uapi: BASE_MEM_SAME_VA, gpu va 与 cpu va 相同, out.gpu_va 为 mmap 的 cookie
+constexpr uint64_t kBaseMemSameVa = 1ULL << 13;
+
+// kbase 的 alloc 参数是 union, ioctl 返回后输入参数被覆盖, 需要在 ioctl 之前读取 commit_pages
+template <typename AllocType>
+class KbaseMemAllocDecoder : public IoctlDecoder {
+public:
+    uint64_t Prepare(void* arg) const override {
+        return ((AllocType*)arg)->in.commit_pages;
+    }
+
+    void Decode(int fd, void* arg, uint64_t commit_pages) const override {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        AllocType* alloc = (AllocType*)arg;
+        g_debug->gpu->Add(
+                fd, alloc->out.gpu_va, commit_pages * page_size,
+                alloc->out.flags & kBaseMemSameVa);
+    }
+};
+
+class KbaseMemFreeDecoder : public IoctlDecoder {
+public:
+    void Decode(int fd, void* arg, uint64_t) const override {
+        g_debug->gpu->Remove(fd, ((struct kbase_ioctl_mem_free*)arg)->gpu_addr);
+    }
+};
+
+const KbaseMemAllocDecoder<union kbase_ioctl_mem_alloc> kAllocDecoder;
+const KbaseMemAllocDecoder<union kbase_ioctl_mem_alloc_ex> kAllocExDecoder;
+const KbaseMemFreeDecoder kFreeDecoder;
+
+const IoctlDecoderEntry kEntries[] = {
+        {KBASE_IOCTL_MEM_ALLOC, &kAllocDecoder},
+        {KBASE_IOCTL_MEM_ALLOC_EX, &kAllocExDecoder},
+        {KBASE_IOCTL_MEM_FREE, &kFreeDecoder},
+};
+
+}  // namespace
+
+IOCTL_DECODER_TABLE(kMidgardIoctlDecoders, kEntries);
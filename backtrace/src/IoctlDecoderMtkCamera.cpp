@@ -0,0 +1,25 @@
+#include "DebugData.h"
+#include "IoctlDecoder.h"
+
+#include "mtk_camera/camera_mem.h"
+
+namespace {
+
+// 相机驱动导入 dma-buf fd 映射 iova
+class CamMemMapPaDecoder : public IoctlDecoder {
+public:
+    void Decode(int, void* arg, uint64_t) const override {
+        struct CAM_MEM_DEV_ION_NODE_STRUCT* heap = (struct CAM_MEM_DEV_ION_NODE_STRUCT*)arg;
+        g_debug->dmabuf->AddFd(heap->memID);
+    }
+};
+
+const CamMemMapPaDecoder kMapPaDecoder;
+
+const IoctlDecoderEntry kEntries[] = {
+        {CAM_MEM_ION_MAP_PA, &kMapPaDecoder},
+};
+
+}  // namespace
+
+IOCTL_DECODER_TABLE(kMtkCameraIoctlDecoders, kEntries);
@@ -0,0 +1,139 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <utility>
+
+#include "DebugData.h"
+#include "MmapData.h"
+#include "PointerData.h"
+
+static inline const void* ToPointer(uintptr_t addr) {
+    return reinterpret_cast<const void*>(addr);
+}
+
+size_t PageAlign(size_t size) {
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+size_t ResidentBytes(uintptr_t start, uintptr_t end, std::vector<unsigned char>* vec) {
+    // 每次 mincore 最多查询的页数, 避免为大区域一次性分配很大的缓冲区
+    constexpr size_t kMincoreBatchPages = 4096;
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    vec->resize(kMincoreBatchPages);
+    size_t resident = 0;
+    for (uintptr_t addr = start; addr < end;) {
+        size_t pages = (end - addr) / page_size;
+        if (pages > kMincoreBatchPages) {
+            pages = kMincoreBatchPages;
+        }
+        // 区域可能已经被其他线程 munmap, 此时视为不常驻
+        if (mincore(reinterpret_cast<void*>(addr), pages * page_size, vec->data()) ==
+            0) {
+            for (size_t i = 0; i < pages; ++i) {
+                if (vec->at(i) & 1) {
+                    resident += page_size;
+                }
+            }
+        }
+        addr += pages * page_size;
+    }
+    return resident;
+}
+
+bool MmapData::Initialize(const Config& config) {
+    ranges_.Clear();
+
+    return true;
+}
+
+void MmapData::Add(const void* addr, size_t size) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    uintptr_t end = start + PageAlign(size);
+
+    std::lock_guard<std::mutex> mmap_guard(mmap_mutex_);
+    RemoveLocked(start, end);
+    ranges_.Insert(start, end, Empty{});
+    g_debug->pointer->Add(addr, end - start, MMAP);
+}
+
+void MmapData::Remove(const void* addr, size_t size) {
+    uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+
+    std::lock_guard<std::mutex> mmap_guard(mmap_mutex_);
+    RemoveLocked(start, start + PageAlign(size));
+}
+
+void MmapData::GetResident(std::unordered_map<uintptr_t, size_t>* resident) {
+    std::vector<std::pair<uintptr_t, uintptr_t>> ranges;
+    {
+        std::lock_guard<std::mutex> mmap_guard(mmap_mutex_);
+        ranges_.ForEach([&ranges](const RangeMap<Empty>::Range& range) {
+            ranges.emplace_back(range.start, range.end);
+        });
+    }
+
+    std::vector<unsigned char> vec;
+    for (const auto& range : ranges) {
+        (*resident)[range.first] = ResidentBytes(range.first, range.second, &vec);
+    }
+}
+
+void MmapData::Remap(
+        const void* old_addr, size_t old_size, const void* new_addr, size_t new_size) {
+    uintptr_t old_start = reinterpret_cast<uintptr_t>(old_addr);
+    uintptr_t old_end = old_start + PageAlign(old_size);
+    uintptr_t new_start = reinterpret_cast<uintptr_t>(new_addr);
+    uintptr_t new_end = new_start + PageAlign(new_size);
+
+    std::lock_guard<std::mutex> mmap_guard(mmap_mutex_);
+    auto range = ranges_.Find(old_start);
+    if (range == nullptr) {
+        // 不是跟踪的区域 (例如 hook 初始化之前的 mmap)
+        return;
+    }
+    uintptr_t range_start = range->start;
+    uintptr_t range_end = range->end;
+
+    if (new_start == old_start) {
+        // 原地缩小或扩大
+        if (new_end < old_end) {
+            RemoveLocked(new_end, old_end);
+        } else if (new_end > old_end && range_end == old_end) {
+            ranges_.Extend(range_start, new_end);
+            g_debug->pointer->Resize(ToPointer(range_start), new_end - range_start);
+        }
+        return;
+    }
+
+    // 移动到新地址, 新区域沿用原区域的堆栈
+    RemoveLocked(new_start, new_end);
+    size_t moved = (old_end < range_end ? old_end : range_end) - old_start;
+    g_debug->pointer->Split(ToPointer(range_start), ToPointer(new_start), moved);
+    ranges_.Insert(new_start, new_end, Empty{});
+    // old_size 为 0 时 (MREMAP_MAYMOVE 复制共享映射) 原区域保持不变
+    RemoveLocked(old_start, old_end);
+    if (new_end - new_start != moved) {
+        g_debug->pointer->Resize(ToPointer(new_start), new_end - new_start);
+    }
+}
+
+void MmapData::RemoveLocked(uintptr_t start, uintptr_t end) {
+    ranges_.Erase(
+            start, end,
+            [](const RangeMap<Empty>::Range& range, uintptr_t cut_start,
+               uintptr_t cut_end) {
+                if (cut_end < range.end) {
+                    g_debug->pointer->Split(
+                            ToPointer(range.start), ToPointer(cut_end),
+                            range.end - cut_end);
+                }
+                if (cut_start > range.start) {
+                    g_debug->pointer->Resize(
+                            ToPointer(range.start), cut_start - range.start);
+                } else {
+                    g_debug->pointer->Remove(ToPointer(range.start));
+                }
+            });
+}
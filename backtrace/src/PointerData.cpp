@@ -1,19 +1,28 @@
-#include <cxxabi.h>
 #include <inttypes.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <unordered_map>
 
 #include "Config.h"
 #include "DebugData.h"
+#include "DumpFormat.h"
 #include "PointerData.h"
+#include "PprofWriter.h"
+#include "Timeline.h"
 #include "UnwindBacktrace.h"
+#include "UnwindClient.h"
 
-#include "android-base/stringprintf.h"
+#include "unwindstack/Demangle.h"
 #include "unwindstack/Error.h"
 
 constexpr size_t kBacktraceExitIndex = 0;
@@ -37,33 +46,58 @@ bool PointerData::Initialize(const Config& config) {
     key_to_index_.clear();
     frames_.clear();
     backtraces_info_.clear();
+    unresolved_.clear();
     peak_list_.clear();
+    samples_.clear();
+    num_samples_ = 0;
+    alloc_stats_.clear();
+    folded_last_.clear();
+    folded_has_last_ = false;
     // A hash index of kBacktraceEmptyIndex indicates that we tried to get
     // a backtrace, but there was nothing recorded.
     cur_hash_index_ = kBacktraceEmptyIndex + 1;
-    current_used_ = current_host_ = current_dma_ = 0;
+    current_used_ = current_host_ = current_dma_ = current_mmap_ = 0;
     peak_tot_ = peak_host_ = peak_dma_ = 0;
 
     return true;
 }
 
 void PointerData::Add(const void* ptr, size_t pointer_size, MemType type) {
+    if (UnwindClientConnected()) {
+        // 回栈和记录都由 unwindd 完成, 不抓堆栈的申请也不需要记录
+        if (ptr != nullptr && ShouldBacktraceAllocSize(pointer_size)) {
+            UnwindClientAlloc(ptr, pointer_size, type);
+        }
+        return;
+    }
+
     size_t hash_index = 0;
-    hash_index = AddBacktrace(g_debug->config().backtrace_frames(), pointer_size);
+    hash_index = AddBacktrace(g_debug->config().backtrace_frames(), pointer_size, type);
 
     // unwind 跳过的函数，不记录其堆栈和 pointer 信息
     if (hash_index == kBacktraceExitIndex)
         return;
 
+    if (TimelineEnabled()) {
+        TimelineRecordAlloc(pointer_size, type, hash_index);
+    }
+
     std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
     struct timeval tv;
     gettimeofday(&tv, NULL);
     uintptr_t mangled_ptr = ManglePointer(reinterpret_cast<uintptr_t>(ptr));
     pointers_[mangled_ptr] = PointerInfoType{pointer_size, hash_index, type, tv};
-    current_used_ += pointer_size;
+    AddUsed(type, pointer_size);
+}
+
+void PointerData::AddUsed(MemType type, size_t size) {
+    current_used_ += size;
+    if (type == MMAP) {
+        current_mmap_ += size;
+    }
     size_t* current = (type == DMA) ? &current_dma_ : &current_host_;
     size_t* peak = (type == DMA) ? &peak_dma_ : &peak_host_;
-    *current += pointer_size;
+    *current += size;
     if (*current > *peak) {
         *peak = *current;
     }
@@ -79,7 +113,7 @@ void PointerData::Add(const void* ptr, size_t pointer_size, MemType type) {
     }
 }
 
-size_t PointerData::AddBacktrace(size_t num_frames, size_t size_bytes) {
+size_t PointerData::AddBacktrace(size_t num_frames, size_t size_bytes, MemType type) {
     if (!ShouldBacktraceAllocSize(size_bytes)) {
         return kBacktraceEmptyIndex;
     }
@@ -100,22 +134,43 @@ size_t PointerData::AddBacktrace(size_t num_frames, size_t size_bytes) {
         return kBacktraceEmptyIndex;
     }
 
-    FrameKeyType key{.num_frames = frames.size(), .frames = frames.data()};
-    size_t hash_index;
     std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+    size_t hash_index = InternBacktrace(&frames, &frames_info);
+    const Config& config = g_debug->config();
+    if ((config.options() & DUMP_PPROF) ||
+        ((config.options() & FLAMEGRAPH) && config.flamegraph_alloc())) {
+        auto result = alloc_stats_.emplace(hash_index, AllocStatsType());
+        if (result.second) {
+            // 堆栈的存活申请都释放后仍要保留累计值
+            frames_[hash_index].references++;
+        }
+        result.first->second.num[type]++;
+        result.first->second.size[type] += size_bytes;
+    }
+    return hash_index;
+}
+
+size_t PointerData::InternBacktrace(
+        std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frames_info) {
+    FrameKeyType key{.num_frames = frames->size(), .frames = frames->data()};
+    size_t hash_index;
     auto entry = key_to_index_.find(key);
     if (entry == key_to_index_.end()) {
         hash_index = cur_hash_index_++;
-        key.frames = frames.data();
         key_to_index_.emplace(key, hash_index);
 
+        // vector 移动后数据地址不变, key 中的指针仍然有效
         frames_.emplace(
                 hash_index,
-                FrameInfoType{.references = 1, .frames = std::move(frames)});
+                FrameInfoType{.references = 1, .frames = std::move(*frames)});
         if (g_debug->config().options() & BACKTRACE) {
+            if (UnwindHasPcOnlyFrames(*frames_info)) {
+                unresolved_.insert(hash_index);
+            }
             backtraces_info_.emplace(
                     hash_index,
-                    std::make_shared<std::vector<unwindstack::FrameData>>(frames_info));
+                    std::make_shared<std::vector<unwindstack::FrameData>>(
+                            std::move(*frames_info)));
         }
     } else {
         hash_index = entry->second;
@@ -125,7 +180,29 @@ size_t PointerData::AddBacktrace(size_t num_frames, size_t size_bytes) {
     return hash_index;
 }
 
+void PointerData::AddSample(
+        std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frames_info) {
+    if (frames->empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+    size_t hash_index = InternBacktrace(frames, frames_info);
+    auto result = samples_.emplace(hash_index, 0);
+    if (!result.second) {
+        // 已经采样过的堆栈只保留第一次的引用
+        frames_[hash_index].references--;
+    }
+    result.first->second++;
+    num_samples_++;
+}
+
 void PointerData::Remove(const void* ptr) {
+    if (UnwindClientConnected()) {
+        UnwindClientFree(ptr);
+        return;
+    }
+
     size_t hash_index;
     {
         std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
@@ -135,9 +212,7 @@ void PointerData::Remove(const void* ptr) {
             // No tracked pointer.
             return;
         }
-        current_used_ -= entry->second.size;
-        size_t* target = (entry->second.mem_type == DMA) ? &current_dma_ : &current_host_;
-        *target -= entry->second.size;
+        SubUsed(entry->second.mem_type, entry->second.size);
         hash_index = entry->second.hash_index;
         pointers_.erase(mangled_ptr);
     }
@@ -145,6 +220,75 @@ void PointerData::Remove(const void* ptr) {
     RemoveBacktrace(hash_index);
 }
 
+void PointerData::SubUsed(MemType type, size_t size) {
+    current_used_ -= size;
+    if (type == MMAP) {
+        current_mmap_ -= size;
+    }
+    size_t* target = (type == DMA) ? &current_dma_ : &current_host_;
+    *target -= size;
+}
+
+void PointerData::Resize(const void* ptr, size_t new_size) {
+    if (UnwindClientConnected()) {
+        UnwindClientResize(ptr, new_size);
+        return;
+    }
+
+    std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
+    uintptr_t mangled_ptr = ManglePointer(reinterpret_cast<uintptr_t>(ptr));
+    auto entry = pointers_.find(mangled_ptr);
+    if (entry == pointers_.end()) {
+        return;
+    }
+
+    PointerInfoType* info = &entry->second;
+    size_t old_size = info->size;
+    info->size = new_size;
+    if (new_size < old_size) {
+        SubUsed(info->mem_type, old_size - new_size);
+    } else {
+        AddUsed(info->mem_type, new_size - old_size);
+    }
+}
+
+void PointerData::Split(const void* ptr, const void* new_ptr, size_t new_size) {
+    if (UnwindClientConnected()) {
+        UnwindClientSplit(ptr, new_ptr, new_size);
+        return;
+    }
+
+    size_t hash_index;
+    {
+        std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
+        uintptr_t mangled_ptr = ManglePointer(reinterpret_cast<uintptr_t>(ptr));
+        auto entry = pointers_.find(mangled_ptr);
+        if (entry == pointers_.end()) {
+            return;
+        }
+
+        PointerInfoType info = entry->second;
+        info.size = new_size;
+        hash_index = info.hash_index;
+        pointers_[ManglePointer(reinterpret_cast<uintptr_t>(new_ptr))] = info;
+        // 拆分不是新的申请, 不更新峰值
+        current_used_ += new_size;
+        *((info.mem_type == DMA) ? &current_dma_ : &current_host_) += new_size;
+        if (info.mem_type == MMAP) {
+            current_mmap_ += new_size;
+        }
+    }
+
+    if (hash_index <= kBacktraceEmptyIndex) {
+        return;
+    }
+    std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+    auto frame_entry = frames_.find(hash_index);
+    if (frame_entry != frames_.end()) {
+        frame_entry->second.references++;
+    }
+}
+
 void PointerData::RemoveBacktrace(size_t hash_index) {
     if (hash_index <= kBacktraceEmptyIndex) {
         return;
@@ -165,10 +309,41 @@ void PointerData::RemoveBacktrace(size_t hash_index) {
         frames_.erase(hash_index);
         if (g_debug->config().options() & BACKTRACE) {
             backtraces_info_.erase(hash_index);
+            unresolved_.erase(hash_index);
         }
     }
 }
 
+void PointerData::RekeyBacktrace(
+        size_t hash_index, std::shared_ptr<std::vector<unwindstack::FrameData>>* info) {
+    // 只记录 pc 时没有减去调整值, 也没有去掉 hook 库的栈帧, 与同一调用点完整回栈的 key 不同.
+    // 补全后的 pc 与完整回栈一致, 用它重新登记
+    std::vector<uintptr_t> pcs((*info)->size());
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        pcs[i] = (*info)->at(i).pc;
+    }
+    FrameInfoType* frame_info = &frames_[hash_index];
+    if (pcs.empty() || pcs == frame_info->frames) {
+        return;
+    }
+
+    auto same = key_to_index_.find(FrameKeyType{.num_frames = pcs.size(), .frames = pcs.data()});
+    if (same != key_to_index_.end()) {
+        // 已经有相同的堆栈, 共用它的 FrameData, dump 时按 FrameData 合并
+        auto same_info = backtraces_info_.find(same->second);
+        if (same_info != backtraces_info_.end() && unresolved_.count(same->second) == 0) {
+            *info = same_info->second;
+        }
+        return;
+    }
+    key_to_index_.erase(
+            FrameKeyType{.num_frames = frame_info->frames.size(), .frames = frame_info->frames.data()});
+    frame_info->frames = std::move(pcs);
+    key_to_index_.emplace(
+            FrameKeyType{.num_frames = frame_info->frames.size(), .frames = frame_info->frames.data()},
+            hash_index);
+}
+
 void PointerData::GetList(
         std::vector<ListInfoType>* list, bool only_with_backtrace, Pred pred) {
     for (auto& entry : pointers_) {
@@ -179,79 +354,267 @@ void PointerData::GetList(
         }
 
         uintptr_t pointer = DemanglePointer(entry.first);
-        auto frame_entry = frames_.find(hash_index);
-        FrameInfoType* frame_info = &frame_entry->second;
+        std::shared_ptr<std::vector<unwindstack::FrameData>> backtrace_info;
         auto backtrace_entry = backtraces_info_.find(hash_index);
-        std::shared_ptr<std::vector<unwindstack::FrameData>> backtrace_info = backtrace_entry->second;
+        if (backtrace_entry != backtraces_info_.end()) {
+            backtrace_info = backtrace_entry->second;
+        }
 
         list->emplace_back(ListInfoType{
-                pointer, 1, entry.second.RealSize(), entry.second.mem_type, frame_info,
+                pointer, 1, entry.second.RealSize(), entry.second.mem_type,
                 std::move(backtrace_info), entry.second.alloc_time});
     }
 
     std::sort(list->begin(), list->end(), pred);
 }
 
-void PointerData::GetUniqueList(
-        std::vector<ListInfoType>* list, bool only_with_backtrace) {
-    // Sort by the size of the allocation.
-    GetList(list, only_with_backtrace,
-            [](const ListInfoType& a, const ListInfoType& b) {
-                if (a.size != b.size)
-                    return a.size > b.size;
-
-                // Put pointers with no backtrace last.
-                FrameInfoType* a_frame = a.frame_info;
-                FrameInfoType* b_frame = b.frame_info;
-                if (a_frame == nullptr && b_frame != nullptr) {
-                    return false;
-                } else if (a_frame != nullptr && b_frame == nullptr) {
-                    return true;
-                } else if (a_frame == nullptr && b_frame == nullptr) {
-                    return a.pointer < b.pointer;
-                }
+// Sort by the size of the allocation.
+static bool UniqueListLess(const ListInfoType& a, const ListInfoType& b) {
+    if (a.size != b.size)
+        return a.size > b.size;
+
+    // Put pointers with no backtrace last.
+    const auto* a_frames = a.backtrace_info.get();
+    const auto* b_frames = b.backtrace_info.get();
+    if (a_frames == nullptr && b_frames != nullptr) {
+        return false;
+    } else if (a_frames != nullptr && b_frames == nullptr) {
+        return true;
+    } else if (a_frames == nullptr && b_frames == nullptr) {
+        return a.pointer < b.pointer;
+    }
 
-                // Put the pointers with longest backtrace first.
-                if (a_frame->frames.size() != b_frame->frames.size()) {
-                    return a_frame->frames.size() > b_frame->frames.size();
-                }
+    // Put the pointers with longest backtrace first.
+    if (a_frames->size() != b_frames->size()) {
+        return a_frames->size() > b_frames->size();
+    }
 
-                // Last sort by pointer.
-                return a.pointer < b.pointer;
-            });
+    // 相同的堆栈排在一起才能合并
+    if (a_frames != b_frames) {
+        return a_frames < b_frames;
+    }
+
+    // Last sort by pointer.
+    return a.pointer < b.pointer;
+}
 
-    // Remove duplicates of size/backtraces.
+// Remove duplicates of size/backtraces.
+static void MergeDuplicates(std::vector<ListInfoType>* list) {
     for (auto iter = list->begin(); iter != list->end();) {
         auto dup_iter = iter + 1;
         size_t size = iter->size;
-        FrameInfoType* frame_info = iter->frame_info;
+        const auto* frames = iter->backtrace_info.get();
         for (; dup_iter != list->end(); ++dup_iter) {
-            if (size != dup_iter->size || frame_info != dup_iter->frame_info) {
+            if (size != dup_iter->size || frames != dup_iter->backtrace_info.get()) {
                 break;
             }
-            iter->num_allocations++;
+            iter->num_allocations += dup_iter->num_allocations;
         }
         iter = list->erase(iter + 1, dup_iter);
     }
 }
 
-void PointerData::DumpLiveToFile(int fd) {
+void PointerData::GetUniqueList(
+        std::vector<ListInfoType>* list, bool only_with_backtrace) {
+    GetList(list, only_with_backtrace, UniqueListLess);
+    MergeDuplicates(list);
+}
+
+void PointerData::GetCurrentUsed(size_t* host, size_t* mmap, size_t* dma) {
     std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
+    *host = current_host_;
+    *mmap = current_mmap_;
+    *dma = current_dma_;
+}
+
+std::shared_ptr<std::vector<unwindstack::FrameData>> PointerData::GetBacktrace(
+        size_t hash_index) {
+    if (hash_index <= kBacktraceEmptyIndex) {
+        return nullptr;
+    }
     std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+    auto entry = backtraces_info_.find(hash_index);
+    return entry == backtraces_info_.end() ? nullptr : entry->second;
+}
 
-    std::vector<ListInfoType> list = std::move(peak_list_);
-    if (!(g_debug->config().options() & RECORD_MEMORY_PEAK)) {
-        list.clear();
-        // Sort by the time of the allocation.
-        GetList(&list, true, [](const ListInfoType& a, const ListInfoType& b) {
-            return a.alloc_time < b.alloc_time;
+void PointerData::FormatBacktrace(
+        const std::vector<unwindstack::FrameData>& frames_info, std::string* out) {
+    // 记录的堆栈不会再被修改, 只记录了 pc 时在副本上补全
+    const std::vector<unwindstack::FrameData>* frames = &frames_info;
+    std::vector<unwindstack::FrameData> resolved;
+    if (UnwindHasPcOnlyFrames(frames_info)) {
+        resolved = frames_info;
+        UnwindResolveFrames({&resolved});
+        frames = &resolved;
+    }
+    for (size_t i = 0; i < frames->size(); ++i) {
+        AppendFrame(out, i, frames->at(i));
+    }
+}
+
+void PointerData::ResolveBacktraces() {
+    // 补全会进入 dl_iterate_phdr, 持有 frame_mutex_ 时会与 dlopen 中申请内存的线程死锁.
+    // 记录的堆栈发布后不再修改, 在锁外补全副本, 再回到锁内替换
+    std::vector<size_t> indexes;
+    std::vector<std::shared_ptr<std::vector<unwindstack::FrameData>>> old_infos;
+    {
+        std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+        for (size_t hash_index : unresolved_) {
+            auto entry = backtraces_info_.find(hash_index);
+            if (entry != backtraces_info_.end()) {
+                indexes.push_back(hash_index);
+                old_infos.push_back(entry->second);
+            }
+        }
+    }
+    if (indexes.empty()) {
+        return;
+    }
+
+    std::vector<std::vector<unwindstack::FrameData>> new_infos;
+    new_infos.reserve(old_infos.size());
+    std::vector<std::vector<unwindstack::FrameData>*> frame_infos;
+    frame_infos.reserve(old_infos.size());
+    for (const auto& info : old_infos) {
+        new_infos.push_back(*info);
+        frame_infos.push_back(&new_infos.back());
+    }
+    if (!UnwindResolveFrames(frame_infos)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+    std::unordered_map<const void*, std::shared_ptr<std::vector<unwindstack::FrameData>>> replaced;
+    for (size_t i = 0; i < indexes.size(); ++i) {
+        auto entry = backtraces_info_.find(indexes[i]);
+        if (entry == backtraces_info_.end() || entry->second != old_infos[i]) {
+            // 补全期间堆栈已经释放或被另一次 dump 替换
+            continue;
+        }
+        auto info = std::make_shared<std::vector<unwindstack::FrameData>>(
+                std::move(new_infos[i]));
+        RekeyBacktrace(indexes[i], &info);
+        entry->second = info;
+        replaced.emplace(old_infos[i].get(), info);
+        unresolved_.erase(indexes[i]);
+    }
+    // 峰值列表中的堆栈可能已经释放, 不在 backtraces_info_ 中的保持原样
+    for (auto& info : peak_list_) {
+        auto entry = replaced.find(info.backtrace_info.get());
+        if (entry != replaced.end()) {
+            info.backtrace_info = entry->second;
+        }
+    }
+}
+
+// 栈帧所在的函数, 用于按函数关联采样和申请. 没有符号时用 map 和相对地址
+static std::string FrameFunctionKey(const unwindstack::FrameData& frame) {
+    std::string key;
+    if (frame.map_info != nullptr) {
+        key = frame.map_info->name();
+    }
+    if (!frame.function_name.empty()) {
+        key += ':';
+        key += static_cast<const std::string&>(frame.function_name);
+    } else {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "+0x%" PRIx64, frame.rel_pc);
+        key += buffer;
+    }
+    return key;
+}
+
+static size_t ReadSmapsRollup(const char* field) {
+    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{
+            fopen("/proc/self/smaps_rollup", "re"), fclose};
+    if (fp == nullptr) {
+        return 0;
+    }
+
+    size_t value = 0;
+    size_t field_len = strlen(field);
+    char line[256];
+    while (fgets(line, sizeof(line), fp.get()) != nullptr) {
+        if (strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+            value = strtoull(line + field_len + 1, nullptr, 10);
+            break;
+        }
+    }
+    return value;
+}
+
+void PointerData::DumpLiveToFile(
+        int fd, const std::unordered_map<uintptr_t, size_t>* resident) {
+    ResolveBacktraces();
+
+    // 锁内只拷贝记录, 格式化和写文件都在锁外
+    std::vector<ListInfoType> list;
+    std::vector<std::pair<std::shared_ptr<std::vector<unwindstack::FrameData>>, size_t>> samples;
+    size_t num_samples;
+    {
+        std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
+        std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+
+        list = std::move(peak_list_);
+        if (g_debug->config().options() & RECORD_MEMORY_PEAK) {
+            // 补全后不同 hash_index 的堆栈可能合并成同一个
+            std::sort(list.begin(), list.end(), UniqueListLess);
+            MergeDuplicates(&list);
+        } else {
+            list.clear();
+            // Sort by the time of the allocation.
+            GetList(&list, true, [](const ListInfoType& a, const ListInfoType& b) {
+                return a.alloc_time < b.alloc_time;
+            });
+        }
+
+        // 采样次数从多到少, 次数相同时按 hash_index 保持稳定顺序
+        std::vector<std::pair<size_t, size_t>> sorted(samples_.begin(), samples_.end());
+        std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+            return a.second != b.second ? a.second > b.second : a.first < b.first;
         });
+        samples.reserve(sorted.size());
+        std::unordered_map<const void*, size_t> sample_pos;
+        for (const auto& sample : sorted) {
+            auto entry = backtraces_info_.find(sample.first);
+            if (entry == backtraces_info_.end()) {
+                continue;
+            }
+            // 补全后共用 FrameData 的堆栈合并计数, 顺序按第一次出现的位置
+            auto pos = sample_pos.emplace(entry->second.get(), samples.size());
+            if (pos.second) {
+                samples.emplace_back(entry->second, sample.second);
+            } else {
+                samples[pos.first->second].second += sample.second;
+            }
+        }
+        num_samples = num_samples_;
     }
 
+    // 峰值列表记录的是峰值时刻的指针, 当前的常驻内存没有意义
+    if (g_debug->config().options() & RECORD_MEMORY_PEAK) {
+        resident = nullptr;
+    }
+    auto get_resident = [resident](const ListInfoType& info) -> size_t {
+        auto entry = resident->find(info.pointer);
+        if (entry == resident->end()) {
+            return 0;
+        }
+        // dma-buf 可能被 mmap 多次
+        return std::min(entry->second, info.size);
+    };
+
     size_t host_use = 0, dma_use = 0;
+    size_t mmap_virt = 0, mmap_rss = 0, dma_rss = 0;
     for (const auto& it : list) {
         size_t bt_size = it.size * it.num_allocations;
         it.mem_type == DMA ? dma_use += bt_size : host_use += bt_size;
+        if (resident != nullptr && it.mem_type == MMAP) {
+            mmap_virt += bt_size;
+            mmap_rss += get_resident(it);
+        } else if (resident != nullptr && it.mem_type == DMA) {
+            dma_rss += get_resident(it);
+        }
     }
 
     if (!(g_debug->config().options() & RECORD_MEMORY_PEAK)) {
@@ -266,9 +629,23 @@ void PointerData::DumpLiveToFile(int fd) {
                 (host_use + dma_use) / 1024.0 / 1024.0);
     }
 
+    if (resident != nullptr) {
+        // 与 /proc/self/smaps_rollup 对账: mmap 常驻内存计入 Anonymous, 都计入 Rss
+        dprintf(fd,
+                "mmap resident: %fMB, mmap virtual: %fMB, dma mapped resident: %fMB, "
+                "smaps_rollup Rss: %fMB, Anonymous: %fMB\n",
+                mmap_rss / 1024.0 / 1024.0, mmap_virt / 1024.0 / 1024.0,
+                dma_rss / 1024.0 / 1024.0, ReadSmapsRollup("Rss") / 1024.0,
+                ReadSmapsRollup("Anonymous") / 1024.0);
+    }
+
     dprintf(fd,
             "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
             "+++++++++++++++\n\n");
+    // 逐行 dprintf 太慢, 攒够一块再写
+    std::string out;
+    out.reserve(kDumpBufferSize * 2);
+    char buffer[256];
     for (const auto& info : list) {
         // 解析时间
         struct tm* local_time = localtime(&info.alloc_time.tv_sec);
@@ -277,46 +654,88 @@ void PointerData::DumpLiveToFile(int fd) {
                 formatted_time, sizeof(formatted_time), "%Y-%m-%d %H:%M:%S",
                 local_time);
 
-        dprintf(fd,
-                "alloc_size:%fKB \t alloc_type:%s \t alloc_num:%zu \t "
-                "alloc_time:%s.%zu\n",
-                info.size / 1024.0, mtype[info.mem_type], info.num_allocations,
-                formatted_time, info.alloc_time.tv_usec / 1000);
+        snprintf(buffer, sizeof(buffer),
+                 "alloc_size:%fKB \t alloc_type:%s \t alloc_num:%zu \t "
+                 "alloc_time:%s.%zu\n",
+                 info.size / 1024.0, mtype[info.mem_type], info.num_allocations,
+                 formatted_time, info.alloc_time.tv_usec / 1000);
+        out += buffer;
+        if (resident != nullptr && info.mem_type != HOST) {
+            snprintf(buffer, sizeof(buffer), "resident_size:%fKB\n", get_resident(info) / 1024.0);
+            out += buffer;
+        }
         for (size_t i = 0; i < info.backtrace_info->size(); ++i) {
-            const unwindstack::FrameData* frame = &info.backtrace_info->at(i);
-            auto map_info = frame->map_info;
-
-            std::string line =
-                    android::base::StringPrintf("#%0zd %" PRIx64 " ", i, frame->rel_pc);
-            // so path
-            if (map_info == nullptr) {
-                line += "<unknown>";
-            } else if (map_info->name().empty()) {
-                line += android::base::StringPrintf(
-                        "<anonymous:%" PRIx64 ">", map_info->start());
-            } else {
-                line += map_info->name();
+            AppendFrame(&out, i, info.backtrace_info->at(i));
+        }
+        out += '\n';
+        if (out.size() >= kDumpBufferSize) {
+            WriteAll(fd, out);
+            out.clear();
+        }
+    }
+
+    if (!samples.empty()) {
+        // 按申请的调用点所在函数汇总存活申请. 采样的堆栈从栈顶往外找到第一个申请过内存的函数,
+        // 用于对照 CPU 热点和申请热点
+        struct FunctionAlloc {
+            const unwindstack::FrameData* frame;
+            size_t size;
+            size_t num;
+        };
+        std::unordered_map<std::string, FunctionAlloc> alloc_by_function;
+        for (const auto& info : list) {
+            if (info.backtrace_info->empty()) {
+                continue;
             }
+            const unwindstack::FrameData& callsite = info.backtrace_info->front();
+            auto& alloc = alloc_by_function.emplace(FrameFunctionKey(callsite),
+                                                    FunctionAlloc{&callsite, 0, 0})
+                                  .first->second;
+            alloc.size += info.size * info.num_allocations;
+            alloc.num += info.num_allocations;
+        }
 
-            if (!frame->function_name.empty()) {
-                line += " (";
-                char* demangled_name = abi::__cxa_demangle(
-                        frame->function_name.c_str(), nullptr, nullptr, nullptr);
-                if (demangled_name != nullptr) {
-                    line += demangled_name;
-                    free(demangled_name);
-                } else {
-                    line += frame->function_name;
+        snprintf(buffer, sizeof(buffer),
+                 "+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
+                 "++++++++++++++\ntotal samples: %zu\n\n",
+                 num_samples);
+        out += buffer;
+        for (const auto& sample : samples) {
+            const auto& frames_info = *sample.first;
+            const FunctionAlloc* alloc = nullptr;
+            for (const auto& frame : frames_info) {
+                auto entry = alloc_by_function.find(FrameFunctionKey(frame));
+                if (entry != alloc_by_function.end()) {
+                    alloc = &entry->second;
+                    break;
                 }
-                if (frame->function_offset != 0) {
-                    line += "+" + std::to_string(frame->function_offset);
-                }
-                line += ")";
             }
-            dprintf(fd, "%s\n", line.c_str());
+            snprintf(buffer, sizeof(buffer),
+                     "sample_num:%zu \t sample_percent:%.2f%% \t alloc_size:%fKB \t "
+                     "alloc_num:%zu \t alloc_func:",
+                     sample.second, sample.second * 100.0 / num_samples,
+                     alloc == nullptr ? 0.0 : alloc->size / 1024.0,
+                     alloc == nullptr ? 0 : alloc->num);
+            out += buffer;
+            if (alloc == nullptr) {
+                out += '-';
+            } else if (!alloc->frame->function_name.empty()) {
+                out += unwindstack::DemangleNameCached(alloc->frame->function_name);
+            } else {
+                out += FrameFunctionKey(*alloc->frame);
+            }
+            out += '\n';
+            for (size_t i = 0; i < frames_info.size(); ++i) {
+                AppendFrame(&out, i, frames_info[i]);
+            }
+            out += '\n';
+            if (out.size() >= kDumpBufferSize) {
+                WriteAll(fd, out);
+                out.clear();
+            }
         }
-        dprintf(fd, "\n");
     }
+    WriteAll(fd, out);
 }
 
 void PointerData::DumpPeakInfo() {
@@ -327,3 +746,230 @@ void PointerData::DumpPeakInfo() {
            peak_host_ / 1024.0 / 1024.0, peak_dma_ / 1024.0 / 1024.0,
            peak_tot_ / 1024.0 / 1024.0);
 }
+
+bool PointerData::DumpPprofToFile(int fd) {
+    ResolveBacktraces();
+
+    // 相同堆栈和类型的记录合并成一条 sample, values 依次为
+    // alloc_objects, alloc_space, inuse_objects, inuse_space
+    struct Sample {
+        std::shared_ptr<std::vector<unwindstack::FrameData>> frames;
+        MemType mem_type;
+        std::vector<int64_t> values;
+    };
+    std::vector<Sample> samples;
+    std::map<std::pair<const void*, MemType>, size_t> sample_index;
+    auto get_values = [&samples, &sample_index](
+                              const std::shared_ptr<std::vector<unwindstack::FrameData>>& frames,
+                              MemType type) -> std::vector<int64_t>& {
+        auto result = sample_index.emplace(std::make_pair(frames.get(), type), samples.size());
+        if (result.second) {
+            samples.push_back(Sample{frames, type, std::vector<int64_t>(4, 0)});
+        }
+        return samples[result.first->second].values;
+    };
+
+    // 与文本 dump 一致, 记录峰值时 inuse 为峰值时刻的申请
+    bool peak = g_debug->config().options() & RECORD_MEMORY_PEAK;
+    {
+        // 锁内只合并记录, 写文件在锁外
+        std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
+        std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+        if (peak) {
+            for (const auto& info : peak_list_) {
+                if (info.backtrace_info == nullptr) {
+                    continue;
+                }
+                std::vector<int64_t>& values = get_values(info.backtrace_info, info.mem_type);
+                values[2] += info.num_allocations;
+                values[3] += info.size * info.num_allocations;
+            }
+        } else {
+            for (const auto& entry : pointers_) {
+                auto backtrace_entry = backtraces_info_.find(entry.second.hash_index);
+                if (backtrace_entry == backtraces_info_.end()) {
+                    continue;
+                }
+                std::vector<int64_t>& values =
+                        get_values(backtrace_entry->second, entry.second.mem_type);
+                values[2]++;
+                values[3] += entry.second.RealSize();
+            }
+        }
+        for (const auto& entry : alloc_stats_) {
+            auto backtrace_entry = backtraces_info_.find(entry.first);
+            if (backtrace_entry == backtraces_info_.end()) {
+                continue;
+            }
+            for (MemType type : {HOST, MMAP, DMA}) {
+                if (entry.second.num[type] == 0) {
+                    continue;
+                }
+                std::vector<int64_t>& values = get_values(backtrace_entry->second, type);
+                values[0] += entry.second.num[type];
+                values[1] += entry.second.size[type];
+            }
+        }
+    }
+
+    PprofWriter writer(fd);
+    std::vector<PprofWriter::SampleType> sample_types = {
+            {"alloc_objects", "count"},
+            {"alloc_space", "bytes"},
+            {"inuse_objects", "count"},
+            {"inuse_space", "bytes"}};
+    const char* comment = peak ? "inuse_objects/inuse_space are the allocations at the peak" : "";
+    if (!writer.Begin(sample_types, 3, comment)) {
+        return false;
+    }
+    for (const auto& sample : samples) {
+        writer.AddSample(*sample.frames, sample.values, "alloc_type", mtype[sample.mem_type]);
+    }
+    return writer.Finish();
+}
+
+// folded 格式的帧名, 同一个 pc 只生成一次
+static const std::string& FoldedFrameName(
+        const unwindstack::FrameData& frame, std::unordered_map<uint64_t, std::string>* names) {
+    auto result = names->emplace(frame.pc, std::string());
+    std::string& name = result.first->second;
+    if (!result.second) {
+        return name;
+    }
+    if (!frame.function_name.empty()) {
+        name = unwindstack::DemangleNameCached(frame.function_name);
+    } else {
+        char buffer[64];
+        if (frame.map_info != nullptr && !frame.map_info->name().empty()) {
+            const std::string& map_name = frame.map_info->name();
+            name = map_name.substr(map_name.rfind('/') + 1);
+            snprintf(buffer, sizeof(buffer), "+0x%" PRIx64, frame.rel_pc);
+        } else {
+            snprintf(buffer, sizeof(buffer), "0x%" PRIx64, frame.pc);
+        }
+        name += buffer;
+    }
+    // ; 是 folded 格式的帧分隔符
+    std::replace(name.begin(), name.end(), ';', ':');
+    return name;
+}
+
+// 缓冲区满时写出, 避免大量堆栈时占用过多内存
+static void AppendFolded(int fd, std::string* out, const std::string& line) {
+    *out += line;
+    if (out->size() >= 64 * 1024) {
+        WriteAll(fd, *out);
+        out->clear();
+    }
+}
+
+bool PointerData::HasFoldedBaseline() {
+    std::lock_guard<std::mutex> folded_guard(folded_mutex_);
+    return folded_has_last_;
+}
+
+bool PointerData::DumpFoldedToFile(int fd, int diff_fd) {
+    ResolveBacktraces();
+
+    const Config& config = g_debug->config();
+    bool by_count = config.flamegraph_count();
+    struct Stack {
+        std::shared_ptr<std::vector<unwindstack::FrameData>> frames;
+        MemType mem_type;
+        int64_t value;
+    };
+    std::vector<Stack> stacks;
+    std::map<std::pair<const void*, MemType>, size_t> stack_index;
+    auto add = [&stacks, &stack_index, by_count](
+                       const std::shared_ptr<std::vector<unwindstack::FrameData>>& frames,
+                       MemType type, size_t num, size_t size) {
+        auto result = stack_index.emplace(std::make_pair(frames.get(), type), stacks.size());
+        if (result.second) {
+            stacks.push_back(Stack{frames, type, 0});
+        }
+        stacks[result.first->second].value += by_count ? num : size;
+    };
+
+    {
+        // 锁内只合并记录, 拼接和写文件在锁外
+        std::lock_guard<std::mutex> pointer_guard(pointer_mutex_);
+        std::lock_guard<std::mutex> frame_guard(frame_mutex_);
+        if (config.flamegraph_alloc()) {
+            for (const auto& entry : alloc_stats_) {
+                auto backtrace_entry = backtraces_info_.find(entry.first);
+                if (backtrace_entry == backtraces_info_.end()) {
+                    continue;
+                }
+                for (MemType type : {HOST, MMAP, DMA}) {
+                    if (entry.second.num[type] != 0) {
+                        add(backtrace_entry->second, type, entry.second.num[type],
+                            entry.second.size[type]);
+                    }
+                }
+            }
+        } else if (config.options() & RECORD_MEMORY_PEAK) {
+            // 与文本 dump 一致, 记录峰值时输出峰值时刻的申请
+            for (const auto& info : peak_list_) {
+                if (info.backtrace_info != nullptr) {
+                    add(info.backtrace_info, info.mem_type, info.num_allocations,
+                        info.size * info.num_allocations);
+                }
+            }
+        } else {
+            for (const auto& entry : pointers_) {
+                auto backtrace_entry = backtraces_info_.find(entry.second.hash_index);
+                if (backtrace_entry != backtraces_info_.end()) {
+                    add(backtrace_entry->second, entry.second.mem_type, 1,
+                        entry.second.RealSize());
+                }
+            }
+        }
+    }
+
+    // 不同 pc 可能落在同一个函数内, 按拼接后的字符串再合并一次. 内存类型作为根帧
+    std::unordered_map<uint64_t, std::string> names;
+    std::unordered_map<std::string, int64_t> folded;
+    std::string line;
+    for (const auto& stack : stacks) {
+        line = '[';
+        line += mtype[stack.mem_type];
+        line += ']';
+        for (auto frame = stack.frames->rbegin(); frame != stack.frames->rend(); ++frame) {
+            line += ';';
+            line += FoldedFrameName(*frame, &names);
+        }
+        folded[line] += stack.value;
+    }
+
+    std::string out;
+    for (const auto& entry : folded) {
+        AppendFolded(fd, &out, entry.first + ' ' + std::to_string(entry.second) + '\n');
+    }
+    WriteAll(fd, out);
+
+    if (!config.flamegraph_diff()) {
+        return true;
+    }
+    // 每行为 "堆栈 上一次 本次", 即 flamegraph.pl 差分火焰图的输入格式, 差值为
+    // 本次减上一次. 第一次 dump 没有可对比的结果, 只保存
+    std::lock_guard<std::mutex> folded_guard(folded_mutex_);
+    if (diff_fd != -1 && folded_has_last_) {
+        out.clear();
+        for (const auto& entry : folded) {
+            auto last = folded_last_.find(entry.first);
+            int64_t before = last == folded_last_.end() ? 0 : last->second;
+            AppendFolded(diff_fd, &out, entry.first + ' ' + std::to_string(before) + ' ' +
+                                                std::to_string(entry.second) + '\n');
+        }
+        for (const auto& entry : folded_last_) {
+            if (folded.find(entry.first) == folded.end()) {
+                AppendFolded(diff_fd, &out,
+                             entry.first + ' ' + std::to_string(entry.second) + " 0\n");
+            }
+        }
+        WriteAll(diff_fd, out);
+    }
+    folded_last_ = std::move(folded);
+    folded_has_last_ = true;
+    return true;
+}
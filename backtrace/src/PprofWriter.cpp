@@ -0,0 +1,265 @@
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+
+#include <unwindstack/Demangle.h>
+
+#include "PprofWriter.h"
+
+static constexpr size_t kDeflateBufferSize = 64 * 1024;
+
+// perftools.profiles.Profile 的字段号
+enum ProfileField : uint32_t {
+    kProfileSampleType = 1,
+    kProfileSample = 2,
+    kProfileMapping = 3,
+    kProfileLocation = 4,
+    kProfileFunction = 5,
+    kProfileStringTable = 6,
+    kProfileTimeNanos = 9,
+    kProfilePeriodType = 11,
+    kProfilePeriod = 12,
+    kProfileComment = 13,
+    kProfileDefaultSampleType = 14,
+};
+
+enum WireType : uint32_t {
+    kWireVarint = 0,
+    kWireLengthDelimited = 2,
+};
+
+static void PutVarint(std::string* out, uint64_t value) {
+    while (value >= 0x80) {
+        out->push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out->push_back(static_cast<char>(value));
+}
+
+static void PutTag(std::string* out, uint32_t field, WireType type) {
+    PutVarint(out, (static_cast<uint64_t>(field) << 3) | type);
+}
+
+// proto3 的默认值 0 不需要写出
+static void PutVarintField(std::string* out, uint32_t field, uint64_t value) {
+    if (value != 0) {
+        PutTag(out, field, kWireVarint);
+        PutVarint(out, value);
+    }
+}
+
+static void PutBytesField(std::string* out, uint32_t field, const std::string& value) {
+    PutTag(out, field, kWireLengthDelimited);
+    PutVarint(out, value.size());
+    out->append(value);
+}
+
+static void PutPackedField(std::string* out, uint32_t field, const std::vector<uint64_t>& values) {
+    if (values.empty()) {
+        return;
+    }
+    std::string packed;
+    for (uint64_t value : values) {
+        PutVarint(&packed, value);
+    }
+    PutBytesField(out, field, packed);
+}
+
+PprofWriter::~PprofWriter() {
+    if (started_) {
+        deflateEnd(&stream_);
+    }
+}
+
+void PprofWriter::Deflate(const void* data, size_t size, int flush) {
+    if (!ok_) {
+        return;
+    }
+    stream_.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+    stream_.avail_in = static_cast<uInt>(size);
+    do {
+        stream_.next_out = out_.data();
+        stream_.avail_out = static_cast<uInt>(out_.size());
+        int ret = deflate(&stream_, flush);
+        if (ret == Z_STREAM_ERROR) {
+            ok_ = false;
+            return;
+        }
+        const uint8_t* ptr = out_.data();
+        size_t remaining = out_.size() - stream_.avail_out;
+        while (remaining > 0) {
+            ssize_t written = TEMP_FAILURE_RETRY(write(fd_, ptr, remaining));
+            if (written <= 0) {
+                ok_ = false;
+                return;
+            }
+            ptr += written;
+            remaining -= written;
+        }
+    } while (stream_.avail_out == 0);
+}
+
+void PprofWriter::WriteField(uint32_t field, const std::string& payload) {
+    std::string header;
+    PutTag(&header, field, kWireLengthDelimited);
+    PutVarint(&header, payload.size());
+    Deflate(header.data(), header.size(), Z_NO_FLUSH);
+    Deflate(payload.data(), payload.size(), Z_NO_FLUSH);
+}
+
+void PprofWriter::WriteVarintField(uint32_t field, uint64_t value) {
+    std::string data;
+    PutVarintField(&data, field, value);
+    Deflate(data.data(), data.size(), Z_NO_FLUSH);
+}
+
+uint64_t PprofWriter::InternString(const std::string& str) {
+    auto entry = strings_.find(str);
+    if (entry != strings_.end()) {
+        return entry->second;
+    }
+    // string_table 的下标就是写出的顺序
+    uint64_t index = strings_.size();
+    strings_.emplace(str, index);
+    WriteField(kProfileStringTable, str);
+    return index;
+}
+
+uint64_t PprofWriter::InternMapping(unwindstack::MapInfo* map_info) {
+    if (map_info == nullptr) {
+        return 0;
+    }
+    auto entry = mappings_.find(map_info);
+    if (entry != mappings_.end()) {
+        return entry->second;
+    }
+    uint64_t id = mappings_.size() + 1;
+    mappings_.emplace(map_info, id);
+
+    // build id 需要 elf, 只在 map 第一次出现时读取
+    uint64_t filename = InternString(map_info->name());
+    uint64_t build_id = InternString(map_info->GetPrintableBuildID());
+    std::string mapping;
+    PutVarintField(&mapping, 1, id);
+    PutVarintField(&mapping, 2, map_info->start());
+    PutVarintField(&mapping, 3, map_info->end());
+    PutVarintField(&mapping, 4, map_info->offset());
+    PutVarintField(&mapping, 5, filename);
+    PutVarintField(&mapping, 6, build_id);
+    PutVarintField(&mapping, 7, 1);  // has_functions
+    WriteField(kProfileMapping, mapping);
+    return id;
+}
+
+uint64_t PprofWriter::InternFunction(const std::string& name, uint64_t filename) {
+    uint64_t name_index = InternString(name);
+    auto key = std::make_pair(name_index, filename);
+    auto entry = functions_.find(key);
+    if (entry != functions_.end()) {
+        return entry->second;
+    }
+    uint64_t id = functions_.size() + 1;
+    functions_.emplace(key, id);
+
+    std::string function;
+    PutVarintField(&function, 1, id);
+    PutVarintField(&function, 2, name_index);
+    PutVarintField(&function, 3, name_index);
+    PutVarintField(&function, 4, filename);
+    WriteField(kProfileFunction, function);
+    return id;
+}
+
+uint64_t PprofWriter::InternLocation(const unwindstack::FrameData& frame) {
+    auto entry = locations_.find(frame.pc);
+    if (entry != locations_.end()) {
+        return entry->second;
+    }
+
+    uint64_t mapping_id = InternMapping(frame.map_info.get());
+    uint64_t function_id = 0;
+    if (!frame.function_name.empty()) {
+        uint64_t filename = frame.map_info == nullptr ? 0 : InternString(frame.map_info->name());
+        function_id = InternFunction(
+                unwindstack::DemangleNameCached(frame.function_name), filename);
+    }
+
+    uint64_t id = locations_.size() + 1;
+    locations_.emplace(frame.pc, id);
+    std::string location;
+    PutVarintField(&location, 1, id);
+    PutVarintField(&location, 2, mapping_id);
+    PutVarintField(&location, 3, frame.pc);
+    if (function_id != 0) {
+        std::string line;
+        PutVarintField(&line, 1, function_id);
+        PutBytesField(&location, 4, line);
+    }
+    WriteField(kProfileLocation, location);
+    return id;
+}
+
+bool PprofWriter::Begin(
+        const std::vector<SampleType>& sample_types, size_t default_type,
+        const std::string& comment) {
+    // windowBits 加 16 输出 gzip 格式
+    if (deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    started_ = true;
+    out_.resize(kDeflateBufferSize);
+
+    // string_table[0] 必须是空字符串
+    InternString("");
+    for (const auto& sample_type : sample_types) {
+        std::string value_type;
+        PutVarintField(&value_type, 1, InternString(sample_type.type));
+        PutVarintField(&value_type, 2, InternString(sample_type.unit));
+        WriteField(kProfileSampleType, value_type);
+    }
+    WriteVarintField(kProfileDefaultSampleType, InternString(sample_types[default_type].type));
+
+    // 每次申请都记录, 不是按字节采样
+    std::string period_type;
+    PutVarintField(&period_type, 1, InternString("space"));
+    PutVarintField(&period_type, 2, InternString("bytes"));
+    WriteField(kProfilePeriodType, period_type);
+    WriteVarintField(kProfilePeriod, 1);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    WriteVarintField(kProfileTimeNanos, now.tv_sec * 1000000000ULL + now.tv_nsec);
+    if (!comment.empty()) {
+        WriteVarintField(kProfileComment, InternString(comment));
+    }
+    return ok_;
+}
+
+void PprofWriter::AddSample(
+        const std::vector<unwindstack::FrameData>& frames, const std::vector<int64_t>& values,
+        const char* label_key, const char* label_value) {
+    std::vector<uint64_t> location_ids;
+    location_ids.reserve(frames.size());
+    for (const auto& frame : frames) {
+        location_ids.push_back(InternLocation(frame));
+    }
+
+    std::string sample;
+    PutPackedField(&sample, 1, location_ids);
+    std::vector<uint64_t> packed_values(values.begin(), values.end());
+    PutPackedField(&sample, 2, packed_values);
+    if (label_key != nullptr) {
+        std::string label;
+        PutVarintField(&label, 1, InternString(label_key));
+        PutVarintField(&label, 2, InternString(label_value));
+        PutBytesField(&sample, 3, label);
+    }
+    WriteField(kProfileSample, sample);
+}
+
+bool PprofWriter::Finish() {
+    Deflate(nullptr, 0, Z_FINISH);
+    return ok_;
+}
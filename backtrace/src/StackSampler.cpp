@@ -0,0 +1,92 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <memory>
+#include <vector>
+
+#include <android-base/threads.h>
+
+#include "DebugData.h"
+#include "StackSampler.h"
+#include "UnwindBacktrace.h"
+#include "debug_disable.h"
+
+struct SamplerArg {
+    size_t interval_ms;
+    int signal;
+};
+
+struct DirCloser {
+    void operator()(DIR* dir) const { closedir(dir); }
+};
+
+static void ListThreads(std::vector<pid_t>* tids) {
+    tids->clear();
+    std::unique_ptr<DIR, DirCloser> dir(opendir("/proc/self/task"));
+    if (dir == nullptr) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir.get())) != nullptr) {
+        pid_t tid = static_cast<pid_t>(atoi(entry->d_name));
+        if (tid > 0) {
+            tids->push_back(tid);
+        }
+    }
+}
+
+static void* SamplerThread(void* data) {
+    // 采样线程自己的申请不记录. 被采样的线程复制完寄存器和栈就继续运行, 回栈时不会等待它
+    ScopedDisableDebugCalls disable;
+
+    SamplerArg arg = *static_cast<SamplerArg*>(data);
+    delete static_cast<SamplerArg*>(data);
+
+    pid_t self = static_cast<pid_t>(android::base::GetThreadId());
+    size_t max_frames = g_debug->config().backtrace_frames();
+    struct timespec interval = {
+            .tv_sec = static_cast<time_t>(arg.interval_ms / 1000),
+            .tv_nsec = static_cast<long>(arg.interval_ms % 1000) * 1000000};
+    std::vector<pid_t> tids;
+    std::vector<uintptr_t> frames;
+    std::vector<unwindstack::FrameData> frames_info;
+    while (true) {
+        nanosleep(&interval, nullptr);
+
+        ListThreads(&tids);
+        for (pid_t tid : tids) {
+            if (tid == self) {
+                continue;
+            }
+            // 预热完成前返回 ERROR_UNSUPPORTED, 本轮直接跳过
+            if (UnwindThread(tid, arg.signal, &frames, &frames_info, max_frames) ==
+                unwindstack::ERROR_UNSUPPORTED) {
+                break;
+            }
+            g_debug->pointer->AddSample(&frames, &frames_info);
+        }
+    }
+    return nullptr;
+}
+
+bool StackSamplerStart(size_t interval_ms, int signal) {
+    if (!UnwindThreadInit(signal)) {
+        return false;
+    }
+    auto* arg = new SamplerArg{.interval_ms = interval_ms, .signal = signal};
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, SamplerThread, arg);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        delete arg;
+        return false;
+    }
+    pthread_setname_np(thread, "alloc_hook_samp");
+    return true;
+}
@@ -0,0 +1,295 @@
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <android-base/threads.h>
+
+#include "DebugData.h"
+#include "DumpFormat.h"
+#include "Timeline.h"
+#include "debug_disable.h"
+
+// 超出的线程合并到最后一个槽位
+static constexpr size_t kMaxThreadSlots = 256;
+
+struct ThreadSlot {
+    std::atomic<pid_t> tid;
+    std::atomic<uint64_t> bytes;
+    // 以下只在 timeline 线程中访问
+    uint64_t last_bytes;
+    // 速率已经输出过 0, 再有申请之前不用重复输出
+    bool idle;
+    // 线程退出后槽位的 tid 清零, 输出最后一次 0 时仍使用原来的名字
+    pid_t last_tid;
+};
+
+struct Spike {
+    uint64_t ts_us;
+    pid_t tid;
+    size_t size;
+    MemType type;
+    size_t stack_id;
+    std::shared_ptr<std::vector<unwindstack::FrameData>> frames;
+};
+
+static const char* kMemTypeNames[] = {"host", "mmap", "dma"};
+
+static std::atomic<bool> g_enabled(false);
+static int g_fd = -1;
+static size_t g_interval_ms = 0;
+static size_t g_spike_bytes = 0;
+static ThreadSlot g_slots[kMaxThreadSlots + 1];
+static pthread_key_t g_slot_key;
+
+static std::mutex g_spike_mutex;
+static std::vector<Spike> g_spikes;
+
+// 保护写文件, timeline 线程和 TimelineFinish 都会写
+static std::mutex g_write_mutex;
+static bool g_finished = false;
+static bool g_first_event = true;
+static uint64_t g_last_round_us = 0;
+static std::unordered_set<size_t> g_written_stacks;
+
+static uint64_t NowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static void ReleaseSlot(void* slot) {
+    static_cast<ThreadSlot*>(slot)->tid.store(0, std::memory_order_relaxed);
+}
+
+static ThreadSlot* GetThreadSlot() {
+    auto* slot = static_cast<ThreadSlot*>(pthread_getspecific(g_slot_key));
+    if (slot != nullptr) {
+        return slot;
+    }
+    pid_t tid = static_cast<pid_t>(android::base::GetThreadId());
+    for (size_t i = 0; i < kMaxThreadSlots; i++) {
+        pid_t expected = 0;
+        if (g_slots[i].tid.compare_exchange_strong(expected, tid, std::memory_order_relaxed)) {
+            pthread_setspecific(g_slot_key, &g_slots[i]);
+            return &g_slots[i];
+        }
+    }
+    // 合并到最后一个槽位的线程也要缓存, 否则每次申请都要遍历所有槽位
+    pthread_setspecific(g_slot_key, &g_slots[kMaxThreadSlots]);
+    return &g_slots[kMaxThreadSlots];
+}
+
+static void AppendEscaped(std::string* out, const std::string& str) {
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            *out += '\\';
+            *out += c;
+        } else if (c == '\n') {
+            *out += "\\n";
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            *out += ' ';
+        } else {
+            *out += c;
+        }
+    }
+}
+
+// 数组格式的结尾 ] 可以省略, 逗号写在事件之前, 进程被杀时文件仍然可以打开
+static void BeginEvent(std::string* out) {
+    *out += g_first_event ? "[\n" : ",\n";
+    g_first_event = false;
+}
+
+static void AppendCounters(std::string* out, uint64_t now_us) {
+    char buffer[256];
+    size_t host, mmap, dma;
+    g_debug->pointer->GetCurrentUsed(&host, &mmap, &dma);
+    BeginEvent(out);
+    snprintf(buffer, sizeof(buffer),
+             "{\"name\":\"memory\",\"ph\":\"C\",\"pid\":%d,\"ts\":%" PRIu64
+             ",\"args\":{\"host\":%zu,\"mmap\":%zu,\"dma\":%zu}}",
+             getpid(), now_us, host - mmap, mmap, dma);
+    *out += buffer;
+
+    double elapsed_s = (now_us - g_last_round_us) / 1000000.0;
+    for (size_t i = 0; i <= kMaxThreadSlots; i++) {
+        ThreadSlot* slot = &g_slots[i];
+        uint64_t bytes = slot->bytes.load(std::memory_order_relaxed);
+        if (bytes == slot->last_bytes) {
+            // counter 保持上一次的值, 停止申请后输出一次 0
+            if (slot->idle) {
+                continue;
+            }
+            slot->idle = true;
+        } else {
+            slot->idle = false;
+        }
+        double rate = g_last_round_us == 0 ? 0 : (bytes - slot->last_bytes) / elapsed_s;
+        slot->last_bytes = bytes;
+        pid_t tid = slot->tid.load(std::memory_order_relaxed);
+        if (tid != 0) {
+            slot->last_tid = tid;
+        } else {
+            tid = slot->last_tid;
+        }
+        BeginEvent(out);
+        if (i == kMaxThreadSlots) {
+            snprintf(buffer, sizeof(buffer),
+                     "{\"name\":\"alloc_rate other\",\"ph\":\"C\",\"pid\":%d,\"ts\":%" PRIu64
+                     ",\"args\":{\"bytes_per_s\":%.0f}}",
+                     getpid(), now_us, rate);
+        } else {
+            snprintf(buffer, sizeof(buffer),
+                     "{\"name\":\"alloc_rate %d\",\"ph\":\"C\",\"pid\":%d,\"ts\":%" PRIu64
+                     ",\"args\":{\"bytes_per_s\":%.0f}}",
+                     tid, getpid(), now_us, rate);
+        }
+        *out += buffer;
+    }
+    g_last_round_us = now_us;
+}
+
+static void AppendSpikes(std::string* out) {
+    std::vector<Spike> spikes;
+    {
+        std::lock_guard<std::mutex> guard(g_spike_mutex);
+        spikes.swap(g_spikes);
+    }
+
+    char buffer[256];
+    std::string stack;
+    for (auto& spike : spikes) {
+        BeginEvent(out);
+        snprintf(buffer, sizeof(buffer),
+                 "{\"name\":\"alloc %s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64
+                 ",\"args\":{\"size\":%zu,\"stack_id\":%zu",
+                 kMemTypeNames[spike.type], getpid(), spike.tid, spike.ts_us, spike.size,
+                 spike.stack_id);
+        *out += buffer;
+        // 每个堆栈只在第一次出现时输出完整内容, 之后通过 stack_id 对应
+        if (spike.frames != nullptr && g_written_stacks.insert(spike.stack_id).second) {
+            stack.clear();
+            g_debug->pointer->FormatBacktrace(*spike.frames, &stack);
+            *out += ",\"stack\":\"";
+            AppendEscaped(out, stack);
+            *out += '"';
+        }
+        *out += "}}";
+    }
+}
+
+// 已经结束时返回 false
+static bool WriteRound(bool finish) {
+    std::lock_guard<std::mutex> guard(g_write_mutex);
+    if (g_finished) {
+        return false;
+    }
+    std::string out;
+    AppendSpikes(&out);
+    AppendCounters(&out, NowUs());
+    if (finish) {
+        out += "\n]\n";
+        g_finished = true;
+    }
+    WriteAll(g_fd, out);
+    return true;
+}
+
+static void* TimelineThread(void*) {
+    ScopedDisableDebugCalls disable;
+
+    struct timespec interval = {
+            .tv_sec = static_cast<time_t>(g_interval_ms / 1000),
+            .tv_nsec = static_cast<long>(g_interval_ms % 1000) * 1000000};
+    do {
+        nanosleep(&interval, nullptr);
+    } while (WriteRound(false));
+    return nullptr;
+}
+
+bool TimelineStart(const char* path, size_t interval_ms, size_t spike_bytes) {
+    ScopedDisableDebugCalls disable;
+
+    if (pthread_key_create(&g_slot_key, ReleaseSlot) != 0) {
+        return false;
+    }
+    g_fd = open(path, O_WRONLY | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0644);
+    if (g_fd == -1) {
+        pthread_key_delete(g_slot_key);
+        return false;
+    }
+    g_interval_ms = interval_ms;
+    g_spike_bytes = spike_bytes;
+
+    std::string out;
+    BeginEvent(&out);
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer),
+             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"", getpid());
+    out += buffer;
+    std::string cmdline;
+    FILE* fp = fopen("/proc/self/cmdline", "re");
+    if (fp != nullptr) {
+        int c;
+        while ((c = fgetc(fp)) != EOF && c != '\0') {
+            cmdline += static_cast<char>(c);
+        }
+        fclose(fp);
+    }
+    AppendEscaped(&out, cmdline);
+    out += "\"}}";
+    WriteAll(g_fd, out);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, TimelineThread, nullptr);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        // 还没有开启, 不会有线程在用 fd 和 key
+        close(g_fd);
+        g_fd = -1;
+        pthread_key_delete(g_slot_key);
+        return false;
+    }
+    pthread_setname_np(thread, "alloc_hook_tl");
+    g_enabled.store(true, std::memory_order_release);
+    return true;
+}
+
+bool TimelineEnabled() {
+    return g_enabled.load(std::memory_order_acquire);
+}
+
+void TimelineRecordAlloc(size_t size, MemType type, size_t stack_id) {
+    GetThreadSlot()->bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size < g_spike_bytes) {
+        return;
+    }
+
+    Spike spike = {
+            .ts_us = NowUs(),
+            .tid = static_cast<pid_t>(android::base::GetThreadId()),
+            .size = size,
+            .type = type,
+            .stack_id = stack_id,
+            .frames = g_debug->pointer->GetBacktrace(stack_id)};
+    std::lock_guard<std::mutex> guard(g_spike_mutex);
+    g_spikes.push_back(std::move(spike));
+}
+
+void TimelineFinish() {
+    if (TimelineEnabled()) {
+        WriteRound(true);
+    }
+}
@@ -27,29 +27,129 @@
  */
 
 #include <cxxabi.h>
+#include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <unwind.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 #include "unwindstack/Error.h"
 
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <unwindstack/AndroidUnwinder.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
 #include <unwindstack/Unwinder.h>
 
 #include "UnwindBacktrace.h"
+#include "debug_disable.h"
+
+static constexpr const char kHookLib[] = "liballoc_hook.so";
+static constexpr size_t kMaxWarmupThreads = 4;
+
+static std::atomic<bool> g_warmed_up(false);
+static std::atomic<bool> g_unwinder_ready(false);
+static bool g_stack_memo_enabled = false;
+static bool g_jit_enabled = true;
+// maps 变化时递增, 各线程保存的回栈结果随之失效
+static std::atomic<uint64_t> g_stack_memo_epoch(0);
+
+static const std::vector<std::string>& GetMapsToSkip() {
+    [[clang::no_destroy]] static const std::vector<std::string> maps{kHookLib};
+    return maps;
+}
+
+static const std::vector<std::string>& GetFunctionsToExit() {
+    [[clang::no_destroy]] static const std::vector<std::string> functions{
+            "_Z24__init_additional_stacksP18pthread_internal_t",
+            "_Z25__allocate_thread_mappingmm"};
+    return functions;
+}
+
+static unwindstack::AndroidLocalUnwinder& GetUnwinder() {
+    [[clang::no_destroy]] static unwindstack::AndroidLocalUnwinder unwinder(
+            GetMapsToSkip(), {}, GetFunctionsToExit());
+    return unwinder;
+}
+
+struct PcOnlyArg {
+    std::vector<uintptr_t>* frames;
+    size_t max_frames;
+};
+
+static _Unwind_Reason_Code PcOnlyCallback(struct _Unwind_Context* context, void* arg) {
+    PcOnlyArg* pc_arg = reinterpret_cast<PcOnlyArg*>(arg);
+    uintptr_t pc = _Unwind_GetIP(context);
+    if (pc == 0) {
+        return _URC_END_OF_STACK;
+    }
+    if (pc_arg->frames->size() == pc_arg->max_frames) {
+        return _URC_NORMAL_STOP;
+    }
+    pc_arg->frames->push_back(pc);
+    return _URC_NO_REASON;
+}
+
+// 预热完成前只记录 pc, 不解析 maps 和 elf, dump 时再补全
+static unwindstack::ErrorCode UnwindPcOnly(
+        std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frame_info,
+        size_t max_frames) {
+    frames->clear();
+    frames->reserve(max_frames);
+    PcOnlyArg arg{.frames = frames, .max_frames = max_frames};
+    _Unwind_Backtrace(PcOnlyCallback, &arg);
+
+    frame_info->resize(frames->size());
+    for (size_t i = 0; i < frames->size(); i++) {
+        unwindstack::FrameData* frame = &frame_info->at(i);
+        frame->num = i;
+        frame->pc = frames->at(i);
+        frame->rel_pc = frame->pc;
+        frame->sp = 0;
+    }
+    if (frames->empty()) {
+        return unwindstack::ERROR_UNWIND_INFO;
+    }
+    return frames->size() == max_frames ? unwindstack::ERROR_MAX_FRAMES_EXCEEDED
+                                        : unwindstack::ERROR_NONE;
+}
 
 unwindstack::ErrorCode Unwind(
         std::vector<uintptr_t>* frames, std::vector<unwindstack::FrameData>* frame_info,
         size_t max_frames) {
-    [[clang::no_destroy]] static unwindstack::AndroidLocalUnwinder unwinder(
-            std::vector<std::string>{"liballoc_hook.so"}, {},
-            std::vector<std::string>{
-                    "_Z24__init_additional_stacksP18pthread_internal_t",
-                    "_Z25__allocate_thread_mappingmm"});
+    if (!g_warmed_up.load(std::memory_order_acquire)) {
+        return UnwindPcOnly(frames, frame_info, max_frames);
+    }
+
     unwindstack::AndroidUnwinderData data(max_frames);
-    if (!unwinder.Unwind(data)) {
+    if (g_stack_memo_enabled) {
+        static thread_local unwindstack::UnwindMemo memo;
+        static thread_local uint64_t memo_epoch = 0;
+        uint64_t epoch = g_stack_memo_epoch.load(std::memory_order_acquire);
+        if (memo_epoch != epoch) {
+            // maps 置空后下一次回栈会丢弃旧结果
+            memo.maps = nullptr;
+            memo_epoch = epoch;
+        }
+        data.memo = &memo;
+    }
+    if (!GetUnwinder().Unwind(data)) {
         frames->clear();
         frame_info->clear();
     } else {
@@ -61,3 +161,331 @@ unwindstack::ErrorCode Unwind(
     }
     return data.error.code;
 }
+
+void UnwindSetStackMemoEnabled(bool enabled) {
+    g_stack_memo_enabled = enabled;
+}
+
+void UnwindSetJitEnabled(bool enabled) {
+    g_jit_enabled = enabled;
+    GetUnwinder().SetJitSupport(enabled);
+}
+
+// 采样时复制的栈, 栈以外的地址从进程内存读取.
+// 读到副本末尾时只返回副本中的部分, 副本之后直到栈映射结束的部分不可读,
+// 不读取线程继续运行后已经改变的栈
+class StackSnapshotMemory : public unwindstack::Memory {
+  public:
+    explicit StackSnapshotMemory(std::shared_ptr<unwindstack::Memory> process_memory)
+        : process_memory_(std::move(process_memory)) {}
+
+    void Reset(uint64_t start, const uint8_t* data, size_t size, uint64_t stack_end) {
+        start_ = start;
+        data_ = data;
+        size_ = size;
+        stack_end_ = std::max(stack_end, start + size);
+    }
+
+    size_t Read(uint64_t addr, void* dst, size_t size) override {
+        if (addr >= start_ && addr - start_ < size_) {
+            size_t offset = addr - start_;
+            size_t len = std::min(size, size_ - offset);
+            memcpy(dst, data_ + offset, len);
+            return len;
+        }
+        if (addr >= start_ && addr < stack_end_) {
+            return 0;
+        }
+        return process_memory_->Read(addr, dst, size);
+    }
+
+  private:
+    std::shared_ptr<unwindstack::Memory> process_memory_;
+    uint64_t start_ = 0;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    uint64_t stack_end_ = 0;
+};
+
+// 只复制 sp 往上的这么多栈, 更外层的栈帧丢弃
+static constexpr size_t kMaxStackSnapshot = 64 * 1024;
+static constexpr size_t kSnapshotPageSize = 4096;
+// 等待信号处理函数复制完成的时间
+static constexpr int kSnapshotTimeoutMs = 100;
+// g_snapshot_request 除了线程号以外的状态
+static constexpr pid_t kSnapshotIdle = 0;
+static constexpr pid_t kSnapshotCopying = -1;
+static constexpr pid_t kSnapshotDone = -2;
+
+// 信号处理函数复制的寄存器和栈. 预先分配, 处理函数中不申请内存也不加锁
+struct ThreadSnapshot {
+    ucontext_t ucontext;
+    uint64_t stack_start;
+    size_t stack_size;
+    alignas(16) uint8_t stack[kMaxStackSnapshot];
+};
+static ThreadSnapshot g_snapshot;
+// 请求复制的线程号, 被请求的线程在处理函数中改为 kSnapshotCopying, 复制完成后改为 kSnapshotDone
+static std::atomic<pid_t> g_snapshot_request(kSnapshotIdle);
+
+static uint64_t GetUcontextSp(const ucontext_t* ucontext) {
+#if defined(__aarch64__)
+    return ucontext->uc_mcontext.sp;
+#elif defined(__arm__)
+    return ucontext->uc_mcontext.arm_sp;
+#elif defined(__x86_64__)
+    return ucontext->uc_mcontext.gregs[REG_RSP];
+#elif defined(__i386__)
+    return ucontext->uc_mcontext.gregs[REG_ESP];
+#else
+    return 0;
+#endif
+}
+
+// 每个 iovec 不跨页, process_vm_readv 读到没有映射的页时停止, 返回之前读到的字节数
+static size_t CopyStack(uint64_t sp, uint8_t* dst, size_t size) {
+    struct iovec local = {.iov_base = dst, .iov_len = size};
+    struct iovec remote[kMaxStackSnapshot / kSnapshotPageSize + 1];
+    size_t count = 0;
+    uint64_t addr = sp;
+    while (size > 0 && count < sizeof(remote) / sizeof(remote[0])) {
+        size_t len = std::min(size, kSnapshotPageSize - addr % kSnapshotPageSize);
+        remote[count].iov_base = reinterpret_cast<void*>(addr);
+        remote[count].iov_len = len;
+        count++;
+        addr += len;
+        size -= len;
+    }
+    ssize_t bytes = process_vm_readv(getpid(), &local, 1, remote, count, 0);
+    return bytes < 0 ? 0 : static_cast<size_t>(bytes);
+}
+
+static void SnapshotHandler(int, siginfo_t*, void* context) {
+    // 不是请求的线程, 或者请求已经超时取消
+    pid_t tid = gettid();
+    if (!g_snapshot_request.compare_exchange_strong(
+                tid, kSnapshotCopying, std::memory_order_acquire)) {
+        return;
+    }
+    int saved_errno = errno;
+    const auto* ucontext = static_cast<const ucontext_t*>(context);
+    memcpy(&g_snapshot.ucontext, ucontext, sizeof(ucontext_t));
+    g_snapshot.stack_start = GetUcontextSp(ucontext);
+    g_snapshot.stack_size = CopyStack(g_snapshot.stack_start, g_snapshot.stack, kMaxStackSnapshot);
+    errno = saved_errno;
+    g_snapshot_request.store(kSnapshotDone, std::memory_order_release);
+}
+
+bool UnwindThreadInit(int signal) {
+    struct sigaction action = {};
+    action.sa_sigaction = SnapshotHandler;
+    action.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    return sigaction(signal, &action, nullptr) == 0;
+}
+
+// 等待 tid 在信号处理函数中复制寄存器和栈, 返回时 tid 已经继续运行
+static unwindstack::ErrorCode CaptureThread(pid_t tid, int signal) {
+    g_snapshot_request.store(tid, std::memory_order_release);
+    if (syscall(SYS_tgkill, getpid(), tid, signal) != 0) {
+        g_snapshot_request.store(kSnapshotIdle, std::memory_order_relaxed);
+        return errno == ESRCH ? unwindstack::ERROR_THREAD_DOES_NOT_EXIST
+                              : unwindstack::ERROR_SYSTEM_CALL;
+    }
+
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 100000};
+    int max_waits = kSnapshotTimeoutMs * 10;
+    for (int i = 0; i < max_waits; i++) {
+        if (g_snapshot_request.load(std::memory_order_acquire) == kSnapshotDone) {
+            g_snapshot_request.store(kSnapshotIdle, std::memory_order_relaxed);
+            return unwindstack::ERROR_NONE;
+        }
+        nanosleep(&wait, nullptr);
+    }
+    // 超时后取消请求. 处理函数已经开始复制时不会再等待其他东西, 等它完成
+    pid_t expected = tid;
+    if (g_snapshot_request.compare_exchange_strong(
+                expected, kSnapshotIdle, std::memory_order_acquire)) {
+        return unwindstack::ERROR_THREAD_TIMEOUT;
+    }
+    while (g_snapshot_request.load(std::memory_order_acquire) != kSnapshotDone) {
+        nanosleep(&wait, nullptr);
+    }
+    g_snapshot_request.store(kSnapshotIdle, std::memory_order_relaxed);
+    return unwindstack::ERROR_NONE;
+}
+
+unwindstack::ErrorCode UnwindThread(
+        pid_t tid, int signal, std::vector<uintptr_t>* frames,
+        std::vector<unwindstack::FrameData>* frame_info, size_t max_frames) {
+    frames->clear();
+    frame_info->clear();
+    if (!g_unwinder_ready.load(std::memory_order_acquire)) {
+        return unwindstack::ERROR_UNSUPPORTED;
+    }
+
+    // 快照只有一份
+    static std::mutex snapshot_mutex;
+    std::lock_guard<std::mutex> guard(snapshot_mutex);
+    unwindstack::ErrorCode code = CaptureThread(tid, signal);
+    if (code != unwindstack::ERROR_NONE) {
+        return code;
+    }
+
+    // 被采样的线程已经继续运行, 查找 maps/elf 时即使需要它持有的锁也不会死锁
+    unwindstack::AndroidLocalUnwinder& local_unwinder = GetUnwinder();
+    [[clang::no_destroy]] static auto memory =
+            std::make_shared<StackSnapshotMemory>(local_unwinder.GetProcessMemory());
+    // 副本之外的栈已经改变, 查出 sp 所在的栈映射, 其余部分不再读取.
+    // 找不到映射时只能确定副本本身
+    uint64_t stack_end = g_snapshot.stack_start + g_snapshot.stack_size;
+    auto stack_map = local_unwinder.GetMaps()->Find(g_snapshot.stack_start);
+    if (stack_map != nullptr) {
+        stack_end = stack_map->end();
+    }
+    memory->Reset(g_snapshot.stack_start, g_snapshot.stack, g_snapshot.stack_size, stack_end);
+    std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::CreateFromUcontext(
+            unwindstack::Regs::CurrentArch(), &g_snapshot.ucontext));
+    unwindstack::Unwinder unwinder(max_frames, local_unwinder.GetMaps(), regs.get(), memory);
+    if (g_jit_enabled) {
+        unwinder.SetJitDebug(local_unwinder.jit_debug());
+        unwinder.SetDexFiles(local_unwinder.dex_files());
+    }
+    // 在 hook 中被采样时去掉 hook 库的栈帧, 与申请的堆栈保持一致
+    unwinder.Unwind(&GetMapsToSkip(), nullptr, &GetFunctionsToExit());
+    *frame_info = unwinder.ConsumeFrames();
+    frames->reserve(frame_info->size());
+    for (const auto& frame : *frame_info) {
+        frames->push_back(frame.pc);
+    }
+    return unwinder.LastErrorCode();
+}
+
+static void WarmupMaps(
+        const std::vector<std::shared_ptr<unwindstack::MapInfo>>& maps,
+        std::atomic<size_t>* next) {
+    ScopedDisableDebugCalls disable;
+
+    unwindstack::AndroidLocalUnwinder& unwinder = GetUnwinder();
+    unwindstack::ArchEnum arch = unwindstack::Regs::CurrentArch();
+    for (size_t i = next->fetch_add(1); i < maps.size(); i = next->fetch_add(1)) {
+        const std::shared_ptr<unwindstack::MapInfo>& map_info = maps[i];
+        // 只处理有名字的可执行映射
+        if (!(map_info->flags() & PROT_EXEC) || map_info->name().empty() ||
+            map_info->flags() & unwindstack::MAPS_FLAGS_DEVICE_MAP) {
+            continue;
+        }
+        unwindstack::Elf* elf = map_info->GetElf(unwinder.GetProcessMemory(), arch);
+        if (elf == nullptr || !elf->valid()) {
+            continue;
+        }
+        // 查一次符号, 提前读取并建立符号表索引
+        unwindstack::SharedString name;
+        uint64_t func_offset;
+        elf->GetFunctionName(elf->GetRelPc(map_info->start(), map_info.get()), &name, &func_offset);
+    }
+}
+
+static void* WarmupThread(void*) {
+    ScopedDisableDebugCalls disable;
+
+    unwindstack::ErrorData error;
+    unwindstack::AndroidLocalUnwinder& unwinder = GetUnwinder();
+    if (unwinder.Initialize(error)) {
+        g_unwinder_ready.store(true, std::memory_order_release);
+        std::vector<std::shared_ptr<unwindstack::MapInfo>> maps = unwinder.GetMaps()->Snapshot();
+        std::atomic<size_t> next(0);
+        size_t num_threads = std::min<size_t>(
+                kMaxWarmupThreads, std::max<long>(1, sysconf(_SC_NPROCESSORS_ONLN)));
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < num_threads; i++) {
+            threads.emplace_back(WarmupMaps, std::cref(maps), &next);
+        }
+        WarmupMaps(maps, &next);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    // 即使初始化失败也切回完整回栈, 由 Unwind 返回错误
+    g_warmed_up.store(true, std::memory_order_release);
+    return nullptr;
+}
+
+bool UnwindWarmupStart() {
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, WarmupThread, nullptr);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        // 没有预热线程时直接使用完整回栈
+        g_warmed_up.store(true, std::memory_order_release);
+        return false;
+    }
+    pthread_setname_np(thread, "alloc_hook_warm");
+    return true;
+}
+
+static bool IsPcOnly(const unwindstack::FrameData& frame) {
+    return frame.map_info == nullptr && frame.sp == 0 && frame.rel_pc == frame.pc;
+}
+
+bool UnwindHasPcOnlyFrames(const std::vector<unwindstack::FrameData>& frame_info) {
+    return std::any_of(frame_info.begin(), frame_info.end(), IsPcOnly);
+}
+
+bool UnwindResolveFrames(const std::vector<std::vector<unwindstack::FrameData>*>& frame_infos) {
+    if (!g_unwinder_ready.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    // 所有记录的栈帧一起解析, 每个 elf 只做一次批量符号查找.
+    // 相同的栈共享同一个 vector, 只能处理一次
+    std::vector<std::vector<unwindstack::FrameData>*> unique_infos(frame_infos);
+    std::sort(unique_infos.begin(), unique_infos.end());
+    unique_infos.erase(std::unique(unique_infos.begin(), unique_infos.end()), unique_infos.end());
+
+    std::vector<std::vector<unwindstack::FrameData>*> pc_only_infos;
+    std::vector<unwindstack::FrameData*> frames;
+    for (auto* frame_info : unique_infos) {
+        bool pc_only = false;
+        for (auto& frame : *frame_info) {
+            if (IsPcOnly(frame)) {
+                frames.push_back(&frame);
+                pc_only = true;
+            }
+        }
+        if (pc_only) {
+            pc_only_infos.push_back(frame_info);
+        }
+    }
+    if (frames.empty()) {
+        return true;
+    }
+    GetUnwinder().BuildFramesFromPcOnly(frames);
+
+    for (auto* frame_info : pc_only_infos) {
+        // 去掉 hook 库自身的栈帧, 与完整回栈的结果保持一致
+        auto first = std::find_if(frame_info->begin(), frame_info->end(), [](const auto& frame) {
+            return frame.map_info == nullptr ||
+                   !android::base::EndsWith(frame.map_info->name(), kHookLib);
+        });
+        frame_info->erase(frame_info->begin(), first);
+        for (size_t i = 0; i < frame_info->size(); i++) {
+            frame_info->at(i).num = i;
+        }
+    }
+    return true;
+}
+
+void UnwindModulesChanged() {
+    // 未初始化时 maps 为空, 初始化时会完整解析
+    if (!g_unwinder_ready.load(std::memory_order_acquire)) {
+        return;
+    }
+    auto* maps = static_cast<unwindstack::LocalUpdatableMaps*>(GetUnwinder().GetMaps());
+    if (maps->SyncModules()) {
+        g_stack_memo_epoch.fetch_add(1, std::memory_order_release);
+    }
+}
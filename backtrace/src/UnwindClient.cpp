@@ -0,0 +1,264 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsGetLocal.h>
+#if defined(__arm__)
+#include <unwindstack/MachineArm.h>
+#elif defined(__aarch64__)
+#include <unwindstack/MachineArm64.h>
+#elif defined(__i386__)
+#include <unwindstack/MachineX86.h>
+#elif defined(__x86_64__)
+#include <unwindstack/MachineX86_64.h>
+#endif
+
+#include "UnwindClient.h"
+#include "UnwindDaemon.h"
+#include "debug_disable.h"
+
+// 环形缓冲区满时最多等待 unwindd 这么久, 超时后丢弃记录
+static constexpr auto kMaxRingWait = std::chrono::milliseconds(10);
+
+// 与 Regs::CreateFromLocal 的寄存器布局一致, 申请路径上直接用栈上的数组, 不创建 Regs
+#if defined(__arm__)
+using LocalReg = uint32_t;
+static constexpr size_t kNumLocalRegs = unwindstack::ARM_REG_LAST;
+static constexpr size_t kLocalRegSp = unwindstack::ARM_REG_SP;
+#elif defined(__aarch64__)
+using LocalReg = uint64_t;
+static constexpr size_t kNumLocalRegs = unwindstack::ARM64_REG_LAST;
+static constexpr size_t kLocalRegSp = unwindstack::ARM64_REG_SP;
+#elif defined(__i386__)
+using LocalReg = uint32_t;
+static constexpr size_t kNumLocalRegs = unwindstack::X86_REG_LAST;
+static constexpr size_t kLocalRegSp = unwindstack::X86_REG_SP;
+#elif defined(__x86_64__)
+using LocalReg = uint64_t;
+static constexpr size_t kNumLocalRegs = unwindstack::X86_64_REG_LAST;
+static constexpr size_t kLocalRegSp = unwindstack::X86_64_REG_SP;
+#endif
+
+enum ClientState { kDisconnected, kConnected, kForked };
+
+static std::atomic<int> g_state(kDisconnected);
+static StackRing* g_ring = nullptr;
+static int g_sock = -1;
+static size_t g_stack_bytes = 0;
+// 上一次等待超时后不再等待, 直到重新写入成功, 避免 unwindd 退出后每次申请都卡住
+static std::atomic<bool> g_ring_stalled(false);
+static std::mutex g_request_mutex;
+
+static void ForkChild() {
+    // 子进程与父进程共享同一个环形缓冲区, 地址空间却不同, 子进程不再记录
+    g_state.store(kForked, std::memory_order_relaxed);
+}
+
+bool UnwindClientConnect(const char* name, size_t max_frames, size_t stack_bytes) {
+    ScopedDisableDebugCalls disable;
+
+    int sock = UnwindDaemonConnect(name);
+    if (sock < 0) {
+        return false;
+    }
+
+    auto* ring = new StackRing();
+    int maps_fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    int mem_fd = open("/proc/self/mem", O_RDONLY | O_CLOEXEC);
+    bool connected = false;
+    if (maps_fd >= 0 && mem_fd >= 0 && ring->Create(kStackRingCapacity)) {
+        UnwindDaemonMessage hello = {
+                .magic = kUnwindDaemonMagic,
+                .request = kRequestHello,
+                .status = 0,
+                .arch = static_cast<uint32_t>(unwindstack::Regs::CurrentArch()),
+                .max_frames = static_cast<uint32_t>(max_frames),
+                .pid = getpid()};
+        int fds[] = {ring->fd(), maps_fd, mem_fd};
+        UnwindDaemonMessage reply;
+        connected = UnwindDaemonSend(sock, hello, fds, 3) &&
+                    UnwindDaemonRecv(sock, &reply, nullptr, 0) == 0 && reply.status == 0;
+    }
+    if (maps_fd >= 0) {
+        close(maps_fd);
+    }
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+    if (!connected) {
+        delete ring;
+        close(sock);
+        return false;
+    }
+
+    g_ring = ring;
+    g_sock = sock;
+    // 单条记录不能超过缓冲区的一半
+    g_stack_bytes = std::min(stack_bytes, kStackRingCapacity / 8);
+    pthread_atfork(nullptr, nullptr, ForkChild);
+    g_state.store(kConnected, std::memory_order_release);
+    return true;
+}
+
+bool UnwindClientConnected() {
+    return g_state.load(std::memory_order_acquire) != kDisconnected;
+}
+
+static bool Writable() {
+    return g_state.load(std::memory_order_acquire) == kConnected;
+}
+
+static void* ReserveRecord(size_t size) {
+    void* payload = g_ring->Reserve(size);
+    if (payload == nullptr && !g_ring_stalled.load(std::memory_order_relaxed)) {
+        auto deadline = std::chrono::steady_clock::now() + kMaxRingWait;
+        while (payload == nullptr && std::chrono::steady_clock::now() < deadline) {
+            sched_yield();
+            payload = g_ring->Reserve(size);
+        }
+        if (payload == nullptr) {
+            g_ring_stalled.store(true, std::memory_order_relaxed);
+        }
+    }
+    if (payload == nullptr) {
+        g_ring->AddDropped();
+    } else if (g_ring_stalled.load(std::memory_order_relaxed)) {
+        g_ring_stalled.store(false, std::memory_order_relaxed);
+    }
+    return payload;
+}
+
+static uintptr_t GetStackLimit(uintptr_t sp) {
+    static thread_local uintptr_t stack_start = 0;
+    static thread_local uintptr_t stack_end = 0;
+    if (sp >= stack_start && sp < stack_end) {
+        return stack_end;
+    }
+
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        void* addr;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+            stack_start = reinterpret_cast<uintptr_t>(addr);
+            stack_end = stack_start + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+    if (sp >= stack_start && sp < stack_end) {
+        return stack_end;
+    }
+    // 信号栈等不在线程栈内, 只拷贝到当前页的末尾
+    uintptr_t page_size = getpagesize();
+    return (sp & ~(page_size - 1)) + page_size;
+}
+
+void UnwindClientAlloc(const void* ptr, size_t size, MemType type) {
+    if (!Writable()) {
+        return;
+    }
+
+    // 寄存器必须在本函数内获取, 拷贝的栈才包含调用者的栈帧
+    LocalReg regs[kNumLocalRegs];
+    unwindstack::AsmGetRegs(regs);
+    uintptr_t sp = regs[kLocalRegSp];
+    uintptr_t stack_limit = GetStackLimit(sp);
+    size_t stack_size = std::min<uintptr_t>(g_stack_bytes, stack_limit - sp);
+    size_t regs_size = sizeof(regs);
+
+    auto* record =
+            static_cast<RingAlloc*>(ReserveRecord(sizeof(RingAlloc) + regs_size + stack_size));
+    if (record == nullptr) {
+        return;
+    }
+    // 粗粒度时钟只读 vdso 中的数据, dump 时由 unwindd 换算成墙上时间
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    record->pointer = reinterpret_cast<uintptr_t>(ptr);
+    record->size = size;
+    record->mem_type = type;
+    record->regs_size = regs_size;
+    record->tv_sec = ts.tv_sec;
+    record->tv_nsec = ts.tv_nsec;
+    record->stack_start = sp;
+    record->stack_size = stack_size;
+    record->stack_limit = stack_limit;
+    uint8_t* data = reinterpret_cast<uint8_t*>(record + 1);
+    memcpy(data, regs, regs_size);
+    memcpy(data + regs_size, reinterpret_cast<const void*>(sp), stack_size);
+    g_ring->Commit(record, kRecordAlloc);
+}
+
+void UnwindClientFree(const void* ptr) {
+    if (!Writable()) {
+        return;
+    }
+    auto* record = static_cast<RingFree*>(ReserveRecord(sizeof(RingFree)));
+    if (record != nullptr) {
+        record->pointer = reinterpret_cast<uintptr_t>(ptr);
+        g_ring->Commit(record, kRecordFree);
+    }
+}
+
+void UnwindClientResize(const void* ptr, size_t new_size) {
+    if (!Writable()) {
+        return;
+    }
+    auto* record = static_cast<RingResize*>(ReserveRecord(sizeof(RingResize)));
+    if (record != nullptr) {
+        record->pointer = reinterpret_cast<uintptr_t>(ptr);
+        record->size = new_size;
+        g_ring->Commit(record, kRecordResize);
+    }
+}
+
+void UnwindClientSplit(const void* ptr, const void* new_ptr, size_t new_size) {
+    if (!Writable()) {
+        return;
+    }
+    auto* record = static_cast<RingSplit*>(ReserveRecord(sizeof(RingSplit)));
+    if (record != nullptr) {
+        record->pointer = reinterpret_cast<uintptr_t>(ptr);
+        record->new_pointer = reinterpret_cast<uintptr_t>(new_ptr);
+        record->new_size = new_size;
+        g_ring->Commit(record, kRecordSplit);
+    }
+}
+
+void UnwindClientModulesChanged() {
+    if (!Writable()) {
+        return;
+    }
+    // 与申请记录按顺序处理, 之后的回栈都使用新的 maps
+    void* record = ReserveRecord(0);
+    if (record != nullptr) {
+        g_ring->Commit(record, kRecordModulesChanged);
+    }
+}
+
+bool UnwindClientDump(int fd) {
+    if (!Writable()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> guard(g_request_mutex);
+    UnwindDaemonMessage request = {};
+    request.magic = kUnwindDaemonMagic;
+    request.request = kRequestDump;
+    UnwindDaemonMessage reply;
+    if (!UnwindDaemonSend(g_sock, request, &fd, 1) ||
+        UnwindDaemonRecv(g_sock, &reply, nullptr, 0) != 0) {
+        return false;
+    }
+    return reply.status == 0;
+}
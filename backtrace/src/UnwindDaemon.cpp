@@ -0,0 +1,287 @@
+#include <sched.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <linux/memfd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "UnwindDaemon.h"
+
+static constexpr uint32_t kRingMagic = 0x72696e67;  // "ring"
+static constexpr size_t kRingHeaderSize = 4096;
+static constexpr size_t kMaxFds = 4;
+
+struct StackRing::Header {
+    uint32_t magic;
+    uint32_t pad;
+    uint64_t capacity;
+    std::atomic<uint32_t> lock;
+    // 写端和读端各自修改的位置放在不同的 cache line
+    alignas(64) std::atomic<uint64_t> write_pos;
+    alignas(64) std::atomic<uint64_t> read_pos;
+    std::atomic<uint64_t> dropped;
+};
+
+static inline size_t AlignRecord(size_t size) {
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+StackRing::~StackRing() {
+    if (header_ != nullptr) {
+        munmap(header_, map_size_);
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+bool StackRing::Map(int fd, size_t total_size, int flags) {
+    static_assert(sizeof(Header) <= kRingHeaderSize, "ring header too large");
+    void* addr = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED | flags, fd, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    fd_ = fd;
+    map_size_ = total_size;
+    header_ = reinterpret_cast<Header*>(addr);
+    data_ = reinterpret_cast<uint8_t*>(addr) + kRingHeaderSize;
+    return true;
+}
+
+bool StackRing::Create(size_t capacity) {
+    // 容量必须是 2 的幂, 位置对容量取模即可得到偏移
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return false;
+    }
+    int fd = static_cast<int>(syscall(__NR_memfd_create, "alloc_hook_ring", MFD_CLOEXEC));
+    if (fd < 0) {
+        return false;
+    }
+    size_t total_size = kRingHeaderSize + capacity;
+    // 预先分配所有页, 避免第一轮写入时在申请路径上触发缺页
+    if (ftruncate(fd, total_size) != 0 || !Map(fd, total_size, MAP_POPULATE)) {
+        close(fd);
+        return false;
+    }
+    capacity_ = capacity;
+    header_->capacity = capacity;
+    header_->magic = kRingMagic;
+    return true;
+}
+
+bool StackRing::Attach(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) <= kRingHeaderSize) {
+        return false;
+    }
+    size_t total_size = st.st_size;
+    if (!Map(fd, total_size, 0)) {
+        return false;
+    }
+    size_t capacity = header_->capacity;
+    if (header_->magic != kRingMagic || capacity != total_size - kRingHeaderSize ||
+        (capacity & (capacity - 1)) != 0) {
+        munmap(header_, map_size_);
+        header_ = nullptr;
+        fd_ = -1;
+        return false;
+    }
+    capacity_ = capacity;
+    return true;
+}
+
+void* StackRing::Reserve(size_t payload_size) {
+    size_t size = AlignRecord(sizeof(RingRecordHeader) + payload_size);
+    if (size > capacity_ / 2) {
+        return nullptr;
+    }
+
+    for (uint32_t spin = 0; header_->lock.exchange(1, std::memory_order_acquire) != 0; spin++) {
+        if (spin >= 64) {
+            sched_yield();
+        }
+    }
+
+    uint64_t write = header_->write_pos.load(std::memory_order_relaxed);
+    uint64_t read = header_->read_pos.load(std::memory_order_acquire);
+    size_t offset = write & (capacity_ - 1);
+    size_t tail = capacity_ - offset;
+    size_t needed = tail < size ? tail + size : size;
+    if (write + needed - read > capacity_) {
+        header_->lock.store(0, std::memory_order_release);
+        return nullptr;
+    }
+
+    if (tail < size) {
+        // 记录都是 8 字节对齐, 末尾至少放得下一个头部
+        auto* padding = reinterpret_cast<RingRecordHeader*>(data_ + offset);
+        padding->size.store(tail, std::memory_order_relaxed);
+        padding->type.store(kRecordPadding, std::memory_order_relaxed);
+        write += tail;
+        offset = 0;
+    }
+    auto* record = reinterpret_cast<RingRecordHeader*>(data_ + offset);
+    record->size.store(size, std::memory_order_relaxed);
+    record->type.store(kRecordEmpty, std::memory_order_relaxed);
+    header_->write_pos.store(write + size, std::memory_order_release);
+
+    header_->lock.store(0, std::memory_order_release);
+    return record + 1;
+}
+
+void StackRing::Commit(void* payload, RingRecordType type) {
+    auto* record = reinterpret_cast<RingRecordHeader*>(payload) - 1;
+    record->type.store(type, std::memory_order_release);
+}
+
+const RingRecordHeader* StackRing::Peek(uint64_t limit, size_t* size) {
+    while (!corrupted_) {
+        uint64_t read = header_->read_pos.load(std::memory_order_relaxed);
+        uint64_t write = header_->write_pos.load(std::memory_order_acquire);
+        if (read >= write || read >= limit) {
+            return nullptr;
+        }
+        size_t offset = read & (capacity_ - 1);
+        auto* record = reinterpret_cast<const RingRecordHeader*>(data_ + offset);
+        uint32_t type = record->type.load(std::memory_order_acquire);
+        if (type == kRecordEmpty) {
+            return nullptr;
+        }
+        // 记录不会跨过缓冲区末尾, 也不会超过已预留的范围
+        size_t record_size = record->size.load(std::memory_order_relaxed);
+        if (record_size < sizeof(RingRecordHeader) || record_size != AlignRecord(record_size) ||
+            record_size > capacity_ - offset || record_size > write - read) {
+            corrupted_ = true;
+            return nullptr;
+        }
+        if (type != kRecordPadding) {
+            *size = record_size;
+            return record;
+        }
+        Pop(record_size);
+    }
+    return nullptr;
+}
+
+void StackRing::Pop(size_t size) {
+    uint64_t read = header_->read_pos.load(std::memory_order_relaxed);
+    header_->read_pos.store(read + size, std::memory_order_release);
+}
+
+uint64_t StackRing::write_pos() const {
+    return header_->write_pos.load(std::memory_order_acquire);
+}
+
+uint64_t StackRing::read_pos() const {
+    return header_->read_pos.load(std::memory_order_acquire);
+}
+
+void StackRing::AddDropped() {
+    header_->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t StackRing::dropped() const {
+    return header_->dropped.load(std::memory_order_relaxed);
+}
+
+static socklen_t MakeAddress(const char* name, sockaddr_un* addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    // sun_path[0] 为 0 表示抽象命名空间, 不需要可写的目录
+    size_t len = std::min(strlen(name), sizeof(addr->sun_path) - 1);
+    memcpy(addr->sun_path + 1, name, len);
+    return offsetof(sockaddr_un, sun_path) + 1 + len;
+}
+
+int UnwindDaemonListen(const char* name) {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    sockaddr_un addr;
+    socklen_t addr_len = MakeAddress(name, &addr);
+    if (bind(sock, reinterpret_cast<sockaddr*>(&addr), addr_len) != 0 || listen(sock, 8) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+int UnwindDaemonConnect(const char* name) {
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return -1;
+    }
+    sockaddr_un addr;
+    socklen_t addr_len = MakeAddress(name, &addr);
+    if (TEMP_FAILURE_RETRY(connect(sock, reinterpret_cast<sockaddr*>(&addr), addr_len)) != 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+bool UnwindDaemonSend(int sock, const UnwindDaemonMessage& message, const int* fds, size_t num_fds) {
+    if (num_fds > kMaxFds) {
+        return false;
+    }
+    iovec iov = {const_cast<UnwindDaemonMessage*>(&message), sizeof(message)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFds)] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (num_fds > 0) {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * num_fds);
+    }
+    return TEMP_FAILURE_RETRY(sendmsg(sock, &msg, MSG_NOSIGNAL)) ==
+           static_cast<ssize_t>(sizeof(message));
+}
+
+int UnwindDaemonRecv(int sock, UnwindDaemonMessage* message, int* fds, size_t max_fds) {
+    iovec iov = {message, sizeof(*message)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * kMaxFds)] = {};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    ssize_t len = TEMP_FAILURE_RETRY(recvmsg(sock, &msg, MSG_CMSG_CLOEXEC));
+
+    int received[kMaxFds];
+    size_t num_received = 0;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+            continue;
+        }
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count && num_received < kMaxFds; i++) {
+            memcpy(&received[num_received++], CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        }
+    }
+
+    bool valid = len == static_cast<ssize_t>(sizeof(*message)) &&
+                 message->magic == kUnwindDaemonMagic && num_received <= max_fds;
+    if (!valid) {
+        for (size_t i = 0; i < num_received; i++) {
+            close(received[i]);
+        }
+        return -1;
+    }
+    if (num_received > 0) {
+        memcpy(fds, received, sizeof(int) * num_received);
+    }
+    return static_cast<int>(num_received);
+}
@@ -2,24 +2,22 @@
 #include <sys/mman.h>
 #include <sys/param.h>  // powerof2 ---> ((((x) - 1) & (x)) == 0)
 #include <unistd.h>
-#include <sys/stat.h>
-#include <linux/dma-heap.h>
 
 #include <cstring>
 #include <string>
-#include <unordered_set>
 #include <android-base/stringprintf.h>
 
 #include "Config.h"
 #include "DebugData.h"
+#include "IoctlDecoder.h"
 #include "PointerData.h"
+#include "StackSampler.h"
+#include "Timeline.h"
+#include "UnwindBacktrace.h"
+#include "UnwindClient.h"
 #include "debug_disable.h"
 #include "malloc_debug.h"
 
-#include "midgard/mali_kbase_ioctl.h"
-#include "msm_ksgl/msm_ksgl.h"
-#include "mtk_camera/camera_mem.h"
-
 #include "memory_hook.h"
 
 class ScopedConcurrentLock {
@@ -62,7 +60,7 @@ bool debug_initialize(void* init_space[]) {
     }
 
     DebugData* debug = new (init_space[0]) DebugData();
-    if (!debug->Initialize(init_space[1])) {
+    if (!debug->Initialize(init_space[1], init_space[2], init_space[3], init_space[4])) {
         DebugDisableFinalize();
         return false;
     }
@@ -70,6 +68,51 @@ bool debug_initialize(void* init_space[]) {
 
     ScopedConcurrentLock::Init();
 
+    if (!IoctlDecoderInitialize()) {
+        return false;
+    }
+
+    if (g_debug->config().unwind_cache_dir() != nullptr) {
+        unwindstack::Elf::SetPersistentCacheDir(g_debug->config().unwind_cache_dir());
+    }
+    if (g_debug->config().options() & COMPACT_UNWIND) {
+        unwindstack::Elf::SetCompactUnwindEnabled(true);
+    }
+    if (g_debug->config().options() & STACK_MEMO) {
+        UnwindSetStackMemoEnabled(true);
+    }
+    if (g_debug->config().options() & NATIVE_ONLY_UNWIND) {
+        UnwindSetJitEnabled(false);
+    }
+
+    // 连接 unwindd 成功后本进程不再回栈, 连接失败时退回本地回栈
+    bool remote_unwind = false;
+    if ((g_debug->config().options() & BACKTRACE) &&
+        (g_debug->config().options() & UNWIND_DAEMON)) {
+        remote_unwind = UnwindClientConnect(
+                g_debug->config().unwind_daemon_name(), g_debug->config().backtrace_frames(),
+                g_debug->config().unwind_daemon_stack_bytes());
+    }
+
+    // 后台预热回栈需要的 maps/elf/符号表, 避免第一次抓栈时卡顿
+    if ((g_debug->config().options() & BACKTRACE) && !remote_unwind) {
+        UnwindWarmupStart();
+    }
+
+    // 采样在本进程内回栈, 交给 unwindd 时不开启
+    if ((g_debug->config().options() & BACKTRACE) &&
+        (g_debug->config().options() & SAMPLE_STACKS) && !remote_unwind) {
+        StackSamplerStart(
+                g_debug->config().sample_interval_ms(), g_debug->config().sample_signal());
+    }
+
+    // 申请记录在 unwindd 中, 交给 unwindd 时不开启
+    if ((g_debug->config().options() & TIMELINE) && g_debug->TrackPointers() && !remote_unwind) {
+        TimelineStart(
+                g_debug->config().timeline_file(), g_debug->config().timeline_interval_ms(),
+                g_debug->config().timeline_spike_bytes());
+    }
+
     if (g_debug->config().options() & DUMP_ON_SIGNAL) {
         struct sigaction enable_act = {};
         enable_act.sa_handler = singal_dump_heap;
@@ -104,10 +147,12 @@ void debug_finalize() {
                                 .c_str());
     }
 
-    if (g_debug->TrackPointers()) {
+    if (g_debug->TrackPointers() && !UnwindClientConnected()) {
         g_debug->pointer->DumpPeakInfo();
     }
 
+    TimelineFinish();
+
     // 对于调试工具或在调试模式下运行的代码, 资源管理可能不是首要关注点.
     // 为了避免在清理过程中出现多线程访问冲突, 决定故意不释放这些资源. 包括
     // g_debug、pthread 键等.
@@ -122,7 +167,50 @@ void debug_dump_heap(const char* file_name) {
         return;
     }
 
-    g_debug->pointer->DumpLiveToFile(fd);
+    // 峰值列表会被 DumpLiveToFile 取走, 先输出 pprof
+    if ((g_debug->config().options() & DUMP_PPROF) && !UnwindClientConnected()) {
+        std::string pprof_name = std::string(file_name) + ".pb.gz";
+        int pprof_fd = open(
+                pprof_name.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0644);
+        if (pprof_fd != -1) {
+            g_debug->pointer->DumpPprofToFile(pprof_fd);
+            close(pprof_fd);
+        }
+    }
+
+    if ((g_debug->config().options() & FLAMEGRAPH) && !UnwindClientConnected()) {
+        std::string folded_name = std::string(file_name) + ".folded";
+        int folded_fd = open(
+                folded_name.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0644);
+        int diff_fd = -1;
+        // 第一次 dump 没有对比的基准, 不创建空的差异文件
+        if (folded_fd != -1 && g_debug->config().flamegraph_diff() &&
+            g_debug->pointer->HasFoldedBaseline()) {
+            std::string diff_name = std::string(file_name) + ".diff.folded";
+            diff_fd = open(
+                    diff_name.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW | O_TRUNC | O_CLOEXEC, 0644);
+        }
+        if (folded_fd != -1) {
+            g_debug->pointer->DumpFoldedToFile(folded_fd, diff_fd);
+            close(folded_fd);
+        }
+        if (diff_fd != -1) {
+            close(diff_fd);
+        }
+    }
+
+    if (UnwindClientConnected()) {
+        // 记录都在 unwindd 中, 由它写入同一个文件
+        UnwindClientDump(fd);
+    } else if (g_debug->config().options() & DUMP_RESIDENT) {
+        // 在 PointerData 加锁之前统计, mincore 不阻塞其他线程的申请和释放
+        std::unordered_map<uintptr_t, size_t> resident;
+        g_debug->mmap->GetResident(&resident);
+        g_debug->dmabuf->GetResident(&resident);
+        g_debug->pointer->DumpLiveToFile(fd, &resident);
+    } else {
+        g_debug->pointer->DumpLiveToFile(fd);
+    }
     close(fd);
 }
 
@@ -263,129 +351,93 @@ int debug_posix_memalign(void** memptr, size_t alignment, size_t size) {
     return (*memptr != nullptr) ? 0 : ENOMEM;
 }
 
-namespace DMA_BUF {
-
-static thread_local bool gpu_ioctl_alloc = false;  // TLS to store a unique flag per thread
-
-static bool is_dma_buf(int fd, size_t* size) {
-    static std::unordered_set<uint64_t> inode_set;
-    std::string fdinfo = android::base::StringPrintf("/proc/self/fdinfo/%d", fd);
-    auto fp = std::unique_ptr<FILE, decltype(&fclose)>{fopen(fdinfo.c_str(), "re"), fclose};
-    if (fp == nullptr) {
-        return false;
+int debug_ioctl(int fd, unsigned int request, void* arg) {
+    // binder/input/socket 等与内存无关的 ioctl 只需要一次查表, 不加锁也不访问 TLS
+    const IoctlDecoder* decoder = FindIoctlDecoder(request);
+    if (decoder == nullptr || DebugCallsDisabled()) {
+        return (int)syscall(SYS_ioctl, fd, request, arg);
     }
 
-    bool is_dmabuf_file = false;
-    uint64_t inode = -1;
-    char* line = nullptr;
-    size_t len = 0;
-    while (getline(&line, &len, fp.get()) > 0) {
-        switch (line[0]) {
-            case 'i':
-                if (strncmp(line, "ino:", 4) == 0) {
-                    char* c = line + 4;
-                    inode = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 's':
-                if (strncmp(line, "size:", 5) == 0) {
-                    char* c = line + 5;
-                    *size = strtoull(c, nullptr, 10);
-                }
-                break;
-            case 'e':
-                if (strncmp(line, "exp_name:", 9) == 0) {
-                    is_dmabuf_file = true;
-                }
-                break;
-            default:
-                break;
-        }
-    }
-    m_sys_free(line);
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
 
-    if (!is_dmabuf_file) {
-        return false;
+    uint64_t saved = decoder->Prepare(arg);
+    int ret = (int)syscall(SYS_ioctl, fd, request, arg);
+
+    if (ret >= 0 && g_debug->TrackPointers()) {
+        decoder->Decode(fd, arg, saved);
     }
 
-    if (inode == static_cast<uint64_t>(-1)) {
-        // Fallback to stat() on the fd path to get inode number
-        std::string fd_path = android::base::StringPrintf("/proc/self/fd/%d", fd);
+    return ret;
+}
 
-        struct stat sb;
-        if (stat(fd_path.c_str(), &sb) < 0) {
-            return false;
-        }
-        inode = sb.st_ino;
+int debug_close(int fd) {
+    if (DebugCallsDisabled()) {
+        return (int)syscall(SYS_close, fd);
     }
 
-    return inode_set.insert(inode).second;
-}
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
 
-static bool handle_dma_node(unsigned int request, void* arg, int* fd, size_t* size) {
-    // delay parsing the backtrace until mmap64.
-    auto set_gpu_ioctl_alloc_and_return_false = []() -> bool {
-        gpu_ioctl_alloc = true;
-        return false;
-    };
-
-    switch (request) {
-        case KBASE_IOCTL_MEM_ALLOC:
-        case KBASE_IOCTL_MEM_ALLOC_EX:
-        case IOCTL_KGSL_GPUOBJ_ALLOC:
-            return set_gpu_ioctl_alloc_and_return_false();
-        // parse the backtrace immediately
-        case DMA_HEAP_IOCTL_ALLOC: {
-                struct dma_heap_allocation_data* heap = (struct dma_heap_allocation_data*)arg;
-                *fd = heap->fd;
-            }
-            return is_dma_buf(*fd, size);
-        case CAM_MEM_ION_MAP_PA: {
-                struct CAM_MEM_DEV_ION_NODE_STRUCT* heap = (struct CAM_MEM_DEV_ION_NODE_STRUCT*)arg;
-                *fd = heap->memID;
-            }
-            return is_dma_buf(*fd, size);
-        default:
-            return false;
+    if (g_debug->TrackPointers()) {
+        g_debug->dmabuf->CloseFd(fd);
+        g_debug->gpu->CloseFd(fd);
     }
-}
 
-}  // namespace DMA_BUF
+    return (int)syscall(SYS_close, fd);
+}
 
-int debug_ioctl(int fd, unsigned int request, void* arg) {
+int debug_dup(int old_fd) {
     if (DebugCallsDisabled()) {
-        return (int)syscall(SYS_ioctl, fd, request, arg);
+        return (int)syscall(SYS_dup, old_fd);
     }
 
     ScopedConcurrentLock lock;
     ScopedDisableDebugCalls disable;
 
-    int ret = (int)syscall(SYS_ioctl, fd, request, arg);
-
-    int node_fd = -1;
-    size_t node_sz = 0;
-    if (g_debug->TrackPointers() && DMA_BUF::handle_dma_node(request, arg, &node_fd, &node_sz)) {
-        void* ptr = reinterpret_cast<void*>(node_fd);
-        g_debug->pointer->Add(ptr, node_sz, DMA);
+    int new_fd = (int)syscall(SYS_dup, old_fd);
+    if (new_fd >= 0 && g_debug->TrackPointers()) {
+        g_debug->dmabuf->DupFd(old_fd, new_fd);
     }
 
-    return ret;
+    return new_fd;
 }
 
-int debug_close(int fd) {
+static int sys_dup3(int old_fd, int new_fd, int flags) {
+    // aarch64 没有 dup2 系统调用, dup2(fd, fd) 只检查 fd 是否有效
+    if (old_fd == new_fd && flags == 0) {
+        return fcntl(old_fd, F_GETFD) < 0 ? -1 : new_fd;
+    }
+    return (int)syscall(SYS_dup3, old_fd, new_fd, flags);
+}
+
+int debug_dup3(int old_fd, int new_fd, int flags) {
     if (DebugCallsDisabled()) {
-        return (int)syscall(SYS_close, fd);
+        return sys_dup3(old_fd, new_fd, flags);
     }
 
     ScopedConcurrentLock lock;
     ScopedDisableDebugCalls disable;
 
-    if (g_debug->TrackPointers()) {
-        void* ptr = reinterpret_cast<void*>(fd);
-        g_debug->pointer->Remove(ptr);
+    int ret = sys_dup3(old_fd, new_fd, flags);
+    if (ret >= 0 && g_debug->TrackPointers()) {
+        g_debug->dmabuf->DupFd(old_fd, ret);
     }
 
-    return (int)syscall(SYS_close, fd);
+    return ret;
+}
+
+static void RecordMmap(void* result, size_t size, int flags, int fd, off_t offset) {
+    // 新的 mapping 会替换 [result, result + size) 内原有的 mapping (MAP_FIXED)
+    if ((flags & MAP_ANONYMOUS) || fd < 0) {
+        g_debug->dmabuf->RemoveMap(result, size);
+        g_debug->mmap->Add(result, size);
+    } else {
+        g_debug->mmap->Remove(result, size);
+        if (!g_debug->dmabuf->AddMap(result, size, fd)) {
+            g_debug->gpu->Map(fd, offset, result);
+        }
+    }
 }
 
 void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset) {
@@ -402,10 +454,8 @@ void* debug_mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t o
     }
 
     void* result = (void*)syscall(SYS_mmap, addr, size, prot, flags, fd, offset);
-
-    if (g_debug->TrackPointers() && DMA_BUF::gpu_ioctl_alloc) {
-        DMA_BUF::gpu_ioctl_alloc = false;  // Reset the flag immediately after processing
-        g_debug->pointer->Add(result, size, DMA);
+    if (result != MAP_FAILED && g_debug->TrackPointers()) {
+        RecordMmap(result, size, flags, fd, offset);
     }
 
     return result;
@@ -425,14 +475,8 @@ void* debug_mmap(void* addr, size_t size, int prot, int flags, int fd, off_t off
     }
 
     void* result = (void*)syscall(SYS_mmap, addr, size, prot, flags, fd, offset);
-    if (g_debug->TrackPointers()) {
-        size_t node_sz = 0;
-        if (fd < 0)
-            g_debug->pointer->Add(result, size, MMAP);
-        else if (DMA_BUF::is_dma_buf(fd, &node_sz)) {
-            void* ptr = reinterpret_cast<void*>(fd);
-            g_debug->pointer->Add(ptr, node_sz, DMA);
-        }
+    if (result != MAP_FAILED && g_debug->TrackPointers()) {
+        RecordMmap(result, size, flags, fd, offset);
     }
 
     return result;
@@ -447,8 +491,48 @@ int debug_munmap(void* addr, size_t size) {
     ScopedDisableDebugCalls disable;
 
     if (g_debug->TrackPointers()) {
-        g_debug->pointer->Remove(addr);
+        g_debug->dmabuf->RemoveMap(addr, size);
+        g_debug->gpu->Unmap(addr);
+        g_debug->mmap->Remove(addr, size);
     }
 
     return (int)syscall(SYS_munmap, addr, size);
 }
+
+void* debug_mremap(void* old_addr, size_t old_size, size_t new_size, int flags, void* new_addr) {
+    if (DebugCallsDisabled()) {
+        return (void*)syscall(SYS_mremap, old_addr, old_size, new_size, flags, new_addr);
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    if (new_size > PointerInfoType::MaxSize()) {
+        errno = ENOMEM;
+        return MAP_FAILED;
+    }
+
+    void* result = (void*)syscall(SYS_mremap, old_addr, old_size, new_size, flags, new_addr);
+    if (result != MAP_FAILED && g_debug->TrackPointers()) {
+        g_debug->mmap->Remap(old_addr, old_size, result, new_size);
+        g_debug->dmabuf->RemapMap(old_addr, old_size, result, new_size);
+    }
+
+    return result;
+}
+
+// dlopen/dlclose 由 hook 库直接调用真实实现, 新库构造函数中的申请仍然会被记录
+void debug_modules_changed() {
+    if (DebugCallsDisabled()) {
+        return;
+    }
+
+    ScopedConcurrentLock lock;
+    ScopedDisableDebugCalls disable;
+
+    if (UnwindClientConnected()) {
+        UnwindClientModulesChanged();
+    } else if (g_debug->config().options() & BACKTRACE) {
+        UnwindModulesChanged();
+    }
+}
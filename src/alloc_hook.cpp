@@ -4,9 +4,16 @@
 #include <cstddef>
 
 #include <dlfcn.h>
+#include <errno.h>
 #include <fcntl.h>
+#if defined(__ANDROID__)
+#include <android/dlext.h>
+#endif
 
 #include "DebugData.h"
+#include "DmaBufData.h"
+#include "GpuMemData.h"
+#include "MmapData.h"
 #include "PointerData.h"
 #include "malloc_debug.h"
 #include "memory_hook.h"
@@ -25,6 +32,30 @@
         }                                                                          \
     } while (0)
 
+// 转发时需要保留调用者地址, 否则 Android 会按 hook 库所在的 namespace 查找
+static void* (*m_sys_loader_dlopen)(const char*, int, const void*) = nullptr;
+static void* (*m_sys_dlopen)(const char*, int) = nullptr;
+static int (*m_sys_dlclose)(void*) = nullptr;
+#if defined(__ANDROID__)
+static void* (*m_sys_loader_android_dlopen_ext)(const char*, int, const android_dlextinfo*,
+                                                const void*) = nullptr;
+#endif
+
+// 不能用 RESOLVE, 它本身会调用 dlopen
+static void ResolveDl() {
+    if (m_sys_dlclose != nullptr) {
+        return;
+    }
+    m_sys_loader_dlopen = reinterpret_cast<decltype(m_sys_loader_dlopen)>(
+            dlsym(RTLD_DEFAULT, "__loader_dlopen"));
+#if defined(__ANDROID__)
+    m_sys_loader_android_dlopen_ext = reinterpret_cast<decltype(m_sys_loader_android_dlopen_ext)>(
+            dlsym(RTLD_DEFAULT, "__loader_android_dlopen_ext"));
+#endif
+    m_sys_dlopen = reinterpret_cast<decltype(m_sys_dlopen)>(dlsym(RTLD_NEXT, "dlopen"));
+    m_sys_dlclose = reinterpret_cast<decltype(m_sys_dlclose)>(dlsym(RTLD_NEXT, "dlclose"));
+}
+
 struct InitState {
     InitState() { allocHook_setup = true; }
     ~InitState() { allocHook_setup = false; }
@@ -36,7 +67,7 @@ class AllocHook {
 public:
     AllocHook() {
         InitState state;
-        void* ptr[2] = {&Db_storage, &Pd_storage};
+        void* ptr[5] = {&Db_storage, &Pd_storage, &Dd_storage, &Gd_storage, &Md_storage};
         debug_initialize(ptr);
     }
     ~AllocHook() { debug_finalize(); }
@@ -53,12 +84,19 @@ public:
         return debug_mmap(addr, size, prot, flags, fd, offset);
     }
     int munmap(void* addr, size_t size) { return debug_munmap(addr, size); }
+    void* mremap(void* old_addr, size_t old_size, size_t new_size, int flags, void* new_addr) {
+        return debug_mremap(old_addr, old_size, new_size, flags, new_addr);
+    }
     int ioctl(int fd, int request, void* arg) { return debug_ioctl(fd, request, arg); }
     int close(int fd) { return debug_close(fd); }
+    int dup(int fd) { return debug_dup(fd); }
+    int dup3(int old_fd, int new_fd, int flags) { return debug_dup3(old_fd, new_fd, flags); }
     void* mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset) {
         return debug_mmap64(addr, size, prot, flags, fd, offset);
     }
 
+    void modules_changed() { debug_modules_changed(); }
+
     void checkpoint(const char* file_name) { return debug_dump_heap(file_name); }
 
     static AllocHook& inst();
@@ -67,10 +105,20 @@ private:
     static std::aligned_storage<sizeof(DebugData), alignof(DebugData)>::type Db_storage;
     static std::aligned_storage<sizeof(PointerData), alignof(PointerData)>::type
             Pd_storage;
+    static std::aligned_storage<sizeof(DmaBufData), alignof(DmaBufData)>::type
+            Dd_storage;
+    static std::aligned_storage<sizeof(GpuMemData), alignof(GpuMemData)>::type
+            Gd_storage;
+    static std::aligned_storage<sizeof(MmapData), alignof(MmapData)>::type Md_storage;
 };
 std::aligned_storage<sizeof(DebugData), alignof(DebugData)>::type AllocHook::Db_storage;
 std::aligned_storage<sizeof(PointerData), alignof(PointerData)>::type
         AllocHook::Pd_storage;
+std::aligned_storage<sizeof(DmaBufData), alignof(DmaBufData)>::type
+        AllocHook::Dd_storage;
+std::aligned_storage<sizeof(GpuMemData), alignof(GpuMemData)>::type
+        AllocHook::Gd_storage;
+std::aligned_storage<sizeof(MmapData), alignof(MmapData)>::type AllocHook::Md_storage;
 
 AllocHook& AllocHook::inst() {
     static AllocHook hook;
@@ -144,6 +192,21 @@ int munmap(void* addr, size_t size) {
     return AllocHook::inst().munmap(addr, size);
 }
 
+void* mremap(void* old_addr, size_t old_size, size_t new_size, int flags, ...) {
+    void* new_addr = nullptr;
+    if (flags & MREMAP_FIXED) {
+        va_list ap;
+        va_start(ap, flags);
+        new_addr = va_arg(ap, void*);
+        va_end(ap);
+    }
+
+    if (in_preinit_phase || InitState::allocHook_setup) {
+        return (void*)syscall(SYS_mremap, old_addr, old_size, new_size, flags, new_addr);
+    }
+    return AllocHook::inst().mremap(old_addr, old_size, new_size, flags, new_addr);
+}
+
 int ioctl(int fd, int request, ...) {
     va_list ap;
     va_start(ap, request);
@@ -157,6 +220,18 @@ int close(int fd) {
     return AllocHook::inst().close(fd);
 }
 
+int dup(int fd) {
+    return AllocHook::inst().dup(fd);
+}
+
+int dup2(int old_fd, int new_fd) {
+    return AllocHook::inst().dup3(old_fd, new_fd, 0);
+}
+
+int dup3(int old_fd, int new_fd, int flags) {
+    return AllocHook::inst().dup3(old_fd, new_fd, flags);
+}
+
 void* mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset) {
     if (in_preinit_phase || InitState::allocHook_setup) {
         return (void*)syscall(SYS_mmap, addr, size, prot, flags, fd, offset);
@@ -165,6 +240,50 @@ void* mmap64(void* addr, size_t size, int prot, int flags, int fd, off_t offset)
     return result;
 }
 
+// 新加载或卸载的库直接更新回栈用的 maps, 不必在回栈时重新解析 /proc/self/maps
+static void NotifyModulesChanged() {
+    if (in_preinit_phase || InitState::allocHook_setup) {
+        return;
+    }
+    AllocHook::inst().modules_changed();
+}
+
+void* dlopen(const char* filename, int flags) {
+    const void* caller = __builtin_return_address(0);
+    ResolveDl();
+    void* handle = m_sys_loader_dlopen != nullptr ? m_sys_loader_dlopen(filename, flags, caller)
+                                                  : m_sys_dlopen(filename, flags);
+    if (handle != nullptr) {
+        NotifyModulesChanged();
+    }
+    return handle;
+}
+
+#if defined(__ANDROID__)
+void* android_dlopen_ext(const char* filename, int flags, const android_dlextinfo* extinfo) {
+    const void* caller = __builtin_return_address(0);
+    ResolveDl();
+    if (m_sys_loader_android_dlopen_ext == nullptr) {
+        errno = ENOSYS;
+        return nullptr;
+    }
+    void* handle = m_sys_loader_android_dlopen_ext(filename, flags, extinfo, caller);
+    if (handle != nullptr) {
+        NotifyModulesChanged();
+    }
+    return handle;
+}
+#endif
+
+int dlclose(void* handle) {
+    ResolveDl();
+    int ret = m_sys_dlclose(handle);
+    if (ret == 0) {
+        NotifyModulesChanged();
+    }
+    return ret;
+}
+
 void checkpoint(const char* file_name) {
     AllocHook::inst().checkpoint(file_name);
 }
@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
@@ -6,19 +9,48 @@
 #include <ctime>
 #include <memory>
 #include <dlfcn.h>
+#include <elf.h>
 #include <fcntl.h>
 #include <linux/mman.h>
 #include <malloc.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <zlib.h>
 #include <regex>
 #include <filesystem>
+#include <map>
 #include <sys/mman.h>
 #include <linux/dma-heap.h>
 
 #include <string>
+#include <thread>
 #include <vector>
+#include <pthread.h>
+#include <signal.h>
 #include <gtest/gtest.h>
+#include <unwindstack/DwarfError.h>
+#include <unwindstack/DwarfLocation.h>
+#include <unwindstack/DwarfMemory.h>
+#include <unwindstack/Demangle.h>
+#include <unwindstack/DwarfStructs.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/Maps.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+#include <unwindstack/RegsGetLocal.h>
+#include <unwindstack/Unwinder.h>
+#include <unwindstack/MachineArm.h>
+#include <unwindstack/RegsArm.h>
+#include <unwindstack/RegsArm64.h>
+#include "ArmExidx.h"
+#include "DwarfDebugFrame.h"
+#include "DwarfEhFrame.h"
+#include "DwarfOp.h"
+#include "MemoryCache.h"
+#include "PprofWriter.h"
+#include "RegsInfo.h"
+#include "UnwindPlanCache.h"
 
 #include <CL/cl.h>
 #include "CL/cl_platform.h"
@@ -26,6 +58,9 @@
 #include <GLES2/gl2.h>
 
 #include "util/gtest_utils.h"
+#include "UnwindBacktrace.h"
+#include "UnwindDaemon.h"
+#include "debug_disable.h"
 #include "gles3jni.h"
 
 #define DISALLOW_COPY_AND_ASSIGN(TypeName)      \
@@ -319,6 +354,1890 @@ TEST(HostAlloc, mmap) {
     Memory::run_alloc(mmap, munmap, qsize, addr, size, prot, flag, fd, offset);
 }
 
+TEST(HostAlloc, munmap_partial) {
+    const size_t size = 96 * 1024 * 1024;
+    const size_t half = size / 2;
+    int prot = PROT_READ | PROT_WRITE;
+    int flag = MAP_ANON | MAP_PRIVATE | MAP_POPULATE;
+
+    // 释放前半部分后, 剩余的后半部分仍需被统计
+    auto mmapAlloc = [&]() -> void* {
+        char* ptr = (char*)mmap(nullptr, size, prot, flag, -1, 0);
+        ASSERT(ptr == MAP_FAILED, "mmap failed: %s", strerror(errno));
+        munmap(ptr, half);
+        return ptr + half;
+    };
+    auto mmapFree = [&](void* ptr, size_t size) { munmap(ptr, size); };
+    auto qsize = [&](const void* ptr) { return half; };
+
+    Memory::run_alloc(mmapAlloc, mmapFree, qsize);
+}
+
+TEST(HostAlloc, mremap) {
+    const size_t size = 41 * 1024 * 1024;
+    const size_t new_size = size * 2;
+    int prot = PROT_READ | PROT_WRITE;
+    int flag = MAP_ANON | MAP_PRIVATE | MAP_POPULATE;
+
+    auto mremapAlloc = [&]() -> void* {
+        void* ptr = mmap(nullptr, size, prot, flag, -1, 0);
+        ASSERT(ptr == MAP_FAILED, "mmap failed: %s", strerror(errno));
+        void* new_ptr = mremap(ptr, size, new_size, MREMAP_MAYMOVE);
+        ASSERT(new_ptr == MAP_FAILED, "mremap failed: %s", strerror(errno));
+        return new_ptr;
+    };
+    auto mremapFree = [&](void* ptr, size_t size) { munmap(ptr, size); };
+    auto qsize = [&](const void* ptr) { return new_size; };
+
+    Memory::run_alloc(mremapAlloc, mremapFree, qsize);
+}
+
+namespace Bench {
+
+// 每一层都在测试程序自身, 回栈时连续多帧落在同一个映射里
+__attribute__((noinline)) size_t deep_alloc(int depth, size_t count) {
+    if (depth > 0) {
+        size_t ret = deep_alloc(depth - 1, count);
+        asm volatile("" ::: "memory");  // 防止尾调用优化
+        return ret;
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < count; ++i) {
+        void* ptr = malloc(64);
+        total += ptr != nullptr;
+        free(ptr);
+    }
+    return total;
+}
+
+// 同样的递归, 在最深处回一次栈
+__attribute__((noinline)) void deep_unwind(
+        int depth, unwindstack::Maps* maps, std::vector<unwindstack::FrameData>* frames) {
+    if (depth > 0) {
+        deep_unwind(depth - 1, maps, frames);
+        asm volatile("" ::: "memory");  // 防止尾调用优化
+        return;
+    }
+    std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::CreateFromLocal());
+    unwindstack::RegsGetLocal(regs.get());
+    auto memory = unwindstack::Memory::CreateProcessMemoryThreadCached(getpid());
+    unwindstack::Unwinder unwinder(256, maps, regs.get(), memory);
+    unwinder.Unwind();
+    *frames = unwinder.ConsumeFrames();
+}
+
+// 对每个 pc 反复调用 find, 取多轮中最快的一轮, 返回每次调用的 ns
+template <typename Find>
+double time_find(const std::vector<uint64_t>& pcs, Find find) {
+    const size_t count = 2000;
+    double best = 0;
+    for (int round = 0; round < 5; ++round) {
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            for (uint64_t pc : pcs) {
+                found += find(pc) != nullptr;
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        EXPECT_EQ(found, count * pcs.size());
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best / (count * pcs.size());
+}
+
+}
+
+TEST(Benchmark, deep_stack) {
+    const int depths[] = {8, 32, 64};
+    const size_t count = 20000;
+    for (int depth : depths) {
+        auto start = std::chrono::steady_clock::now();
+        size_t total = Bench::deep_alloc(depth, count);
+        auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        printf("depth %d: %.0f ns per malloc/free\n", depth, ns / count);
+        EXPECT_EQ(total, count);
+    }
+
+    unwindstack::LocalUpdatableMaps maps;
+    ASSERT_TRUE(maps.Parse());
+    std::vector<unwindstack::FrameData> frames;
+    for (int depth : depths) {
+        Bench::deep_unwind(depth, &maps, &frames);
+        // depth 次递归加上最深处的一层
+        size_t recursion = 0;
+        for (const auto& frame : frames) {
+            recursion += static_cast<const std::string&>(frame.function_name).find(
+                    "deep_unwind") != std::string::npos;
+        }
+        EXPECT_EQ(recursion, static_cast<size_t>(depth) + 1) << "depth " << depth;
+    }
+
+    // 最深一次回栈的所有 pc. 缓存清空时 Find 每次都要加读锁再二分查找, 命中 MRU 不能比它慢
+    std::vector<uint64_t> pcs;
+    for (const auto& frame : frames) {
+        pcs.push_back(frame.pc);
+    }
+    ASSERT_FALSE(pcs.empty());
+    double hit = Bench::time_find(pcs, [&](uint64_t pc) { return maps.Find(pc); });
+    pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+    double miss = Bench::time_find(pcs, [&](uint64_t pc) {
+        pthread_rwlock_rdlock(&lock);
+        auto map_info = maps.Maps::Find(pc);
+        pthread_rwlock_unlock(&lock);
+        return map_info;
+    });
+    printf("%zu pcs: %.1f ns per MRU find, %.1f ns uncached\n", pcs.size(), hit, miss);
+    EXPECT_LE(hit, miss);
+}
+
+namespace MapsCache {
+
+// memfd 映射在 maps 中有唯一的名字, 不会与相邻的映射合并
+void* map_pages(size_t pages) {
+    int fd = memfd_create("alloc_hook_maps_test", MFD_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    size_t size = pages * getpagesize();
+    void* addr = ftruncate(fd, size) == 0
+            ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    return addr == MAP_FAILED ? nullptr : addr;
+}
+
+}
+
+// Find 的结果缓存在线程局部的 MRU 中, maps 变化后代数改变, 不能再返回旧的 MapInfo
+TEST(LocalUpdatableMaps, mru_invalidated_after_reparse) {
+    const size_t page_size = getpagesize();
+    auto* addr = static_cast<uint8_t*>(MapsCache::map_pages(4));
+    ASSERT_NE(addr, nullptr);
+    uint64_t start = reinterpret_cast<uintptr_t>(addr);
+    uint64_t pc = start + page_size;
+
+    unwindstack::LocalUpdatableMaps maps;
+    ASSERT_TRUE(maps.Parse());
+    auto before = maps.Find(pc);
+    ASSERT_NE(before, nullptr);
+    EXPECT_EQ(before->end(), start + 4 * page_size);
+    // 第二次命中 MRU
+    EXPECT_EQ(maps.Find(pc), before);
+
+    // 后半段取消映射, 旧的 MapInfo 仍然覆盖 pc
+    ASSERT_EQ(munmap(addr + 2 * page_size, 2 * page_size), 0);
+    bool changed = false;
+    ASSERT_TRUE(maps.Reparse(&changed));
+    EXPECT_TRUE(changed);
+
+    auto after = maps.Find(pc);
+    ASSERT_NE(after, nullptr);
+    EXPECT_NE(after, before);
+    EXPECT_EQ(after->start(), start);
+    EXPECT_EQ(after->end(), start + 2 * page_size);
+    munmap(addr, 2 * page_size);
+}
+
+// 代数在所有对象之间唯一, 一个对象缓存的结果不会被另一个对象命中
+TEST(LocalUpdatableMaps, mru_not_shared_between_objects) {
+    const size_t page_size = getpagesize();
+    auto* addr = static_cast<uint8_t*>(MapsCache::map_pages(4));
+    ASSERT_NE(addr, nullptr);
+    uint64_t pc = reinterpret_cast<uintptr_t>(addr) + page_size;
+
+    unwindstack::LocalUpdatableMaps old_maps;
+    ASSERT_TRUE(old_maps.Parse());
+    auto before = old_maps.Find(pc);
+    ASSERT_NE(before, nullptr);
+
+    ASSERT_EQ(munmap(addr + 2 * page_size, 2 * page_size), 0);
+    unwindstack::LocalUpdatableMaps new_maps;
+    ASSERT_TRUE(new_maps.Parse());
+    auto after = new_maps.Find(pc);
+    ASSERT_NE(after, nullptr);
+    EXPECT_NE(after, before);
+    EXPECT_EQ(after->end(), reinterpret_cast<uintptr_t>(addr) + 2 * page_size);
+    munmap(addr, 2 * page_size);
+}
+
+namespace Cache {
+
+// 每个字节的内容由地址决定, 记录穿透到底层的读取次数
+class CountingMemory : public unwindstack::Memory {
+public:
+    size_t Read(uint64_t addr, void* dst, size_t size) override {
+        reads++;
+        auto* bytes = static_cast<uint8_t*>(dst);
+        for (size_t i = 0; i < size; ++i) {
+            bytes[i] = value(addr + i);
+        }
+        return size;
+    }
+
+    static uint8_t value(uint64_t addr) { return static_cast<uint8_t>(addr ^ (addr >> 12)); }
+
+    size_t reads = 0;
+};
+
+const uint64_t kPageSize = 4096;
+// MemoryCache 有 128 组, 页号相差 128 的页落在同一组
+const uint64_t kSetStride = 128 * kPageSize;
+
+struct Fixture {
+    Fixture() : counting(new CountingMemory()), cache(counting) {}
+
+    // 读一个 uint64_t 并检查内容
+    void read(uint64_t addr) {
+        uint64_t value = 0;
+        ASSERT_TRUE(cache.ReadFully(addr, &value, sizeof(value)));
+        for (size_t i = 0; i < sizeof(value); ++i) {
+            EXPECT_EQ(reinterpret_cast<uint8_t*>(&value)[i], CountingMemory::value(addr + i));
+        }
+    }
+
+    CountingMemory* counting;
+    unwindstack::MemoryCache cache;
+};
+
+const size_t kReadRounds = 5;
+const size_t kReadsPerRound = 200000;
+
+// 在 pages 个页内按固定步长反复读 uint64_t, 取多轮中最快的一轮, 返回每次读取的 ns
+double time_reads(unwindstack::Memory* memory, uint64_t base, size_t pages) {
+    double best = 0;
+    for (size_t round = 0; round < kReadRounds; ++round) {
+        uint64_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < kReadsPerRound; ++i) {
+            uint64_t value = 0;
+            memory->ReadFully(base + (i * 520) % (pages * kPageSize), &value, sizeof(value));
+            sum += value;
+        }
+        auto end = std::chrono::steady_clock::now();
+        asm volatile("" : : "r"(sum));
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best / kReadsPerRound;
+}
+
+}
+
+// 同一页的第二次读取命中缓存, 不再读底层
+TEST(MemoryCache, hit_after_insert) {
+    Cache::Fixture fixture;
+    const uint64_t page = 0x10000000;
+    fixture.read(page + 0x10);
+    EXPECT_EQ(fixture.counting->reads, 1u);
+    fixture.read(page + 0x800);
+    fixture.read(page + 0x10);
+    EXPECT_EQ(fixture.counting->reads, 1u);
+    // 跨页的读取再填入下一页
+    fixture.read(page + Cache::kPageSize - 4);
+    EXPECT_EQ(fixture.counting->reads, 2u);
+    fixture.read(page + Cache::kPageSize + 8);
+    EXPECT_EQ(fixture.counting->reads, 2u);
+}
+
+// 每组两路, 第三个页替换最久没有访问的那一路
+TEST(MemoryCache, lru_way_eviction) {
+    Cache::Fixture fixture;
+    const uint64_t a = 0x10000000;
+    const uint64_t b = a + Cache::kSetStride;
+    const uint64_t c = b + Cache::kSetStride;
+    fixture.read(a);
+    fixture.read(b);
+    EXPECT_EQ(fixture.counting->reads, 2u);
+    // a 最近访问过, c 替换 b
+    fixture.read(a);
+    fixture.read(c);
+    EXPECT_EQ(fixture.counting->reads, 3u);
+    fixture.read(a);
+    fixture.read(c);
+    EXPECT_EQ(fixture.counting->reads, 3u);
+    fixture.read(b);
+    EXPECT_EQ(fixture.counting->reads, 4u);
+}
+
+// Clear 只递增代数, 之前的页全部失效, 之后重新填入
+TEST(MemoryCache, clear_invalidates) {
+    Cache::Fixture fixture;
+    const uint64_t a = 0x10000000;
+    const uint64_t b = a + Cache::kSetStride;
+    fixture.read(a);
+    fixture.read(b);
+    fixture.cache.Clear();
+    fixture.read(a);
+    fixture.read(b);
+    EXPECT_EQ(fixture.counting->reads, 4u);
+    fixture.read(a);
+    fixture.read(b);
+    EXPECT_EQ(fixture.counting->reads, 4u);
+}
+
+// 回栈时对同一片栈的反复读取, 每 100 次读清一次缓存, 与一次回栈的节奏相当
+TEST(Benchmark, memory_cache_read) {
+    std::vector<uint64_t> stack(8192, 0x1234);
+    auto memory = unwindstack::Memory::CreateProcessMemoryThreadCached(getpid());
+    ASSERT_NE(memory, nullptr);
+    const size_t count = 2000000;
+    uint64_t base = reinterpret_cast<uintptr_t>(stack.data());
+    uint64_t value = 0;
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; ++i) {
+        if (i % 100 == 0) {
+            memory->Clear();
+        }
+        uint64_t offset = (i * 520) % (stack.size() * sizeof(uint64_t));
+        ASSERT_TRUE(memory->ReadFully(base + offset, &value, sizeof(value)));
+        sum += value;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    printf("%.1f ns per cached read\n", ns / count);
+    EXPECT_EQ(sum, count * 0x1234);
+
+    // 页全部在缓存中时, 同样的读取不再穿透到 CountingMemory
+    Cache::Fixture fixture;
+    const uint64_t page = 0x10000000;
+    const size_t pages = 16;
+    Cache::time_reads(&fixture.cache, page, pages);
+    EXPECT_EQ(fixture.counting->reads, pages);
+    double hit = Cache::time_reads(&fixture.cache, page, pages);
+    EXPECT_EQ(fixture.counting->reads, pages);
+    double uncached = Cache::time_reads(fixture.counting, page, pages);
+    EXPECT_EQ(fixture.counting->reads, pages + Cache::kReadRounds * Cache::kReadsPerRound);
+    printf("%.1f ns per hit, %.1f ns per CountingMemory read\n", hit, uncached);
+
+    // 同一片栈, 命中缓存不能比每次都从进程内存读慢
+    auto stack_cache = unwindstack::Memory::CreateProcessMemoryCached(getpid());
+    auto stack_memory = unwindstack::Memory::CreateProcessMemory(getpid());
+    Cache::time_reads(stack_cache.get(), base, pages);
+    double stack_hit = Cache::time_reads(stack_cache.get(), base, pages);
+    double stack_uncached = Cache::time_reads(stack_memory.get(), base, pages);
+    printf("%.1f ns per stack hit, %.1f ns uncached\n", stack_hit, stack_uncached);
+    EXPECT_LE(stack_hit, stack_uncached);
+}
+
+namespace Exidx {
+
+// 每个 4 字节对齐的字由地址决定, 出栈的值都不相同
+class PatternMemory : public unwindstack::Memory {
+public:
+    size_t Read(uint64_t addr, void* dst, size_t size) override {
+        auto* bytes = static_cast<uint8_t*>(dst);
+        for (size_t i = 0; i < size; ++i) {
+            uint64_t word_addr = (addr + i) & ~3ull;
+            uint32_t word = static_cast<uint32_t>(word_addr * 2654435761u) ^ 0x5a5a0000u;
+            bytes[i] = static_cast<uint8_t>(word >> (((addr + i) & 3) * 8));
+        }
+        return size;
+    }
+};
+
+struct Result {
+    bool ok = false;
+    bool finished = false;
+    uint32_t regs[unwindstack::ARM_REG_LAST] = {};
+};
+
+void init_regs(unwindstack::RegsArm* regs) {
+    for (size_t reg = 0; reg < unwindstack::ARM_REG_LAST; ++reg) {
+        (*regs)[reg] = 0x40000 + reg * 0x100;
+    }
+    (*regs)[unwindstack::ARM_REG_SP] = 0x80000;
+}
+
+void save_regs(unwindstack::RegsArm* regs, Result* result) {
+    for (size_t reg = 0; reg < unwindstack::ARM_REG_LAST; ++reg) {
+        result->regs[reg] = (*regs)[reg];
+    }
+}
+
+// 与 ElfInterfaceArm::StepExidx 解释执行的路径相同
+Result eval(const std::vector<uint8_t>& data) {
+    PatternMemory memory;
+    unwindstack::RegsArm regs;
+    init_regs(&regs);
+    unwindstack::ArmExidx arm(&regs, nullptr, &memory);
+    arm.data()->assign(data.begin(), data.end());
+    arm.set_cfa(regs.sp());
+    Result result;
+    if (arm.Eval()) {
+        if (!arm.pc_set()) {
+            regs[unwindstack::ARM_REG_PC] = regs[unwindstack::ARM_REG_LR];
+        }
+        regs[unwindstack::ARM_REG_SP] = arm.cfa();
+        result.ok = true;
+        result.finished = regs.pc() == 0;
+        save_regs(&regs, &result);
+    }
+    return result;
+}
+
+// 编译成 UnwindPlanRow 后应用, 编译失败时 compiled 为 false
+Result compile(const std::vector<uint8_t>& data, bool* compiled) {
+    PatternMemory memory;
+    unwindstack::RegsArm regs;
+    init_regs(&regs);
+    unwindstack::ArmExidx arm(&regs, nullptr, &memory);
+    arm.data()->assign(data.begin(), data.end());
+    Result result;
+    unwindstack::UnwindPlanRow row;
+    *compiled = arm.Compile(&row);
+    bool is_signal_frame;
+    if (*compiled && row.Apply(true, &regs, &memory, &result.finished, &is_signal_frame)) {
+        result.ok = true;
+        save_regs(&regs, &result);
+    }
+    return result;
+}
+
+// 能编译的条目应用后的寄存器必须与 Eval 完全一致
+void expect_same(const std::vector<uint8_t>& data) {
+    std::string bytes;
+    for (uint8_t byte : data) {
+        char hex[4];
+        snprintf(hex, sizeof(hex), "%02x ", byte);
+        bytes += hex;
+    }
+    bool compiled;
+    Result row = compile(data, &compiled);
+    ASSERT_TRUE(compiled) << bytes;
+    Result expected = eval(data);
+    ASSERT_TRUE(expected.ok) << bytes;
+    ASSERT_TRUE(row.ok) << bytes;
+    EXPECT_EQ(row.finished, expected.finished) << bytes;
+    for (size_t reg = 0; reg < unwindstack::ARM_REG_LAST; ++reg) {
+        EXPECT_EQ(row.regs[reg], expected.regs[reg]) << bytes << "r" << reg;
+    }
+}
+
+bool compiles(const std::vector<uint8_t>& data) {
+    bool compiled;
+    compile(data, &compiled);
+    return compiled;
+}
+
+}
+
+TEST(ArmExidx, compile_matches_eval) {
+    const std::vector<std::vector<uint8_t>> entries = {
+            // vsp 加减
+            {0x00, 0x3f, 0x40, 0xb0},
+            {0x7f, 0x3f, 0x3f, 0xb0},
+            // 1000iiii iiiiiiii: 出栈 r4-r15, 包含 pc 和只包含 lr
+            {0x80, 0x01, 0xb0},
+            {0x89, 0xf0, 0xb0},
+            {0x8d, 0xff, 0xb0},
+            {0x84, 0x00, 0xb0},
+            {0x88, 0x00, 0xb0},
+            {0x04, 0x81, 0x10, 0xb0},
+            // 1001nnnn: 出栈之前设置 vsp
+            {0x97, 0xa3, 0xb0},
+            {0x90, 0x02, 0x88, 0x00, 0xb0},
+            {0x9c, 0xb1, 0x0f, 0xb0},
+            // 1010xnnn: 出栈 r4-r[4+nnn], 可带 r14
+            {0xa0, 0xb0},
+            {0xa7, 0xb0},
+            {0xab, 0xb0},
+            {0xaf, 0x00, 0xb0},
+            // 10110000: 结束, 后面的字节不再解析
+            {0xb0, 0xb4},
+            {0xb0},
+            // 10110001 0000iiii: 出栈 r0-r3
+            {0xb1, 0x01, 0xb0},
+            {0xb1, 0x0f, 0xa1, 0xb0},
+            {0xb1, 0x0a, 0x84, 0x00, 0xb0},
+            // 10110010 uleb128: vsp = vsp + 0x204 + (uleb128 << 2)
+            {0xb2, 0x00, 0xb0},
+            {0xb2, 0x7f, 0xa0, 0xb0},
+            {0xb2, 0x81, 0x01, 0xb0},
+            {0xb2, 0xff, 0xff, 0x01, 0xb0},
+            // 浮点寄存器只调整 vsp
+            {0xb3, 0x12, 0xb8, 0xc9, 0x21, 0xd3, 0xa8, 0xb0},
+    };
+    for (const auto& entry : entries) {
+        Exidx::expect_same(entry);
+    }
+}
+
+// 行表达不了的条目, 以及 Eval 不会成功完成的条目, 都不能编译
+TEST(ArmExidx, compile_refuses) {
+    const std::vector<std::vector<uint8_t>> entries = {
+            {0x80, 0x00, 0xb0},        // 拒绝回栈
+            {0x82, 0x00, 0xb0},        // 出栈 sp
+            {0xa1, 0x97, 0xb0},        // 出栈之后设置 vsp
+            {0xa1, 0x80, 0x01, 0xb0},  // 同一个寄存器出栈两次
+            {0xb1, 0x01, 0xb1, 0x01, 0xb0},
+            {0x9d, 0xb0},              // vsp = sp
+            {0x9f, 0xb0},              // vsp = pc
+            {0xb1, 0x00, 0xb0},        // 空的寄存器列表
+            {0xb1, 0x10, 0xb0},
+            {0xb4, 0xb0},              // 保留的操作码
+            {0xca, 0xb0},
+            {0xf0, 0xb0},
+            {0x84},                    // 截断
+            {0xb2, 0x80},
+            {0xa0},                    // 没有结束
+            {0xb2, 0xff, 0xff, 0xff, 0x7f, 0xb2, 0xff, 0xff, 0xff, 0x7f, 0xb0},  // vsp 超过 32 位
+    };
+    for (const auto& entry : entries) {
+        std::string bytes;
+        for (uint8_t byte : entry) {
+            bytes += std::to_string(byte) + " ";
+        }
+        EXPECT_FALSE(Exidx::compiles(entry)) << bytes;
+    }
+}
+
+// 由常见操作随机组合的条目, 能编译的都要与 Eval 一致
+TEST(ArmExidx, compile_matches_eval_random) {
+    uint32_t seed = 12345;
+    auto next = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<uint8_t>(seed >> 16);
+    };
+    size_t num_compiled = 0;
+    for (int i = 0; i < 20000; ++i) {
+        std::vector<uint8_t> entry;
+        int ops = next() % 6;
+        for (int op = 0; op < ops; ++op) {
+            uint8_t byte = next();
+            switch (next() % 6) {
+            case 0:  // vsp 加减
+                entry.push_back(byte & 0x7f);
+                break;
+            case 1:  // 按掩码出栈 r4-r15
+                entry.push_back(0x80 | (byte & 0xf));
+                entry.push_back(next());
+                break;
+            case 2:  // 设置 vsp
+                entry.push_back(0x90 | (byte & 0xf));
+                break;
+            case 3:  // 出栈 r4-r[4+nnn]
+                entry.push_back(0xa0 | (byte & 0xf));
+                break;
+            case 4:  // 出栈 r0-r3
+                entry.push_back(0xb1);
+                entry.push_back(byte & 0xf);
+                break;
+            default:  // 两个字节的 uleb128
+                entry.push_back(0xb2);
+                entry.push_back(byte | 0x80);
+                entry.push_back(next() & 0x7f);
+                break;
+            }
+        }
+        entry.push_back(0xb0);
+        if (Exidx::compiles(entry)) {
+            num_compiled++;
+            Exidx::expect_same(entry);
+            if (HasFatalFailure()) {
+                return;
+            }
+        }
+    }
+    EXPECT_GT(num_compiled, 1000u);
+}
+
+namespace Dwarf {
+
+// 表达式所在的段, 表达式放在末尾, 读到末尾之后失败
+class SectionMemory : public unwindstack::Memory {
+public:
+    size_t Read(uint64_t addr, void* dst, size_t size) override {
+        if (addr >= data.size()) {
+            return 0;
+        }
+        size_t len = std::min<size_t>(size, data.size() - addr);
+        memcpy(dst, data.data() + addr, len);
+        return len;
+    }
+
+    // 追加一个表达式, 返回它的起始偏移
+    uint64_t add(const std::vector<uint8_t>& bytes) {
+        uint64_t start = data.size();
+        data.insert(data.end(), bytes.begin(), bytes.end());
+        return start;
+    }
+
+    std::vector<uint8_t> data = std::vector<uint8_t>(0x10, 0);
+};
+
+// 栈上每个字节的内容由地址决定, 0x100000 以上不可读
+class StackMemory : public unwindstack::Memory {
+public:
+    size_t Read(uint64_t addr, void* dst, size_t size) override {
+        auto* bytes = static_cast<uint8_t*>(dst);
+        for (size_t i = 0; i < size; ++i) {
+            if (addr + i >= kEnd) {
+                return i;
+            }
+            bytes[i] = static_cast<uint8_t>((addr + i) * 131 >> 3);
+        }
+        return size;
+    }
+
+    static constexpr uint64_t kEnd = 0x100000;
+};
+
+void init_regs(unwindstack::RegsArm64* regs) {
+    for (size_t reg = 0; reg < unwindstack::ARM64_REG_LAST; ++reg) {
+        (*regs)[reg] = 0x40000 + reg * 0x100;
+    }
+    (*regs)[unwindstack::ARM64_REG_SP] = 0x80000;
+}
+
+struct Result {
+    bool ok;
+    unwindstack::DwarfErrorCode error;
+    uint64_t error_address;
+    bool is_register;
+    bool dex_pc_set;
+    std::vector<uint64_t> stack;
+};
+
+// compiled 为 false 时是原来逐个 Decode 的路径
+Result eval(SectionMemory* section, uint64_t start, uint64_t end, bool compiled) {
+    unwindstack::DwarfMemory dwarf_memory(section);
+    StackMemory stack_memory;
+    unwindstack::RegsArm64 regs;
+    init_regs(&regs);
+    unwindstack::RegsInfo<uint64_t> regs_info(&regs);
+    unwindstack::DwarfOp<uint64_t> op(&dwarf_memory, &stack_memory);
+    op.set_regs_info(&regs_info);
+    unwindstack::DwarfExpression expression;
+    if (compiled) {
+        op.Compile(start, end, &expression);
+    }
+    Result result;
+    result.ok = op.Eval(start, end, compiled ? &expression : nullptr);
+    result.error = op.LastErrorCode();
+    result.error_address = op.LastErrorAddress();
+    result.is_register = op.is_register();
+    result.dex_pc_set = op.dex_pc_set();
+    for (size_t i = 0; i < op.StackSize(); ++i) {
+        result.stack.push_back(op.StackAt(i));
+    }
+    return result;
+}
+
+std::string hex(const std::vector<uint8_t>& bytes) {
+    std::string out;
+    for (uint8_t byte : bytes) {
+        char buffer[4];
+        snprintf(buffer, sizeof(buffer), "%02x ", byte);
+        out += buffer;
+    }
+    return out;
+}
+
+// 结果, 错误和整个栈都要与逐个 Decode 一致
+void expect_same(const std::vector<uint8_t>& bytes) {
+    SectionMemory section;
+    uint64_t start = section.add(bytes);
+    uint64_t end = section.data.size();
+    Result expected = eval(&section, start, end, false);
+    Result result = eval(&section, start, end, true);
+    EXPECT_EQ(result.ok, expected.ok) << hex(bytes);
+    EXPECT_EQ(result.error, expected.error) << hex(bytes);
+    EXPECT_EQ(result.error_address, expected.error_address) << hex(bytes);
+    EXPECT_EQ(result.is_register, expected.is_register) << hex(bytes);
+    EXPECT_EQ(result.dex_pc_set, expected.dex_pc_set) << hex(bytes);
+    EXPECT_EQ(result.stack, expected.stack) << hex(bytes);
+}
+
+// 用 DW_CFA_expression 或 DW_CFA_val_expression 规则恢复 x19
+struct Section {
+    Section() : section(&memory) {
+        cie.return_address_register = unwindstack::ARM64_REG_LR;
+        loc_regs.cie = &cie;
+        loc_regs[unwindstack::CFA_REG] = {unwindstack::DWARF_LOCATION_REGISTER,
+                                          {unwindstack::ARM64_REG_SP, 0}};
+    }
+
+    // 返回是否成功, 成功时 value 为 x19 的新值
+    bool eval(unwindstack::DwarfLocationEnum type, uint64_t start, uint64_t end, uint64_t* value) {
+        loc_regs[unwindstack::ARM64_REG_R19] = {type, {end - start, end}};
+        unwindstack::RegsArm64 regs;
+        init_regs(&regs);
+        bool finished;
+        if (!section.Eval(&cie, &stack_memory, loc_regs, &regs, &finished)) {
+            return false;
+        }
+        *value = regs[unwindstack::ARM64_REG_R19];
+        return true;
+    }
+
+    // 不经过段的缓存, 直接逐个 Decode 得到的 x19
+    bool expected(unwindstack::DwarfLocationEnum type, uint64_t start, uint64_t end,
+                  uint64_t* value, Result* result) {
+        *result = Dwarf::eval(&memory, start, end, false);
+        if (!result->ok || result->stack.empty()) {
+            return false;
+        }
+        *value = result->stack[0];
+        return type == unwindstack::DWARF_LOCATION_VAL_EXPRESSION ||
+               stack_memory.ReadFully(*value, value, sizeof(*value));
+    }
+
+    void expect_same(unwindstack::DwarfLocationEnum type, uint64_t start, uint64_t end) {
+        std::vector<uint8_t> bytes(memory.data.begin() + start, memory.data.begin() + end);
+        uint64_t value = 0;
+        bool ok = eval(type, start, end, &value);
+        uint64_t expected_value = 0;
+        Result result;
+        bool expected_ok = expected(type, start, end, &expected_value, &result);
+        ASSERT_EQ(ok, expected_ok) << hex(bytes) << "type " << type;
+        if (ok) {
+            EXPECT_EQ(value, expected_value) << hex(bytes) << "type " << type;
+        } else if (!result.ok) {
+            // 失败时报告的错误与逐个 Decode 相同
+            EXPECT_EQ(section.LastErrorCode(), result.error) << hex(bytes);
+            EXPECT_EQ(section.LastErrorAddress(), result.error_address) << hex(bytes);
+        }
+    }
+
+    SectionMemory memory;
+    StackMemory stack_memory;
+    unwindstack::DwarfDebugFrame<uint64_t> section;
+    unwindstack::DwarfCie cie;
+    unwindstack::DwarfLocations loc_regs;
+};
+
+}
+
+TEST(DwarfOp, compiled_matches_decode) {
+    std::vector<std::vector<uint8_t>> expressions = {
+            {0x7d, 0x10},                                // breg13 +16
+            {0x92, 0x1f, 0x78},                          // bregx sp -8
+            {0x7f, 0x08, 0x06},                          // breg15 +8, deref
+            {0x92, 0x13, 0x00, 0x06},                    // bregx x19, deref
+            {0x70, 0x80, 0x80, 0x80, 0x80, 0x01, 0x06},  // breg0 +0x10000000 读取失败
+            {0x7d, 0x00, 0x94, 0x04},                    // deref_size 4
+            {0x08, 0x05, 0x08, 0x07, 0x22, 0x12, 0x1e},  // 5 + 7, dup, mul
+            {0x30, 0x28, 0x02, 0x00, 0x31, 0x32, 0x33},  // bra 不跳转
+            {0x31, 0x28, 0x01, 0x00, 0x31, 0x32},        // bra 跳过一个操作
+            {0x2f, 0x01, 0x00, 0x08, 0x31, 0x32},        // skip 到操作数中间
+            {0x2f, 0xfd, 0xff},                          // 死循环, 超过迭代次数
+            {0x31, 0x02},                                // 非法操作
+            {0x31, 0x0e, 0x01},                          // 操作数被截断
+            {0x0c, 'D', 'E', 'X', '1', 0x13, 0x7d, 0x00},  // dex pc 标记
+            {0x50},                                      // 寄存器
+            {0x13},                                      // 栈为空
+            {},
+    };
+    // 超过预先解码的操作个数, 后面的操作回到逐个 Decode
+    std::vector<uint8_t> long_expression = {0x31};
+    for (int i = 0; i < 300; ++i) {
+        long_expression.push_back(0x31);
+        long_expression.push_back(0x22);
+    }
+    expressions.push_back(long_expression);
+    for (const auto& bytes : expressions) {
+        Dwarf::expect_same(bytes);
+    }
+}
+
+// 随机的操作序列, 包括跳转到操作中间和非法操作
+TEST(DwarfOp, compiled_matches_decode_random) {
+    uint32_t seed = 54321;
+    auto next = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<uint8_t>(seed >> 16);
+    };
+    // 没有操作数或者操作数为单字节的常用操作
+    const uint8_t ops[] = {0x06, 0x08, 0x09, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+                           0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23,
+                           0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e,
+                           0x2f, 0x30, 0x31, 0x3f, 0x50, 0x70, 0x7d, 0x92, 0x94, 0x96};
+    for (int i = 0; i < 20000; ++i) {
+        std::vector<uint8_t> bytes;
+        int length = next() % 12;
+        for (int j = 0; j < length; ++j) {
+            uint8_t op = ops[next() % sizeof(ops)];
+            bytes.push_back(op);
+            if (op == 0x28 || op == 0x2f) {
+                // 小范围跳转, 可能跳到操作数中间
+                bytes.push_back(static_cast<uint8_t>(static_cast<int8_t>(next() % 9) - 4));
+                bytes.push_back(0);
+            } else if (op == 0x08 || op == 0x09 || op == 0x10 || op == 0x11 || op == 0x15 ||
+                       op == 0x23 || op == 0x70 || op == 0x7d || op == 0x94) {
+                bytes.push_back(next() & 0x7f);
+            } else if (op == 0x92) {
+                bytes.push_back(next() % 40);
+                bytes.push_back(next() & 0x7f);
+            }
+        }
+        Dwarf::expect_same(bytes);
+        if (HasFailure()) {
+            return;
+        }
+    }
+}
+
+// breg 和 breg + deref 不经过 DwarfOp 直接求值, 结果和读取失败时的错误都不能变
+TEST(DwarfSection, expression_fast_path) {
+    Dwarf::Section section;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (const auto& bytes : std::vector<std::vector<uint8_t>>{
+                 {0x7d, 0x10},                                // breg
+                 {0x92, 0x1f, 0x78},                          // bregx
+                 {0x7f, 0x08, 0x06},                          // breg + deref
+                 {0x92, 0x13, 0x70, 0x06},                    // bregx + deref
+                 {0x70, 0x80, 0x80, 0x80, 0x80, 0x01, 0x06},  // deref 读取失败
+                 {0x70, 0x80, 0x80, 0x80, 0x80, 0x01},        // 恢复时读取失败
+                 {0x92, 0x40, 0x00, 0x06},                    // 寄存器超出范围
+                 {0x7d, 0x10, 0x06, 0x06},                    // 不是快速路径
+         }) {
+        uint64_t start = section.memory.add(bytes);
+        ranges.emplace_back(start, start + bytes.size());
+    }
+    // 每个表达式求值两次, 第二次命中缓存
+    for (int round = 0; round < 2; ++round) {
+        for (const auto& range : ranges) {
+            section.expect_same(unwindstack::DWARF_LOCATION_EXPRESSION, range.first, range.second);
+            section.expect_same(
+                    unwindstack::DWARF_LOCATION_VAL_EXPRESSION, range.first, range.second);
+        }
+    }
+}
+
+// 缓存按起始偏移查找, 结束偏移不同时不能使用缓存的表达式
+TEST(DwarfSection, expression_end_mismatch) {
+    Dwarf::Section section;
+    uint64_t start = section.memory.add({0x7d, 0x10, 0x06, 0x23, 0x08});
+    const uint64_t ends[] = {start + 3, start + 2, start + 5, start + 3, start + 2};
+    for (uint64_t end : ends) {
+        section.expect_same(unwindstack::DWARF_LOCATION_VAL_EXPRESSION, start, end);
+        section.expect_same(unwindstack::DWARF_LOCATION_EXPRESSION, start, end);
+    }
+    // breg 与 breg + deref 的结果确实不同
+    uint64_t breg = 0;
+    uint64_t deref = 0;
+    ASSERT_TRUE(section.eval(unwindstack::DWARF_LOCATION_VAL_EXPRESSION, start, start + 2, &breg));
+    ASSERT_TRUE(section.eval(unwindstack::DWARF_LOCATION_VAL_EXPRESSION, start, start + 3, &deref));
+    EXPECT_EQ(breg, 0x40000u + 13 * 0x100 + 0x10);
+    EXPECT_NE(deref, breg);
+}
+
+namespace FdeIndex {
+
+// 没有 .eh_frame_hdr 的 .eh_frame, 用线性遍历作为查找的参照
+class EhFrame : public unwindstack::DwarfEhFrame<uint64_t> {
+public:
+    explicit EhFrame(Dwarf::SectionMemory* memory) : DwarfEhFrame<uint64_t>(memory) {}
+
+    // 段中第一个覆盖 pc 的 fde
+    const unwindstack::DwarfFde* linear(uint64_t pc) {
+        for (uint64_t offset = entries_offset_; offset < entries_end_;) {
+            const uint64_t fde_offset = offset;
+            std::optional<unwindstack::DwarfFde> fde;
+            if (!GetNextCieOrFde(offset, fde) || offset < memory_.cur_offset()) {
+                break;
+            }
+            if (fde.has_value() && fde->pc_start <= pc && pc < fde->pc_end) {
+                return GetFdeFromOffset(fde_offset);
+            }
+        }
+        return nullptr;
+    }
+};
+
+void put32(std::vector<uint8_t>* data, uint64_t offset, uint32_t value) {
+    memcpy(data->data() + offset, &value, sizeof(value));
+}
+
+// 版本 1, 没有增强字符串, fde 的地址是相对于字段本身的 sdata4
+uint64_t add_cie(Dwarf::SectionMemory* memory) {
+    return memory->add({0x0c, 0, 0, 0, 0, 0, 0, 0, 0x01, 0x00, 0x01, 0x78, 0x1e, 0, 0, 0});
+}
+
+void add_fde(Dwarf::SectionMemory* memory, uint64_t cie, uint32_t pc_start, uint32_t pc_end) {
+    uint64_t start = memory->add(std::vector<uint8_t>(16, 0));
+    put32(&memory->data, start, 12);
+    put32(&memory->data, start + 4, start + 4 - cie);
+    put32(&memory->data, start + 8, pc_start - (start + 8));
+    put32(&memory->data, start + 12, pc_end - pc_start);
+}
+
+// 每个 fde 的起止地址前后和相邻边界之间的 pc 都与线性遍历一致
+void expect_same(Dwarf::SectionMemory* memory,
+                 const std::vector<std::pair<uint32_t, uint32_t>>& ranges, size_t* found) {
+    EhFrame section(memory);
+    ASSERT_TRUE(section.Init(0x10, memory->data.size() - 0x10, 0));
+    std::vector<uint64_t> bounds = {0, UINT64_MAX};
+    for (const auto& range : ranges) {
+        bounds.push_back(range.first);
+        bounds.push_back(range.second);
+    }
+    std::sort(bounds.begin(), bounds.end());
+    std::vector<uint64_t> pcs;
+    for (size_t i = 0; i < bounds.size(); ++i) {
+        pcs.push_back(bounds[i]);
+        if (bounds[i] != 0) {
+            pcs.push_back(bounds[i] - 1);
+        }
+        if (i + 1 < bounds.size() && bounds[i + 1] - bounds[i] > 1) {
+            pcs.push_back(bounds[i] + (bounds[i + 1] - bounds[i]) / 2);
+        }
+    }
+    *found = 0;
+    for (uint64_t pc : pcs) {
+        const unwindstack::DwarfFde* fde = section.GetFdeFromPc(pc);
+        ASSERT_EQ(fde, section.linear(pc)) << "pc 0x" << std::hex << pc;
+        if (fde != nullptr) {
+            ++*found;
+        }
+    }
+}
+
+}
+
+// 重叠时段中靠前的 fde 优先, 空的 fde 和段尾被截断的 fde 不出现在索引中
+TEST(DwarfSection, fde_index_matches_linear) {
+    const std::vector<std::pair<uint32_t, uint32_t>> ranges = {
+            {0x200, 0x400},    // A
+            {0x100, 0x500},    // 包住 A
+            {0x300, 0x350},    // 在 A 里面
+            {0x380, 0x600},    // 跨过 A 和第二个的结尾
+            {0x200, 0x400},    // 与 A 相同
+            {0x710, 0x720},    // 与下一个首尾相接
+            {0x700, 0x710},
+            {0x800, 0x800},    // 空
+            {0x1000, 0x1004},
+            {0x900, 0x700},    // 结束在开始之前
+    };
+    Dwarf::SectionMemory memory;
+    uint64_t cie = FdeIndex::add_cie(&memory);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        if (i == ranges.size() / 2) {
+            cie = FdeIndex::add_cie(&memory);
+        }
+        FdeIndex::add_fde(&memory, cie, ranges[i].first, ranges[i].second);
+    }
+    // 段尾只有一半的 fde
+    memory.add({0x0c, 0, 0, 0, 0x04, 0, 0, 0});
+    size_t found = 0;
+    FdeIndex::expect_same(&memory, ranges, &found);
+    EXPECT_GT(found, 0u);
+}
+
+// 随机的重叠和间隙
+TEST(DwarfSection, fde_index_matches_linear_random) {
+    uint32_t seed = 54321;
+    auto next = [&seed]() {
+        seed = seed * 1103515245 + 12345;
+        return seed >> 16;
+    };
+    for (int round = 0; round < 200; ++round) {
+        Dwarf::SectionMemory memory;
+        uint64_t cie = FdeIndex::add_cie(&memory);
+        std::vector<std::pair<uint32_t, uint32_t>> ranges;
+        int count = 1 + next() % 40;
+        for (int i = 0; i < count; ++i) {
+            uint32_t start = 0x1000 + (next() % 0x100) * 0x10;
+            uint32_t end = start + (next() % 0x20) * 0x10;
+            ranges.emplace_back(start, end);
+            FdeIndex::add_fde(&memory, cie, start, end);
+        }
+        size_t found = 0;
+        FdeIndex::expect_same(&memory, ranges, &found);
+        if (HasFatalFailure()) {
+            return;
+        }
+    }
+}
+
+namespace SymbolLookup {
+
+// 逐个 pc 查找的结果, 作为批量查找的参照
+std::vector<unwindstack::FunctionLookup> lookup_each(
+        unwindstack::Elf* elf, const std::vector<uint64_t>& pcs) {
+    std::vector<unwindstack::FunctionLookup> result;
+    for (uint64_t pc : pcs) {
+        unwindstack::FunctionLookup lookup{.addr = pc};
+        lookup.found = elf->GetFunctionName(pc, &lookup.name, &lookup.offset);
+        result.push_back(lookup);
+    }
+    return result;
+}
+
+// 批量查找与逐个查找使用不同的 Elf, 逐个查找不会用到批量查找建立的索引
+void expect_same(unwindstack::Elf* batch_elf, unwindstack::Elf* each_elf,
+                 const std::vector<uint64_t>& pcs, size_t* found) {
+    std::vector<unwindstack::FunctionLookup> batch;
+    for (uint64_t pc : pcs) {
+        batch.push_back({.addr = pc});
+    }
+    batch_elf->GetFunctionNames(&batch);
+    auto each = lookup_each(each_elf, pcs);
+    *found = 0;
+    for (size_t i = 0; i < pcs.size(); ++i) {
+        SCOPED_TRACE(testing::Message() << "pc 0x" << std::hex << pcs[i]);
+        EXPECT_EQ(batch[i].addr, pcs[i]);
+        ASSERT_EQ(batch[i].found, each[i].found);
+        if (each[i].found) {
+            EXPECT_EQ(static_cast<const std::string&>(batch[i].name),
+                      static_cast<const std::string&>(each[i].name));
+            EXPECT_EQ(batch[i].offset, each[i].offset);
+            ++*found;
+        }
+    }
+}
+
+struct Symbol {
+    uint32_t value;
+    uint32_t size;
+    uint8_t type;
+    const char* name;
+};
+
+// 只有符号表的 32 位 ARM ELF, 符号不按地址排序
+std::vector<uint8_t> arm_image(const std::vector<Symbol>& symbols) {
+    constexpr uint32_t kShdrOffset = 0x40;
+    constexpr uint32_t kSymtabOffset = 0x100;
+    const uint32_t strtab_offset = kSymtabOffset + (symbols.size() + 1) * sizeof(Elf32_Sym);
+
+    std::string strtab(1, '\0');
+    std::vector<Elf32_Sym> syms(1);
+    for (const auto& symbol : symbols) {
+        Elf32_Sym sym{};
+        sym.st_name = strtab.size();
+        sym.st_value = symbol.value;
+        sym.st_size = symbol.size;
+        sym.st_info = ELF32_ST_INFO(STB_GLOBAL, symbol.type);
+        sym.st_shndx = 1;
+        syms.push_back(sym);
+        strtab += symbol.name;
+        strtab += '\0';
+    }
+    const char shstrtab[] = "\0.symtab\0.strtab\0.shstrtab";
+    const uint32_t shstrtab_offset = strtab_offset + strtab.size();
+
+    Elf32_Ehdr ehdr{};
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_DYN;
+    ehdr.e_machine = EM_ARM;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr.e_phentsize = sizeof(Elf32_Phdr);
+    ehdr.e_shoff = kShdrOffset;
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum = 4;
+    ehdr.e_shstrndx = 3;
+
+    Elf32_Shdr shdrs[4]{};
+    shdrs[1] = {.sh_name = 1, .sh_type = SHT_SYMTAB, .sh_offset = kSymtabOffset,
+                .sh_size = static_cast<Elf32_Word>(syms.size() * sizeof(Elf32_Sym)),
+                .sh_link = 2, .sh_entsize = sizeof(Elf32_Sym)};
+    shdrs[2] = {.sh_name = 9, .sh_type = SHT_STRTAB, .sh_offset = strtab_offset,
+                .sh_size = static_cast<Elf32_Word>(strtab.size())};
+    shdrs[3] = {.sh_name = 17, .sh_type = SHT_STRTAB, .sh_offset = shstrtab_offset,
+                .sh_size = sizeof(shstrtab)};
+
+    std::vector<uint8_t> image(shstrtab_offset + sizeof(shstrtab));
+    memcpy(image.data(), &ehdr, sizeof(ehdr));
+    memcpy(image.data() + kShdrOffset, shdrs, sizeof(shdrs));
+    memcpy(image.data() + kSymtabOffset, syms.data(), syms.size() * sizeof(Elf32_Sym));
+    memcpy(image.data() + strtab_offset, strtab.data(), strtab.size());
+    memcpy(image.data() + shstrtab_offset, shstrtab, sizeof(shstrtab));
+    return image;
+}
+
+std::unique_ptr<unwindstack::Elf> arm_elf(const std::vector<uint8_t>& image) {
+    auto* memory = new Dwarf::SectionMemory;
+    memory->data = image;
+    auto elf = std::make_unique<unwindstack::Elf>(memory);
+    EXPECT_TRUE(elf->Init());
+    EXPECT_EQ(elf->machine_type(), static_cast<uint32_t>(EM_ARM));
+    return elf;
+}
+
+}
+
+// 在测试程序自身上, 批量查找与逐个查找的结果一致, 包括符号之间和最后一个符号之后的 pc
+TEST(Symbols, batch_matches_each) {
+    auto batch_elf = std::make_unique<unwindstack::Elf>(
+            unwindstack::Memory::CreateFileMemory("/proc/self/exe", 0).release());
+    auto each_elf = std::make_unique<unwindstack::Elf>(
+            unwindstack::Memory::CreateFileMemory("/proc/self/exe", 0).release());
+    ASSERT_TRUE(batch_elf->Init());
+    ASSERT_TRUE(each_elf->Init());
+
+    uint64_t size = std::filesystem::file_size("/proc/self/exe");
+    uint64_t step = (size / 50000) | 1;
+    std::vector<uint64_t> pcs;
+    for (uint64_t pc = 0; pc < size; pc += step) {
+        pcs.push_back(pc);
+    }
+    pcs.push_back(size * 4);
+    pcs.push_back(1ull << 40);
+    pcs.push_back(UINT64_MAX - 1);
+
+    size_t found = 0;
+    SymbolLookup::expect_same(batch_elf.get(), each_elf.get(), pcs, &found);
+    EXPECT_GT(found, 0u);
+    EXPECT_LT(found, pcs.size());
+
+    // 已经建立索引后, 未排序的批次也要得到同样的结果
+    std::reverse(pcs.begin(), pcs.end());
+    SymbolLookup::expect_same(batch_elf.get(), each_elf.get(), pcs, &found);
+}
+
+// ARM 的 thumb 符号地址带 bit 0, 查找时 pc 置 bit 0, 结果的偏移清除 bit 0
+TEST(Symbols, batch_matches_each_arm) {
+    auto image = SymbolLookup::arm_image({
+            {0x2000, 0x8, STT_FUNC, "arm_last"},
+            {0x1201, 0x10, STT_FUNC, "thumb_c"},
+            {0x1001, 0x20, STT_FUNC, "thumb_a"},
+            {0x1300, 0x100, STT_OBJECT, "data"},
+            {0x1100, 0x40, STT_FUNC, "arm_b"},
+            {0x1100, 0x80, STT_FUNC, "arm_b_alias"},
+    });
+    auto batch_elf = SymbolLookup::arm_elf(image);
+    auto each_elf = SymbolLookup::arm_elf(image);
+
+    std::vector<uint64_t> pcs;
+    for (uint64_t pc = 0xf00; pc < 0x2100; pc += 3) {
+        pcs.push_back(pc);
+    }
+    pcs.push_back(0x10000);
+    pcs.push_back(UINT32_MAX);
+    size_t found = 0;
+    SymbolLookup::expect_same(batch_elf.get(), each_elf.get(), pcs, &found);
+    EXPECT_GT(found, 0u);
+
+    std::vector<unwindstack::FunctionLookup> lookups;
+    for (uint64_t pc : {0x1000, 0x1011, 0x101f, 0x1020, 0x1080, 0x1104, 0x1140, 0x1200,
+                        0x1300, 0x2007, 0x2008}) {
+        lookups.push_back({.addr = pc});
+    }
+    batch_elf->GetFunctionNames(&lookups);
+    const struct {
+        bool found;
+        const char* name;
+        uint64_t offset;
+    } expected[] = {
+            {true, "thumb_a", 0x0}, {true, "thumb_a", 0x10}, {true, "thumb_a", 0x1e},
+            {false, "", 0},         {false, "", 0},          {true, "arm_b", 0x4},
+            {false, "", 0},         {true, "thumb_c", 0x0},  {false, "", 0},
+            {true, "arm_last", 0x6}, {false, "", 0},
+    };
+    ASSERT_EQ(lookups.size(), std::size(expected));
+    for (size_t i = 0; i < lookups.size(); ++i) {
+        SCOPED_TRACE(testing::Message() << "pc 0x" << std::hex << lookups[i].addr);
+        ASSERT_EQ(lookups[i].found, expected[i].found);
+        if (expected[i].found) {
+            EXPECT_EQ(static_cast<const std::string&>(lookups[i].name), expected[i].name);
+            EXPECT_EQ(lookups[i].offset, expected[i].offset);
+        }
+    }
+}
+
+namespace Memo {
+
+// 同一个现场先用 memo 回栈, 再不带 memo 完整回一遍, 两者应当完全一致
+struct Result {
+    std::vector<unwindstack::FrameData> memo;
+    std::vector<unwindstack::FrameData> full;
+};
+
+unwindstack::Maps* local_maps() {
+    static unwindstack::LocalMaps* maps = [] {
+        auto maps = new unwindstack::LocalMaps();
+        maps->Parse();
+        return maps;
+    }();
+    return maps;
+}
+
+__attribute__((noinline)) void unwind_both(unwindstack::UnwindMemo* memo, Result* result) {
+    std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::CreateFromLocal());
+    unwindstack::RegsGetLocal(regs.get());
+    std::unique_ptr<unwindstack::Regs> copy(regs->Clone());
+    auto memory = unwindstack::Memory::CreateProcessMemoryThreadCached(getpid());
+
+    unwindstack::Unwinder memo_unwinder(64, local_maps(), regs.get(), memory);
+    memo_unwinder.SetMemo(memo);
+    memo_unwinder.Unwind();
+    result->memo = memo_unwinder.ConsumeFrames();
+
+    unwindstack::Unwinder full_unwinder(64, local_maps(), copy.get(), memory);
+    full_unwinder.Unwind();
+    result->full = full_unwinder.ConsumeFrames();
+}
+
+void expect_same(const Result& result) {
+    ASSERT_EQ(result.memo.size(), result.full.size());
+    for (size_t i = 0; i < result.memo.size(); ++i) {
+        EXPECT_EQ(result.memo[i].pc, result.full[i].pc) << "frame " << i;
+        EXPECT_EQ(result.memo[i].sp, result.full[i].sp) << "frame " << i;
+        EXPECT_EQ(static_cast<const std::string&>(result.memo[i].function_name),
+                  static_cast<const std::string&>(result.full[i].function_name))
+                << "frame " << i;
+    }
+}
+
+__attribute__((noinline)) void recurse(int depth, unwindstack::UnwindMemo* memo, Result* result) {
+    if (depth > 0) {
+        recurse(depth - 1, memo, result);
+        asm volatile("" ::: "memory");  // 防止尾调用优化
+        return;
+    }
+    unwind_both(memo, result);
+}
+
+struct CallbackArgs {
+    unwindstack::UnwindMemo* memo;
+    Result* result;
+};
+
+__attribute__((noinline)) void callback(void* arg) {
+    auto args = static_cast<CallbackArgs*>(arg);
+    unwind_both(args->memo, args->result);
+    asm volatile("" ::: "memory");
+}
+
+}
+
+// memo_call_with_frame(cb, frame, arg) 把 frame 放进 callee-saved 寄存器后调用 cb(arg),
+// 这一帧的 CFA 由这个寄存器决定: 保存的寄存器在 frame[0], 返回地址在 frame[1].
+// 两个 frame 分别返回到 memo_fake_ret_a / memo_fake_ret_b, 那里的返回地址未定义, 回栈到此结束
+#if defined(__aarch64__)
+asm(R"(
+    .text
+    .p2align 2
+    .type memo_call_with_frame, %function
+memo_call_with_frame:
+    .cfi_startproc
+    stp x19, x30, [sp, #-16]!
+    .cfi_def_cfa_offset 16
+    .cfi_offset x19, -16
+    .cfi_offset x30, -8
+    mov x19, x1
+    .cfi_def_cfa x19, 16
+    mov x3, x0
+    mov x0, x2
+    blr x3
+    .cfi_def_cfa sp, 16
+    ldp x19, x30, [sp], #16
+    .cfi_def_cfa_offset 0
+    .cfi_restore x19
+    .cfi_restore x30
+    ret
+    .cfi_endproc
+    .size memo_call_with_frame, .-memo_call_with_frame
+
+    .type memo_fake_callers, %function
+memo_fake_callers:
+    .cfi_startproc
+    .cfi_undefined x30
+    nop
+memo_fake_ret_a:
+    nop
+memo_fake_ret_b:
+    nop
+    ret
+    .cfi_endproc
+    .size memo_fake_callers, .-memo_fake_callers
+)");
+#define MEMO_HAS_FAKE_FRAMES 1
+#elif defined(__x86_64__)
+asm(R"(
+    .text
+    .p2align 4
+    .type memo_call_with_frame, @function
+memo_call_with_frame:
+    .cfi_startproc
+    push %rbx
+    .cfi_def_cfa_offset 16
+    .cfi_offset %rbx, -16
+    mov %rsi, %rbx
+    .cfi_def_cfa %rbx, 16
+    mov %rdi, %rax
+    mov %rdx, %rdi
+    call *%rax
+    .cfi_def_cfa %rsp, 16
+    pop %rbx
+    .cfi_def_cfa_offset 8
+    .cfi_restore %rbx
+    ret
+    .cfi_endproc
+    .size memo_call_with_frame, .-memo_call_with_frame
+
+    .type memo_fake_callers, @function
+memo_fake_callers:
+    .cfi_startproc
+    .cfi_undefined %rip
+    nop
+memo_fake_ret_a:
+    nop
+memo_fake_ret_b:
+    nop
+    ret
+    .cfi_endproc
+    .size memo_fake_callers, .-memo_fake_callers
+)");
+#define MEMO_HAS_FAKE_FRAMES 1
+#endif
+
+#if defined(MEMO_HAS_FAKE_FRAMES)
+extern "C" void memo_call_with_frame(void (*cb)(void*), uintptr_t* frame, void* arg);
+extern "C" char memo_fake_ret_a[];
+extern "C" char memo_fake_ret_b[];
+#endif
+
+TEST(StackMemo, matches_full_unwind) {
+    unwindstack::UnwindMemo memo;
+    const int depths[] = {8, 8, 16, 4, 16, 16, 8};
+    for (int depth : depths) {
+        Memo::Result result;
+        Memo::recurse(depth, &memo, &result);
+        ASSERT_GT(result.full.size(), static_cast<size_t>(depth));
+        Memo::expect_same(result);
+    }
+}
+
+// 外层帧的 pc/sp/fp/lr 都相同, 只有 CFA 所在的 callee-saved 寄存器不同, 不能复用上一次的结果
+TEST(StackMemo, cfa_from_callee_saved) {
+#if defined(MEMO_HAS_FAKE_FRAMES)
+    static uintptr_t frame_a[4] = {0, reinterpret_cast<uintptr_t>(memo_fake_ret_a)};
+    static uintptr_t frame_b[4] = {0, reinterpret_cast<uintptr_t>(memo_fake_ret_b)};
+    uintptr_t* frames[] = {frame_a, frame_b, frame_b, frame_a};
+
+    unwindstack::UnwindMemo memo;
+    std::vector<uintptr_t> last_pcs;
+    for (uintptr_t* frame : frames) {
+        Memo::Result result;
+        Memo::CallbackArgs args{&memo, &result};
+        memo_call_with_frame(Memo::callback, frame, &args);
+        ASSERT_FALSE(result.full.empty());
+        Memo::expect_same(result);
+        // 最外层是假的调用者
+        uint64_t ret = result.full.back().pc;
+        EXPECT_LT(ret, frame[1]);
+        EXPECT_GE(ret + 4, frame[1]);
+    }
+#else
+    GTEST_SKIP() << "no fake frames for this architecture";
+#endif
+}
+
+namespace Sampler {
+
+std::atomic<bool> stop(false);
+std::atomic<pid_t> tid(0);
+std::atomic<size_t> loops(0);
+
+__attribute__((noinline)) void spin() {
+    tid = gettid();
+    while (!stop.load(std::memory_order_relaxed)) {
+        void* ptr = malloc(64 + loops.load(std::memory_order_relaxed) % 1024);
+        asm volatile("" : : "r"(ptr) : "memory");
+        free(ptr);
+        loops.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// 每层占 4KB 栈, 递归到底后一直运行, 外层的栈帧在复制的 64KB 之外
+__attribute__((noinline)) void deep_spin(int depth) {
+    volatile char pad[4096];
+    pad[0] = static_cast<char>(depth);
+    if (depth > 0) {
+        deep_spin(depth - 1);
+        asm volatile("" ::: "memory");  // 防止尾调用优化
+        return;
+    }
+    tid = gettid();
+    while (!stop.load(std::memory_order_relaxed)) {
+        loops.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+__attribute__((noinline)) void deep_entry() {
+    deep_spin(32);
+    asm volatile("" ::: "memory");
+}
+
+}
+
+// 被采样的线程一直在 malloc/free, 采样只复制寄存器和栈, 回栈期间它要继续运行,
+// 回栈时的申请也不能与它持有的锁互相等待
+TEST(StackSampler, target_keeps_running) {
+    const int signal = SIGRTMAX - 2;
+    ASSERT_TRUE(DebugDisableInitialize());
+    ASSERT_TRUE(UnwindThreadInit(signal));
+    UnwindWarmupStart();
+    std::thread spinner(Sampler::spin);
+    while (Sampler::tid == 0) {
+        std::this_thread::yield();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    std::vector<uintptr_t> frames;
+    std::vector<unwindstack::FrameData> frames_info;
+    size_t samples = 0;
+    size_t with_spin = 0;
+    while (samples < 50 && std::chrono::steady_clock::now() < deadline) {
+        size_t before = Sampler::loops;
+        unwindstack::ErrorCode code =
+                UnwindThread(Sampler::tid, signal, &frames, &frames_info, 64);
+        if (code == unwindstack::ERROR_UNSUPPORTED) {
+            // 预热还没有完成
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        ASSERT_NE(code, unwindstack::ERROR_THREAD_TIMEOUT);
+        samples++;
+        for (const auto& frame : frames_info) {
+            if (static_cast<const std::string&>(frame.function_name).find("Sampler4spin") !=
+                std::string::npos) {
+                with_spin++;
+                break;
+            }
+        }
+        while (Sampler::loops == before && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        ASSERT_GT(Sampler::loops, before);
+    }
+    Sampler::stop = true;
+    spinner.join();
+    EXPECT_EQ(samples, 50u);
+    EXPECT_GT(with_spin, 0u);
+}
+
+// 复制的栈之外的部分在线程继续运行后已经改变, 回栈到副本末尾为止, 不读取现在的栈
+TEST(StackSampler, stops_at_snapshot_end) {
+    const int signal = SIGRTMAX - 2;
+    ASSERT_TRUE(DebugDisableInitialize());
+    ASSERT_TRUE(UnwindThreadInit(signal));
+    UnwindWarmupStart();
+    Sampler::stop = false;
+    Sampler::tid = 0;
+    std::thread spinner(Sampler::deep_entry);
+    while (Sampler::tid == 0) {
+        std::this_thread::yield();
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    std::vector<uintptr_t> frames;
+    std::vector<unwindstack::FrameData> frames_info;
+    size_t samples = 0;
+    while (samples < 10 && std::chrono::steady_clock::now() < deadline) {
+        unwindstack::ErrorCode code =
+                UnwindThread(Sampler::tid, signal, &frames, &frames_info, 64);
+        if (code == unwindstack::ERROR_UNSUPPORTED) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+        ASSERT_NE(code, unwindstack::ERROR_THREAD_TIMEOUT);
+        samples++;
+        size_t deep = 0;
+        for (const auto& frame : frames_info) {
+            const std::string& name = frame.function_name;
+            deep += name.find("deep_spin") != std::string::npos;
+            EXPECT_EQ(name.find("deep_entry"), std::string::npos);
+        }
+        EXPECT_GT(deep, 0u);
+        EXPECT_LE(deep, 16u);
+    }
+    Sampler::stop = true;
+    spinner.join();
+    EXPECT_EQ(samples, 10u);
+}
+
+namespace Ring {
+
+const size_t kCapacity = 4096;
+
+// 写入一条负载为 payload_size 字节的记录, 负载开头写入 seq
+bool write(StackRing* ring, size_t payload_size, uint64_t seq) {
+    void* payload = ring->Reserve(payload_size);
+    if (payload == nullptr) {
+        return false;
+    }
+    memcpy(payload, &seq, sizeof(seq));
+    ring->Commit(payload, kRecordFree);
+    return true;
+}
+
+// 读出一条记录并检查 seq, 返回校验过的记录大小
+size_t read(StackRing* ring, uint64_t seq) {
+    size_t size = 0;
+    const RingRecordHeader* record = ring->Peek(UINT64_MAX, &size);
+    if (record == nullptr) {
+        return 0;
+    }
+    uint64_t value;
+    memcpy(&value, record + 1, sizeof(value));
+    EXPECT_EQ(value, seq);
+    ring->Pop(size);
+    return size;
+}
+
+}
+
+// 写入的总量是容量的很多倍, 每条记录都原样读出
+TEST(StackRing, wrap) {
+    StackRing ring;
+    ASSERT_TRUE(ring.Create(Ring::kCapacity));
+    size_t total = 0;
+    for (uint64_t seq = 0; seq < 1000; ++seq) {
+        size_t payload_size = 8 + seq * 40 % 600;
+        ASSERT_TRUE(Ring::write(&ring, payload_size, seq));
+        size_t size = Ring::read(&ring, seq);
+        ASSERT_GE(size, sizeof(RingRecordHeader) + payload_size);
+        EXPECT_EQ(size % 8, 0u);
+        total += size;
+    }
+    EXPECT_GT(total, Ring::kCapacity * 10);
+    EXPECT_EQ(ring.read_pos(), ring.write_pos());
+    EXPECT_FALSE(ring.corrupted());
+}
+
+// 末尾放不下的记录从头开始写, 读端跳过末尾的填充
+TEST(StackRing, padding) {
+    StackRing ring;
+    ASSERT_TRUE(ring.Create(Ring::kCapacity));
+    for (uint64_t seq = 0; seq < 3; ++seq) {
+        ASSERT_TRUE(Ring::write(&ring, 1000, seq));
+        ASSERT_EQ(Ring::read(&ring, seq), 1008u);
+    }
+    ASSERT_EQ(ring.write_pos(), 3024u);
+
+    ASSERT_TRUE(Ring::write(&ring, 1500, 3));
+    // 末尾剩下的 1072 字节是填充
+    EXPECT_EQ(ring.write_pos(), Ring::kCapacity + 1512);
+    EXPECT_EQ(Ring::read(&ring, 3), 1512u);
+    EXPECT_EQ(ring.read_pos(), ring.write_pos());
+}
+
+// 写满后预留失败, 读出一条后又可以写入
+TEST(StackRing, full_drop) {
+    StackRing ring;
+    ASSERT_TRUE(ring.Create(Ring::kCapacity));
+    uint64_t written = 0;
+    while (Ring::write(&ring, 1000, written)) {
+        written++;
+    }
+    EXPECT_EQ(written, 4u);
+    ring.AddDropped();
+    EXPECT_EQ(ring.dropped(), 1u);
+    // 超过容量一半的记录永远写不进去
+    EXPECT_EQ(ring.Reserve(Ring::kCapacity / 2), nullptr);
+
+    ASSERT_EQ(Ring::read(&ring, 0), 1008u);
+    ASSERT_TRUE(Ring::write(&ring, 1000, written));
+    for (uint64_t seq = 1; seq <= written; ++seq) {
+        ASSERT_EQ(Ring::read(&ring, seq), 1008u);
+    }
+    EXPECT_EQ(ring.read_pos(), ring.write_pos());
+}
+
+// 写端改坏记录大小后, 读端标记损坏并且不再前进
+TEST(StackRing, corrupt_size) {
+    const uint32_t sizes[] = {0, 4, 12, Ring::kCapacity, 0x80000000u};
+    for (uint32_t bad_size : sizes) {
+        StackRing writer;
+        ASSERT_TRUE(writer.Create(Ring::kCapacity));
+        StackRing reader;
+        ASSERT_TRUE(reader.Attach(dup(writer.fd())));
+
+        void* payload = writer.Reserve(64);
+        ASSERT_NE(payload, nullptr);
+        writer.Commit(payload, kRecordAlloc);
+        auto* header = static_cast<RingRecordHeader*>(payload) - 1;
+        header->size.store(bad_size, std::memory_order_relaxed);
+        ASSERT_TRUE(Ring::write(&writer, 8, 1));
+
+        size_t size = 0;
+        EXPECT_EQ(reader.Peek(UINT64_MAX, &size), nullptr) << bad_size;
+        EXPECT_TRUE(reader.corrupted()) << bad_size;
+        EXPECT_EQ(reader.Peek(UINT64_MAX, &size), nullptr) << bad_size;
+        EXPECT_EQ(reader.read_pos(), 0u) << bad_size;
+    }
+}
+
+namespace Pprof {
+
+// 只解码测试用到的 Profile 字段
+struct Proto {
+    explicit Proto(const std::string& data) : pos(data.data()), end(data.data() + data.size()) {}
+
+    bool varint(uint64_t* value) {
+        *value = 0;
+        for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+            uint8_t byte = *pos++;
+            *value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // 读出下一个字段, varint 放在 value, length-delimited 放在 bytes
+    bool next(uint32_t* field, uint64_t* value, std::string* bytes) {
+        uint64_t tag;
+        if (pos == end || !varint(&tag)) {
+            return false;
+        }
+        *field = tag >> 3;
+        wire = tag & 7;
+        if (wire == 0) {
+            return varint(value);
+        }
+        uint64_t size;
+        if (wire != 2 || !varint(&size) || size > static_cast<uint64_t>(end - pos)) {
+            return false;
+        }
+        bytes->assign(pos, size);
+        pos += size;
+        return true;
+    }
+
+    // 解码成 字段号 -> 值, repeated 和 packed 的字段按顺序追加,
+    // nested_field 是嵌套的消息, 原样放在 nested
+    std::map<uint32_t, std::vector<uint64_t>> varints(
+            uint32_t nested_field = 0, std::vector<std::string>* nested = nullptr) {
+        std::map<uint32_t, std::vector<uint64_t>> fields;
+        uint32_t field;
+        uint64_t value;
+        std::string bytes;
+        while (next(&field, &value, &bytes)) {
+            if (wire == 0) {
+                fields[field].push_back(value);
+            } else if (field == nested_field) {
+                nested->push_back(bytes);
+            } else {
+                Proto packed(bytes);
+                while (packed.pos < packed.end && packed.varint(&value)) {
+                    fields[field].push_back(value);
+                }
+                EXPECT_EQ(packed.pos, packed.end);
+            }
+        }
+        EXPECT_EQ(pos, end);
+        return fields;
+    }
+
+    const char* pos;
+    const char* end;
+    uint32_t wire = 0;
+};
+
+uint64_t get(const std::map<uint32_t, std::vector<uint64_t>>& fields, uint32_t field) {
+    auto entry = fields.find(field);
+    return entry == fields.end() ? 0 : entry->second.at(0);
+}
+
+std::string inflate_fd(int fd) {
+    std::string compressed;
+    char buffer[4096];
+    ssize_t size;
+    lseek(fd, 0, SEEK_SET);
+    while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+        compressed.append(buffer, size);
+    }
+
+    z_stream stream = {};
+    EXPECT_EQ(inflateInit2(&stream, 15 + 16), Z_OK);
+    stream.next_in = reinterpret_cast<Bytef*>(compressed.data());
+    stream.avail_in = compressed.size();
+    std::string data;
+    int ret;
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(buffer);
+        stream.avail_out = sizeof(buffer);
+        ret = inflate(&stream, Z_NO_FLUSH);
+        data.append(buffer, sizeof(buffer) - stream.avail_out);
+    } while (ret == Z_OK);
+    EXPECT_EQ(ret, Z_STREAM_END);
+    inflateEnd(&stream);
+    return data;
+}
+
+unwindstack::FrameData frame(
+        uint64_t pc, const std::shared_ptr<unwindstack::MapInfo>& map_info, const char* name) {
+    unwindstack::FrameData frame{};
+    frame.pc = pc;
+    frame.map_info = map_info;
+    frame.function_name = unwindstack::SharedString(name);
+    return frame;
+}
+
+}
+
+// 写出的 Profile 解压后能解码, 各种 id 都能对应上
+TEST(PprofWriter, decode) {
+    int fd = memfd_create("alloc_hook_pprof_test", MFD_CLOEXEC);
+    ASSERT_GE(fd, 0);
+
+    auto lib = unwindstack::MapInfo::Create(
+            0x1000, 0x3000, 0, PROT_READ | PROT_EXEC, "/lib/liba.so");
+    auto app = unwindstack::MapInfo::Create(
+            0x8000, 0x9000, 0x2000, PROT_READ | PROT_EXEC, "/bin/app");
+    std::vector<std::vector<unwindstack::FrameData>> stacks = {
+            {Pprof::frame(0x1010, lib, "_Z6mallocv"), Pprof::frame(0x8010, app, "main")},
+            {Pprof::frame(0x1020, lib, "_Z6mallocv"), Pprof::frame(0x2000, lib, ""),
+             Pprof::frame(0x8010, app, "main")},
+            {Pprof::frame(0x40, nullptr, ""), Pprof::frame(0x8020, app, "main")},
+    };
+    std::vector<std::vector<int64_t>> values = {{1, 16, 1, 16}, {2, 64, 0, 0}, {3, 300, 1, 100}};
+    const char* labels[] = {"host", "mmap", "dma"};
+
+    PprofWriter writer(fd);
+    ASSERT_TRUE(writer.Begin({{"alloc_objects", "count"},
+                              {"alloc_space", "bytes"},
+                              {"inuse_objects", "count"},
+                              {"inuse_space", "bytes"}},
+                             3, "peak"));
+    for (size_t i = 0; i < stacks.size(); ++i) {
+        writer.AddSample(stacks[i], values[i], "alloc_type", labels[i]);
+    }
+    ASSERT_TRUE(writer.Finish());
+    std::string data = Pprof::inflate_fd(fd);
+    close(fd);
+
+    std::vector<std::string> strings;
+    std::vector<std::string> sample_types;
+    std::vector<std::string> samples;
+    std::map<uint64_t, std::map<uint32_t, std::vector<uint64_t>>> mappings;
+    std::map<uint64_t, std::map<uint32_t, std::vector<uint64_t>>> functions;
+    std::map<uint64_t, std::map<uint32_t, std::vector<uint64_t>>> locations;
+    std::map<uint64_t, std::vector<std::string>> lines;
+    std::map<uint32_t, uint64_t> scalars;
+    Pprof::Proto profile(data);
+    uint32_t field;
+    uint64_t value = 0;
+    std::string bytes;
+    while (profile.next(&field, &value, &bytes)) {
+        if (field == 6) {
+            strings.push_back(bytes);
+        } else if (field == 1) {
+            sample_types.push_back(bytes);
+        } else if (field == 2) {
+            samples.push_back(bytes);
+        } else if (field == 3 || field == 5) {
+            auto fields = Pprof::Proto(bytes).varints();
+            auto& table = field == 3 ? mappings : functions;
+            EXPECT_TRUE(table.emplace(Pprof::get(fields, 1), fields).second) << "重复的 id";
+        } else if (field == 4) {
+            std::vector<std::string> nested;
+            auto fields = Pprof::Proto(bytes).varints(4, &nested);  // Location.line
+            EXPECT_TRUE(locations.emplace(Pprof::get(fields, 1), fields).second) << "重复的 id";
+            lines[Pprof::get(fields, 1)] = nested;
+        } else if (profile.wire == 0) {
+            scalars[field] = value;
+        }
+    }
+    ASSERT_EQ(profile.pos, profile.end);
+
+    auto str = [&strings](uint64_t index) {
+        EXPECT_LT(index, strings.size());
+        return index < strings.size() ? strings[index] : std::string("<bad index>");
+    };
+    ASSERT_FALSE(strings.empty());
+    EXPECT_EQ(strings[0], "");
+
+    // 四种类型按顺序, 默认显示 inuse_space
+    const std::pair<const char*, const char*> expected_types[] = {
+            {"alloc_objects", "count"},
+            {"alloc_space", "bytes"},
+            {"inuse_objects", "count"},
+            {"inuse_space", "bytes"}};
+    ASSERT_EQ(sample_types.size(), std::size(expected_types));
+    for (size_t i = 0; i < sample_types.size(); ++i) {
+        auto fields = Pprof::Proto(sample_types[i]).varints();
+        EXPECT_EQ(str(Pprof::get(fields, 1)), expected_types[i].first);
+        EXPECT_EQ(str(Pprof::get(fields, 2)), expected_types[i].second);
+    }
+    EXPECT_EQ(str(scalars[14]), "inuse_space");
+    EXPECT_EQ(str(scalars[13]), "peak");
+    EXPECT_EQ(scalars[12], 1u);
+    EXPECT_NE(scalars[9], 0u);
+
+    // id 从 1 开始连续, 引用的 id 都存在
+    for (const auto* table : {&mappings, &functions, &locations}) {
+        uint64_t id = 1;
+        for (const auto& entry : *table) {
+            EXPECT_EQ(entry.first, id++);
+        }
+    }
+    ASSERT_EQ(mappings.size(), 2u);
+    for (const auto& [id, fields] : mappings) {
+        std::string name = str(Pprof::get(fields, 5));
+        const auto& map_info = name == "/lib/liba.so" ? lib : app;
+        EXPECT_EQ(name, std::string(map_info->name()));
+        EXPECT_EQ(Pprof::get(fields, 2), map_info->start());
+        EXPECT_EQ(Pprof::get(fields, 3), map_info->end());
+        EXPECT_EQ(Pprof::get(fields, 4), map_info->offset());
+    }
+    for (const auto& [id, fields] : functions) {
+        EXPECT_EQ(Pprof::get(fields, 2), Pprof::get(fields, 3));
+        str(Pprof::get(fields, 4));
+    }
+
+    ASSERT_EQ(samples.size(), stacks.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        SCOPED_TRACE(i);
+        std::vector<std::string> label;
+        auto fields = Pprof::Proto(samples[i]).varints(3, &label);
+        const auto& location_ids = fields[1];
+        ASSERT_EQ(location_ids.size(), stacks[i].size());
+        std::vector<uint64_t> expected_values(values[i].begin(), values[i].end());
+        EXPECT_EQ(fields[2], expected_values);
+        ASSERT_EQ(label.size(), 1u);
+        auto label_fields = Pprof::Proto(label[0]).varints();
+        EXPECT_EQ(str(Pprof::get(label_fields, 1)), "alloc_type");
+        EXPECT_EQ(str(Pprof::get(label_fields, 2)), labels[i]);
+
+        for (size_t j = 0; j < location_ids.size(); ++j) {
+            const auto& frame = stacks[i][j];
+            ASSERT_EQ(locations.count(location_ids[j]), 1u);
+            const auto& location = locations[location_ids[j]];
+            EXPECT_EQ(Pprof::get(location, 3), frame.pc);
+            uint64_t mapping_id = Pprof::get(location, 2);
+            if (frame.map_info == nullptr) {
+                EXPECT_EQ(mapping_id, 0u);
+            } else {
+                ASSERT_EQ(mappings.count(mapping_id), 1u);
+                EXPECT_EQ(str(Pprof::get(mappings[mapping_id], 5)),
+                          std::string(frame.map_info->name()));
+            }
+
+            const auto& location_lines = lines[location_ids[j]];
+            if (frame.function_name.empty()) {
+                EXPECT_TRUE(location_lines.empty());
+                continue;
+            }
+            ASSERT_EQ(location_lines.size(), 1u);
+            uint64_t function_id = Pprof::get(Pprof::Proto(location_lines[0]).varints(), 1);
+            ASSERT_EQ(functions.count(function_id), 1u);
+            const auto& function = functions[function_id];
+            EXPECT_EQ(str(Pprof::get(function, 2)),
+                      std::string(unwindstack::DemangleNameCached(frame.function_name)));
+            EXPECT_EQ(str(Pprof::get(function, 4)), std::string(frame.map_info->name()));
+        }
+    }
+    // 同一个 pc 只有一个 location, 同名同文件的函数只有一个
+    EXPECT_EQ(locations.size(), 6u);
+    EXPECT_EQ(functions.size(), 2u);
+}
+
 TEST(DmaAlloc, ioctl) {
     const size_t size = 79 * 1024 * 1024;
     std::pair<int, int> node = Memory::dma_alloc(size);
@@ -336,6 +2255,28 @@ TEST(DmaAlloc, ioctl) {
     Memory::run_alloc(dmaAlloc, damFree, qsize);
 }
 
+TEST(DmaAlloc, dup) {
+    const size_t size = 83 * 1024 * 1024;
+    std::pair<int, int> node = Memory::dma_alloc(size);
+    int dup_fd = -1;
+
+    // 关闭原始 fd 后, dup 出来的 fd 和 mapping 仍然持有 dma-buf
+    auto dmaAlloc = [&]() {
+        dup_fd = dup(node.second);
+        ASSERT(dup_fd < 0, "failed to dup dma fd: %s", strerror(errno));
+        close(node.second);
+        return mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, dup_fd, 0);
+    };
+    auto damFree = [&] (void* ptr, size_t size) {
+        munmap(ptr, size);
+        close(dup_fd);
+        close(node.first);
+    };
+    auto qsize = [&](const void* ptr) {return size;};
+
+    Memory::run_alloc(dmaAlloc, damFree, qsize);
+}
+
 TEST(OpenCLAlloc, clcreatebuffer) {
     const size_t size = 128 * 1024 * 1024;
 
@@ -0,0 +1,437 @@
+#include <inttypes.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include <unwindstack/Error.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+
+#include "ClientSession.h"
+#include "DumpFormat.h"
+#include "MemoryOfflineBuffer.h"
+
+// 与 PointerData.h 中的 MemType 一致
+static constexpr uint32_t kMemTypeDma = 2;
+static const char* const kMemTypeNames[] = {"host", "mmap", "dma"};
+
+// 与 UnwindBacktrace.cpp 中本地回栈的配置一致
+static const std::vector<std::string> kInitialMapsToSkip = {"liballoc_hook.so"};
+static const std::vector<std::string> kFunctionsToExit = {
+        "_Z24__init_additional_stacksP18pthread_internal_t", "_Z25__allocate_thread_mappingmm"};
+
+static constexpr int kIdlePollMs = 2;
+// 找不到 pc 所在的 map 时重新读取 maps 的最小间隔, jit 等新映射不会通知 unwindd
+static constexpr uint64_t kMapsReloadIntervalMs = 100;
+// dump 时等待已预留但还没写完的记录, 写入的线程可能已经随进程一起退出
+static constexpr auto kMaxDrainWait = std::chrono::seconds(1);
+
+static int64_t ToNs(int64_t sec, int64_t nsec) {
+    return sec * 1000000000 + nsec;
+}
+
+static uint64_t NowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+// 栈内的地址只从 hook 拷贝的快照中读取, 其它地址 (内存中的 elf 等) 读目标进程
+class SnapshotMemory : public unwindstack::Memory {
+public:
+    explicit SnapshotMemory(int mem_fd) : mem_fd_(mem_fd), stack_(nullptr, 0, 0) {}
+    ~SnapshotMemory() override { close(mem_fd_); }
+
+    void SetStack(const uint8_t* data, uint64_t start, uint64_t size, uint64_t limit) {
+        stack_.Reset(data, start, start + size);
+        stack_start_ = start;
+        stack_limit_ = limit;
+    }
+
+    size_t Read(uint64_t addr, void* dst, size_t size) override {
+        if (addr >= stack_start_ && addr < stack_limit_) {
+            return stack_.Read(addr, dst, size);
+        }
+        if (addr > static_cast<uint64_t>(INT64_MAX)) {
+            return 0;
+        }
+        ssize_t bytes = TEMP_FAILURE_RETRY(pread64(mem_fd_, dst, size, addr));
+        return bytes < 0 ? 0 : bytes;
+    }
+
+private:
+    int mem_fd_;
+    unwindstack::MemoryOfflineBuffer stack_;
+    uint64_t stack_start_ = 0;
+    uint64_t stack_limit_ = 0;
+};
+
+ClientSession::ClientSession(int sock) : sock_(sock) {}
+
+ClientSession::~ClientSession() {
+    close(sock_);
+    if (maps_fd_ >= 0) {
+        close(maps_fd_);
+    }
+}
+
+bool ClientSession::Hello() {
+    UnwindDaemonMessage hello;
+    int fds[3];
+    int num_fds = UnwindDaemonRecv(sock_, &hello, fds, 3);
+    if (num_fds < 0) {
+        return false;
+    }
+
+    bool valid = num_fds == 3 && hello.request == kRequestHello &&
+                 hello.arch == static_cast<uint32_t>(unwindstack::Regs::CurrentArch());
+    if (valid) {
+        valid = ring_.Attach(fds[0]);
+        maps_fd_ = fds[1];
+        memory_ = std::make_shared<SnapshotMemory>(fds[2]);
+        if (!valid) {
+            close(fds[0]);
+        }
+    } else {
+        for (int i = 0; i < num_fds; i++) {
+            close(fds[i]);
+        }
+    }
+    if (valid) {
+        pid_ = hello.pid;
+        max_frames_ = hello.max_frames;
+        valid = ReloadMaps();
+    }
+
+    UnwindDaemonMessage reply = hello;
+    reply.status = valid ? 0 : -1;
+    if (!UnwindDaemonSend(sock_, reply, nullptr, 0) || !valid) {
+        fprintf(stderr, "unwindd: reject client %d\n", hello.pid);
+        return false;
+    }
+    printf("unwindd: client %d connected\n", pid_);
+    return true;
+}
+
+bool ClientSession::ReloadMaps() {
+    maps_reload_time_ = NowMs();
+
+    // maps 的 fd 由 hook 打开, 每次从头读到的都是 hook 进程当前的 maps
+    std::string buffer;
+    char data[16 * 1024];
+    for (off64_t offset = 0;;) {
+        ssize_t bytes = TEMP_FAILURE_RETRY(pread64(maps_fd_, data, sizeof(data), offset));
+        if (bytes < 0) {
+            return false;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        buffer.append(data, bytes);
+        offset += bytes;
+    }
+
+    // BufferMaps 只保存指针, buffer 必须与之同时替换
+    auto maps = std::make_unique<unwindstack::BufferMaps>(buffer.c_str());
+    if (!maps->Parse()) {
+        return false;
+    }
+    maps_ = std::move(maps);
+    maps_buffer_ = std::move(buffer);
+    return true;
+}
+
+void ClientSession::Run() {
+    if (!Hello()) {
+        return;
+    }
+
+    while (true) {
+        bool idle = !Drain(UINT64_MAX);
+        if (ring_.corrupted()) {
+            // 记录的大小不合法, 之后的位置都不可信, 不再读取这个客户端
+            fprintf(stderr, "unwindd: client %d ring corrupted\n", pid_);
+            break;
+        }
+        pollfd pfd = {.fd = sock_, .events = POLLIN, .revents = 0};
+        int ret = poll(&pfd, 1, idle ? kIdlePollMs : 0);
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+        if (ret <= 0) {
+            continue;
+        }
+
+        // 连接断开时 Recv 返回 -1, hook 进程已经退出, 剩下的记录不再处理
+        UnwindDaemonMessage request;
+        int fd = -1;
+        int num_fds = UnwindDaemonRecv(sock_, &request, &fd, 1);
+        if (num_fds < 0) {
+            break;
+        }
+        UnwindDaemonMessage reply = request;
+        reply.status = -1;
+        if (request.request == kRequestDump && num_fds == 1) {
+            HandleDump(fd);
+            reply.status = 0;
+        }
+        if (num_fds == 1) {
+            close(fd);
+        }
+        if (!UnwindDaemonSend(sock_, reply, nullptr, 0)) {
+            break;
+        }
+    }
+    printf("unwindd: client %d disconnected\n", pid_);
+}
+
+bool ClientSession::Drain(uint64_t limit) {
+    bool processed = false;
+    const RingRecordHeader* record;
+    size_t size;
+    while ((record = ring_.Peek(limit, &size)) != nullptr) {
+        Process(record, size);
+        ring_.Pop(size);
+        processed = true;
+    }
+    return processed;
+}
+
+// hook 进程可能同时修改共享内存, 先拷贝出来再校验和使用
+template <typename T>
+static bool CopyPayload(const void* payload, size_t payload_size, T* out) {
+    if (payload_size < sizeof(T)) {
+        return false;
+    }
+    memcpy(out, payload, sizeof(T));
+    return true;
+}
+
+void ClientSession::Process(const RingRecordHeader* record, size_t size) {
+    const auto* payload = reinterpret_cast<const uint8_t*>(record + 1);
+    size_t payload_size = size - sizeof(RingRecordHeader);
+    switch (record->type.load(std::memory_order_relaxed)) {
+        case kRecordAlloc: {
+            RingAlloc alloc;
+            if (!CopyPayload(payload, payload_size, &alloc)) {
+                break;
+            }
+            // 分开比较, 避免 regs_size + stack_size 溢出
+            size_t available = payload_size - sizeof(RingAlloc);
+            if (alloc.regs_size <= available && alloc.stack_size <= available - alloc.regs_size) {
+                Alloc(alloc, payload + sizeof(RingAlloc));
+            }
+            break;
+        }
+        case kRecordFree: {
+            RingFree free_record;
+            if (CopyPayload(payload, payload_size, &free_record)) {
+                Free(free_record.pointer);
+            }
+            break;
+        }
+        case kRecordResize: {
+            RingResize resize;
+            if (CopyPayload(payload, payload_size, &resize)) {
+                Resize(resize);
+            }
+            break;
+        }
+        case kRecordSplit: {
+            RingSplit split;
+            if (CopyPayload(payload, payload_size, &split)) {
+                Split(split);
+            }
+            break;
+        }
+        case kRecordModulesChanged:
+            ReloadMaps();
+            break;
+        default:
+            break;
+    }
+}
+
+void ClientSession::Alloc(const RingAlloc& record, const uint8_t* data) {
+    std::unique_ptr<unwindstack::Regs> regs(unwindstack::Regs::CreateFromLocal());
+    size_t regs_size = regs->total_regs() * (regs->Is32Bit() ? sizeof(uint32_t) : sizeof(uint64_t));
+    if (record.regs_size != regs_size) {
+        return;
+    }
+    memory_->SetStack(data + regs_size, record.stack_start, record.stack_size,
+                      record.stack_limit);
+
+    std::vector<unwindstack::FrameData> frames;
+    auto unwind = [&]() {
+        memcpy(regs->RawData(), data, regs_size);
+        unwindstack::Unwinder unwinder(max_frames_, maps_.get(), regs.get(), memory_);
+        unwinder.Unwind(&kInitialMapsToSkip, nullptr, &kFunctionsToExit);
+        frames = unwinder.ConsumeFrames();
+        return unwinder.LastErrorCode();
+    };
+    unwindstack::ErrorCode error = unwind();
+    if (error == unwindstack::ERROR_INVALID_MAP &&
+        NowMs() - maps_reload_time_ >= kMapsReloadIntervalMs && ReloadMaps()) {
+        error = unwind();
+    }
+    // 与本地回栈一致: 跳过的函数不记录, 没有堆栈的申请不会出现在 dump 中
+    if (error == unwindstack::ERROR_EXIT_FUNC || frames.empty()) {
+        return;
+    }
+
+    std::vector<uint64_t> pcs(frames.size());
+    for (size_t i = 0; i < frames.size(); i++) {
+        pcs[i] = frames[i].pc;
+    }
+    Callsite* callsite = &callsites_[std::move(pcs)];
+    if (callsite->references == 0) {
+        callsite->frames = std::move(frames);
+    }
+    callsite->references++;
+
+    // 同一个地址没有释放又被记录 (例如 dma-buf 的 inode), 以新的为准
+    Free(record.pointer);
+    LiveInfo info = {record.size, record.mem_type, ToNs(record.tv_sec, record.tv_nsec), callsite};
+    live_.emplace(record.pointer, info);
+    AddUsed(info);
+}
+
+void ClientSession::Free(uint64_t pointer) {
+    auto entry = live_.find(pointer);
+    if (entry == live_.end()) {
+        return;
+    }
+    SubUsed(entry->second);
+    Callsite* callsite = entry->second.callsite;
+    live_.erase(entry);
+    ReleaseCallsite(callsite);
+}
+
+void ClientSession::Resize(const RingResize& record) {
+    auto entry = live_.find(record.pointer);
+    if (entry == live_.end()) {
+        return;
+    }
+    SubUsed(entry->second);
+    entry->second.size = record.size;
+    AddUsed(entry->second);
+}
+
+void ClientSession::Split(const RingSplit& record) {
+    auto entry = live_.find(record.pointer);
+    if (entry == live_.end()) {
+        return;
+    }
+    LiveInfo info = entry->second;
+    info.size = record.new_size;
+    info.callsite->references++;
+    Free(record.new_pointer);
+    live_[record.new_pointer] = info;
+    AddUsed(info);
+}
+
+void ClientSession::AddUsed(const LiveInfo& info) {
+    (info.mem_type == kMemTypeDma ? current_dma_ : current_host_) += info.size;
+}
+
+void ClientSession::SubUsed(const LiveInfo& info) {
+    (info.mem_type == kMemTypeDma ? current_dma_ : current_host_) -= info.size;
+}
+
+void ClientSession::ReleaseCallsite(Callsite* callsite) {
+    if (--callsite->references != 0) {
+        return;
+    }
+    std::vector<uint64_t> pcs(callsite->frames.size());
+    for (size_t i = 0; i < pcs.size(); i++) {
+        pcs[i] = callsite->frames[i].pc;
+    }
+    callsites_.erase(pcs);
+}
+
+void ClientSession::HandleDump(int fd) {
+    // dump 请求之前写入的记录都要处理完, 结果才与 hook 进程内 dump 一致
+    uint64_t limit = ring_.write_pos();
+    auto deadline = std::chrono::steady_clock::now() + kMaxDrainWait;
+    while (ring_.read_pos() < limit && !ring_.corrupted()) {
+        if (Drain(limit)) {
+            deadline = std::chrono::steady_clock::now() + kMaxDrainWait;
+        } else if (std::chrono::steady_clock::now() > deadline) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    Dump(fd);
+}
+
+void ClientSession::Dump(int fd) {
+    std::vector<std::pair<uint64_t, const LiveInfo*>> list;
+    list.reserve(live_.size());
+    for (const auto& entry : live_) {
+        list.emplace_back(entry.first, &entry.second);
+    }
+    // 按申请时间排序
+    std::sort(list.begin(), list.end(), [](const auto& a, const auto& b) {
+        return a.second->time_ns < b.second->time_ns;
+    });
+    // 按当前两个时钟的差换算成墙上时间
+    struct timespec real_now;
+    struct timespec monotonic_now;
+    clock_gettime(CLOCK_REALTIME, &real_now);
+    clock_gettime(CLOCK_MONOTONIC, &monotonic_now);
+    int64_t real_offset_ns = ToNs(real_now.tv_sec, real_now.tv_nsec) -
+                             ToNs(monotonic_now.tv_sec, monotonic_now.tv_nsec);
+
+    dprintf(fd,
+            "current host used: %fMB, current dma used %fMB, current total used: "
+            "%fMB\n",
+            current_host_ / 1024.0 / 1024.0, current_dma_ / 1024.0 / 1024.0,
+            (current_host_ + current_dma_) / 1024.0 / 1024.0);
+    if (ring_.dropped() != 0) {
+        dprintf(fd, "unwindd dropped records: %" PRIu64 "\n", ring_.dropped());
+    }
+    dprintf(fd,
+            "++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++"
+            "+++++++++++++++\n\n");
+
+    std::string out;
+    out.reserve(kDumpBufferSize * 2);
+    char buffer[256];
+    for (const auto& entry : list) {
+        const LiveInfo& info = *entry.second;
+        int64_t real_ns = info.time_ns + real_offset_ns;
+        time_t alloc_time = real_ns / 1000000000;
+        struct tm local_time;
+        localtime_r(&alloc_time, &local_time);
+        char formatted_time[20];
+        strftime(formatted_time, sizeof(formatted_time), "%Y-%m-%d %H:%M:%S", &local_time);
+
+        const char* type_name = info.mem_type <= kMemTypeDma ? kMemTypeNames[info.mem_type] : "?";
+        snprintf(buffer, sizeof(buffer),
+                 "alloc_size:%fKB \t alloc_type:%s \t alloc_num:%zu \t "
+                 "alloc_time:%s.%zu\n",
+                 info.size / 1024.0, type_name, static_cast<size_t>(1), formatted_time,
+                 static_cast<size_t>(real_ns % 1000000000 / 1000000));
+        out += buffer;
+        const auto& frames = info.callsite->frames;
+        for (size_t i = 0; i < frames.size(); ++i) {
+            AppendFrame(&out, i, frames[i]);
+        }
+        out += '\n';
+        if (out.size() >= kDumpBufferSize) {
+            WriteAll(fd, out);
+            out.clear();
+        }
+    }
+    WriteAll(fd, out);
+}
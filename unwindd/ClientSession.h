@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unwindstack/Maps.h>
+#include <unwindstack/Unwinder.h>
+
+#include "UnwindDaemon.h"
+
+class SnapshotMemory;
+
+struct PcsHash {
+    size_t operator()(const std::vector<uint64_t>& pcs) const {
+        size_t hash = pcs.size();
+        for (uint64_t pc : pcs) {
+            hash = hash * 31 + pc;
+        }
+        return hash;
+    }
+};
+
+// 一个 hook 进程的连接: 消费它的环形缓冲区, 回栈并维护存活内存和调用栈表
+class ClientSession {
+public:
+    explicit ClientSession(int sock);
+    ~ClientSession();
+
+    // 处理 hello 后一直运行到连接断开
+    void Run();
+
+private:
+    struct Callsite {
+        size_t references = 0;
+        std::vector<unwindstack::FrameData> frames;
+    };
+
+    struct LiveInfo {
+        uint64_t size;
+        uint32_t mem_type;
+        // hook 记录的 CLOCK_MONOTONIC_COARSE
+        int64_t time_ns;
+        Callsite* callsite;
+    };
+
+    bool Hello();
+    bool ReloadMaps();
+
+    // 处理位置在 limit 之前的所有已写完的记录, 返回是否处理了记录
+    bool Drain(uint64_t limit);
+    // size 为校验过的记录大小, 负载大小不符合类型的记录直接丢弃
+    void Process(const RingRecordHeader* record, size_t size);
+
+    // record 已经拷贝出共享内存, data 为其后的寄存器和栈, 大小已经校验
+    void Alloc(const RingAlloc& record, const uint8_t* data);
+    void Free(uint64_t pointer);
+    void Resize(const RingResize& record);
+    void Split(const RingSplit& record);
+
+    void AddUsed(const LiveInfo& info);
+    void SubUsed(const LiveInfo& info);
+    void ReleaseCallsite(Callsite* callsite);
+
+    void HandleDump(int fd);
+    void Dump(int fd);
+
+    int sock_;
+    pid_t pid_ = 0;
+    size_t max_frames_ = 0;
+    int maps_fd_ = -1;
+    uint64_t maps_reload_time_ = 0;
+
+    StackRing ring_;
+    std::string maps_buffer_;
+    std::unique_ptr<unwindstack::BufferMaps> maps_;
+    std::shared_ptr<SnapshotMemory> memory_;
+
+    std::unordered_map<std::vector<uint64_t>, Callsite, PcsHash> callsites_;
+    std::unordered_map<uint64_t, LiveInfo> live_;
+    size_t current_host_ = 0;
+    size_t current_dma_ = 0;
+};
@@ -0,0 +1,53 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <unwindstack/Elf.h>
+
+#include "ClientSession.h"
+#include "UnwindDaemon.h"
+
+// 用法: alloc_hook_unwindd [name]
+// hook 进程设置 UNWIND_DAEMON=name 后连接, 每个连接由一个线程处理
+int main(int argc, char** argv) {
+    const char* name = argc > 1 ? argv[1] : kUnwindDaemonDefaultName;
+    signal(SIGPIPE, SIG_IGN);
+
+    // 多个进程以及 dlopen 后重新解析的 maps 共用同一份 elf
+    unwindstack::Elf::SetCachingEnabled(true);
+    const char* compact_unwind = getenv("COMPACT_UNWIND");
+    if (compact_unwind != nullptr && strcmp(compact_unwind, "0") != 0) {
+        unwindstack::Elf::SetCompactUnwindEnabled(true);
+    }
+    const char* cache_dir = getenv("UNWIND_CACHE_DIR");
+    if (cache_dir != nullptr && cache_dir[0] != '\0') {
+        unwindstack::Elf::SetCompactUnwindEnabled(true);
+        unwindstack::Elf::SetPersistentCacheDir(cache_dir);
+    }
+
+    int listen_fd = UnwindDaemonListen(name);
+    if (listen_fd < 0) {
+        fprintf(stderr, "unwindd: listen on @%s failed: %s\n", name, strerror(errno));
+        return 1;
+    }
+    printf("unwindd: listening on @%s\n", name);
+    fflush(stdout);
+
+    while (true) {
+        int sock = TEMP_FAILURE_RETRY(accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC));
+        if (sock < 0) {
+            continue;
+        }
+        std::thread([sock]() {
+            ClientSession session(sock);
+            session.Run();
+        }).detach();
+    }
+    return 0;
+}
@@ -18,9 +18,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include <android-base/stringprintf.h>
@@ -30,6 +32,7 @@
 #include <unwindstack/Arch.h>
 #include <unwindstack/Demangle.h>
 #include <unwindstack/DexFiles.h>
+#include <unwindstack/Elf.h>
 #include <unwindstack/Error.h>
 #include <unwindstack/JitDebug.h>
 #include <unwindstack/Maps.h>
@@ -50,7 +53,7 @@ namespace unwindstack {
 
 void AndroidUnwinderData::DemangleFunctionNames() {
   for (auto& frame : frames) {
-    frame.function_name = DemangleNameIfNeeded(frame.function_name);
+    frame.function_name = DemangleNameCached(frame.function_name);
   }
 }
 
@@ -81,6 +84,11 @@ bool AndroidUnwinder::Initialize(ErrorData& error) {
       return;
     }
 
+    if (!jit_support_) {
+      initialize_status_ = true;
+      return;
+    }
+
     jit_debug_ = CreateJitDebug(arch_, process_memory_, search_libs);
 
 #if defined(DEXFILE_SUPPORT)
@@ -120,6 +128,49 @@ FrameData AndroidUnwinder::BuildFrameFromPcOnly(uint64_t pc) {
                                         true);
 }
 
+void AndroidUnwinder::BuildFramesFromPcOnly(const std::vector<FrameData*>& frames) {
+  std::unordered_map<Elf*, std::vector<FrameData*>> frames_by_elf;
+  for (FrameData* frame : frames) {
+    uint64_t pc = frame->pc;
+    *frame = Unwinder::BuildFrameFromPcOnly(pc, arch_, maps_.get(), jit_debug_.get(),
+                                            process_memory_, false);
+    if (frame->map_info == nullptr) {
+      continue;
+    }
+    Elf* elf = frame->map_info->GetElf(process_memory_, arch_);
+    if (!elf->valid()) {
+      // Jit frames are looked up one at a time.
+      *frame = BuildFrameFromPcOnly(pc);
+      continue;
+    }
+    frames_by_elf[elf].push_back(frame);
+  }
+
+  std::vector<FunctionLookup> lookups;
+  for (auto& [elf, elf_frames] : frames_by_elf) {
+    std::sort(elf_frames.begin(), elf_frames.end(),
+              [](const FrameData* a, const FrameData* b) { return a->rel_pc < b->rel_pc; });
+    lookups.clear();
+    for (const FrameData* frame : elf_frames) {
+      if (lookups.empty() || lookups.back().addr != frame->rel_pc) {
+        lookups.push_back({.addr = frame->rel_pc});
+      }
+    }
+    elf->GetFunctionNames(&lookups);
+
+    auto lookup = lookups.begin();
+    for (FrameData* frame : elf_frames) {
+      while (lookup->addr != frame->rel_pc) {
+        ++lookup;
+      }
+      if (lookup->found) {
+        frame->function_name = lookup->name;
+        frame->function_offset = lookup->offset;
+      }
+    }
+  }
+}
+
 bool AndroidUnwinder::Unwind(AndroidUnwinderData& data) {
   return Unwind(std::nullopt, data);
 }
@@ -169,6 +220,7 @@ bool AndroidUnwinder::Unwind(Regs* initial_regs, AndroidUnwinderData& data) {
                     process_memory_);
   unwinder.SetJitDebug(jit_debug_.get());
   unwinder.SetDexFiles(dex_files_.get());
+  unwinder.SetMemo(data.memo);
   unwinder.Unwind(data.show_all_frames ? nullptr : &initial_map_names_to_skip_,
                   &map_suffixes_to_ignore_, &mangle_function_to_exit_);
   data.frames = unwinder.ConsumeFrames();
@@ -28,6 +28,7 @@
 
 #include "ArmExidx.h"
 #include "Check.h"
+#include "UnwindPlanCache.h"
 
 namespace unwindstack {
 
@@ -283,6 +284,7 @@ inline bool ArmExidx::DecodePrefix_10_01(uint8_t byte) {
   }
   // It is impossible for bits to be larger than the total number of
   // arm registers, so don't bother checking if bits is a valid register.
+  regs_->MarkRead(bits);
   cfa_ = (*regs_)[bits];
   return true;
 }
@@ -827,6 +829,178 @@ bool ArmExidx::Eval() {
   return status_ == ARM_STATUS_FINISH;
 }
 
+bool ArmExidx::Compile(UnwindPlanRow* row) {
+  uint8_t cfa_reg = ARM_REG_SP;
+  int64_t cfa_offset = 0;
+  // The offset from the start of vsp at which each register is popped.
+  int64_t pop_offsets[ARM_REG_LAST] = {};
+  uint16_t popped = 0;
+  auto pop = [&](uint16_t registers) {
+    // Eval reads every pop of a register, the row only reads the last one,
+    // which only differs when one of the reads fails.
+    if (popped & registers) {
+      return false;
+    }
+    for (size_t reg = 0; reg < ARM_REG_LAST; reg++) {
+      if (registers & (1 << reg)) {
+        pop_offsets[reg] = cfa_offset;
+        cfa_offset += 4;
+      }
+    }
+    popped |= registers;
+    return true;
+  };
+
+  while (true) {
+    uint8_t byte;
+    if (!GetByte(&byte)) {
+      return false;
+    }
+    switch (byte >> 4) {
+      case 0x0:
+      case 0x1:
+      case 0x2:
+      case 0x3:
+        // 00xxxxxx: vsp = vsp + (xxxxxx << 2) + 4
+        cfa_offset += ((byte & 0x3f) << 2) + 4;
+        continue;
+      case 0x4:
+      case 0x5:
+      case 0x6:
+      case 0x7:
+        // 01xxxxxx: vsp = vsp - (xxxxxx << 2) - 4
+        cfa_offset -= ((byte & 0x3f) << 2) + 4;
+        continue;
+      case 0x8: {
+        // 1000iiii iiiiiiii: Pop up to 12 integer registers under masks {r15-r12}, {r11-r4}
+        uint16_t registers = (byte & 0xf) << 8;
+        if (!GetByte(&byte)) {
+          return false;
+        }
+        registers = (registers | byte) << 4;
+        if (registers == 0 || (registers & (1 << ARM_REG_SP)) || !pop(registers)) {
+          return false;
+        }
+        continue;
+      }
+      case 0x9:
+        // 1001nnnn: Set vsp = r[nnnn] (nnnn != 13, 15)
+        // The row computes every value from the registers on entry, so the
+        // vsp can only come from a register before anything is popped.
+        if ((byte & 0xf) == 13 || (byte & 0xf) == 15 || popped != 0) {
+          return false;
+        }
+        cfa_reg = byte & 0xf;
+        cfa_offset = 0;
+        continue;
+      case 0xa:
+        // 10100nnn: Pop r4-r[4+nnn]
+        // 10101nnn: Pop r4-r[4+nnn], r14
+        if (!pop(((1 << ((byte & 0x7) + 1)) - 1) << 4 | ((byte & 0x8) ? (1 << ARM_REG_LR) : 0))) {
+          return false;
+        }
+        continue;
+      case 0xb:
+        break;
+      case 0xc:
+      case 0xd:
+        break;
+      default:
+        // 11xxxyyy: Spare (xxx != 000, 001, 010)
+        return false;
+    }
+
+    if (byte == 0xb0) {
+      // 10110000: Finish
+      break;
+    }
+    switch (byte) {
+      case 0xb1:
+        // 10110001 0000iiii: Pop integer registers under mask {r3, r2, r1, r0}
+        if (!GetByte(&byte) || byte == 0 || (byte >> 4) != 0 || !pop(byte)) {
+          return false;
+        }
+        continue;
+      case 0xb2: {
+        // 10110010 uleb128: vsp = vsp + 0x204 + (uleb128 << 2)
+        uint32_t result = 0;
+        uint32_t shift = 0;
+        do {
+          if (shift > 21 || !GetByte(&byte)) {
+            return false;
+          }
+          result |= (byte & 0x7f) << shift;
+          shift += 7;
+        } while (byte & 0x80);
+        cfa_offset += 0x204 + (static_cast<int64_t>(result) << 2);
+        continue;
+      }
+      case 0xb3:
+        // 10110011 sssscccc: Pop VFP double precision registers by FSTMFDX
+        if (!GetByte(&byte)) {
+          return false;
+        }
+        cfa_offset += (byte & 0xf) * 8 + 12;
+        continue;
+      case 0xc6:
+        // 11000110 sssscccc: Intel Wireless MMX pop wR[ssss]-wR[ssss+cccc]
+      case 0xc8:
+        // 11001000 sssscccc: Pop VFP double precision registers D[16+ssss]-D[16+ssss+cccc]
+      case 0xc9:
+        // 11001001 sssscccc: Pop VFP double precision registers D[ssss]-D[ssss+cccc]
+        if (!GetByte(&byte)) {
+          return false;
+        }
+        cfa_offset += (byte & 0xf) * 8 + 8;
+        continue;
+      case 0xc7:
+        // 11000111 0000iiii: Intel Wireless MMX pop wCGR registers
+        if (!GetByte(&byte) || byte == 0 || (byte >> 4) != 0) {
+          return false;
+        }
+        cfa_offset += __builtin_popcount(byte) * 4;
+        continue;
+    }
+    if ((byte & 0xf8) == 0xb8) {
+      // 10111nnn: Pop VFP double-precision registers D[8]-D[8+nnn] by FSTMFDX
+      cfa_offset += (byte & 0x7) * 8 + 12;
+    } else if ((byte & 0xf8) == 0xc0 || (byte & 0xf8) == 0xd0) {
+      // 11000nnn: Intel Wireless MMX pop wR[10]-wR[10+nnn] (nnn != 6, 7)
+      // 11010nnn: Pop VFP double precision registers D[8]-D[8+nnn]
+      cfa_offset += (byte & 0x7) * 8 + 8;
+    } else {
+      // 101101nn, 11001yyy: Spare
+      return false;
+    }
+  }
+
+  // The vsp wraps at 32 bits while the row computes the addresses at 64 bits.
+  if (__builtin_popcount(popped) > static_cast<int>(UnwindPlanRow::kMaxRules) ||
+      cfa_offset != static_cast<int32_t>(cfa_offset)) {
+    return false;
+  }
+  row->cfa_reg = cfa_reg;
+  row->cfa_offset = cfa_offset;
+  // If the pc was not popped, the lr holds the return address.
+  row->return_address_register = (popped & (1 << ARM_REG_PC)) ? ARM_REG_PC : ARM_REG_LR;
+  row->num_rules = 0;
+  row->flags = 0;
+  for (size_t reg = 0; reg < ARM_REG_LAST; reg++) {
+    if (popped & (1 << reg)) {
+      int64_t offset = pop_offsets[reg] - cfa_offset;
+      if (offset != static_cast<int32_t>(offset)) {
+        return false;
+      }
+      UnwindPlanRow::Rule& rule = row->rules[row->num_rules++];
+      rule = {};
+      rule.reg = reg;
+      rule.type = DWARF_LOCATION_OFFSET;
+      rule.offset = offset;
+    }
+  }
+  return true;
+}
+
 void ArmExidx::LogByReg() {
   if (log_type_ != ARM_LOG_BY_REG) {
     return;
@@ -27,6 +27,7 @@ namespace unwindstack {
 // Forward declarations.
 class Memory;
 class RegsArm;
+struct UnwindPlanRow;
 
 enum ArmStatus : size_t {
   ARM_STATUS_NONE = 0,
@@ -65,6 +66,12 @@ class ArmExidx {
 
   bool Eval();
 
+  // Translates the extracted data into a row that restores the same
+  // registers as Eval. Fails for anything a row cannot express, such as
+  // popping sp or setting vsp from a register after a pop, and for every
+  // entry that Eval would not finish successfully.
+  bool Compile(UnwindPlanRow* row);
+
   bool Decode();
 
   std::deque<uint8_t>* data() { return &data_; }
@@ -17,7 +17,9 @@
 #include <cxxabi.h>
 #include <stdlib.h>
 
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include <unwindstack/Demangle.h>
 
@@ -43,4 +45,39 @@ std::string DemangleNameIfNeeded(const std::string& name) {
   return demangled_name;
 }
 
+namespace {
+
+// Plenty for the distinct functions seen in a process, the table is simply
+// dropped if it ever gets this big.
+constexpr size_t kMaxCachedNames = 1 << 16;
+
+struct CachedName {
+  // Holds a reference so that the key can not be reused by another string.
+  SharedString name;
+  SharedString demangled;
+};
+
+std::mutex g_demangle_lock;
+[[clang::no_destroy]] std::unordered_map<const void*, CachedName> g_demangled_names;
+
+}  // namespace
+
+SharedString DemangleNameCached(const SharedString& name) {
+  if (name.size() < 2 || name.c_str()[0] != '_' || name.c_str()[1] != 'Z') {
+    return name;
+  }
+
+  std::lock_guard<std::mutex> guard(g_demangle_lock);
+  auto entry = g_demangled_names.find(name.id());
+  if (entry != g_demangled_names.end()) {
+    return entry->second.demangled;
+  }
+  if (g_demangled_names.size() >= kMaxCachedNames) {
+    g_demangled_names.clear();
+  }
+  SharedString demangled(DemangleNameIfNeeded(name));
+  g_demangled_names.emplace(name.id(), CachedName{.name = name, .demangled = demangled});
+  return demangled;
+}
+
 }  // namespace unwindstack
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+
+#include <unwindstack/MachineArm.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineMips.h>
+#include <unwindstack/MachineMips64.h>
+#include <unwindstack/MachineX86.h>
+#include <unwindstack/MachineX86_64.h>
+
+#include "DwarfCompactTable.h"
+
+namespace unwindstack {
+
+static uint16_t TotalRegs(ArchEnum arch) {
+  switch (arch) {
+    case ARCH_ARM:
+      return ARM_REG_LAST;
+    case ARCH_ARM64:
+      return ARM64_REG_LAST;
+    case ARCH_X86:
+      return X86_REG_LAST;
+    case ARCH_X86_64:
+      return X86_64_REG_LAST;
+    case ARCH_MIPS:
+      return MIPS_REG_LAST;
+    case ARCH_MIPS64:
+      return MIPS64_REG_LAST;
+    default:
+      return 0;
+  }
+}
+
+DwarfCompactTable::DwarfCompactTable(ArchEnum arch)
+    : is_32bit_(ArchIs32Bit(arch)), total_regs_(TotalRegs(arch)) {}
+
+void DwarfCompactTable::Add(uint64_t pc_start, const DwarfLocations& loc_regs) {
+  UnwindPlanRow row;
+  // Clear the whole row so identical rows have identical bytes.
+  memset(&row, 0, sizeof(row));
+  if (!row.Compile(loc_regs, total_regs_)) {
+    AddIndex(pc_start, kNoRow);
+    return;
+  }
+
+  std::string key(reinterpret_cast<const char*>(&row), sizeof(row));
+  auto entry = row_map_.find(key);
+  if (entry == row_map_.end()) {
+    entry = row_map_.emplace(std::move(key), rows_.size()).first;
+    rows_.push_back(row);
+  }
+  AddIndex(pc_start, entry->second);
+}
+
+void DwarfCompactTable::AddNoRow(uint64_t pc_start) {
+  AddIndex(pc_start, kNoRow);
+}
+
+void DwarfCompactTable::AddIndex(uint64_t pc_start, uint32_t index) {
+  if (!pcs_.empty()) {
+    if (indexes_.back() == index) {
+      // Same row as the previous range, extend it.
+      return;
+    }
+    if (pcs_.back() == pc_start) {
+      indexes_.back() = index;
+      return;
+    }
+  }
+  pcs_.push_back(pc_start);
+  indexes_.push_back(index);
+}
+
+void DwarfCompactTable::Finish() {
+  std::unordered_map<std::string, uint32_t>().swap(row_map_);
+  pcs_.shrink_to_fit();
+  indexes_.shrink_to_fit();
+  rows_.shrink_to_fit();
+
+  pc_data_ = pcs_.data();
+  index_data_ = indexes_.data();
+  row_data_ = rows_.data();
+  num_entries_ = pcs_.size();
+  num_rows_ = rows_.size();
+}
+
+const UnwindPlanRow* DwarfCompactTable::Find(uint64_t pc) const {
+  const uint64_t* it = std::upper_bound(pc_data_, pc_data_ + num_entries_, pc);
+  if (it == pc_data_) {
+    return nullptr;
+  }
+  uint32_t index = index_data_[it - pc_data_ - 1];
+  if (index == kNoRow) {
+    return nullptr;
+  }
+  return &row_data_[index];
+}
+
+// Serialized layout, every array starts 8 byte aligned:
+//   SerializedHeader
+//   uint64_t pcs[num_entries]
+//   uint32_t indexes[num_entries], padded to 8 bytes
+//   UnwindPlanRow rows[num_rows]
+struct SerializedHeader {
+  uint64_t num_entries;
+  uint64_t num_rows;
+  uint32_t is_32bit;
+  uint32_t row_size;
+};
+
+static size_t AlignUp8(size_t size) {
+  return (size + 7) & ~static_cast<size_t>(7);
+}
+
+void DwarfCompactTable::Serialize(std::string* payload) const {
+  SerializedHeader header{.num_entries = num_entries_,
+                          .num_rows = num_rows_,
+                          .is_32bit = is_32bit_,
+                          .row_size = sizeof(UnwindPlanRow)};
+  size_t index_size = num_entries_ * sizeof(uint32_t);
+  payload->clear();
+  payload->reserve(sizeof(header) + num_entries_ * sizeof(uint64_t) + AlignUp8(index_size) +
+                   num_rows_ * sizeof(UnwindPlanRow));
+  payload->append(reinterpret_cast<const char*>(&header), sizeof(header));
+  payload->append(reinterpret_cast<const char*>(pc_data_), num_entries_ * sizeof(uint64_t));
+  payload->append(reinterpret_cast<const char*>(index_data_), index_size);
+  payload->append(AlignUp8(index_size) - index_size, '\0');
+  payload->append(reinterpret_cast<const char*>(row_data_), num_rows_ * sizeof(UnwindPlanRow));
+}
+
+bool DwarfCompactTable::Deserialize(std::shared_ptr<PersistentCache::Blob> blob) {
+  const uint8_t* data = blob->data();
+  size_t size = blob->size();
+  if (size < sizeof(SerializedHeader)) {
+    return false;
+  }
+  SerializedHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (header.is_32bit != is_32bit_ || header.row_size != sizeof(UnwindPlanRow) ||
+      header.num_entries > size || header.num_rows > size) {
+    return false;
+  }
+  size_t pcs_offset = sizeof(header);
+  size_t indexes_offset = pcs_offset + header.num_entries * sizeof(uint64_t);
+  size_t rows_offset = indexes_offset + AlignUp8(header.num_entries * sizeof(uint32_t));
+  if (rows_offset + header.num_rows * sizeof(UnwindPlanRow) != size) {
+    return false;
+  }
+
+  const uint64_t* pcs = reinterpret_cast<const uint64_t*>(data + pcs_offset);
+  const uint32_t* indexes = reinterpret_cast<const uint32_t*>(data + indexes_offset);
+  const UnwindPlanRow* rows = reinterpret_cast<const UnwindPlanRow*>(data + rows_offset);
+  // The file could have been modified by anything, never trust it.
+  for (size_t i = 0; i < header.num_entries; i++) {
+    if ((i != 0 && pcs[i] <= pcs[i - 1]) ||
+        (indexes[i] != kNoRow && indexes[i] >= header.num_rows)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < header.num_rows; i++) {
+    if (!rows[i].Valid(total_regs_)) {
+      return false;
+    }
+  }
+
+  pc_data_ = pcs;
+  index_data_ = indexes;
+  row_data_ = rows;
+  num_entries_ = header.num_entries;
+  num_rows_ = header.num_rows;
+  blob_ = std::move(blob);
+  return true;
+}
+
+}  // namespace unwindstack
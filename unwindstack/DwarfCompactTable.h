@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBUNWINDSTACK_DWARF_COMPACT_TABLE_H
+#define _LIBUNWINDSTACK_DWARF_COMPACT_TABLE_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <unwindstack/Arch.h>
+#include <unwindstack/DwarfLocation.h>
+
+#include "PersistentCache.h"
+#include "UnwindPlanCache.h"
+
+namespace unwindstack {
+
+// Every row of a dwarf section, pre-evaluated into a sorted array of
+// (pc_start, row) so that a step is a binary search instead of running the
+// cie and fde cfa instructions. Identical rows are stored once.
+class DwarfCompactTable {
+ public:
+  // Marks a range that has no compact row, either because there is no fde
+  // or because the row needs the full evaluation.
+  static constexpr uint32_t kNoRow = UINT32_MAX;
+
+  DwarfCompactTable(ArchEnum arch);
+  ~DwarfCompactTable() = default;
+
+  // Rows must be added in increasing pc order.
+  void Add(uint64_t pc_start, const DwarfLocations& loc_regs);
+  void AddNoRow(uint64_t pc_start);
+
+  // Release the memory only needed while adding rows.
+  void Finish();
+
+  // Returns nullptr if the pc needs the full evaluation.
+  const UnwindPlanRow* Find(uint64_t pc) const;
+
+  // The serialized form is used directly from the mapped blob, nothing is
+  // copied when it is loaded.
+  void Serialize(std::string* payload) const;
+  bool Deserialize(std::shared_ptr<PersistentCache::Blob> blob);
+
+  bool is_32bit() const { return is_32bit_; }
+  size_t NumEntries() const { return num_entries_; }
+  size_t NumRows() const { return num_rows_; }
+
+ private:
+  void AddIndex(uint64_t pc_start, uint32_t index);
+
+  bool is_32bit_;
+  uint16_t total_regs_;
+
+  const uint64_t* pc_data_ = nullptr;
+  const uint32_t* index_data_ = nullptr;
+  const UnwindPlanRow* row_data_ = nullptr;
+  size_t num_entries_ = 0;
+  size_t num_rows_ = 0;
+
+  // Storage for a table built in this process.
+  std::vector<uint64_t> pcs_;
+  std::vector<uint32_t> indexes_;
+  std::vector<UnwindPlanRow> rows_;
+  std::unordered_map<std::string, uint32_t> row_map_;
+
+  // Storage for a table loaded from the persistent cache.
+  std::shared_ptr<PersistentCache::Blob> blob_;
+};
+
+}  // namespace unwindstack
+
+#endif  // _LIBUNWINDSTACK_DWARF_COMPACT_TABLE_H
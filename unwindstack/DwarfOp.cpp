@@ -16,6 +16,7 @@
 
 #include <stdint.h>
 
+#include <algorithm>
 #include <deque>
 #include <string>
 #include <vector>
@@ -1521,11 +1522,13 @@ const typename DwarfOp<AddressType>::OpHandleFuncPtr DwarfOp<AddressType>::kOpHa
 };
 
 template <typename AddressType>
-bool DwarfOp<AddressType>::Eval(uint64_t start, uint64_t end) {
+bool DwarfOp<AddressType>::Eval(uint64_t start, uint64_t end,
+                                const DwarfExpression* expression) {
   is_register_ = false;
   stack_.clear();
   memory_->set_cur_offset(start);
   dex_pc_set_ = false;
+  size_t index = 0;
 
   // Unroll the first Decode calls to be able to check for a special
   // sequence of ops and values that indicate this is the dex pc.
@@ -1533,7 +1536,7 @@ bool DwarfOp<AddressType>::Eval(uint64_t start, uint64_t end) {
   //   OP_const4u (0x0c)  'D' 'E' 'X' '1'
   //   OP_drop (0x13)
   if (memory_->cur_offset() < end) {
-    if (!Decode()) {
+    if (!Decode(expression, &index)) {
       return false;
     }
   } else {
@@ -1546,7 +1549,7 @@ bool DwarfOp<AddressType>::Eval(uint64_t start, uint64_t end) {
     check_for_drop = false;
   }
   if (memory_->cur_offset() < end) {
-    if (!Decode()) {
+    if (!Decode(expression, &index)) {
       return false;
     }
   } else {
@@ -1559,7 +1562,7 @@ bool DwarfOp<AddressType>::Eval(uint64_t start, uint64_t end) {
 
   uint32_t iterations = 2;
   while (memory_->cur_offset() < end) {
-    if (!Decode()) {
+    if (!Decode(expression, &index)) {
       return false;
     }
     // To protect against a branch that creates an infinite loop,
@@ -1608,6 +1611,107 @@ bool DwarfOp<AddressType>::Decode() {
   return (this->*handle_func)();
 }
 
+template <typename AddressType>
+bool DwarfOp<AddressType>::Decode(const DwarfExpression* expression, size_t* index) {
+  if (expression == nullptr) {
+    return Decode();
+  }
+
+  // Ops run in order unless there is a branch.
+  uint64_t offset = memory_->cur_offset();
+  const std::vector<DwarfExpression::Op>& ops = expression->ops;
+  if (*index >= ops.size() || ops[*index].offset != offset) {
+    auto it = std::lower_bound(
+        ops.begin(), ops.end(), offset,
+        [](const DwarfExpression::Op& op, uint64_t offset) { return op.offset < offset; });
+    if (it == ops.end() || it->offset != offset) {
+      // A branch into the middle of an op or past the decoded ops.
+      *index = ops.size();
+      return Decode();
+    }
+    *index = it - ops.begin();
+  }
+  return Execute(ops[(*index)++]);
+}
+
+template <typename AddressType>
+bool DwarfOp<AddressType>::Execute(const DwarfExpression::Op& op) {
+  last_error_.code = DWARF_ERROR_NONE;
+  cur_op_ = op.op;
+  const auto* callback = &kCallbackTable[cur_op_];
+  if (stack_.size() < callback->num_required_stack_values) {
+    last_error_.code = DWARF_ERROR_STACK_INDEX_NOT_VALID;
+    return false;
+  }
+
+  operands_.clear();
+  for (size_t i = 0; i < callback->num_operands; i++) {
+    operands_.push_back(op.operands[i]);
+  }
+  memory_->set_cur_offset(op.next_offset);
+  return (this->*kOpHandleFuncList[callback->handle_func])();
+}
+
+template <typename AddressType>
+void DwarfOp<AddressType>::Compile(uint64_t start, uint64_t end, DwarfExpression* expression) {
+  // Longer expressions only decode the first ops ahead of time.
+  static constexpr size_t kMaxOps = 256;
+
+  expression->start = start;
+  expression->end = end;
+  expression->ops.clear();
+  expression->shape = DwarfExpression::SHAPE_GENERIC;
+  memory_->set_cur_offset(start);
+  while (memory_->cur_offset() < end && expression->ops.size() < kMaxOps) {
+    DwarfExpression::Op op = {.offset = memory_->cur_offset()};
+    if (!memory_->ReadBytes(&op.op, 1)) {
+      break;
+    }
+    const auto* callback = &kCallbackTable[op.op];
+    if (callback->handle_func == OP_ILLEGAL) {
+      break;
+    }
+    bool valid = true;
+    for (size_t i = 0; i < callback->num_operands; i++) {
+      if (!memory_->ReadEncodedValue<AddressType>(callback->operands[i], &op.operands[i])) {
+        valid = false;
+        break;
+      }
+    }
+    if (!valid) {
+      break;
+    }
+    op.next_offset = memory_->cur_offset();
+    expression->ops.push_back(op);
+  }
+
+  // Recognize the shapes that only read a register and maybe the memory it
+  // points to, these can be evaluated without running any ops.
+  const std::vector<DwarfExpression::Op>& ops = expression->ops;
+  if (ops.empty() || ops[0].offset != start) {
+    return;
+  }
+  const DwarfExpression::Op& breg = ops[0];
+  if (breg.op >= 0x70 && breg.op <= 0x8f) {
+    expression->reg = breg.op - 0x70;
+    expression->reg_offset = breg.operands[0];
+  } else if (breg.op == 0x92) {
+    if (static_cast<AddressType>(breg.operands[0]) != breg.operands[0]) {
+      return;
+    }
+    expression->reg = breg.operands[0];
+    expression->reg_offset = breg.operands[1];
+  } else {
+    return;
+  }
+  if (breg.next_offset >= end) {
+    expression->shape = DwarfExpression::SHAPE_BREG;
+  } else if (ops.size() >= 2 && ops[1].offset == breg.next_offset && ops[1].op == 0x06 &&
+             ops[1].next_offset >= end) {
+    expression->shape = DwarfExpression::SHAPE_BREG_DEREF;
+  }
+}
+
 template <typename AddressType>
 void DwarfOp<AddressType>::GetLogInfo(uint64_t start, uint64_t end,
                                       std::vector<std::string>* lines) {
@@ -36,6 +36,34 @@ class Memory;
 template <typename AddressType>
 class RegsImpl;
 
+// An expression decoded once by DwarfOp::Compile, so that evaluating it again
+// does not read and decode every op and operand from the elf.
+struct DwarfExpression {
+  enum Shape : uint8_t {
+    SHAPE_GENERIC = 0,
+    SHAPE_BREG,        // DW_OP_breg/bregx
+    SHAPE_BREG_DEREF,  // DW_OP_breg/bregx, DW_OP_deref
+  };
+
+  struct Op {
+    uint64_t offset;       // The offset of the op.
+    uint64_t next_offset;  // The offset after the operands.
+    uint64_t operands[2];
+    uint8_t op;
+  };
+
+  uint64_t start = 0;
+  uint64_t end = 0;
+  // Sorted by offset. Decoding stops at the first op that cannot be decoded,
+  // evaluation falls back to decoding for any offset not found here.
+  std::vector<Op> ops;
+
+  // The register and offset for the breg shapes.
+  Shape shape = SHAPE_GENERIC;
+  uint32_t reg = 0;
+  uint64_t reg_offset = 0;
+};
+
 template <typename AddressType>
 class DwarfOp {
   // Signed version of AddressType
@@ -48,7 +76,10 @@ class DwarfOp {
 
   bool Decode();
 
-  bool Eval(uint64_t start, uint64_t end);
+  // If expression is set, it must have been compiled from the same range.
+  bool Eval(uint64_t start, uint64_t end, const DwarfExpression* expression = nullptr);
+
+  void Compile(uint64_t start, uint64_t end, DwarfExpression* expression);
 
   void GetLogInfo(uint64_t start, uint64_t end, std::vector<std::string>* lines);
 
@@ -93,6 +124,9 @@ class DwarfOp {
 
   inline AddressType bool_to_dwarf_bool(bool value) { return value ? 1 : 0; }
 
+  bool Decode(const DwarfExpression* expression, size_t* index);
+  bool Execute(const DwarfExpression::Op& op);
+
   // Op processing functions.
   bool op_deref();
   bool op_deref_size();
@@ -16,6 +16,13 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
 #include <unwindstack/DwarfError.h>
 #include <unwindstack/DwarfLocation.h>
 #include <unwindstack/DwarfMemory.h>
@@ -27,18 +34,39 @@
 #include <unwindstack/Regs.h>
 
 #include "DwarfCfa.h"
+#include "DwarfCompactTable.h"
 #include "DwarfDebugFrame.h"
 #include "DwarfEhFrame.h"
 #include "DwarfEncoding.h"
 #include "DwarfOp.h"
+#include "PersistentCache.h"
 #include "RegsInfo.h"
+#include "UnwindPlanCache.h"
 
 namespace unwindstack {
 
+// The process wide UnwindPlanCache holds the hot rows, this only needs to
+// keep enough rows to avoid re-running the cfa for nearby pcs.
+static constexpr size_t kMaxLocRegsRows = 1024;
+
+// Only a few functions, such as signal trampolines, use expressions.
+static constexpr size_t kMaxExpressions = 256;
+
 DwarfSection::DwarfSection(Memory* memory) : memory_(memory) {}
 
+DwarfSection::~DwarfSection() = default;
+
 bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
                         bool* is_signal_frame) {
+  if (compact_table_ != nullptr) {
+    const UnwindPlanRow* row = compact_table_->Find(pc);
+    if (row != nullptr &&
+        row->Apply(compact_table_->is_32bit(), regs, process_memory, finished, is_signal_frame)) {
+      UnwindPlanCache::Record(*row);
+      return true;
+    }
+  }
+
   // Lookup the pc in the cache.
   auto it = loc_regs_.upper_bound(pc);
   if (it == loc_regs_.end() || pc < it->second.pc_start) {
@@ -57,13 +85,88 @@ bool DwarfSection::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* f
     loc_regs.cie = fde->cie;
 
     // Store it in the cache.
+    if (loc_regs_.size() >= kMaxLocRegsRows) {
+      loc_regs_.clear();
+    }
     it = loc_regs_.emplace(loc_regs.pc_end, std::move(loc_regs)).first;
   }
 
   *is_signal_frame = it->second.cie->is_signal_frame;
 
   // Now eval the actual registers.
-  return Eval(it->second.cie, process_memory, it->second, regs, finished);
+  if (!Eval(it->second.cie, process_memory, it->second, regs, finished)) {
+    return false;
+  }
+  UnwindPlanCache::Record(it->second, regs->total_regs());
+  return true;
+}
+
+bool DwarfSection::BuildCompactTable(ArchEnum arch) {
+  std::vector<const DwarfFde*> fdes;
+  GetFdes(&fdes);
+  fdes.erase(std::remove(fdes.begin(), fdes.end(), nullptr), fdes.end());
+  std::sort(fdes.begin(), fdes.end(), [](const DwarfFde* a, const DwarfFde* b) {
+    return a->pc_start < b->pc_start;
+  });
+  fdes.erase(std::unique(fdes.begin(), fdes.end()), fdes.end());
+
+  auto table = std::make_unique<DwarfCompactTable>(arch);
+  uint64_t last_end = 0;
+  for (const DwarfFde* fde : fdes) {
+    if (fde->cie == nullptr || fde->pc_start >= fde->pc_end) {
+      continue;
+    }
+    if (fde->pc_start < last_end) {
+      // Overlapping fdes are resolved by GetFdeFromPc, do not try to
+      // duplicate that logic here.
+      return false;
+    }
+    if (fde->pc_start > last_end) {
+      table->AddNoRow(last_end);
+    }
+
+    uint64_t pc = fde->pc_start;
+    while (pc < fde->pc_end) {
+      DwarfLocations loc_regs;
+      if (!GetCfaLocationInfo(pc, fde, &loc_regs, arch) || loc_regs.pc_end <= pc) {
+        // Leave the rest of the fde to the full evaluation, which will
+        // report the error.
+        table->AddNoRow(pc);
+        break;
+      }
+      loc_regs.cie = fde->cie;
+      table->Add(pc, loc_regs);
+      pc = loc_regs.pc_end;
+    }
+    last_end = fde->pc_end;
+  }
+  table->AddNoRow(last_end);
+  table->Finish();
+
+  compact_table_ = std::move(table);
+  return true;
+}
+
+bool DwarfSection::LoadCompactTable(ArchEnum arch, const std::string& name, uint64_t key) {
+  std::shared_ptr<PersistentCache::Blob> blob = PersistentCache::Load(name, key);
+  if (blob == nullptr) {
+    return false;
+  }
+  auto table = std::make_unique<DwarfCompactTable>(arch);
+  if (!table->Deserialize(std::move(blob))) {
+    return false;
+  }
+  compact_table_ = std::move(table);
+  return true;
+}
+
+bool DwarfSection::StoreCompactTable(const std::string& name, uint64_t key) {
+  if (compact_table_ == nullptr) {
+    return false;
+  }
+  std::string payload;
+  compact_table_->Serialize(&payload);
+  return PersistentCache::Store(name, key, payload);
 }
 
 template <typename AddressType>
@@ -384,13 +487,26 @@ bool DwarfSectionImpl<AddressType>::EvalExpression(const DwarfLocation& loc, Mem
                                                    AddressType* value,
                                                    RegsInfo<AddressType>* regs_info,
                                                    bool* is_dex_pc) {
-  DwarfOp<AddressType> op(&memory_, regular_memory);
-  op.set_regs_info(regs_info);
-
   // Need to evaluate the op data.
   uint64_t end = loc.values[1];
   uint64_t start = end - loc.values[0];
-  if (!op.Eval(start, end)) {
+  const DwarfExpression* expression = GetExpression(start, end);
+  if (expression->shape != DwarfExpression::SHAPE_GENERIC && expression->reg < regs_info->Total()) {
+    AddressType address = regs_info->Get(expression->reg);
+    address += static_cast<AddressType>(expression->reg_offset);
+    if (expression->shape == DwarfExpression::SHAPE_BREG) {
+      *value = address;
+      return true;
+    }
+    if (regular_memory->ReadFully(address, value, sizeof(AddressType))) {
+      return true;
+    }
+    // Run the ops to set the error.
+  }
+
+  DwarfOp<AddressType> op(&memory_, regular_memory);
+  op.set_regs_info(regs_info);
+  if (!op.Eval(start, end, expression)) {
     last_error_ = op.last_error();
     return false;
   }
@@ -410,6 +526,25 @@ bool DwarfSectionImpl<AddressType>::EvalExpression(const DwarfLocation& loc, Mem
   return true;
 }
 
+template <typename AddressType>
+const DwarfExpression* DwarfSectionImpl<AddressType>::GetExpression(uint64_t start, uint64_t end) {
+  auto entry = expressions_.find(start);
+  if (entry != expressions_.end() && entry->second->end == end) {
+    return entry->second.get();
+  }
+
+  if (expressions_.size() >= kMaxExpressions) {
+    expressions_.clear();
+  }
+  std::unique_ptr<DwarfExpression>& expression = expressions_[start];
+  if (expression == nullptr) {
+    expression.reset(new DwarfExpression);
+  }
+  DwarfOp<AddressType> op(&memory_, nullptr);
+  op.Compile(start, end, expression.get());
+  return expression.get();
+}
+
 template <typename AddressType>
 struct EvalInfo {
   const DwarfLocations* loc_regs;
@@ -517,6 +652,7 @@ bool DwarfSectionImpl<AddressType>::Eval(const DwarfCie* cie, Memory* regular_me
         last_error_.code = DWARF_ERROR_ILLEGAL_VALUE;
         return false;
       }
+      cur_regs->MarkRead(loc->values[0]);
       eval_info.cfa = (*cur_regs)[loc->values[0]];
       eval_info.cfa += loc->values[1];
       break;
@@ -561,6 +697,9 @@ bool DwarfSectionImpl<AddressType>::Eval(const DwarfCie* cie, Memory* regular_me
   if (eval_info.return_address_undefined) {
     cur_regs->set_pc(0);
   } else {
+    if (!eval_info.regs_info.IsSaved(cie->return_address_register)) {
+      cur_regs->MarkRead(cie->return_address_register);
+    }
     cur_regs->set_pc((*cur_regs)[cie->return_address_register]);
   }
 
@@ -629,32 +768,6 @@ bool DwarfSectionImpl<AddressType>::Init(uint64_t offset, uint64_t size, int64_t
   return true;
 }
 
-// Create a cached version of the fde information such that it is a std::map
-// that is indexed by end pc and contains a pair that represents the start pc
-// followed by the fde offset.
-// It is possible for an fde to be represented by multiple entries in
-// the map. This can happen if the the start pc and end pc overlap already
-// existing entries. For example, if there is already an entry of 0x400, 0x200,
-// and an fde has a start pc of 0x100 and end pc of 0x500, two new entries
-// will be added: 0x200, 0x100 and 0x500, 0x400.
-template <typename AddressType>
-void DwarfSectionImpl<AddressType>::InsertFde(uint64_t fde_offset, const DwarfFde* fde,
-                                              DwarfFdeMap& fdes) {
-  uint64_t start = fde->pc_start;
-  uint64_t end = fde->pc_end;
-  auto it = fdes.upper_bound(start);
-  while (it != fdes.end() && start < end && it->second.first < end) {
-    if (start < it->second.first) {
-      fdes[it->second.first] = std::make_pair(start, fde_offset);
-    }
-    start = it->first;
-    ++it;
-  }
-  if (start < end) {
-    fdes[end] = std::make_pair(start, fde_offset);
-  }
-}
-
 // Read CIE or FDE entry at the given offset, and set the offset to the following entry.
 // The 'fde' argument is set only if we have seen an FDE entry.
 template <typename AddressType>
@@ -742,46 +855,52 @@ bool DwarfSectionImpl<AddressType>::GetNextCieOrFde(uint64_t& next_entries_offse
 
 template <typename AddressType>
 void DwarfSectionImpl<AddressType>::GetFdes(std::vector<const DwarfFde*>* fdes) {
-  if (fde_index_.empty()) {
+  if (!fde_index_built_) {
     BuildFdeIndex();
   }
-  for (auto& it : fde_index_) {
-    fdes->push_back(GetFdeFromOffset(it.second));
+  for (const FdeIndexEntry& entry : fde_index_) {
+    fdes->push_back(GetFdeFromOffset(entry.fde_offset));
   }
 }
 
 template <typename AddressType>
 const DwarfFde* DwarfSectionImpl<AddressType>::GetFdeFromPc(uint64_t pc) {
   // Ensure that the binary search table is initialized.
-  if (fde_index_.empty()) {
+  if (!fde_index_built_) {
     BuildFdeIndex();
   }
 
-  // Find the FDE offset in the binary search table.
-  auto comp = [](uint64_t pc, auto& entry) { return pc < entry.first; };
+  // Find the FDE offset in the binary search table. The ranges do not overlap,
+  // so a pc outside of every fde is rejected without loading anything.
+  auto comp = [](uint64_t pc, const FdeIndexEntry& entry) { return pc < entry.pc_end; };
   auto it = std::upper_bound(fde_index_.begin(), fde_index_.end(), pc, comp);
-  if (it == fde_index_.end()) {
+  if (it == fde_index_.end() || pc < it->pc_start) {
     return nullptr;
   }
 
   // Load the full FDE entry based on the offset.
-  const DwarfFde* fde = GetFdeFromOffset(/*fde_offset=*/it->second);
-  return fde != nullptr && fde->pc_start <= pc ? fde : nullptr;
+  return GetFdeFromOffset(it->fde_offset);
 }
 
-// Create binary search table to make FDE lookups fast.
-// We store only the FDE offset rather than the full entry to save memory.
+// Create binary search table to make FDE lookups fast, in a single pass over
+// the section and without any per entry allocation.
+// When fdes overlap, a pc belongs to the first fde in section order that
+// covers it. For example, if an fde covering 0x200-0x400 is followed by one
+// covering 0x100-0x500, the table contains 0x100-0x200 and 0x400-0x500 for
+// the second fde and 0x200-0x400 for the first.
 template <typename AddressType>
 void DwarfSectionImpl<AddressType>::BuildFdeIndex() {
-  DwarfFdeMap fdes;
+  fde_index_built_ = true;
+
+  std::vector<FdeIndexEntry> fdes;
   for (uint64_t offset = entries_offset_; offset < entries_end_;) {
     const uint64_t fde_offset = offset;
     std::optional<DwarfFde> fde;
     if (!GetNextCieOrFde(offset, fde)) {
       break;
     }
-    if (fde.has_value()) {
-      InsertFde(fde_offset, &*fde, fdes);
+    if (fde.has_value() && fde->pc_start < fde->pc_end) {
+      fdes.push_back({fde->pc_start, fde->pc_end, fde_offset});
     }
 
     if (offset < memory_.cur_offset()) {
@@ -789,12 +908,54 @@ void DwarfSectionImpl<AddressType>::BuildFdeIndex() {
       break;
     }
   }
+  if (fdes.empty()) {
+    return;
+  }
+
+  // Walk the fdes by start pc, keeping the ones that cover the current pc in
+  // a heap ordered by their position in the section. The top of the heap owns
+  // the pc until it ends or the next fde starts. Entries that ended while not
+  // on top are dropped once they reach it.
+  std::vector<size_t> by_start(fdes.size());
+  for (size_t i = 0; i < by_start.size(); i++) {
+    by_start[i] = i;
+  }
+  std::stable_sort(by_start.begin(), by_start.end(),
+                   [&fdes](size_t a, size_t b) { return fdes[a].pc_start < fdes[b].pc_start; });
 
-  // Copy the map into vector for space efficiency. The entries are already sorted.
+  std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>> active;
   fde_index_.reserve(fdes.size());
-  for (const auto& it : fdes) {
-    fde_index_.emplace_back(/*end address=*/it.first, /*FDE offset=*/it.second.second);
+  size_t next = 0;
+  uint64_t pc = fdes[by_start[0]].pc_start;
+  while (true) {
+    for (; next < by_start.size() && fdes[by_start[next]].pc_start <= pc; next++) {
+      active.push(by_start[next]);
+    }
+    while (!active.empty() && fdes[active.top()].pc_end <= pc) {
+      active.pop();
+    }
+    if (active.empty()) {
+      if (next == by_start.size()) {
+        break;
+      }
+      pc = fdes[by_start[next]].pc_start;
+      continue;
+    }
+
+    const FdeIndexEntry& owner = fdes[active.top()];
+    uint64_t end = owner.pc_end;
+    if (next < by_start.size()) {
+      end = std::min(end, fdes[by_start[next]].pc_start);
+    }
+    if (!fde_index_.empty() && fde_index_.back().pc_end == pc &&
+        fde_index_.back().fde_offset == owner.fde_offset) {
+      fde_index_.back().pc_end = end;
+    } else {
+      fde_index_.push_back({pc, end, owner.fde_offset});
+    }
+    pc = end;
   }
+  fde_index_.shrink_to_fit();
 }
 
 // Explicitly instantiate DwarfSectionImpl
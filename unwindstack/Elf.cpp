@@ -25,6 +25,7 @@
 
 #include <android-base/stringprintf.h>
 
+#include <unwindstack/DwarfSection.h>
 #include <unwindstack/Elf.h>
 #include <unwindstack/ElfInterface.h>
 #include <unwindstack/Log.h>
@@ -36,13 +37,31 @@
 #include <android-base/stringprintf.h>
 
 #include "ElfInterfaceArm.h"
+#include "PersistentCache.h"
 #include "Symbols.h"
+#include "UnwindPlanCache.h"
 
 namespace unwindstack {
 
+// All elf objects created for one file name, indexed by elf start offset.
+struct Elf::CacheEntry {
+  std::mutex lock;
+  std::unordered_map<uint64_t, std::shared_ptr<Elf>> elfs;
+};
+
+// The cache is split by file name hash so that looking up one file does not
+// contend with a lookup of another. The shard lock is only held while
+// finding the entry, never while an elf is created.
+struct Elf::CacheShard {
+  std::mutex lock;
+  std::unordered_map<std::string, std::unique_ptr<CacheEntry>> entries;
+};
+
+static constexpr size_t kCacheShards = 16;
+
 bool Elf::cache_enabled_;
-std::unordered_map<std::string, std::unordered_map<uint64_t, std::shared_ptr<Elf>>>* Elf::cache_;
-std::mutex* Elf::cache_lock_;
+bool Elf::compact_unwind_enabled_;
+Elf::CacheShard* Elf::cache_;
 
 bool Elf::Init() {
   load_bias_ = 0;
@@ -59,6 +78,24 @@ bool Elf::Init() {
   if (valid_) {
     interface_->InitHeaders();
     InitGnuDebugdata();
+
+    // Without a build id there is no way to tell if a cached blob is stale.
+    std::string cache_name;
+    if (PersistentCache::Enabled()) {
+      std::string build_id = interface_->GetBuildID();
+      cache_name = GetPrintableBuildID(build_id);
+    }
+    std::string gnu_cache_name = cache_name.empty() ? "" : cache_name + ".gnu_debugdata";
+    if (!cache_name.empty()) {
+      interface_->SetCacheName(cache_name);
+      if (gnu_debugdata_interface_ != nullptr) {
+        gnu_debugdata_interface_->SetCacheName(gnu_cache_name);
+      }
+    }
+    if (compact_unwind_enabled_) {
+      InitCompactUnwind(interface_.get(), cache_name);
+      InitCompactUnwind(gnu_debugdata_interface_.get(), gnu_cache_name);
+    }
   } else {
     interface_.reset(nullptr);
   }
@@ -92,6 +129,35 @@ void Elf::InitGnuDebugdata() {
   }
 }
 
+void Elf::InitCompactUnwind(ElfInterface* interface, const std::string& cache_name) {
+  if (interface == nullptr) {
+    return;
+  }
+  auto init_section = [&](DwarfSection* section, const char* suffix, uint64_t offset,
+                          uint64_t size) {
+    if (section == nullptr) {
+      return;
+    }
+    if (cache_name.empty()) {
+      section->BuildCompactTable(arch_);
+      return;
+    }
+    std::string name = cache_name + suffix;
+    uint64_t key = PersistentCache::Key({arch_, offset, size, sizeof(UnwindPlanRow)});
+    if (!section->LoadCompactTable(arch_, name, key) && section->BuildCompactTable(arch_)) {
+      section->StoreCompactTable(name, key);
+    }
+  };
+  init_section(interface->debug_frame(), ".debug_frame", interface->debug_frame_offset(),
+               interface->debug_frame_size());
+  init_section(interface->eh_frame(), ".eh_frame", interface->eh_frame_offset(),
+               interface->eh_frame_size());
+}
+
+void Elf::SetPersistentCacheDir(const std::string& dir) {
+  PersistentCache::SetDirectory(dir);
+}
+
 void Elf::Invalidate() {
   interface_.reset(nullptr);
   valid_ = false;
@@ -116,6 +182,17 @@ bool Elf::GetFunctionName(uint64_t addr, SharedString* name, uint64_t* func_offs
                      gnu_debugdata_interface_->GetFunctionName(addr, name, func_offset)));
 }
 
+void Elf::GetFunctionNames(std::vector<FunctionLookup>* lookups) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (!valid_) {
+    return;
+  }
+  interface_->GetFunctionNames(lookups);
+  if (gnu_debugdata_interface_) {
+    gnu_debugdata_interface_->GetFunctionNames(lookups);
+  }
+}
+
 bool Elf::GetGlobalVariableOffset(const std::string& name, uint64_t* memory_offset) {
   if (!valid_) {
     return false;
@@ -201,11 +278,22 @@ bool Elf::Step(uint64_t rel_pc, Regs* regs, Memory* process_memory, bool* finish
     return false;
   }
 
+  // Hot pcs are handled by the process wide cache without taking the lock.
+  if (UnwindPlanCache::Step(plan_cache_owner_, rel_pc, class_type_ == ELFCLASS32, regs,
+                            process_memory, finished, is_signal_frame)) {
+    return true;
+  }
+
   // Lock during the step which can update information in the object.
   std::lock_guard<std::mutex> guard(lock_);
+  UnwindPlanCache::Recorder recorder(plan_cache_owner_, rel_pc);
   return interface_->Step(rel_pc, regs, process_memory, finished, is_signal_frame);
 }
 
+uint64_t Elf::NewPlanCacheOwner() {
+  return UnwindPlanCache::NewOwner();
+}
+
 bool Elf::IsValidElf(Memory* memory) {
   if (memory == nullptr) {
     return false;
@@ -352,39 +440,39 @@ int64_t Elf::GetLoadBias(Memory* memory) {
 void Elf::SetCachingEnabled(bool enable) {
   if (!cache_enabled_ && enable) {
     cache_enabled_ = true;
-    cache_ =
-        new std::unordered_map<std::string, std::unordered_map<uint64_t, std::shared_ptr<Elf>>>;
-    cache_lock_ = new std::mutex;
+    cache_ = new CacheShard[kCacheShards];
   } else if (cache_enabled_ && !enable) {
     cache_enabled_ = false;
-    delete cache_;
-    delete cache_lock_;
+    delete[] cache_;
   }
 }
 
-void Elf::CacheLock() {
-  cache_lock_->lock();
+Elf::CacheEntry* Elf::CacheFind(const std::string& name) {
+  CacheShard* shard = &cache_[std::hash<std::string>()(name) % kCacheShards];
+  std::lock_guard<std::mutex> guard(shard->lock);
+  std::unique_ptr<CacheEntry>& entry = shard->entries[name];
+  if (entry == nullptr) {
+    entry.reset(new CacheEntry);
+  }
+  // Entries are never removed while caching is enabled.
+  return entry.get();
 }
 
-void Elf::CacheUnlock() {
-  cache_lock_->unlock();
+std::mutex* Elf::CacheLock(const std::string& name) {
+  return &CacheFind(name)->lock;
 }
 
 void Elf::CacheAdd(MapInfo* info) {
   if (!info->elf()->valid()) {
     return;
   }
-  (*cache_)[std::string(info->name())].emplace(info->elf_start_offset(), info->elf());
+  CacheFind(info->name())->elfs.emplace(info->elf_start_offset(), info->elf());
 }
 
 bool Elf::CacheGet(MapInfo* info) {
-  auto name_entry = cache_->find(std::string(info->name()));
-  if (name_entry == cache_->end()) {
-    return false;
-  }
   // First look to see if there is a zero offset entry, this indicates
   // the whole elf is the file.
-  auto& offset_cache = name_entry->second;
+  auto& offset_cache = CacheFind(info->name())->elfs;
   uint64_t elf_start_offset = 0;
   auto entry = offset_cache.find(elf_start_offset);
   if (entry == offset_cache.end()) {
@@ -40,6 +40,20 @@ ElfInterface::~ElfInterface() {
   }
 }
 
+void ElfInterface::SetCacheName(const std::string& cache_name) {
+  for (size_t i = 0; i < symbols_.size(); i++) {
+    symbols_[i]->set_cache_name(cache_name + ".symbols" + std::to_string(i));
+  }
+}
+
+void ElfInterface::GetFunctionNames(std::vector<FunctionLookup>* lookups) {
+  for (auto& lookup : *lookups) {
+    if (!lookup.found) {
+      lookup.found = GetFunctionName(lookup.addr, &lookup.name, &lookup.offset);
+    }
+  }
+}
+
 bool ElfInterface::IsValidPc(uint64_t pc) {
   if (!pt_loads_.empty()) {
     for (auto& entry : pt_loads_) {
@@ -418,6 +432,13 @@ bool ElfInterfaceImpl<ElfTypes>::GetFunctionName(uint64_t addr, SharedString* na
   return false;
 }
 
+template <typename ElfTypes>
+void ElfInterfaceImpl<ElfTypes>::GetFunctionNames(std::vector<FunctionLookup>* lookups) {
+  for (const auto symbol : symbols_) {
+    symbol->template GetNames<SymType>(memory_, lookups);
+  }
+}
+
 template <typename ElfTypes>
 bool ElfInterfaceImpl<ElfTypes>::GetGlobalVariable(const std::string& name,
                                                    uint64_t* memory_address) {
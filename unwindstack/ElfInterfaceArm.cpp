@@ -26,6 +26,10 @@
 
 namespace unwindstack {
 
+// The process wide UnwindPlanCache holds the hot pcs, this only needs to
+// avoid decoding the same entry again for nearby pcs.
+static constexpr size_t kMaxExidxRows = 1024;
+
 bool ElfInterfaceArm::Init(int64_t* load_bias) {
   if (!ElfInterface32::Init(load_bias)) {
     return false;
@@ -106,11 +110,17 @@ bool ElfInterfaceArm::Step(uint64_t pc, Regs* regs, Memory* process_memory, bool
   // but arm unwind information only has ranges of pc. In order to avoid
   // incorrectly doing a bad unwind using arm unwind information for a
   // different function, always try and unwind with the dwarf information first.
-  return ElfInterface32::Step(pc, regs, process_memory, finished, is_signal_frame) ||
-         StepExidx(pc, regs, process_memory, finished);
+  if (ElfInterface32::Step(pc, regs, process_memory, finished, is_signal_frame)) {
+    return true;
+  }
+  // If the dwarf step failed to read the stack it may work for the next
+  // unwind, so do not let the cache skip it.
+  bool record_row = last_error_.code != ERROR_MEMORY_INVALID;
+  return StepExidx(pc, regs, process_memory, finished, record_row);
 }
 
-bool ElfInterfaceArm::StepExidx(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished) {
+bool ElfInterfaceArm::StepExidx(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
+                                bool record_row) {
   // Adjust the load bias to get the real relative pc.
   if (pc < load_bias_) {
     last_error_.code = ERROR_UNWIND_INFO;
@@ -124,12 +134,41 @@ bool ElfInterfaceArm::StepExidx(uint64_t pc, Regs* regs, Memory* process_memory,
     return false;
   }
 
+  auto entry = exidx_rows_.find(entry_offset);
+  if (entry == exidx_rows_.end()) {
+    std::optional<UnwindPlanRow> row;
+    ArmExidx arm(regs_arm, memory_, process_memory);
+    UnwindPlanRow compiled;
+    if (arm.ExtractEntryData(entry_offset) && arm.Compile(&compiled)) {
+      row = compiled;
+    }
+    if (exidx_rows_.size() >= kMaxExidxRows) {
+      exidx_rows_.clear();
+    }
+    entry = exidx_rows_.emplace(entry_offset, row).first;
+  }
+  if (entry->second.has_value()) {
+    bool is_signal_frame;
+    if (entry->second->Apply(true, regs, process_memory, finished, &is_signal_frame)) {
+      if (record_row) {
+        UnwindPlanCache::Record(*entry->second);
+      }
+      return true;
+    }
+    // Evaluate the entry again to report the error.
+  }
+
   ArmExidx arm(regs_arm, memory_, process_memory);
   arm.set_cfa(regs_arm->sp());
+  uint32_t lr = (*regs_arm)[ARM_REG_LR];
   bool return_value = false;
   if (arm.ExtractEntryData(entry_offset) && arm.Eval()) {
     // If the pc was not set, then use the LR registers for the PC.
     if (!arm.pc_set()) {
+      if ((*regs_arm)[ARM_REG_LR] == lr) {
+        // The entry may not have restored lr.
+        regs_arm->MarkRead(ARM_REG_LR);
+      }
       (*regs_arm)[ARM_REG_PC] = (*regs_arm)[ARM_REG_LR];
     }
     (*regs_arm)[ARM_REG_SP] = arm.cfa();
@@ -182,4 +221,20 @@ bool ElfInterfaceArm::GetFunctionName(uint64_t addr, SharedString* name, uint64_
   return false;
 }
 
+void ElfInterfaceArm::GetFunctionNames(std::vector<FunctionLookup>* lookups) {
+  // Same adjustment as GetFunctionName, setting bit 0 keeps the order.
+  std::vector<std::pair<FunctionLookup*, uint64_t>> pending;
+  for (auto& lookup : *lookups) {
+    if (!lookup.found) {
+      pending.emplace_back(&lookup, lookup.addr);
+      lookup.addr |= 1;
+    }
+  }
+  ElfInterface32::GetFunctionNames(lookups);
+  for (auto& [lookup, addr] : pending) {
+    lookup->addr = addr;
+    lookup->offset &= ~1;
+  }
+}
+
 }  // namespace unwindstack
@@ -20,11 +20,14 @@
 #include <elf.h>
 #include <stdint.h>
 
+#include <optional>
 #include <unordered_map>
 
 #include <unwindstack/ElfInterface.h>
 #include <unwindstack/Memory.h>
 
+#include "UnwindPlanCache.h"
+
 namespace unwindstack {
 
 class ElfInterfaceArm : public ElfInterface32 {
@@ -80,10 +83,15 @@ class ElfInterfaceArm : public ElfInterface32 {
   bool Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
             bool* is_signal_frame) override;
 
-  bool StepExidx(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished);
+  // If record_row is set, a compiled entry is also added to the process
+  // wide UnwindPlanCache for this pc.
+  bool StepExidx(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished,
+                 bool record_row = true);
 
   bool GetFunctionName(uint64_t addr, SharedString* name, uint64_t* offset) override;
 
+  void GetFunctionNames(std::vector<FunctionLookup>* lookups) override;
+
   uint64_t start_offset() { return start_offset_; }
 
   size_t total_entries() { return total_entries_; }
@@ -96,6 +104,8 @@ class ElfInterfaceArm : public ElfInterface32 {
   uint64_t load_bias_ = 0;
 
   std::unordered_map<size_t, uint32_t> addrs_;
+  // Every entry is compiled once, an empty row means it has to be evaluated.
+  std::unordered_map<uint64_t, std::optional<UnwindPlanRow>> exidx_rows_;
 };
 
 }  // namespace unwindstack
@@ -113,9 +113,11 @@ class GlobalDebugImpl : public GlobalDebugInterface<Symfile>, public Global {
     if (memcmp(desc.magic, kMagic, sizeof(kMagic)) == 0) {
       jit_entry_size_ = kSizeOfCodeEntryV2;
       seqlock_offset_ = offsetof(JITCodeEntry, seqlock);
+      has_action_timestamp_ = true;
     } else {
       jit_entry_size_ = kSizeOfCodeEntryV1;
       seqlock_offset_ = 0;
+      has_action_timestamp_ = false;
     }
     descriptor_addr_ = addr;
     return true;
@@ -146,8 +148,11 @@ class GlobalDebugImpl : public GlobalDebugInterface<Symfile>, public Global {
       }
     }
 
-    // Update all entries and retry.
-    ReadAllEntries(maps);
+    // Update all entries and retry. If nothing was added or removed since the
+    // last read, the cached entries are complete and the retry can be skipped.
+    if (!UpdateEntries(maps)) {
+      return false;
+    }
     for (auto& it : entries_) {
       if (callback(it.first, it.second.get())) {
         return true;
@@ -184,12 +189,63 @@ class GlobalDebugImpl : public GlobalDebugInterface<Symfile>, public Global {
     return result;
   }
 
+  // Read the descriptor timestamp, which the runtime updates on every
+  // register/unregister action. Fails if an action is in progress.
+  bool ReadActionTimestamp(uint64_t* timestamp) {
+    uint32_t seqlock[2]{0, 0};
+    Uint64_T value{};
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!memory_->Read32(descriptor_addr_ + offsetof(JITDescriptor, seqlock), &seqlock[0])) {
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!memory_->ReadFully(descriptor_addr_ + offsetof(JITDescriptor, timestamp), &value,
+                            sizeof(value))) {
+      return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!memory_->Read32(descriptor_addr_ + offsetof(JITDescriptor, seqlock), &seqlock[1])) {
+      return false;
+    }
+    if (seqlock[0] != seqlock[1] || (seqlock[0] & 1) == 1) {
+      return false;
+    }
+    *timestamp = value.value;
+    return true;
+  }
+
+  // Bring the cached entries up to date with the process.
+  // Returns false if the descriptor has not changed since the last read.
+  bool UpdateEntries(Maps* maps) {
+    if (!has_action_timestamp_) {
+      // Without the Android-specific fields there is no way to tell
+      // whether the list changed, so always read all of it.
+      ReadAllEntries(maps, false);
+      return true;
+    }
+
+    uint64_t timestamp = 0;
+    bool stable = ReadActionTimestamp(&timestamp);
+    if (stable && entries_valid_ && timestamp == entries_timestamp_) {
+      return false;
+    }
+    // The timestamp is read before the list, so an action that races with the
+    // read below only makes the next lookup read the list again.
+    if (ReadAllEntries(maps, true) && stable) {
+      entries_timestamp_ = timestamp;
+      entries_valid_ = true;
+    }
+    return true;
+  }
+
   // Read all entries from the process and cache them locally.
   // The linked list might be concurrently modified. We detect races and retry.
-  bool ReadAllEntries(Maps* maps) {
+  // If incremental is set, cached entries that are still alive are kept and
+  // only the new entries at the head of the list are read.
+  bool ReadAllEntries(Maps* maps, bool incremental) {
     for (int i = 0; i < kMaxRaceRetries; i++) {
       bool race = false;
-      if (!ReadAllEntries(maps, &race)) {
+      if (!ReadAllEntries(maps, incremental, &race)) {
         if (race) {
           continue;  // Retry due to concurrent modification of the linked list.
         }
@@ -202,12 +258,22 @@ class GlobalDebugImpl : public GlobalDebugInterface<Symfile>, public Global {
 
   // Read all JIT entries while assuming there might be concurrent modifications.
   // If there is a race, the method will fail and the caller should retry the call.
-  bool ReadAllEntries(Maps* maps, bool* race) {
+  bool ReadAllEntries(Maps* maps, bool incremental, bool* race) {
     // New entries might be added while we iterate over the linked list.
     // In particular, an entry could be effectively moved from end to start due to
     // the ART repacking algorithm, which groups smaller entries into a big one.
     // Therefore keep reading the most recent entries until we reach a fixed point.
     std::map<UID, std::shared_ptr<Symfile>> entries;
+    if (incremental) {
+      // New entries are only ever inserted at the head, and a repacked entry
+      // gets a new seqlock, so reading stops at the first entry kept here.
+      // Removed entries are the ones whose seqlock has changed.
+      for (auto& it : entries_) {
+        if (CheckSeqlock(it.first)) {
+          entries.emplace(it.first, it.second);
+        }
+      }
+    }
     for (size_t i = 0; i < kMaxHeadRetries; i++) {
       size_t old_size = entries.size();
       if (!ReadNewEntries(maps, &entries, race)) {
@@ -342,7 +408,10 @@ class GlobalDebugImpl : public GlobalDebugInterface<Symfile>, public Global {
   uint64_t descriptor_addr_ = 0;  // Non-zero if we have found (non-empty) descriptor.
   uint32_t jit_entry_size_ = 0;
   uint32_t seqlock_offset_ = 0;
+  bool has_action_timestamp_ = false;
   std::map<UID, std::shared_ptr<Symfile>> entries_;  // Cached loaded entries.
+  uint64_t entries_timestamp_ = 0;  // Descriptor timestamp when entries_ was read.
+  bool entries_valid_ = false;
 
   std::mutex lock_;
 };
@@ -261,12 +261,18 @@ Memory* MapInfo::CreateMemory(const std::shared_ptr<Memory>& process_memory) {
 
 class ScopedElfCacheLock {
  public:
-  ScopedElfCacheLock() {
-    if (Elf::CachingEnabled()) Elf::CacheLock();
+  ScopedElfCacheLock(const std::string& name) {
+    if (Elf::CachingEnabled() && !name.empty()) {
+      lock_ = Elf::CacheLock(name);
+      lock_->lock();
+    }
   }
   ~ScopedElfCacheLock() {
-    if (Elf::CachingEnabled()) Elf::CacheUnlock();
+    if (lock_ != nullptr) lock_->unlock();
   }
+
+ private:
+  std::mutex* lock_ = nullptr;
 };
 
 Elf* MapInfo::GetElf(const std::shared_ptr<Memory>& process_memory, ArchEnum expected_arch) {
@@ -277,7 +283,7 @@ Elf* MapInfo::GetElf(const std::shared_ptr<Memory>& process_memory, ArchEnum exp
     return elf().get();
   }
 
-  ScopedElfCacheLock elf_cache_lock;
+  ScopedElfCacheLock elf_cache_lock(name());
   if (Elf::CachingEnabled() && !name().empty()) {
     if (Elf::CacheGet(this)) {
       return elf().get();
@@ -318,7 +324,7 @@ Elf* MapInfo::GetElf(const std::shared_ptr<Memory>& process_memory, ArchEnum exp
 
   // Cache the elf only after all of the above checks since we might
   // discard the original elf we created.
-  if (Elf::CachingEnabled()) {
+  if (Elf::CachingEnabled() && !name().empty()) {
     Elf::CacheAdd(this);
   }
   return elf().get();
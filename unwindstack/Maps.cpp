@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <elf.h>
 #include <fcntl.h>
+#include <link.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
@@ -135,35 +138,257 @@ const std::string LocalUpdatableMaps::GetMapsFile() const {
   return "/proc/self/maps";
 }
 
-LocalUpdatableMaps::LocalUpdatableMaps() : Maps() {
+namespace {
+
+// Consecutive frames, and consecutive unwinds, mostly hit the same few maps.
+constexpr size_t kNumCachedMaps = 4;
+
+struct CachedMap {
+  uint64_t generation = 0;
+  std::shared_ptr<MapInfo> map_info;
+};
+
+// Most recently used first.
+thread_local CachedMap g_cached_maps[kNumCachedMaps];
+
+std::atomic<uint64_t> g_next_generation(1);
+
+std::shared_ptr<MapInfo> FindCachedMap(uint64_t generation, uint64_t pc) {
+  for (size_t i = 0; i < kNumCachedMaps; i++) {
+    CachedMap& entry = g_cached_maps[i];
+    if (entry.generation == generation && pc >= entry.map_info->start() &&
+        pc < entry.map_info->end()) {
+      std::rotate(&g_cached_maps[0], &g_cached_maps[i], &g_cached_maps[i + 1]);
+      return g_cached_maps[0].map_info;
+    }
+  }
+  return nullptr;
+}
+
+void CacheMap(uint64_t generation, const std::shared_ptr<MapInfo>& map_info) {
+  std::move_backward(&g_cached_maps[0], &g_cached_maps[kNumCachedMaps - 1],
+                     &g_cached_maps[kNumCachedMaps]);
+  g_cached_maps[0].generation = generation;
+  g_cached_maps[0].map_info = map_info;
+}
+
+}  // namespace
+
+LocalUpdatableMaps::LocalUpdatableMaps() : Maps(), generation_(g_next_generation.fetch_add(1)) {
   pthread_rwlock_init(&maps_rwlock_, nullptr);
 }
 
+void LocalUpdatableMaps::MapsChanged() {
+  generation_.store(g_next_generation.fetch_add(1, std::memory_order_relaxed),
+                    std::memory_order_release);
+}
+
 std::shared_ptr<MapInfo> LocalUpdatableMaps::Find(uint64_t pc) {
+  // The generation changes whenever a map is added or removed, so a cached
+  // entry with the current generation is exactly what the search would find.
+  std::shared_ptr<MapInfo> map_info =
+      FindCachedMap(generation_.load(std::memory_order_acquire), pc);
+  if (map_info != nullptr) {
+    return map_info;
+  }
+
   pthread_rwlock_rdlock(&maps_rwlock_);
-  std::shared_ptr<MapInfo> map_info = Maps::Find(pc);
+  map_info = Maps::Find(pc);
+  if (map_info != nullptr) {
+    CacheMap(generation_.load(std::memory_order_relaxed), map_info);
+  }
   pthread_rwlock_unlock(&maps_rwlock_);
 
   if (map_info == nullptr) {
+    // Most misses come from a module loaded since the last update, which the
+    // loader can describe without the cost of reading /proc/self/maps.
+    ModuleList list;
+    bool have_modules = ReadModules(&list);
+
     pthread_rwlock_wrlock(&maps_rwlock_);
+    // Another thread may have already added the map.
+    map_info = Maps::Find(pc);
+    if (map_info == nullptr && have_modules && ApplyModules(&list)) {
+      map_info = Maps::Find(pc);
+    }
+    // Raw mappings of code are only visible in procfs.
     // This is guaranteed not to invalidate any previous MapInfo objects so
     // we don't need to worry about any MapInfo* values already in use.
-    if (Reparse()) {
+    if (map_info == nullptr && Reparse()) {
       map_info = Maps::Find(pc);
     }
+    if (map_info != nullptr) {
+      CacheMap(generation_.load(std::memory_order_relaxed), map_info);
+    }
     pthread_rwlock_unlock(&maps_rwlock_);
   }
 
   return map_info;
 }
 
+std::vector<std::shared_ptr<MapInfo>> LocalUpdatableMaps::Snapshot() {
+  pthread_rwlock_rdlock(&maps_rwlock_);
+  std::vector<std::shared_ptr<MapInfo>> maps = maps_;
+  pthread_rwlock_unlock(&maps_rwlock_);
+  return maps;
+}
+
 bool LocalUpdatableMaps::Parse() {
   pthread_rwlock_wrlock(&maps_rwlock_);
   bool parsed = Maps::Parse();
+  MapsChanged();
   pthread_rwlock_unlock(&maps_rwlock_);
   return parsed;
 }
 
+bool LocalUpdatableMaps::SyncModules() {
+  ModuleList list;
+  if (!ReadModules(&list)) {
+    return false;
+  }
+  pthread_rwlock_wrlock(&maps_rwlock_);
+  bool changed = ApplyModules(&list);
+  pthread_rwlock_unlock(&maps_rwlock_);
+  return changed;
+}
+
+static uint64_t LoaderGeneration(struct dl_phdr_info* info, size_t size) {
+  if (size < offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+    return 0;
+  }
+  return info->dlpi_adds + info->dlpi_subs;
+}
+
+bool LocalUpdatableMaps::ReadModules(ModuleList* list) {
+  // Skip the full walk if nothing was loaded or unloaded since the last sync.
+  uint64_t generation = 0;
+  dl_iterate_phdr(
+      [](struct dl_phdr_info* info, size_t size, void* data) {
+        *reinterpret_cast<uint64_t*>(data) = LoaderGeneration(info, size);
+        return 1;
+      },
+      &generation);
+  if (generation != 0 && generation == modules_generation_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  dl_iterate_phdr(
+      [](struct dl_phdr_info* info, size_t size, void* data) {
+        ModuleList* list = reinterpret_cast<ModuleList*>(data);
+        list->generation = LoaderGeneration(info, size);
+
+        static const uint64_t page_size = getpagesize();
+        Module module;
+        module.name = info->dlpi_name != nullptr ? info->dlpi_name : "";
+        for (size_t i = 0; i < info->dlpi_phnum; i++) {
+          const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+          if (phdr.p_type != PT_LOAD || phdr.p_filesz == 0) {
+            continue;
+          }
+          // Only the file backed part, the bss beyond it is an anonymous map.
+          uint64_t vaddr = info->dlpi_addr + phdr.p_vaddr;
+          Module::Segment segment;
+          segment.start = vaddr & ~(page_size - 1);
+          segment.end = (vaddr + phdr.p_filesz + page_size - 1) & ~(page_size - 1);
+          segment.offset = phdr.p_offset & ~(page_size - 1);
+          segment.flags = ((phdr.p_flags & PF_R) ? PROT_READ : 0) |
+                          ((phdr.p_flags & PF_W) ? PROT_WRITE : 0) |
+                          ((phdr.p_flags & PF_X) ? PROT_EXEC : 0);
+          if (module.segments.empty() || segment.start < module.start) {
+            module.start = segment.start;
+          }
+          module.end = std::max(module.end, segment.end);
+          module.segments.push_back(segment);
+        }
+        if (!module.segments.empty()) {
+          list->modules.emplace_back(std::move(module));
+        }
+        return 0;
+      },
+      list);
+  return true;
+}
+
+bool LocalUpdatableMaps::Overlaps(uint64_t start, uint64_t end) {
+  auto entry = std::lower_bound(
+      maps_.begin(), maps_.end(), start,
+      [](const std::shared_ptr<MapInfo>& info, uint64_t value) { return info->start() < value; });
+  if (entry != maps_.end() && (*entry)->start() < end) {
+    return true;
+  }
+  return entry != maps_.begin() && (*std::prev(entry))->end() > start;
+}
+
+bool LocalUpdatableMaps::ApplyModules(ModuleList* list) {
+  // Two threads can read the modules concurrently, never let an older list
+  // undo a newer one.
+  if (list->generation != 0 &&
+      list->generation <= modules_generation_.load(std::memory_order_relaxed)) {
+    return false;
+  }
+
+  std::map<uint64_t, Module> current;
+  for (auto& module : list->modules) {
+    uint64_t start = module.start;
+    current.emplace(start, std::move(module));
+  }
+
+  // Retire everything inside the range of a module that is gone. The
+  // MapInfo objects stay alive for any frame still referencing them.
+  bool retired = false;
+  for (const auto& [start, module] : modules_) {
+    auto entry = current.find(start);
+    if (entry != current.end() && entry->second.name == module.name &&
+        entry->second.end == module.end) {
+      continue;
+    }
+    auto removed = std::remove_if(maps_.begin(), maps_.end(), [&module](const auto& info) {
+      return info->start() >= module.start && info->end() <= module.end;
+    });
+    retired |= removed != maps_.end();
+    maps_.erase(removed, maps_.end());
+  }
+
+  // Add the segments of the new modules. Anything that overlaps an existing
+  // map is left alone, procfs always has the more accurate view. Libraries
+  // loaded directly from an apk have offsets relative to the apk, and there
+  // is no file at all for a nameless module, leave those to the reparse.
+  bool changed = retired;
+  for (const auto& [start, module] : current) {
+    auto entry = modules_.find(start);
+    if ((entry != modules_.end() && entry->second.name == module.name &&
+         entry->second.end == module.end) ||
+        module.name.empty() || module.name.find("!/") != std::string::npos) {
+      continue;
+    }
+    std::vector<std::shared_ptr<MapInfo>> added;
+    for (const auto& segment : module.segments) {
+      if (!Overlaps(segment.start, segment.end)) {
+        added.emplace_back(MapInfo::Create(segment.start, segment.end, segment.offset,
+                                           segment.flags, module.name));
+      }
+    }
+    // Keep the vector sorted so that Overlaps works for the next module.
+    if (!added.empty()) {
+      maps_.insert(maps_.end(), added.begin(), added.end());
+      Sort();
+      changed = true;
+      retired = false;
+    }
+  }
+  if (retired) {
+    // Fix the prev_map and next_map of the entries around the removed maps.
+    Sort();
+  }
+
+  modules_ = std::move(current);
+  modules_generation_.store(list->generation, std::memory_order_relaxed);
+  if (changed) {
+    MapsChanged();
+  }
+  return changed;
+}
+
 bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
   // New maps will be added at the end without deleting the old ones.
   size_t last_map_idx = maps_.size();
@@ -242,8 +467,12 @@ bool LocalUpdatableMaps::Reparse(/*out*/ bool* any_changed) {
   });
   maps_.resize(maps_.size() - num_deleted_old_entries - num_deleted_new_entries);
 
+  bool changed = num_deleted_old_entries != 0 || maps_.size() != last_map_idx;
+  if (changed) {
+    MapsChanged();
+  }
   if (any_changed != nullptr) {
-    *any_changed = num_deleted_old_entries != 0 || maps_.size() != last_map_idx;
+    *any_changed = changed;
   }
 
   return true;
@@ -493,20 +493,58 @@ size_t MemoryOfflineParts::Read(uint64_t addr, void* dst, size_t size) {
   return 0;
 }
 
+uint8_t* MemoryCacheBase::CacheDataType::Insert(uint64_t page) {
+  if (data_ == nullptr) {
+    size_t num_slots = kCacheWays << set_bits_;
+    slots_.reset(new Slot[num_slots]());
+    lru_.reset(new uint8_t[1 << set_bits_]());
+    data_.reset(new uint8_t[num_slots << kCacheBits]);
+  }
+  size_t set = page & ((1 << set_bits_) - 1);
+  size_t way = lru_[set];
+  for (size_t i = 0; i < kCacheWays; i++) {
+    if (slots_[set * kCacheWays + i].generation != generation_) {
+      way = i;
+      break;
+    }
+  }
+  lru_[set] = way ^ 1;
+  Slot& slot = slots_[set * kCacheWays + way];
+  slot.page = page;
+  slot.generation = generation_;
+  return &data_[((set * kCacheWays) + way) << kCacheBits];
+}
+
+void MemoryCacheBase::CacheDataType::Erase(uint64_t page) {
+  size_t set = page & ((1 << set_bits_) - 1);
+  for (size_t way = 0; way < kCacheWays; way++) {
+    Slot& slot = slots_[set * kCacheWays + way];
+    if (slot.generation == generation_ && slot.page == page) {
+      slot.generation = 0;
+      lru_[set] = way;
+    }
+  }
+}
+
+uint8_t* MemoryCacheBase::GetCachedPage(uint64_t addr_page, CacheDataType* cache) {
+  uint8_t* cache_dst = cache->Find(addr_page);
+  if (cache_dst != nullptr) {
+    return cache_dst;
+  }
+  cache_dst = cache->Insert(addr_page);
+  if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
+    cache->Erase(addr_page);
+    return nullptr;
+  }
+  return cache_dst;
+}
+
 size_t MemoryCacheBase::InternalCachedRead(uint64_t addr, void* dst, size_t size,
                                            CacheDataType* cache) {
   uint64_t addr_page = addr >> kCacheBits;
-  auto entry = cache->find(addr_page);
-  uint8_t* cache_dst;
-  if (entry != cache->end()) {
-    cache_dst = entry->second;
-  } else {
-    cache_dst = (*cache)[addr_page];
-    if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
-      // Erase the entry.
-      cache->erase(addr_page);
-      return impl_->Read(addr, dst, size);
-    }
+  uint8_t* cache_dst = GetCachedPage(addr_page, cache);
+  if (cache_dst == nullptr) {
+    return impl_->Read(addr, dst, size);
   }
   size_t max_read = ((addr_page + 1) << kCacheBits) - addr;
   if (size <= max_read) {
@@ -520,16 +558,9 @@ size_t MemoryCacheBase::InternalCachedRead(uint64_t addr, void* dst, size_t size
   dst = &reinterpret_cast<uint8_t*>(dst)[max_read];
   addr_page++;
 
-  entry = cache->find(addr_page);
-  if (entry != cache->end()) {
-    cache_dst = entry->second;
-  } else {
-    cache_dst = (*cache)[addr_page];
-    if (!impl_->ReadFully(addr_page << kCacheBits, cache_dst, kCacheSize)) {
-      // Erase the entry.
-      cache->erase(addr_page);
-      return impl_->Read(addr_page << kCacheBits, dst, size - max_read) + max_read;
-    }
+  cache_dst = GetCachedPage(addr_page, cache);
+  if (cache_dst == nullptr) {
+    return impl_->Read(addr_page << kCacheBits, dst, size - max_read) + max_read;
   }
   memcpy(dst, cache_dst, size - max_read);
   return size;
@@ -537,7 +568,7 @@ size_t MemoryCacheBase::InternalCachedRead(uint64_t addr, void* dst, size_t size
 
 void MemoryCache::Clear() {
   std::lock_guard<std::mutex> lock(cache_lock_);
-  cache_.clear();
+  cache_.Clear();
 }
 
 size_t MemoryCache::CachedRead(uint64_t addr, void* dst, size_t size) {
@@ -573,7 +604,7 @@ size_t MemoryThreadCache::CachedRead(uint64_t addr, void* dst, size_t size) {
 
   CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(*thread_cache_));
   if (cache == nullptr) {
-    cache = new CacheDataType;
+    cache = new CacheDataType(kCacheSetBits);
     pthread_setspecific(*thread_cache_, cache);
   }
 
@@ -585,10 +616,10 @@ void MemoryThreadCache::Clear() {
     return;
   }
 
+  // Keep the pages allocated, they are reused by the next unwind.
   CacheDataType* cache = reinterpret_cast<CacheDataType*>(pthread_getspecific(*thread_cache_));
   if (cache != nullptr) {
-    delete cache;
-    pthread_setspecific(*thread_cache_, nullptr);
+    cache->Clear();
   }
 }
 }  // namespace unwindstack
@@ -23,7 +23,6 @@
 #include <memory>
 #include <mutex>
 #include <optional>
-#include <unordered_map>
 
 #include <unwindstack/Memory.h>
 
@@ -53,18 +52,64 @@ class MemoryCacheBase : public Memory {
   constexpr static size_t kCacheMask = (1 << kCacheBits) - 1;
   constexpr static size_t kCacheSize = 1 << kCacheBits;
 
-  using CacheDataType = std::unordered_map<uint64_t, uint8_t[kCacheSize]>;
+  // A fixed number of pages in a two way set associative cache. The pages
+  // are allocated on the first miss and never freed, Clear only bumps the
+  // generation, so neither a hit nor a clear allocates.
+  class CacheDataType {
+   public:
+    CacheDataType(size_t set_bits) : set_bits_(set_bits) {}
+
+    uint8_t* Find(uint64_t page) {
+      if (slots_ == nullptr) {
+        return nullptr;
+      }
+      size_t set = page & ((1 << set_bits_) - 1);
+      Slot* slots = &slots_[set * kCacheWays];
+      for (size_t way = 0; way < kCacheWays; way++) {
+        if (slots[way].generation == generation_ && slots[way].page == page) {
+          lru_[set] = way ^ 1;
+          return &data_[((set * kCacheWays) + way) << kCacheBits];
+        }
+      }
+      return nullptr;
+    }
+
+    // Returns the slot for the page, the caller fills it in. Replaces the
+    // least recently used page of the set.
+    uint8_t* Insert(uint64_t page);
+
+    // Forgets a page returned by Insert that could not be read.
+    void Erase(uint64_t page);
+
+    void Clear() { generation_++; }
+
+   private:
+    static constexpr size_t kCacheWays = 2;
+
+    struct Slot {
+      uint64_t page;
+      uint64_t generation;  // The slot is empty unless this matches generation_.
+    };
+
+    size_t set_bits_;
+    uint64_t generation_ = 1;
+    std::unique_ptr<Slot[]> slots_;
+    std::unique_ptr<uint8_t[]> lru_;  // The way to replace next in every set.
+    std::unique_ptr<uint8_t[]> data_;
+  };
 
   virtual size_t CachedRead(uint64_t addr, void* dst, size_t size) = 0;
 
   size_t InternalCachedRead(uint64_t addr, void* dst, size_t size, CacheDataType* cache);
 
+  uint8_t* GetCachedPage(uint64_t addr_page, CacheDataType* cache);
+
   std::shared_ptr<Memory> impl_;
 };
 
 class MemoryCache : public MemoryCacheBase {
  public:
-  MemoryCache(Memory* memory) : MemoryCacheBase(memory) {}
+  MemoryCache(Memory* memory) : MemoryCacheBase(memory), cache_(kCacheSetBits) {}
   virtual ~MemoryCache() = default;
 
   size_t CachedRead(uint64_t addr, void* dst, size_t size) override;
@@ -72,6 +117,9 @@ class MemoryCache : public MemoryCacheBase {
   void Clear() override;
 
  protected:
+  // 256 pages, 1 MiB, shared by every thread.
+  constexpr static size_t kCacheSetBits = 7;
+
   CacheDataType cache_;
 
   std::mutex cache_lock_;
@@ -87,6 +135,9 @@ class MemoryThreadCache : public MemoryCacheBase {
   void Clear() override;
 
  protected:
+  // 16 pages, 64 KiB, for every thread that reads through this object.
+  constexpr static size_t kCacheSetBits = 3;
+
   std::optional<pthread_key_t> thread_cache_;
 };
 
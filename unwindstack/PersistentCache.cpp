@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
+#include <android-base/unique_fd.h>
+
+#include "PersistentCache.h"
+
+namespace unwindstack {
+
+// Bump when the header or any payload layout changes.
+static constexpr uint32_t kVersion = 1;
+static constexpr uint32_t kMagic = 0x55574342;  // UWCB
+
+struct BlobHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t size;
+};
+static_assert(sizeof(BlobHeader) % sizeof(uint64_t) == 0, "Payload must stay 8 byte aligned");
+
+std::string* PersistentCache::directory_;
+
+PersistentCache::Blob::~Blob() {
+  munmap(addr_, map_size_);
+}
+
+void PersistentCache::SetDirectory(const std::string& directory) {
+  if (directory.empty()) {
+    return;
+  }
+  // Intentionally leaked, the directory stays valid until the process exits.
+  directory_ = new std::string(directory);
+}
+
+std::shared_ptr<PersistentCache::Blob> PersistentCache::Load(const std::string& name,
+                                                             uint64_t key) {
+  if (directory_ == nullptr) {
+    return nullptr;
+  }
+  std::string path = *directory_ + '/' + name;
+  android::base::unique_fd fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  if (fd == -1) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(BlobHeader)) {
+    return nullptr;
+  }
+  size_t map_size = st.st_size;
+  void* addr = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  auto blob = std::make_shared<Blob>(addr, map_size, sizeof(BlobHeader),
+                                     map_size - sizeof(BlobHeader));
+  const BlobHeader* header = reinterpret_cast<const BlobHeader*>(addr);
+  if (header->magic != kMagic || header->version != kVersion || header->key != key ||
+      header->size != blob->size()) {
+    // Stale or truncated, it will be replaced by the next Store.
+    return nullptr;
+  }
+  return blob;
+}
+
+bool PersistentCache::Store(const std::string& name, uint64_t key, const std::string& payload) {
+  if (directory_ == nullptr) {
+    return false;
+  }
+  std::string path = *directory_ + '/' + name;
+  // Write to a private file first so readers never see a partial blob.
+  std::string tmp_path = android::base::StringPrintf("%s.%d.tmp", path.c_str(), getpid());
+  android::base::unique_fd fd(
+      open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+  if (fd == -1) {
+    return false;
+  }
+  BlobHeader header{.magic = kMagic, .version = kVersion, .key = key, .size = payload.size()};
+  if (!android::base::WriteFully(fd, &header, sizeof(header)) ||
+      !android::base::WriteFully(fd, payload.data(), payload.size())) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+uint64_t PersistentCache::Key(std::initializer_list<uint64_t> values) {
+  // FNV-1a over the values, with the format version mixed in.
+  uint64_t key = 0xcbf29ce484222325ULL ^ kVersion;
+  for (uint64_t value : values) {
+    for (size_t i = 0; i < sizeof(value); i++) {
+      key ^= (value >> (i * 8)) & 0xff;
+      key *= 0x100000001b3ULL;
+    }
+  }
+  return key;
+}
+
+}  // namespace unwindstack
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBUNWINDSTACK_PERSISTENT_CACHE_H
+#define _LIBUNWINDSTACK_PERSISTENT_CACHE_H
+
+#include <stdint.h>
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+
+namespace unwindstack {
+
+// Read only blobs stored in a directory shared by all processes. A blob is
+// identified by a file name, which always starts with the printable build id
+// of the elf it was generated from, and a key that callers derive from
+// everything else the contents depend on. Blobs that do not match are
+// ignored and regenerated.
+class PersistentCache {
+ public:
+  class Blob {
+   public:
+    Blob(void* addr, size_t map_size, size_t offset, size_t size)
+        : addr_(addr), map_size_(map_size), offset_(offset), size_(size) {}
+    ~Blob();
+
+    const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(addr_) + offset_; }
+    size_t size() const { return size_; }
+
+   private:
+    void* addr_;
+    size_t map_size_;
+    size_t offset_;
+    size_t size_;
+  };
+
+  static void SetDirectory(const std::string& directory);
+
+  static bool Enabled() { return directory_ != nullptr; }
+
+  // Maps the blob into memory, the payload is 8 byte aligned.
+  static std::shared_ptr<Blob> Load(const std::string& name, uint64_t key);
+
+  static bool Store(const std::string& name, uint64_t key, const std::string& payload);
+
+  // Combines everything a blob depends on into a single key.
+  static uint64_t Key(std::initializer_list<uint64_t> values);
+
+ private:
+  static std::string* directory_;
+};
+
+}  // namespace unwindstack
+
+#endif  // _LIBUNWINDSTACK_PERSISTENT_CACHE_H
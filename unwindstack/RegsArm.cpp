@@ -52,6 +52,7 @@ void RegsArm::set_sp(uint64_t sp) {
 }
 
 bool RegsArm::SetPcFromReturnAddress(Memory*) {
+  MarkRead(ARM_REG_LR);
   uint32_t lr = regs_[ARM_REG_LR];
   if (regs_[ARM_REG_PC] == lr) {
     return false;
@@ -85,6 +85,7 @@ void RegsArm64::fallback_pc() {
 }
 
 bool RegsArm64::SetPcFromReturnAddress(Memory*) {
+  MarkRead(ARM64_REG_LR);
   uint64_t lr = regs_[ARM64_REG_LR];
   if (regs_[ARM64_REG_PC] == lr) {
     return false;
@@ -34,6 +34,7 @@ struct RegsInfo {
   AddressType saved_regs[MAX_REGISTERS];
 
   inline AddressType Get(uint32_t reg) {
+    regs->MarkRead(reg);
     if (IsSaved(reg)) {
       return saved_regs[reg];
     }
@@ -53,6 +53,7 @@ void RegsMips::set_sp(uint64_t sp) {
 }
 
 bool RegsMips::SetPcFromReturnAddress(Memory*) {
+  MarkRead(MIPS_REG_RA);
   uint32_t ra = regs_[MIPS_REG_RA];
   if (regs_[MIPS_REG_PC] == ra) {
     return false;
@@ -53,6 +53,7 @@ void RegsMips64::set_sp(uint64_t sp) {
 }
 
 bool RegsMips64::SetPcFromReturnAddress(Memory*) {
+  MarkRead(MIPS64_REG_RA);
   uint64_t ra = regs_[MIPS64_REG_RA];
   if (regs_[MIPS64_REG_PC] == ra) {
     return false;
@@ -64,7 +64,7 @@ Symbols::Info* Symbols::BinarySearch(uint64_t addr, Memory* elf_memory, uint64_t
 
   while (first < last) {
     uint32_t current = first + (last - first) / 2;
-    uint32_t symbol_index = RemapIndices ? remap_.value()[current] : current;
+    uint32_t symbol_index = RemapIndices ? (*remap_)[current] : current;
     SymType sym;
     if (!elf_memory->ReadFully(offset_ + symbol_index * entry_size_, &sym, sizeof(sym))) {
       return nullptr;
@@ -88,8 +88,8 @@ template <typename SymType>
 void Symbols::BuildRemapTable(Memory* elf_memory) {
   std::vector<uint64_t> addrs;  // Addresses of all symbols (addrs[i] == symbols[i].st_value).
   addrs.reserve(count_);
-  remap_.emplace();  // Construct the optional remap table.
-  remap_->reserve(count_);
+  std::vector<uint32_t> remap;
+  remap.reserve(count_);
   for (size_t symbol_idx = 0; symbol_idx < count_;) {
     // Read symbols from memory.  We intentionally bypass the cache to save memory.
     // Do the reads in batches so that we minimize the number of memory read calls.
@@ -104,29 +104,203 @@ void Symbols::BuildRemapTable(Memory* elf_memory) {
       memcpy(&sym, &buffer[offset], sizeof(SymType));  // Copy to ensure alignment.
       addrs.push_back(sym.st_value);  // Always insert so it is indexable by symbol index.
       if (IsFunc(&sym)) {
-        remap_->push_back(symbol_idx);  // Indices of function symbols only.
+        remap.push_back(symbol_idx);  // Indices of function symbols only.
       }
     }
   }
   // Sort by address to make the remap list binary searchable (stable due to the a<b tie break).
   auto comp = [&addrs](auto a, auto b) { return std::tie(addrs[a], a) < std::tie(addrs[b], b); };
-  std::sort(remap_->begin(), remap_->end(), comp);
+  std::sort(remap.begin(), remap.end(), comp);
   // Remove duplicate entries (methods de-duplicated by the linker).
   auto pred = [&addrs](auto a, auto b) { return addrs[a] == addrs[b]; };
-  remap_->erase(std::unique(remap_->begin(), remap_->end(), pred), remap_->end());
-  remap_->shrink_to_fit();
+  remap.erase(std::unique(remap.begin(), remap.end(), pred), remap.end());
+  remap.shrink_to_fit();
+  remap_.emplace(std::move(remap));
+}
+
+size_t Symbols::FlatIndex::Find(uint64_t addr, size_t first) const {
+  size_t count = starts_.size();
+  if (first >= count || starts_[first] > addr) {
+    return count;
+  }
+
+  // starts_[low] <= addr, and the answer is below high.
+  size_t low = first;
+  size_t high = count;
+  if (first != 0) {
+    size_t step = 1;
+    high = low + 1;
+    while (high < count && starts_[high] <= addr) {
+      low = high;
+      step *= 2;
+      high = low + step;
+    }
+    high = std::min(high, count);
+  }
+
+  // Branchless, the compiler turns the select into a conditional move.
+  const uint64_t* base = &starts_[low];
+  size_t n = high - low;
+  while (n > 1) {
+    size_t half = n / 2;
+    base = (base[half] <= addr) ? base + half : base;
+    n -= half;
+  }
+  return base - starts_.data();
+}
+
+template <typename SymType>
+void Symbols::BuildFlatIndex(Memory* elf_memory) {
+  struct FlatSymbol {
+    uint64_t start;
+    FlatIndex::Entry entry;
+  };
+  std::vector<FlatSymbol> symbols;
+  symbols.reserve(remap_.has_value() ? remap_->size() : count_ / 2);
+
+  // The whole table is read once, so use much bigger reads than the remap table.
+  std::vector<uint8_t> buffer(64 * 1024);
+  for (size_t symbol_idx = 0; symbol_idx < count_;) {
+    size_t read = std::min<size_t>(buffer.size(), (count_ - symbol_idx) * entry_size_);
+    size_t size = elf_memory->Read(offset_ + symbol_idx * entry_size_, buffer.data(), read);
+    if (size < sizeof(SymType)) {
+      break;  // Stop processing, something looks like it is corrupted.
+    }
+    for (size_t offset = 0; offset + sizeof(SymType) <= size; offset += entry_size_, symbol_idx++) {
+      SymType sym;
+      memcpy(&sym, &buffer[offset], sizeof(SymType));  // Copy to ensure alignment.
+      if (IsFunc(&sym)) {
+        symbols.push_back({.start = sym.st_value,
+                           .entry = {.size = static_cast<uint32_t>(sym.st_size),
+                                     .name = static_cast<uint32_t>(sym.st_name)}});
+      }
+    }
+  }
+  // Same order and de-duplication as the remap table, the first symbol at
+  // an address wins.
+  std::stable_sort(symbols.begin(), symbols.end(),
+                   [](const auto& a, const auto& b) { return a.start < b.start; });
+  symbols.erase(std::unique(symbols.begin(), symbols.end(),
+                            [](const auto& a, const auto& b) { return a.start == b.start; }),
+                symbols.end());
+
+  std::vector<uint64_t> starts;
+  std::vector<FlatIndex::Entry> entries;
+  starts.reserve(symbols.size());
+  entries.reserve(symbols.size());
+  for (const auto& symbol : symbols) {
+    starts.push_back(symbol.start);
+    entries.push_back(symbol.entry);
+  }
+  flat_.emplace(std::move(starts), std::move(entries));
+}
+
+bool Symbols::GetFlatName(size_t index, Memory* elf_memory, SharedString* name) {
+  auto cached = flat_names_.find(index);
+  if (cached != flat_names_.end()) {
+    *name = cached->second;
+    return true;
+  }
+  uint64_t str;
+  if (__builtin_add_overflow(str_offset_, flat_->entry(index).name, &str) || str >= str_end_) {
+    return false;
+  }
+  std::string symbol_name;
+  if (!elf_memory->ReadString(str, &symbol_name, str_end_ - str)) {
+    return false;
+  }
+  *name = flat_names_.emplace(index, SharedString(std::move(symbol_name))).first->second;
+  return true;
+}
+
+template <typename SymType>
+void Symbols::GetNames(Memory* elf_memory, std::vector<FunctionLookup>* lookups) {
+  if (!flat_.has_value()) {
+    BuildFlatIndex<SymType>(elf_memory);
+  }
+
+  size_t first = 0;
+  uint64_t prev_addr = 0;
+  for (auto& lookup : *lookups) {
+    if (lookup.found) {
+      continue;
+    }
+    if (lookup.addr < prev_addr) {
+      first = 0;  // Not sorted, search the whole index again.
+    }
+    prev_addr = lookup.addr;
+
+    size_t index = flat_->Find(lookup.addr, first);
+    if (index == flat_->size()) {
+      continue;
+    }
+    first = index;
+    uint64_t func_offset = lookup.addr - flat_->start(index);
+    if (func_offset >= flat_->entry(index).size ||
+        !GetFlatName(index, elf_memory, &lookup.name)) {
+      continue;
+    }
+    lookup.offset = func_offset;
+    lookup.found = true;
+  }
+}
+
+uint64_t Symbols::CacheKey() {
+  return PersistentCache::Key({offset_, count_, entry_size_, str_offset_, str_end_});
+}
+
+bool Symbols::LoadRemapTable() {
+  if (cache_name_.empty()) {
+    return false;
+  }
+  std::shared_ptr<PersistentCache::Blob> blob = PersistentCache::Load(cache_name_, CacheKey());
+  if (blob == nullptr || blob->size() % sizeof(uint32_t) != 0) {
+    return false;
+  }
+  // Only the indices are trusted to be in range, a bad order just makes
+  // the lookups fail.
+  const uint32_t* indices = reinterpret_cast<const uint32_t*>(blob->data());
+  for (size_t i = 0; i < blob->size() / sizeof(uint32_t); i++) {
+    if (indices[i] >= count_) {
+      return false;
+    }
+  }
+  remap_.emplace(std::move(blob));
+  return true;
+}
+
+void Symbols::StoreRemapTable() {
+  if (cache_name_.empty()) {
+    return;
+  }
+  PersistentCache::Store(
+      cache_name_, CacheKey(),
+      std::string(reinterpret_cast<const char*>(remap_->data()), remap_->size() * sizeof(uint32_t)));
 }
 
 template <typename SymType>
 bool Symbols::GetName(uint64_t addr, Memory* elf_memory, SharedString* name,
                       uint64_t* func_offset) {
+  if (flat_.has_value()) {
+    size_t index = flat_->Find(addr);
+    if (index == flat_->size() || addr - flat_->start(index) >= flat_->entry(index).size ||
+        !GetFlatName(index, elf_memory, name)) {
+      return false;
+    }
+    *func_offset = addr - flat_->start(index);
+    return true;
+  }
+
   Info* info;
   if (!remap_.has_value()) {
     // Assume the symbol table is sorted. If it is not, this will gracefully fail.
     info = BinarySearch<SymType, false>(addr, elf_memory, func_offset);
     if (info == nullptr) {
       // Create the remapping table and retry the search.
-      BuildRemapTable<SymType>(elf_memory);
+      if (!LoadRemapTable()) {
+        BuildRemapTable<SymType>(elf_memory);
+        StoreRemapTable();
+      }
       symbols_.clear();  // Remove cached symbols since the access pattern will be different.
       info = BinarySearch<SymType, true>(addr, elf_memory, func_offset);
     }
@@ -140,7 +314,7 @@ bool Symbols::GetName(uint64_t addr, Memory* elf_memory, SharedString* name,
   // Read and cache the symbol name.
   if (info->name.is_null()) {
     SymType sym;
-    uint32_t symbol_index = remap_.has_value() ? remap_.value()[info->index] : info->index;
+    uint32_t symbol_index = remap_.has_value() ? (*remap_)[info->index] : info->index;
     if (!elf_memory->ReadFully(offset_ + symbol_index * entry_size_, &sym, sizeof(sym))) {
       return false;
     }
@@ -198,6 +372,9 @@ bool Symbols::GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* m
 template bool Symbols::GetName<Elf32_Sym>(uint64_t, Memory*, SharedString*, uint64_t*);
 template bool Symbols::GetName<Elf64_Sym>(uint64_t, Memory*, SharedString*, uint64_t*);
 
+template void Symbols::GetNames<Elf32_Sym>(Memory*, std::vector<FunctionLookup>*);
+template void Symbols::GetNames<Elf64_Sym>(Memory*, std::vector<FunctionLookup>*);
+
 template bool Symbols::GetGlobal<Elf32_Sym>(Memory*, const std::string&, uint64_t*);
 template bool Symbols::GetGlobal<Elf64_Sym>(Memory*, const std::string&, uint64_t*);
 }  // namespace unwindstack
@@ -20,12 +20,17 @@
 #include <stdint.h>
 
 #include <map>
+#include <memory>
 #include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
+#include <unwindstack/ElfInterface.h>
 #include <unwindstack/SharedString.h>
 
+#include "PersistentCache.h"
+
 namespace unwindstack {
 
 // Forward declaration.
@@ -46,21 +51,85 @@ class Symbols {
   template <typename SymType>
   bool GetName(uint64_t addr, Memory* elf_memory, SharedString* name, uint64_t* func_offset);
 
+  // Resolves every entry not already found with one pass over the flat
+  // index, which is built on the first call.
+  template <typename SymType>
+  void GetNames(Memory* elf_memory, std::vector<FunctionLookup>* lookups);
+
   template <typename SymType>
   bool GetGlobal(Memory* elf_memory, const std::string& name, uint64_t* memory_address);
 
   void ClearCache() {
     symbols_.clear();
     remap_.reset();
+    flat_.reset();
+    flat_names_.clear();
   }
 
+  // Enables saving the remap table in the persistent cache under this name.
+  void set_cache_name(const std::string& cache_name) { cache_name_ = cache_name; }
+
  private:
+  // Indices of function symbols sorted by address, either built in this
+  // process or mapped from the persistent cache.
+  class RemapTable {
+   public:
+    RemapTable(std::vector<uint32_t>&& indices) : storage_(std::move(indices)) {}
+    RemapTable(std::shared_ptr<PersistentCache::Blob> blob) : blob_(std::move(blob)) {}
+
+    const uint32_t* data() const {
+      return blob_ ? reinterpret_cast<const uint32_t*>(blob_->data()) : storage_.data();
+    }
+    size_t size() const { return blob_ ? blob_->size() / sizeof(uint32_t) : storage_.size(); }
+    uint32_t operator[](size_t index) const { return data()[index]; }
+
+   private:
+    std::vector<uint32_t> storage_;
+    std::shared_ptr<PersistentCache::Blob> blob_;
+  };
+
+  // All function symbols sorted by address, with what is needed to read the
+  // name without going back to the symbol entry. The addresses are kept apart
+  // from the rest so that a search only touches the addresses.
+  class FlatIndex {
+   public:
+    struct Entry {
+      uint32_t size;
+      uint32_t name;  // Offset in the string table.
+    };
+
+    FlatIndex(std::vector<uint64_t>&& starts, std::vector<Entry>&& entries)
+        : starts_(std::move(starts)), entries_(std::move(entries)) {}
+
+    // Returns the last symbol starting at or before addr, or size() if there
+    // is none. A non-zero first is a known lower bound, the search gallops
+    // forward from it so that a sorted batch costs O(log distance) per entry.
+    size_t Find(uint64_t addr, size_t first = 0) const;
+
+    size_t size() const { return starts_.size(); }
+    uint64_t start(size_t index) const { return starts_[index]; }
+    const Entry& entry(size_t index) const { return entries_[index]; }
+
+   private:
+    std::vector<uint64_t> starts_;
+    std::vector<Entry> entries_;
+  };
+
   template <typename SymType, bool RemapIndices>
   Info* BinarySearch(uint64_t addr, Memory* elf_memory, uint64_t* func_offset);
 
   template <typename SymType>
   void BuildRemapTable(Memory* elf_memory);
 
+  template <typename SymType>
+  void BuildFlatIndex(Memory* elf_memory);
+
+  bool GetFlatName(size_t index, Memory* elf_memory, SharedString* name);
+
+  uint64_t CacheKey();
+  bool LoadRemapTable();
+  void StoreRemapTable();
+
   const uint64_t offset_;
   const uint64_t count_;
   const uint64_t entry_size_;
@@ -68,7 +137,10 @@ class Symbols {
   const uint64_t str_end_;
 
   std::map<uint64_t, Info> symbols_;  // Cache of read symbols (keyed by function *end* address).
-  std::optional<std::vector<uint32_t>> remap_;  // Indices of function symbols sorted by address.
+  std::optional<RemapTable> remap_;
+  std::optional<FlatIndex> flat_;
+  std::unordered_map<uint32_t, SharedString> flat_names_;  // Keyed by flat index entry.
+  std::string cache_name_;
 
   // Cache of global data (non-function) symbols.
   std::unordered_map<std::string, std::optional<uint64_t>> global_variables_;
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+#include <unwindstack/DwarfLocation.h>
+#include <unwindstack/DwarfStructs.h>
+#include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
+
+#include "UnwindPlanCache.h"
+
+namespace unwindstack {
+
+static_assert(sizeof(UnwindPlanRow) % sizeof(uint64_t) == 0, "Row must be a whole number of words");
+
+static bool FitsInt32(uint64_t value) {
+  int64_t signed_value = static_cast<int64_t>(value);
+  return signed_value == static_cast<int32_t>(signed_value);
+}
+
+bool UnwindPlanRow::Compile(const DwarfLocations& loc_regs, uint16_t total_regs) {
+  const DwarfCie* cie = loc_regs.cie;
+  if (cie == nullptr || cie->return_address_register >= total_regs) {
+    return false;
+  }
+
+  auto cfa_entry = loc_regs.find(CFA_REG);
+  if (cfa_entry == loc_regs.end()) {
+    return false;
+  }
+  const DwarfLocation& cfa = cfa_entry->second;
+  if (cfa.type != DWARF_LOCATION_REGISTER || cfa.values[0] >= total_regs ||
+      !FitsInt32(cfa.values[1])) {
+    return false;
+  }
+
+  cfa_reg = cfa.values[0];
+  cfa_offset = static_cast<int32_t>(cfa.values[1]);
+  return_address_register = cie->return_address_register;
+  num_rules = 0;
+  flags = cie->is_signal_frame ? kSignalFrame : 0;
+
+  for (const auto& entry : loc_regs) {
+    uint32_t reg = entry.first;
+    if (reg == CFA_REG) continue;
+
+    const DwarfLocation& loc = entry.second;
+    if (reg >= total_regs) {
+      if (loc.type == DWARF_LOCATION_PSEUDO_REGISTER) {
+        return false;
+      }
+      // Skip this unknown register, the same as the full evaluation.
+      continue;
+    }
+
+    Rule rule = {.reg = static_cast<uint8_t>(reg), .type = loc.type};
+    switch (loc.type) {
+      case DWARF_LOCATION_OFFSET:
+      case DWARF_LOCATION_VAL_OFFSET:
+        if (!FitsInt32(loc.values[0])) {
+          return false;
+        }
+        rule.offset = static_cast<int32_t>(loc.values[0]);
+        break;
+      case DWARF_LOCATION_REGISTER:
+        if (loc.values[0] >= total_regs || !FitsInt32(loc.values[1])) {
+          return false;
+        }
+        rule.src_reg = loc.values[0];
+        rule.offset = static_cast<int32_t>(loc.values[1]);
+        break;
+      case DWARF_LOCATION_UNDEFINED:
+        if (reg == return_address_register) {
+          flags |= kReturnAddressUndefined;
+        }
+        continue;
+      case DWARF_LOCATION_INVALID:
+        // Evaluation leaves the register untouched.
+        continue;
+      default:
+        return false;
+    }
+    if (num_rules == kMaxRules) {
+      return false;
+    }
+    rules[num_rules++] = rule;
+  }
+  return true;
+}
+
+bool UnwindPlanRow::Valid(uint16_t total_regs) const {
+  if (cfa_reg >= total_regs || return_address_register >= total_regs || num_rules > kMaxRules) {
+    return false;
+  }
+  for (size_t i = 0; i < num_rules; i++) {
+    const Rule& rule = rules[i];
+    if (rule.reg >= total_regs) {
+      return false;
+    }
+    switch (rule.type) {
+      case DWARF_LOCATION_OFFSET:
+      case DWARF_LOCATION_VAL_OFFSET:
+        break;
+      case DWARF_LOCATION_REGISTER:
+        if (rule.src_reg >= total_regs) {
+          return false;
+        }
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+template <typename AddressType>
+bool UnwindPlanRow::Apply(Regs* regs, Memory* process_memory, bool* finished) const {
+  RegsImpl<AddressType>* cur_regs = reinterpret_cast<RegsImpl<AddressType>*>(regs);
+
+  // All of the new values are computed from the registers as they were on
+  // entry, so do every read before modifying anything. If any read fails,
+  // the registers are untouched and the caller can do the full evaluation.
+  regs->MarkRead(cfa_reg);
+  AddressType cfa = (*cur_regs)[cfa_reg];
+  cfa += static_cast<uint64_t>(static_cast<int64_t>(cfa_offset));
+
+  AddressType values[kMaxRules];
+  for (size_t i = 0; i < num_rules; i++) {
+    const Rule& rule = rules[i];
+    uint64_t offset = static_cast<int64_t>(rule.offset);
+    switch (rule.type) {
+      case DWARF_LOCATION_OFFSET:
+        if (!process_memory->ReadFully(cfa + offset, &values[i], sizeof(AddressType))) {
+          return false;
+        }
+        break;
+      case DWARF_LOCATION_VAL_OFFSET:
+        values[i] = cfa + offset;
+        break;
+      case DWARF_LOCATION_REGISTER:
+        regs->MarkRead(rule.src_reg);
+        values[i] = (*cur_regs)[rule.src_reg] + offset;
+        break;
+    }
+  }
+
+  cur_regs->set_dex_pc(0);
+  regs->ResetPseudoRegisters();
+  bool return_address_restored = false;
+  for (size_t i = 0; i < num_rules; i++) {
+    (*cur_regs)[rules[i].reg] = values[i];
+    return_address_restored |= rules[i].reg == return_address_register;
+  }
+
+  if (flags & kReturnAddressUndefined) {
+    cur_regs->set_pc(0);
+  } else {
+    if (!return_address_restored) {
+      regs->MarkRead(return_address_register);
+    }
+    cur_regs->set_pc((*cur_regs)[return_address_register]);
+  }
+  *finished = cur_regs->pc() == 0 && !(flags & kSignalFrame);
+  cur_regs->set_sp(cfa);
+  return true;
+}
+
+bool UnwindPlanRow::Apply(bool is_32bit, Regs* regs, Memory* process_memory, bool* finished,
+                          bool* is_signal_frame) const {
+  bool applied = is_32bit ? Apply<uint32_t>(regs, process_memory, finished)
+                          : Apply<uint64_t>(regs, process_memory, finished);
+  if (!applied) {
+    return false;
+  }
+  *is_signal_frame = flags & kSignalFrame;
+  return true;
+}
+
+namespace {
+
+constexpr size_t kSlotBits = 11;
+constexpr size_t kNumSlots = 1 << kSlotBits;
+constexpr size_t kRowWords = sizeof(UnwindPlanRow) / sizeof(uint64_t);
+
+struct Slot {
+  // Odd while a writer is updating the slot.
+  std::atomic<uint32_t> seq;
+  std::atomic<uint64_t> owner;
+  std::atomic<uint64_t> pc;
+  std::atomic<uint64_t> row[kRowWords];
+};
+
+Slot g_slots[kNumSlots];
+std::atomic<uint64_t> g_next_owner(1);
+thread_local UnwindPlanCache::Recorder* g_recorder = nullptr;
+
+inline Slot* GetSlot(uint64_t owner, uint64_t pc) {
+  uint64_t hash = (pc ^ (owner * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+  return &g_slots[hash >> (64 - kSlotBits)];
+}
+
+bool Find(uint64_t owner, uint64_t pc, UnwindPlanRow* row) {
+  Slot* slot = GetSlot(owner, pc);
+  uint32_t seq = slot->seq.load(std::memory_order_acquire);
+  if (seq & 1) {
+    return false;
+  }
+  if (slot->owner.load(std::memory_order_relaxed) != owner ||
+      slot->pc.load(std::memory_order_relaxed) != pc) {
+    return false;
+  }
+  uint64_t words[kRowWords];
+  for (size_t i = 0; i < kRowWords; i++) {
+    words[i] = slot->row[i].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  if (slot->seq.load(std::memory_order_relaxed) != seq) {
+    return false;
+  }
+  memcpy(row, words, sizeof(words));
+  return true;
+}
+
+void Insert(uint64_t owner, uint64_t pc, const UnwindPlanRow& row) {
+  Slot* slot = GetSlot(owner, pc);
+  uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+  if ((seq & 1) || !slot->seq.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+    // Another thread is writing this slot, drop the row.
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+
+  uint64_t words[kRowWords];
+  memcpy(words, &row, sizeof(words));
+  slot->owner.store(owner, std::memory_order_relaxed);
+  slot->pc.store(pc, std::memory_order_relaxed);
+  for (size_t i = 0; i < kRowWords; i++) {
+    slot->row[i].store(words[i], std::memory_order_relaxed);
+  }
+  slot->seq.store(seq + 2, std::memory_order_release);
+}
+
+}  // namespace
+
+UnwindPlanCache::Recorder::Recorder(uint64_t owner, uint64_t pc)
+    : owner_(owner), pc_(pc), prev_(g_recorder) {
+  g_recorder = this;
+}
+
+UnwindPlanCache::Recorder::~Recorder() {
+  g_recorder = prev_;
+  if (valid_) {
+    Insert(owner_, pc_, row_);
+  }
+}
+
+uint64_t UnwindPlanCache::NewOwner() {
+  return g_next_owner.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool UnwindPlanCache::Step(uint64_t owner, uint64_t pc, bool is_32bit, Regs* regs,
+                           Memory* process_memory, bool* finished, bool* is_signal_frame) {
+  UnwindPlanRow row;
+  if (!Find(owner, pc, &row)) {
+    return false;
+  }
+  return row.Apply(is_32bit, regs, process_memory, finished, is_signal_frame);
+}
+
+void UnwindPlanCache::Record(const DwarfLocations& loc_regs, uint16_t total_regs) {
+  Recorder* recorder = g_recorder;
+  if (recorder == nullptr) {
+    return;
+  }
+  recorder->valid_ = recorder->row_.Compile(loc_regs, total_regs);
+}
+
+void UnwindPlanCache::Record(const UnwindPlanRow& row) {
+  Recorder* recorder = g_recorder;
+  if (recorder == nullptr) {
+    return;
+  }
+  recorder->row_ = row;
+  recorder->valid_ = true;
+}
+
+}  // namespace unwindstack
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _LIBUNWINDSTACK_UNWIND_PLAN_CACHE_H
+#define _LIBUNWINDSTACK_UNWIND_PLAN_CACHE_H
+
+#include <stdint.h>
+
+#include <unwindstack/DwarfLocation.h>
+
+namespace unwindstack {
+
+// Forward declarations.
+class Memory;
+class Regs;
+
+// A pre-evaluated dwarf row. Only rows whose cfa is register + offset and
+// whose registers are restored from cfa relative slots or other registers
+// can be compacted, anything with an expression or a pseudo register always
+// goes through the full DwarfSection evaluation.
+struct UnwindPlanRow {
+  static constexpr size_t kMaxRules = 12;
+
+  struct Rule {
+    int32_t offset;
+    uint8_t reg;
+    uint8_t type;  // DwarfLocationEnum
+    uint8_t src_reg;
+    uint8_t pad;
+  };
+
+  int32_t cfa_offset;
+  uint8_t cfa_reg;
+  uint8_t return_address_register;
+  uint8_t num_rules;
+  uint8_t flags;
+  Rule rules[kMaxRules];
+
+  static constexpr uint8_t kSignalFrame = 0x1;
+  static constexpr uint8_t kReturnAddressUndefined = 0x2;
+
+  bool Compile(const DwarfLocations& loc_regs, uint16_t total_regs);
+
+  // Verifies a row that was not produced by Compile in this process.
+  bool Valid(uint16_t total_regs) const;
+
+  // Returns false without modifying regs if a value could not be read, the
+  // full evaluation is then needed to report the error.
+  bool Apply(bool is_32bit, Regs* regs, Memory* process_memory, bool* finished,
+             bool* is_signal_frame) const;
+
+ private:
+  template <typename AddressType>
+  bool Apply(Regs* regs, Memory* process_memory, bool* finished) const;
+};
+
+// Process wide, fixed size table of unwind rows keyed by the owning elf and
+// the relative pc. Lookups never take a lock, every slot is guarded by its
+// own sequence counter and a writer that loses the race simply drops the row.
+class UnwindPlanCache {
+ public:
+  // Rows compiled by DwarfSection::Step while this object is alive on the
+  // current thread are added to the cache when it goes out of scope.
+  class Recorder {
+   public:
+    Recorder(uint64_t owner, uint64_t pc);
+    ~Recorder();
+
+   private:
+    friend class UnwindPlanCache;
+
+    uint64_t owner_;
+    uint64_t pc_;
+    bool valid_ = false;
+    UnwindPlanRow row_;
+    Recorder* prev_;
+  };
+
+  static uint64_t NewOwner();
+
+  static bool Step(uint64_t owner, uint64_t pc, bool is_32bit, Regs* regs,
+                   Memory* process_memory, bool* finished, bool* is_signal_frame);
+
+  static void Record(const DwarfLocations& loc_regs, uint16_t total_regs);
+  static void Record(const UnwindPlanRow& row);
+};
+
+}  // namespace unwindstack
+
+#endif  // _LIBUNWINDSTACK_UNWIND_PLAN_CACHE_H
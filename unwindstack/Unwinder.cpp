@@ -129,6 +129,177 @@ static bool ShouldExit(const std::vector<std::string>* mangle_function_to_exit,
                    function_name) != mangle_function_to_exit->end();
 }
 
+namespace {
+
+// Forwards to the process memory and keeps everything read through it, so
+// that a later unwind can check that none of it has changed.
+class MemoryMemoRecorder : public Memory {
+ public:
+  MemoryMemoRecorder(Memory* memory, UnwindMemo::State* state) : memory_(memory), state_(state) {}
+  virtual ~MemoryMemoRecorder() = default;
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override {
+    size_t bytes = memory_->Read(addr, dst, size);
+    state_->reads.push_back({addr, static_cast<uint32_t>(size), static_cast<uint32_t>(bytes)});
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(dst);
+    state_->data.insert(state_->data.end(), data, data + bytes);
+    return bytes;
+  }
+
+ private:
+  Memory* memory_;
+  UnwindMemo::State* state_;
+};
+
+void GetRegValues(Regs* regs, uint64_t* values) {
+  size_t num_regs = regs->total_regs();
+  if (regs->Is32Bit()) {
+    const uint32_t* data = reinterpret_cast<uint32_t*>(regs->RawData());
+    std::copy(data, data + num_regs, values);
+  } else {
+    memcpy(values, regs->RawData(), num_regs * sizeof(uint64_t));
+  }
+}
+
+}  // namespace
+
+void UnwindMemo::State::Clear() {
+  frames.clear();
+  steps.clear();
+  num_regs = 0;
+  regs.clear();
+  reads.clear();
+  data.clear();
+  last_error = {ERROR_NONE, 0};
+  warnings = 0;
+}
+
+void Unwinder::RecordMemoStep() {
+  UnwindMemo::State& state = memo_->next;
+  state.num_regs = regs_->total_regs();
+  state.steps.push_back({regs_->pc(), regs_->sp(), frames_.size(), state.reads.size(),
+                         state.data.size(), last_error_, 0, 0});
+  state.regs.resize(state.regs.size() + state.num_regs);
+  GetRegValues(regs_, &state.regs[state.regs.size() - state.num_regs]);
+  // The registers read until the next recorded step are charged to this one.
+  regs_->set_read_mask(&state.steps.back().regs_read);
+}
+
+// A step depends on the registers it read, and on the registers a later step
+// depends on that it left unchanged.
+void Unwinder::FinishMemo() {
+  UnwindMemo::State& state = memo_->next;
+  uint64_t needed = 0;
+  for (size_t i = state.steps.size(); i > 0; i--) {
+    UnwindMemo::Step& step = state.steps[i - 1];
+    if (i < state.steps.size()) {
+      const uint64_t* regs = &state.regs[(i - 1) * state.num_regs];
+      const uint64_t* next_regs = regs + state.num_regs;
+      for (size_t reg = 0; reg < state.num_regs; reg++) {
+        if (regs[reg] != next_regs[reg]) {
+          needed &= ~(1ULL << reg);
+        }
+      }
+    }
+    needed |= step.regs_read;
+    step.regs_needed = needed;
+  }
+}
+
+// The previous steps are ordered by increasing sp, so a single forward scan
+// finds the candidates for every new step. Steps before memo_invalid read
+// memory that is known to have changed.
+bool Unwinder::ReuseMemoFrames(size_t* memo_index, size_t* memo_invalid) {
+  const UnwindMemo::State& prev = memo_->prev;
+  uint64_t pc = regs_->pc();
+  uint64_t sp = regs_->sp();
+  size_t index = *memo_index;
+  while (index < prev.steps.size() && prev.steps[index].sp < sp) {
+    index++;
+  }
+  *memo_index = index;
+
+  size_t num_regs = prev.num_regs;
+  if (num_regs != regs_->total_regs() || num_regs > 64 ||
+      prev.regs.size() != prev.steps.size() * num_regs) {
+    return false;
+  }
+  uint64_t values[64];
+  GetRegValues(regs_, values);
+  bool truncated = prev.last_error.code == ERROR_MAX_FRAMES_EXCEEDED;
+  std::vector<uint8_t> buffer;
+  for (; index < prev.steps.size() && prev.steps[index].sp == sp; index++) {
+    const UnwindMemo::Step& step = prev.steps[index];
+    if (index < *memo_invalid || step.pc != pc || step.last_error.code != last_error_.code ||
+        step.last_error.address != last_error_.address || step.first_frame > prev.frames.size()) {
+      continue;
+    }
+    // Removing a speculative frame depends on how many frames come before
+    // it, and a truncated unwind has no frames past its limit.
+    if (step.first_frame < 2 || frames_.size() < 2 ||
+        (truncated && frames_.size() < step.first_frame)) {
+      continue;
+    }
+    const uint64_t* regs = &prev.regs[index * num_regs];
+    bool same_regs = true;
+    for (size_t reg = 0; reg < num_regs && same_regs; reg++) {
+      same_regs = !(step.regs_needed & (1ULL << reg)) || regs[reg] == values[reg];
+    }
+    if (!same_regs) {
+      continue;
+    }
+
+    // Every later step only depends on those registers and on these reads.
+    size_t changed = prev.reads.size();
+    size_t data_offset = step.first_data;
+    for (size_t i = step.first_read; i < prev.reads.size(); i++) {
+      const UnwindMemo::Read& read = prev.reads[i];
+      buffer.resize(read.size);
+      if (process_memory_->Read(read.addr, buffer.data(), read.size) != read.bytes ||
+          memcmp(buffer.data(), &prev.data[data_offset], read.bytes) != 0) {
+        changed = i;
+        break;
+      }
+      data_offset += read.bytes;
+    }
+    if (changed != prev.reads.size()) {
+      // No step that made this read can be reused either.
+      while (*memo_invalid < prev.steps.size() && prev.steps[*memo_invalid].first_read <= changed) {
+        (*memo_invalid)++;
+      }
+      continue;
+    }
+
+    size_t first_frame = frames_.size();
+    size_t frame_index = step.first_frame;
+    for (; frame_index < prev.frames.size() && frames_.size() < max_frames_; frame_index++) {
+      frames_.push_back(prev.frames[frame_index]);
+      frames_.back().num = frames_.size() - 1;
+    }
+    last_error_ = prev.last_error;
+    warnings_ |= prev.warnings;
+    if (frame_index < prev.frames.size()) {
+      last_error_.code = ERROR_MAX_FRAMES_EXCEEDED;
+    }
+
+    // The steps from here on are the same, append them to this unwind.
+    UnwindMemo::State& next = memo_->next;
+    for (size_t i = index; i < prev.steps.size(); i++) {
+      UnwindMemo::Step next_step = prev.steps[i];
+      next_step.first_frame = next_step.first_frame - step.first_frame + first_frame;
+      next_step.first_read = next_step.first_read - step.first_read + next.reads.size();
+      next_step.first_data = next_step.first_data - step.first_data + next.data.size();
+      next.steps.push_back(next_step);
+    }
+    next.num_regs = num_regs;
+    next.regs.insert(next.regs.end(), prev.regs.begin() + index * num_regs, prev.regs.end());
+    next.reads.insert(next.reads.end(), prev.reads.begin() + step.first_read, prev.reads.end());
+    next.data.insert(next.data.end(), prev.data.begin() + step.first_data, prev.data.end());
+    return true;
+  }
+  return false;
+}
+
 void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
                       const std::vector<std::string>* map_suffixes_to_ignore,
                       const std::vector<std::string>* mangle_function_to_exit) {
@@ -144,12 +315,43 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
     regs_->fallback_pc();
   }
 
+  // Only the steps go through the recorder, everything else reads the
+  // process memory directly.
+  Memory* step_memory = process_memory_.get();
+  std::unique_ptr<MemoryMemoRecorder> recorder;
+  if (memo_ != nullptr) {
+    if (memo_->maps != maps_ || memo_->map_suffixes_to_ignore != map_suffixes_to_ignore ||
+        memo_->mangle_function_to_exit != mangle_function_to_exit ||
+        memo_->resolve_names != resolve_names_) {
+      memo_->prev.Clear();
+      memo_->maps = maps_;
+      memo_->map_suffixes_to_ignore = map_suffixes_to_ignore;
+      memo_->mangle_function_to_exit = mangle_function_to_exit;
+      memo_->resolve_names = resolve_names_;
+    }
+    memo_->next.Clear();
+    regs_->set_read_mask(nullptr);
+    recorder.reset(new MemoryMemoRecorder(process_memory_.get(), &memo_->next));
+    step_memory = recorder.get();
+  }
+  size_t memo_index = 0;
+  size_t memo_invalid = 0;
+
   bool return_address_attempt = false;
   bool adjust_pc = false;
   for (; frames_.size() < max_frames_;) {
     uint64_t cur_pc = regs_->pc();
     uint64_t cur_sp = regs_->sp();
 
+    // The first frame is never reused, it is not adjusted and may be skipped.
+    if (memo_ != nullptr && adjust_pc && !return_address_attempt &&
+        initial_map_names_to_skip == nullptr && regs_->dex_pc() == 0) {
+      if (ReuseMemoFrames(&memo_index, &memo_invalid)) {
+        break;
+      }
+      RecordMemoStep();
+    }
+
     std::shared_ptr<MapInfo> map_info = maps_->Find(regs_->pc());
     uint64_t pc_adjustment = 0;
     uint64_t step_pc;
@@ -240,10 +442,10 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
           in_device_map = true;
         } else {
           bool is_signal_frame = false;
-          if (elf->StepIfSignalHandler(rel_pc, regs_, process_memory_.get())) {
+          if (elf->StepIfSignalHandler(rel_pc, regs_, step_memory)) {
             stepped = true;
             is_signal_frame = true;
-          } else if (elf->Step(step_pc, regs_, process_memory_.get(), &finished,
+          } else if (elf->Step(step_pc, regs_, step_memory, &finished,
                                &is_signal_frame)) {
             stepped = true;
           }
@@ -293,7 +495,7 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
         break;
       } else {
         // Steping didn't work, try this secondary method.
-        if (!regs_->SetPcFromReturnAddress(process_memory_.get())) {
+        if (!regs_->SetPcFromReturnAddress(step_memory)) {
           break;
         }
         return_address_attempt = true;
@@ -311,6 +513,15 @@ void Unwinder::Unwind(const std::vector<std::string>* initial_map_names_to_skip,
       break;
     }
   }
+
+  if (memo_ != nullptr) {
+    regs_->set_read_mask(nullptr);
+    FinishMemo();
+    memo_->next.frames = frames_;
+    memo_->next.last_error = last_error_;
+    memo_->next.warnings = warnings_;
+    std::swap(memo_->prev, memo_->next);
+  }
 }
 
 std::string Unwinder::FormatFrame(const FrameData& frame) const {
@@ -341,7 +552,7 @@ std::string Unwinder::FormatFrame(ArchEnum arch, const FrameData& frame, bool di
   }
 
   if (!frame.function_name.empty()) {
-    data += "(" + DemangleNameIfNeeded(frame.function_name);
+    data += "(" + DemangleNameCached(frame.function_name);
     if (frame.function_offset != 0) {
       data += android::base::StringPrintf("+%" PRId64, frame.function_offset);
     }
@@ -54,6 +54,9 @@ struct AndroidUnwinderData {
   std::optional<std::unique_ptr<Regs>> saved_initial_regs;
   const std::optional<size_t> max_frames;
   const bool show_all_frames = false;
+  // Previous unwind of the calling thread, see UnwindMemo. Only set this
+  // when unwinding the calling thread.
+  UnwindMemo* memo = nullptr;
 };
 
 class AndroidUnwinder {
@@ -80,12 +83,22 @@ class AndroidUnwinder {
 
   bool Initialize(ErrorData& error);
 
+  // Must be called before Initialize. When disabled, the jit and dex file
+  // descriptors in libart.so are never looked up, so pcs in jitted code are
+  // reported against their maps without function names.
+  void SetJitSupport(bool enabled) { jit_support_ = enabled; }
+
   std::shared_ptr<Memory>& GetProcessMemory() { return process_memory_; }
   unwindstack::Maps* GetMaps() { return maps_.get(); }
 
   const JitDebug& GetJitDebug() { return *jit_debug_.get(); }
   const DexFiles& GetDexFiles() { return *dex_files_.get(); }
 
+  // Both are null when jit support is disabled. Used to unwind registers and
+  // a stack captured elsewhere, e.g. copied in a signal handler.
+  JitDebug* jit_debug() { return jit_debug_.get(); }
+  DexFiles* dex_files() { return dex_files_.get(); }
+
   std::string FormatFrame(const FrameData& frame) const;
 
   bool Unwind(AndroidUnwinderData& data);
@@ -95,6 +108,11 @@ class AndroidUnwinder {
 
   FrameData BuildFrameFromPcOnly(uint64_t pc);
 
+  // Replaces every frame, whose pc is the only field used, with the result
+  // of BuildFrameFromPcOnly. The function names are resolved with one
+  // batched lookup per elf, which is much faster for many frames.
+  void BuildFramesFromPcOnly(const std::vector<FrameData*>& frames);
+
   static AndroidUnwinder* Create(pid_t pid);
 
  protected:
@@ -110,6 +128,7 @@ class AndroidUnwinder {
   std::vector<std::string> mangle_function_to_exit_;
   std::once_flag initialize_;
   bool initialize_status_ = false;
+  bool jit_support_ = true;
 
   ArchEnum arch_ = ARCH_UNKNOWN;
 
@@ -18,8 +18,15 @@
 
 #include <string>
 
+#include <unwindstack/SharedString.h>
+
 namespace unwindstack {
 
 std::string DemangleNameIfNeeded(const std::string& name);
 
+// Same as DemangleNameIfNeeded, but each name is only demangled once per
+// process. Function names returned by an Elf are shared per symbol, so the
+// lookup is keyed by the shared data and never hashes the string.
+SharedString DemangleNameCached(const SharedString& name);
+
 }  // namespace unwindstack
@@ -20,7 +20,9 @@
 #include <stdint.h>
 
 #include <map>
+#include <memory>
 #include <optional>
+#include <string>
 #include <unordered_map>
 
 #include <unwindstack/DwarfError.h>
@@ -32,6 +34,8 @@ namespace unwindstack {
 
 // Forward declarations.
 enum ArchEnum : uint8_t;
+class DwarfCompactTable;
+struct DwarfExpression;
 class Memory;
 class Regs;
 template <typename AddressType>
@@ -40,7 +44,7 @@ struct RegsInfo;
 class DwarfSection {
  public:
   DwarfSection(Memory* memory);
-  virtual ~DwarfSection() = default;
+  virtual ~DwarfSection();
 
   class iterator {
    public:
@@ -114,6 +118,14 @@ class DwarfSection {
 
   bool Step(uint64_t pc, Regs* regs, Memory* process_memory, bool* finished, bool* is_signal_frame);
 
+  // Evaluate every row of every fde up front so that Step does not need to
+  // run any cfa instructions for the compactable rows.
+  bool BuildCompactTable(ArchEnum arch);
+
+  // Use a compact table saved by a previous process, see PersistentCache.
+  bool LoadCompactTable(ArchEnum arch, const std::string& name, uint64_t key);
+  bool StoreCompactTable(const std::string& name, uint64_t key);
+
  protected:
   DwarfMemory memory_;
   DwarfErrorData last_error_{DWARF_ERROR_NONE, 0};
@@ -125,6 +137,9 @@ class DwarfSection {
   std::unordered_map<uint64_t, DwarfCie> cie_entries_;
   std::unordered_map<uint64_t, DwarfLocations> cie_loc_regs_;
   std::map<uint64_t, DwarfLocations> loc_regs_;  // Single row indexed by pc_end.
+  std::unique_ptr<DwarfCompactTable> compact_table_;
+  // Decoded expressions indexed by the offset of their first op.
+  std::unordered_map<uint64_t, std::unique_ptr<DwarfExpression>> expressions_;
 };
 
 template <typename AddressType>
@@ -154,8 +169,13 @@ class DwarfSectionImpl : public DwarfSection {
   bool Log(uint8_t indent, uint64_t pc, const DwarfFde* fde, ArchEnum arch) override;
 
  protected:
-  using DwarfFdeMap =
-      std::map</*end*/ uint64_t, std::pair</*start*/ uint64_t, /*offset*/ uint64_t>>;
+  // One non-overlapping pc range of the binary search table. A single fde
+  // can be split over several entries when other fdes overlap it.
+  struct FdeIndexEntry {
+    uint64_t pc_start;
+    uint64_t pc_end;
+    uint64_t fde_offset;
+  };
 
   bool GetNextCieOrFde(/*inout*/ uint64_t& offset, /*out*/ std::optional<DwarfFde>& fde);
 
@@ -170,7 +190,7 @@ class DwarfSectionImpl : public DwarfSection {
   bool EvalExpression(const DwarfLocation& loc, Memory* regular_memory, AddressType* value,
                       RegsInfo<AddressType>* regs_info, bool* is_dex_pc);
 
-  static void InsertFde(uint64_t fde_offset, const DwarfFde* fde, /*out*/ DwarfFdeMap& fdes);
+  const DwarfExpression* GetExpression(uint64_t start, uint64_t end);
 
   void BuildFdeIndex();
 
@@ -179,8 +199,10 @@ class DwarfSectionImpl : public DwarfSection {
   uint64_t entries_end_ = 0;
   uint64_t pc_offset_ = 0;
 
-  // Binary search table (similar to .eh_frame_hdr). Contains only FDE offsets to save memory.
-  std::vector<std::pair</*function end address*/ uint64_t, /*FDE offset*/ uint64_t>> fde_index_;
+  // Binary search table (similar to .eh_frame_hdr) sorted by pc. Contains only FDE offsets to
+  // save memory, the full entries are parsed on demand.
+  bool fde_index_built_ = false;
+  std::vector<FdeIndexEntry> fde_index_;
 };
 
 }  // namespace unwindstack
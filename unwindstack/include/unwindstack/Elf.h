@@ -58,6 +58,9 @@ class Elf {
 
   bool GetFunctionName(uint64_t addr, SharedString* name, uint64_t* func_offset);
 
+  // Batched GetFunctionName, the addresses should be sorted.
+  void GetFunctionNames(std::vector<FunctionLookup>* lookups);
+
   bool GetGlobalVariableOffset(const std::string& name, uint64_t* memory_offset);
 
   uint64_t GetRelPc(uint64_t pc, MapInfo* map_info);
@@ -113,14 +116,31 @@ class Elf {
 
   static bool CachingEnabled() { return cache_enabled_; }
 
-  static void CacheLock();
-  static void CacheUnlock();
+  // When enabled, every dwarf row is evaluated when the elf is initialized.
+  // This makes Init more expensive but removes the cfa evaluation from Step.
+  static void SetCompactUnwindEnabled(bool enable) { compact_unwind_enabled_ = enable; }
+
+  static bool CompactUnwindEnabled() { return compact_unwind_enabled_; }
+
+  // Save the compact unwind tables and the sorted symbol tables in this
+  // directory, keyed by build id, so later processes can map them directly.
+  // Must be called before any elf is created.
+  static void SetPersistentCacheDir(const std::string& dir);
+
+  // Returns the lock that serializes creating elf objects for the given
+  // file. Threads creating elf objects for other files never wait on it.
+  // CacheGet and CacheAdd must be called with this lock held.
+  static std::mutex* CacheLock(const std::string& name);
   static void CacheAdd(MapInfo* info);
   static bool CacheGet(MapInfo* info);
 
   static std::string GetPrintableBuildID(std::string& build_id);
 
  protected:
+  static uint64_t NewPlanCacheOwner();
+
+  void InitCompactUnwind(ElfInterface* interface, const std::string& cache_name);
+
   bool valid_ = false;
   int64_t load_bias_ = 0;
   std::unique_ptr<ElfInterface> interface_;
@@ -130,14 +150,19 @@ class Elf {
   ArchEnum arch_;
   // Protect calls that can modify internal state of the interface object.
   std::mutex lock_;
+  // Identifies the rows this object adds to the global unwind plan cache.
+  const uint64_t plan_cache_owner_ = NewPlanCacheOwner();
 
   std::unique_ptr<Memory> gnu_debugdata_memory_;
   std::unique_ptr<ElfInterface> gnu_debugdata_interface_;
 
+  struct CacheEntry;
+  struct CacheShard;
+  static CacheEntry* CacheFind(const std::string& name);
+
   static bool cache_enabled_;
-  static std::unordered_map<std::string, std::unordered_map<uint64_t, std::shared_ptr<Elf>>>*
-      cache_;
-  static std::mutex* cache_lock_;
+  static bool compact_unwind_enabled_;
+  static CacheShard* cache_;
 };
 
 }  // namespace unwindstack
@@ -42,6 +42,14 @@ struct LoadInfo {
   size_t table_size;
 };
 
+// One entry of a batched function name lookup.
+struct FunctionLookup {
+  uint64_t addr;
+  SharedString name;
+  uint64_t offset = 0;
+  bool found = false;
+};
+
 enum : uint8_t {
   SONAME_UNKNOWN = 0,
   SONAME_VALID,
@@ -81,6 +89,10 @@ class ElfInterface {
 
   virtual bool GetFunctionName(uint64_t addr, SharedString* name, uint64_t* offset) = 0;
 
+  // Resolves every entry that is not already found. The entries should be
+  // sorted by address, in which case each symbol table is walked only once.
+  virtual void GetFunctionNames(std::vector<FunctionLookup>* lookups);
+
   virtual bool GetGlobalVariable(const std::string& name, uint64_t* memory_address) = 0;
 
   virtual std::string GetBuildID() = 0;
@@ -103,6 +115,9 @@ class ElfInterface {
 
   void SetGnuDebugdataInterface(ElfInterface* interface) { gnu_debugdata_interface_ = interface; }
 
+  // Prefix for the persistent cache blobs generated from this interface.
+  void SetCacheName(const std::string& cache_name);
+
   uint64_t dynamic_offset() { return dynamic_offset_; }
   uint64_t dynamic_vaddr_start() { return dynamic_vaddr_start_; }
   uint64_t dynamic_vaddr_end() { return dynamic_vaddr_end_; }
@@ -208,6 +223,8 @@ class ElfInterfaceImpl : public ElfInterface {
 
   bool GetFunctionName(uint64_t addr, SharedString* name, uint64_t* func_offset) override;
 
+  void GetFunctionNames(std::vector<FunctionLookup>* lookups) override;
+
   bool GetGlobalVariable(const std::string& name, uint64_t* memory_address) override;
 
   std::string GetBuildID() override { return ReadBuildID(); }
@@ -21,6 +21,8 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -77,6 +79,10 @@ class Maps {
     return maps_[index];
   }
 
+  // Copy of the current maps that stays valid while other threads update
+  // this object.
+  virtual std::vector<std::shared_ptr<MapInfo>> Snapshot() { return maps_; }
+
  protected:
   std::vector<std::shared_ptr<MapInfo>> maps_;
 };
@@ -111,8 +117,47 @@ class LocalUpdatableMaps : public Maps {
 
   bool Reparse(/*out*/ bool* any_changed = nullptr);
 
+  // Inserts the modules the dynamic loader has added and retires the ones
+  // it has removed since the last call, without reading /proc/self/maps.
+  // Meant to be called after dlopen/dlclose. Returns true if any map changed.
+  bool SyncModules();
+
+  std::vector<std::shared_ptr<MapInfo>> Snapshot() override;
+
  private:
+  struct Module {
+    struct Segment {
+      uint64_t start;
+      uint64_t end;
+      uint64_t offset;
+      uint64_t flags;
+    };
+    std::string name;
+    uint64_t start = 0;
+    uint64_t end = 0;
+    std::vector<Segment> segments;
+  };
+
+  struct ModuleList {
+    // Sum of the loader's add and remove counters, zero if not supported.
+    uint64_t generation = 0;
+    std::vector<Module> modules;
+  };
+
+  // Must not hold maps_rwlock_, the loader lock is taken while iterating.
+  bool ReadModules(ModuleList* list);
+  bool ApplyModules(ModuleList* list);
+  bool Overlaps(uint64_t start, uint64_t end);
+
+  // Invalidates the per thread cache of recent Find results. Must be called
+  // with maps_rwlock_ held for write after any change to maps_.
+  void MapsChanged();
+
   pthread_rwlock_t maps_rwlock_;
+  // Process wide unique value, never reused by another object.
+  std::atomic<uint64_t> generation_;
+  std::map<uint64_t, Module> modules_;
+  std::atomic<uint64_t> modules_generation_{0};
 };
 
 class BufferMaps : public Maps {
@@ -80,6 +80,14 @@ class Regs {
 
   uint16_t total_regs() { return total_regs_; }
 
+  // While set, every register an unwind rule reads is added to the mask.
+  void set_read_mask(uint64_t* read_mask) { read_mask_ = read_mask; }
+  void MarkRead(uint32_t reg) {
+    if (read_mask_ != nullptr) {
+      *read_mask_ |= 1ULL << (reg & 63);
+    }
+  }
+
   virtual Regs* Clone() = 0;
 
   static ArchEnum CurrentArch();
@@ -92,6 +100,7 @@ class Regs {
   uint16_t total_regs_;
   Location return_loc_;
   uint64_t dex_pc_ = 0;
+  uint64_t* read_mask_ = nullptr;
 };
 
 template <typename AddressType>
@@ -44,6 +44,9 @@ class SharedString {
 
   operator std::string_view() const { return static_cast<const std::string&>(*this); }
 
+  // Identifies the shared data, copies of the same string return the same value.
+  const void* id() const { return data_.get(); }
+
  private:
   std::shared_ptr<const std::string> data_;
 };
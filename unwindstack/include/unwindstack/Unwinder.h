@@ -52,6 +52,56 @@ struct FrameData {
   std::shared_ptr<MapInfo> map_info; // 映射信息
 };
 
+// The previous unwind of one thread, used to skip stepping through outer
+// frames that did not change since then. Every step keeps the registers it
+// started with and the registers its unwind rules read, and every read of
+// process memory made from that step on. The rest of the unwind depends only
+// on the registers a step or a later step read before they were changed, and
+// on the memory. A new unwind that reaches a step with the same values in
+// those registers reuses the remaining frames if none of the memory has
+// changed.
+struct UnwindMemo {
+  struct Step {
+    uint64_t pc;
+    uint64_t sp;
+    size_t first_frame;
+    size_t first_read;
+    size_t first_data;
+    ErrorData last_error;
+    uint64_t regs_read;    // Registers the unwind rules of this step read.
+    uint64_t regs_needed;  // Registers the rest of the unwind depends on.
+  };
+
+  struct Read {
+    uint64_t addr;
+    uint32_t size;
+    uint32_t bytes;  // The number of bytes the read returned.
+  };
+
+  struct State {
+    std::vector<FrameData> frames;
+    std::vector<Step> steps;
+    size_t num_regs = 0;
+    std::vector<uint64_t> regs;  // num_regs registers for every step.
+    std::vector<Read> reads;
+    std::vector<uint8_t> data;  // The data returned by every read.
+    ErrorData last_error;
+    uint64_t warnings = 0;
+
+    void Clear();
+  };
+
+  // The unwind that can be reused and the one being recorded.
+  State prev;
+  State next;
+
+  // The memo is dropped when any of these change.
+  const Maps* maps = nullptr;
+  const std::vector<std::string>* map_suffixes_to_ignore = nullptr;
+  const std::vector<std::string>* mangle_function_to_exit = nullptr;
+  bool resolve_names = true;
+};
+
 class Unwinder {
  public:
   Unwinder(size_t max_frames, Maps* maps, Regs* regs, std::shared_ptr<Memory> process_memory)
@@ -106,6 +156,10 @@ class Unwinder {
 
   void SetDexFiles(DexFiles* dex_files);
 
+  // Reuses the unchanged outer frames of the previous unwind stored in memo,
+  // and stores this unwind in it. Only for unwinds of the same thread.
+  void SetMemo(UnwindMemo* memo) { memo_ = memo; }
+
   const ErrorData& LastError() { return last_error_; }
   ErrorCode LastErrorCode() { return last_error_.code; }
   const char* LastErrorCodeString() { return GetErrorCodeString(last_error_.code); }
@@ -134,6 +188,10 @@ class Unwinder {
     last_error_.address = 0;
   }
 
+  bool ReuseMemoFrames(size_t* memo_index, size_t* memo_invalid);
+  void RecordMemoStep();
+  void FinishMemo();
+
   void FillInDexFrame();
   FrameData* FillInFrame(std::shared_ptr<MapInfo>& map_info, Elf* elf, uint64_t rel_pc,
                          uint64_t pc_adjustment);
@@ -145,6 +203,7 @@ class Unwinder {
   std::shared_ptr<Memory> process_memory_;
   JitDebug* jit_debug_ = nullptr;
   DexFiles* dex_files_ = nullptr;
+  UnwindMemo* memo_ = nullptr;
   bool resolve_names_ = true;
   bool display_build_id_ = false;
   ErrorData last_error_;